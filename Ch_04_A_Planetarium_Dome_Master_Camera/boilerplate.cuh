@@ -172,20 +172,26 @@ void dof_ray(const float3 &ray_origin_orig, float3 &ray_origin,
 //
 // Ray gen accumulation buffer helper routines
 //
-static void __inline__ __device__ accumulate_color(float3 &col,
+static void __inline__ __device__ accumulate_color(const uint2 &index,
+                                                   float3 &col,
                                                    float alpha = 1.0f) {
 //  if (progressive_enabled) {
     col *= accumulation_normalization_factor;
     alpha *= accumulation_normalization_factor;
 
     // for optix-vca progressive mode accumulation is handled in server code
-    accumulation_buffer[launch_index]  = make_float4(col, alpha);
+    accumulation_buffer[index]  = make_float4(col, alpha);
 //  } else {
 //    // For batch mode we accumulate ourselves
-//    accumulation_buffer[launch_index] += make_float4(col, alpha);
+//    accumulation_buffer[index] += make_float4(col, alpha);
 //  }
 }
 
+static void __inline__ __device__ accumulate_color(float3 &col,
+                                                   float alpha = 1.0f) {
+  accumulate_color(launch_index, col, alpha);
+}
+
 
 
 struct PerRayData_radiance {
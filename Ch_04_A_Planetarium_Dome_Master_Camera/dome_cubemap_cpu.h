@@ -0,0 +1,290 @@
+//
+// Ray Tracing Gems sample code for
+//   "A Planetarium Dome Master Camera"
+//
+// Cubemap-to-dome reprojection, an alternative to rendering the dome
+// master image with the dome camera directly.  The five cube faces that
+// cover the upper hemisphere (the top face and the upper halves of the
+// four side faces) are rendered with the CPU tracer of dome_master_cpu.h
+// and then resampled into the fisheye image by a filtered reprojection
+// pass.  The faces do not depend on the dome master resolution, so a set
+// of rendered faces can be kept and reprojected to any fisheye size.
+//
+// Each face stores a one texel border rendered like the interior, so that
+// bilinear lookups never need texels of a neighboring face.  Stereo and
+// depth of field vary the ray origin per dome pixel and cannot be baked
+// into a cubemap; use the dome camera for those.
+//
+
+#ifndef DOME_CUBEMAP_CPU_H
+#define DOME_CUBEMAP_CPU_H
+
+#include "dome_master_cpu.h"
+
+namespace dome_cpu {
+
+enum {
+  DOME_CUBE_TOP,    // toward cam_W, the zenith
+  DOME_CUBE_POS_U,
+  DOME_CUBE_NEG_U,
+  DOME_CUBE_POS_V,
+  DOME_CUBE_NEG_V,
+  DOME_CUBE_FACES
+};
+
+//
+// One face: direction axis + s*right + t*up for s in [-1, 1] and t in
+// [t_min, 1].  The side faces only cover t >= 0, the half above the
+// horizon, with res_y = res_x / 2 texels of the same size.
+//
+struct dome_cube_face {
+  unsigned int res_x, res_y;    // texels, without the border
+  float3 axis, right, up;
+  float t_min;
+  std::vector<float4> texels;   // (res_x + 2) x (res_y + 2), border included
+};
+
+struct dome_cubemap {
+  dome_cube_face faces[DOME_CUBE_FACES];
+};
+
+//
+// Face resolution that matches the radial sampling density of a dome
+// master image of dome_res pixels: a dome pixel spans pi / dome_res
+// radians, a texel at the center of a face 2 / res.  scale trades quality
+// for rendering time.
+//
+static inline unsigned int dome_cube_face_res(unsigned int dome_res, float scale) {
+  unsigned int res = (unsigned int) ceilf(scale * 2.0f * dome_res / M_PIf);
+  return res < 2 ? 2 : (res + 1) & ~1u; // even, for the half-height sides
+}
+
+// Set up the face bases and sizes of cube for the camera basis of cam.
+static inline void dome_cubemap_init(dome_cubemap &cube, const dome_camera &cam,
+                                     unsigned int top_res, unsigned int side_res) {
+  const float3 axes[DOME_CUBE_FACES] = {
+    cam.cam_W, cam.cam_U, -cam.cam_U, cam.cam_V, -cam.cam_V };
+  const float3 rights[DOME_CUBE_FACES] = {
+    cam.cam_U, cam.cam_V, -cam.cam_V, -cam.cam_U, cam.cam_U };
+  for (int f = 0; f < DOME_CUBE_FACES; f++) {
+    dome_cube_face &face = cube.faces[f];
+    face.axis = axes[f];
+    face.right = rights[f];
+    face.up = (f == DOME_CUBE_TOP) ? cam.cam_V : cam.cam_W;
+    face.t_min = (f == DOME_CUBE_TOP) ? -1.0f : 0.0f;
+    face.res_x = (f == DOME_CUBE_TOP) ? top_res : side_res;
+    face.res_y = (f == DOME_CUBE_TOP) ? top_res : side_res / 2;
+    face.texels.assign((size_t)(face.res_x + 2) * (face.res_y + 2),
+                       make_float4(make_float3(0.0f), 0.0f));
+  }
+}
+
+//
+// Render all faces of cube (set up by dome_cubemap_init) from cam.cam_pos
+// with cam.aa_samples jittered samples per texel, on nthreads threads.
+// Texel rows of all faces are handed out as one work list and traced in
+// batches, as the rows of the dome camera.
+//
+static inline void dome_render_cubemap(const dome_camera &cam,
+                                       const dome_ray_tracer &tracer,
+                                       dome_cubemap &cube,
+                                       unsigned int nthreads) {
+  // first row and texel of every face in the work list, the texel index
+  // seeds the jitter as the pixel index does in the camera
+  unsigned int row_start[DOME_CUBE_FACES + 1], texel_start[DOME_CUBE_FACES];
+  row_start[0] = 0;
+  texel_start[0] = 0;
+  for (int f = 0; f < DOME_CUBE_FACES; f++) {
+    row_start[f + 1] = row_start[f] + cube.faces[f].res_y + 2;
+    if (f + 1 < DOME_CUBE_FACES)
+      texel_start[f + 1] = texel_start[f] + (unsigned int) cube.faces[f].texels.size();
+  }
+  if (nthreads < 1)
+    nthreads = 1;
+
+  std::atomic<unsigned int> next_row(0);
+  const float norm = 1.0f / cam.aa_samples;
+
+  auto worker = [&]() {
+    std::vector<dome_ray> batch;
+    std::vector<dome_ray_result> results;
+    std::vector<float> jitter;
+    for (unsigned int row = next_row++; row < row_start[DOME_CUBE_FACES]; row = next_row++) {
+      int f = 0;
+      while (row >= row_start[f + 1])
+        f++;
+      dome_cube_face &face = cube.faces[f];
+      const unsigned int j = row - row_start[f];   // 0 and res_y + 1 are border rows
+      const unsigned int width = face.res_x + 2;
+      const float ds = 2.0f / face.res_x;
+      const float dt = (1.0f - face.t_min) / face.res_y;
+
+      jitter.resize(dome_jitter_block_size(width, cam.aa_samples));
+      dome_jitter_block(texel_start[f] + j * width, width, cam.subframe,
+                        cam.aa_samples, jitter.data());
+
+      batch.clear();
+      for (unsigned int i = 0; i < width; i++) {
+        for (int s = 0; s < cam.aa_samples; s++) {
+          const float *jit = jitter.data() + dome_jitter_index(i, s, cam.aa_samples);
+          float2 jxy = make_float2(jit[0], jit[DOME_JITTER_LANES]);
+          float fs = -1.0f + ((float) i - 0.5f + jxy.x) * ds;
+          float ft = face.t_min + ((float) j - 0.5f + jxy.y) * dt;
+          dome_ray ray;
+          ray.origin = cam.cam_pos;
+          ray.direction = normalize(face.axis + face.right * fs + face.up * ft);
+          ray.x = i;
+          batch.push_back(ray);
+        }
+      }
+      results.resize(batch.size());
+      tracer.trace(batch.data(), batch.size(), results.data());
+
+      float4 *dst = &face.texels[(size_t) j * width];
+      for (unsigned int i = 0; i < width; i++)
+        dst[i] = make_float4(make_float3(0.0f), 0.0f);
+      for (size_t k = 0; k < batch.size(); k++) {
+        float4 &t = dst[batch[k].x];
+        t.x += results[k].color.x * norm;
+        t.y += results[k].color.y * norm;
+        t.z += results[k].color.z * norm;
+        t.w += results[k].alpha * norm;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < nthreads; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+//
+// Bilinear lookup of direction d in cube, with d in camera coordinates:
+// d.x, d.y and d.z along cam_U, cam_V and cam_W, not necessarily
+// normalized.  Directions below the horizon map to the side faces.
+//
+static inline float4 dome_cubemap_lookup(const dome_cubemap &cube, const float3 &d) {
+  // the face of the major axis, and the face coordinates s, t of d, see
+  // the face bases in dome_cubemap_init()
+  const float ax = fabsf(d.x), ay = fabsf(d.y);
+  int f;
+  float s, t;
+  if (d.z >= ax && d.z >= ay) {
+    f = DOME_CUBE_TOP;
+    s = d.x / d.z;
+    t = d.y / d.z;
+  } else if (ax >= ay) {
+    f = d.x > 0.0f ? DOME_CUBE_POS_U : DOME_CUBE_NEG_U;
+    s = d.y / d.x;
+    t = d.z / ax;
+  } else {
+    f = d.y > 0.0f ? DOME_CUBE_POS_V : DOME_CUBE_NEG_V;
+    s = -d.x / d.y;
+    t = d.z / ay;
+  }
+  const dome_cube_face &face = cube.faces[f];
+
+  // continuous texel coordinates, texel centers at integers, border at 0
+  const unsigned int width = face.res_x + 2;
+  float x = (s + 1.0f) * 0.5f * face.res_x + 0.5f;
+  float y = (t - face.t_min) / (1.0f - face.t_min) * face.res_y + 0.5f;
+  x = fminf(fmaxf(x, 0.0f), (float) (face.res_x + 1));
+  y = fminf(fmaxf(y, 0.0f), (float) (face.res_y + 1));
+  unsigned int x0 = (unsigned int) x;
+  unsigned int y0 = (unsigned int) y;
+  if (x0 > face.res_x) x0 = face.res_x;
+  if (y0 > face.res_y) y0 = face.res_y;
+  const float fx = x - x0;
+  const float fy = y - y0;
+
+  const float4 &t00 = face.texels[(size_t) y0 * width + x0];
+  const float4 &t10 = face.texels[(size_t) y0 * width + x0 + 1];
+  const float4 &t01 = face.texels[(size_t) (y0 + 1) * width + x0];
+  const float4 &t11 = face.texels[(size_t) (y0 + 1) * width + x0 + 1];
+  const float w00 = (1.0f - fx) * (1.0f - fy);
+  const float w10 = fx * (1.0f - fy);
+  const float w01 = (1.0f - fx) * fy;
+  const float w11 = fx * fy;
+  float4 r;
+  r.x = w00 * t00.x + w10 * t10.x + w01 * t01.x + w11 * t11.x;
+  r.y = w00 * t00.y + w10 * t10.y + w01 * t01.y + w11 * t11.y;
+  r.z = w00 * t00.z + w10 * t10.z + w01 * t01.z + w11 * t11.z;
+  r.w = w00 * t00.w + w10 * t10.w + w01 * t01.w + w11 * t11.w;
+  return r;
+}
+
+//
+// Resample cube into a mono dome master image of width x height pixels
+// (accum, row 0 at the bottom), with the fisheye mapping of the dome
+// camera.  Each pixel averages filter_size x filter_size stratified
+// bilinear lookups over its area, counting those outside the dome as
+// black like the AA samples of the camera.  For faces rendered for a
+// larger dome master, a filter_size of about the resolution ratio avoids
+// aliasing.  spans (from dome_compute_row_spans) may be NULL; pixels
+// outside them are set to 0.
+//
+static inline void dome_reproject_cubemap(const dome_cubemap &cube,
+                                          unsigned int width, unsigned int height,
+                                          const dome_row_span *spans,
+                                          int filter_size,
+                                          float4 *accum, unsigned int nthreads) {
+  const float fov = M_PIf;
+  const float thetamax = 0.5f * fov;
+  const float2 viewport_sz = make_float2(width, height);
+  const float2 radperpix = fov / viewport_sz;
+  const float2 viewport_mid = viewport_sz * 0.5f;
+  const float norm = 1.0f / (filter_size * filter_size);
+  if (nthreads < 1)
+    nthreads = 1;
+
+  std::atomic<unsigned int> next_row(0);
+  auto worker = [&]() {
+    for (unsigned int y = next_row++; y < height; y = next_row++) {
+      float4 *row = accum + (size_t) y * width;
+      unsigned int x0 = 0, x1 = width;
+      if (spans) {
+        x0 = spans[y].x0;
+        x1 = spans[y].x1;
+      }
+      for (unsigned int x = 0; x < width; x++)
+        row[x] = make_float4(make_float3(0.0f), 0.0f);
+
+      for (unsigned int x = x0; x < x1; x++) {
+        float4 sum = make_float4(make_float3(0.0f), 0.0f);
+        for (int sy = 0; sy < filter_size; sy++) {
+          for (int sx = 0; sx < filter_size; sx++) {
+            float2 jxy = make_float2((sx + 0.5f) / filter_size - 0.5f,
+                                     (sy + 0.5f) / filter_size - 0.5f);
+            float2 p = (make_float2(x, y) + jxy - viewport_mid) * radperpix;
+            float theta = sqrtf(p.x * p.x + p.y * p.y);
+            if (theta >= thetamax)
+              continue;
+            // the direction of the dome camera, in camera coordinates
+            float3 dir = make_float3(0.0f, 0.0f, 1.0f);
+            if (theta > 0) {
+              float rsin = sinf(theta) / theta;
+              dir = make_float3(rsin * p.x, rsin * p.y, cosf(theta));
+            }
+            float4 c = dome_cubemap_lookup(cube, dir);
+            sum.x += c.x; sum.y += c.y; sum.z += c.z; sum.w += c.w;
+          }
+        }
+        row[x] = make_float4(make_float3(sum.x * norm, sum.y * norm, sum.z * norm), sum.w * norm);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < nthreads; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+} // namespace dome_cpu
+
+#endif // DOME_CUBEMAP_CPU_H
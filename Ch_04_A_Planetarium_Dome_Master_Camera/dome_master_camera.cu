@@ -13,13 +13,22 @@
 
 #include "boilerplate.cuh"
 
+// In-dome pixel list for the compacted raygen programs below: the (x, y)
+// framebuffer coordinates of the pixels whose AA samples can fall inside
+// the dome FoV, in the order of dome_pixel_list() in dome_master_cpu.h.
+// The compacted programs are launched with dimensions (list size, 1) and
+// never write the pixels outside the list, so the accumulation buffer has
+// to be cleared once whenever the resolution changes.
+rtBuffer<uint2, 1> dome_pixel_list;
+
 //
 // Camera ray generation code for planetarium dome display
 // Generates a fisheye style frame with ~180 degree FoV
+// for pixel pixel_index of a framebuffer of size image_dim
 //
 template<int STEREO_ON, int DOF_ON>
 static __device__ __inline__
-void camera_dome_general() {
+void camera_dome_general(const uint2 &pixel_index, const uint2 &image_dim) {
   // Stereoscopic rendering is provided by rendering in an over/under
   // format with the left eye image into the top half of a double-high
   // framebuffer, and the right eye into the lower half.  The subsequent
@@ -29,20 +38,20 @@ void camera_dome_general() {
   float eyeshift;
   if (STEREO_ON) {
     // render into a double-high framebuffer when stereo is enabled
-    viewport_sz_y = launch_dim.y >> 1;
-    if (launch_index.y >= viewport_sz_y) {
+    viewport_sz_y = image_dim.y >> 1;
+    if (pixel_index.y >= viewport_sz_y) {
       // left image
-      viewport_idx_y = launch_index.y - viewport_sz_y;
+      viewport_idx_y = pixel_index.y - viewport_sz_y;
       eyeshift = -0.5f * cam_stereo_eyesep;
     } else {
       // right image
-      viewport_idx_y = launch_index.y;
+      viewport_idx_y = pixel_index.y;
       eyeshift =  0.5f * cam_stereo_eyesep;
     }
   } else {
     // render into a normal size framebuffer if stereo is not enabled
-    viewport_sz_y = launch_dim.y;
-    viewport_idx_y = launch_index.y;
+    viewport_sz_y = image_dim.y;
+    viewport_idx_y = pixel_index.y;
     eyeshift = 0.0f;
   }
 
@@ -58,11 +67,11 @@ void camera_dome_general() {
   // radians/pixel scaling factors in X/Y, and viewport_mid contains
   // the midpoint coordinate of the viewpoint used to compute the
   // distance from center.
-  float2 viewport_sz = make_float2(launch_dim.x, viewport_sz_y);
+  float2 viewport_sz = make_float2(image_dim.x, viewport_sz_y);
   float2 radperpix = fov / viewport_sz;
   float2 viewport_mid = viewport_sz * 0.5f;
 
-  unsigned int randseed = tea<4>(launch_dim.x*(launch_index.y)+launch_index.x, subframe_count());
+  unsigned int randseed = tea<4>(image_dim.x*(pixel_index.y)+pixel_index.x, subframe_count());
 
   float3 col = make_float3(0.0f);
   float alpha = 0.0f;
@@ -70,7 +79,7 @@ void camera_dome_general() {
     // compute the jittered image plane sample coordinate
     float2 jxy;
     jitter_offset2f(randseed, jxy);
-    float2 viewport_idx = make_float2(launch_index.x, viewport_idx_y) + jxy;
+    float2 viewport_idx = make_float2(pixel_index.x, viewport_idx_y) + jxy;
 
     // compute the ray angles in X/Y and total angular distance from center
     float2 p = (viewport_idx - viewport_mid) * radperpix;
@@ -119,7 +128,17 @@ void camera_dome_general() {
     }
   }
 
-  accumulate_color(col, alpha);
+  accumulate_color(pixel_index, col, alpha);
+}
+
+
+//
+// Size of the framebuffer, for the compacted launches whose launch_dim
+// is the length of dome_pixel_list
+//
+static __device__ __inline__ uint2 framebuffer_dim() {
+  size_t2 sz = framebuffer.size();
+  return make_uint2(sz.x, sz.y);
 }
 
 
@@ -128,19 +147,39 @@ void camera_dome_general() {
 // case-specific versions of the raygen program.
 //
 RT_PROGRAM void camera_dome_master() {
-  camera_dome_general<0, 0>();
+  camera_dome_general<0, 0>(launch_index, launch_dim);
 }
 
 RT_PROGRAM void camera_dome_master_dof() {
-  camera_dome_general<0, 1>();
+  camera_dome_general<0, 1>(launch_index, launch_dim);
 }
 
 RT_PROGRAM void camera_dome_master_stereo() {
-  camera_dome_general<1, 0>();
+  camera_dome_general<1, 0>(launch_index, launch_dim);
 }
 
 RT_PROGRAM void camera_dome_master_stereo_dof() {
-  camera_dome_general<1, 1>();
+  camera_dome_general<1, 1>(launch_index, launch_dim);
+}
+
+//
+// Compacted versions that only launch the in-dome pixels of
+// dome_pixel_list, about 79% of a square dome master frame
+//
+RT_PROGRAM void camera_dome_master_compact() {
+  camera_dome_general<0, 0>(dome_pixel_list[launch_index.x], framebuffer_dim());
+}
+
+RT_PROGRAM void camera_dome_master_dof_compact() {
+  camera_dome_general<0, 1>(dome_pixel_list[launch_index.x], framebuffer_dim());
+}
+
+RT_PROGRAM void camera_dome_master_stereo_compact() {
+  camera_dome_general<1, 0>(dome_pixel_list[launch_index.x], framebuffer_dim());
+}
+
+RT_PROGRAM void camera_dome_master_stereo_dof_compact() {
+  camera_dome_general<1, 1>(dome_pixel_list[launch_index.x], framebuffer_dim());
 }
 
 
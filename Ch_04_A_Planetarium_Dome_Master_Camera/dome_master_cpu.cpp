@@ -0,0 +1,510 @@
+//
+// Ray Tracing Gems sample code for
+//   "A Planetarium Dome Master Camera"
+//
+// Headless batch renderer using the CPU dome master camera of
+// dome_master_cpu.h with a small built-in scene (spheres above the
+// audience and a sky gradient), writing one PPM file per frame.  With
+// -cube the frames are rendered as cube faces and reprojected into the dome
+// master (dome_cubemap_cpu.h); the faces of a frame can then also be
+// reprojected to further fisheye sizes with -cubeout, without tracing again.
+//
+// Build:  g++ -O3 -std=c++11 -pthread -o dome_master_cpu dome_master_cpu.cpp
+// Run:    ./dome_master_cpu -res 2048 -stereo -aa 4 -frames 10 -o dome
+//         ./dome_master_cpu -res 4096 -cube -cubeout 2048 -cubeout 1024
+//         ./dome_master_cpu -res 4096 -aa 4 -jittertest
+//         ./dome_master_cpu -res 1024 -cubescale 0.8 -sidescale 1.2 -cubetest
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "dome_cubemap_cpu.h"
+
+using namespace dome_cpu;
+
+struct sphere {
+  float3 center;
+  float radius;
+  float3 color;
+};
+
+//
+// Brute force ray tracer for a few dozen spheres, with diffuse shading
+// from one directional light with hard shadows and from a headlight.
+//
+class sphere_tracer : public dome_ray_tracer {
+public:
+  sphere_tracer(unsigned int nspheres, const float3 &up) : zenith(up) {
+    light = normalize(make_float3(0.3f, 0.5f, 0.0f) + up);
+    unsigned int seed = 12345;
+    for (unsigned int i = 0; i < nspheres; i++) {
+      // random positions on a shell around the audience, above the horizon
+      float u = myrt_rand(seed) * MYRT_RAND_MAX_INV;
+      float v = myrt_rand(seed) * MYRT_RAND_MAX_INV;
+      float w = myrt_rand(seed) * MYRT_RAND_MAX_INV;
+      float phi = 2.0f * M_PIf * u;
+      float elev = 0.05f + 0.45f * M_PIf * v;
+      float dist = 6.0f + 8.0f * w;
+      sphere s;
+      s.center = make_float3(cosf(phi) * cosf(elev) * dist,
+                             sinf(phi) * cosf(elev) * dist, 0.0f) + up * (sinf(elev) * dist);
+      s.radius = 0.4f + 0.8f * (myrt_rand(seed) * MYRT_RAND_MAX_INV);
+      s.color = make_float3(0.3f + 0.7f * (myrt_rand(seed) * MYRT_RAND_MAX_INV),
+                            0.3f + 0.7f * (myrt_rand(seed) * MYRT_RAND_MAX_INV),
+                            0.3f + 0.7f * (myrt_rand(seed) * MYRT_RAND_MAX_INV));
+      spheres.push_back(s);
+    }
+  }
+
+  void trace(const dome_ray *rays, size_t count, dome_ray_result *results) const {
+    for (size_t i = 0; i < count; i++) {
+      const dome_ray &ray = rays[i];
+      int hit;
+      float t = intersect(ray.origin, ray.direction, hit);
+      if (hit < 0) {
+        // sky gradient from the horizon to the zenith
+        float h = fmaxf(dot(ray.direction, zenith), 0.0f);
+        results[i].color = make_float3(0.8f - 0.6f * h, 0.85f - 0.5f * h, 1.0f - 0.2f * h);
+        results[i].alpha = 1.0f;
+        continue;
+      }
+      const sphere &s = spheres[hit];
+      float3 p = ray.origin + ray.direction * t;
+      float3 n = normalize(p - s.center);
+      float ndotl = fmaxf(dot(n, light), 0.0f);
+      int shadow_hit;
+      if (ndotl > 0.0f) {
+        intersect(p + n * 1e-3f, light, shadow_hit);
+        if (shadow_hit >= 0)
+          ndotl = 0.0f;
+      }
+      float headlight = fmaxf(-dot(n, ray.direction), 0.0f);
+      results[i].color = s.color * (0.1f + 0.5f * ndotl + 0.4f * headlight);
+      results[i].alpha = 1.0f;
+    }
+  }
+
+private:
+  float intersect(const float3 &org, const float3 &dir, int &hit) const {
+    float tmin = 1e30f;
+    hit = -1;
+    for (size_t j = 0; j < spheres.size(); j++) {
+      float3 oc = org - spheres[j].center;
+      float b = dot(oc, dir);
+      float c = dot(oc, oc) - spheres[j].radius * spheres[j].radius;
+      float disc = b * b - c;
+      if (disc < 0.0f)
+        continue;
+      float t = -b - sqrtf(disc);
+      if (t > 0.0f && t < tmin) {
+        tmin = t;
+        hit = (int)j;
+      }
+    }
+    return tmin;
+  }
+
+  std::vector<sphere> spheres;
+  float3 zenith;
+  float3 light;
+};
+
+
+// Write accum as a binary PPM, top row first (accum has row 0 at the bottom).
+static int write_ppm(const char *filename, const float4 *accum,
+                     unsigned int width, unsigned int height) {
+  FILE *ofp = fopen(filename, "wb");
+  if (ofp == NULL)
+    return -1;
+  fprintf(ofp, "P6\n%u %u\n255\n", width, height);
+  std::vector<unsigned char> row(width * 3);
+  for (unsigned int y = 0; y < height; y++) {
+    const float4 *src = accum + (size_t)(height - 1 - y) * width;
+    for (unsigned int x = 0; x < width; x++) {
+      float c[3] = { src[x].x, src[x].y, src[x].z };
+      for (int k = 0; k < 3; k++)
+        row[x*3 + k] = (unsigned char)(255.0f * fminf(fmaxf(c[k], 0.0f), 1.0f) + 0.5f);
+    }
+    fwrite(row.data(), 1, row.size(), ofp);
+  }
+  return fclose(ofp) == 0 ? 0 : -1;
+}
+
+// Scalar reference of dome_jitter_block(): one tea<4> seed per pixel and
+// aa_samples calls of jitter_offset2f(), stored in the same layout.
+static void scalar_jitter(unsigned int pixel_index, unsigned int count,
+                          unsigned int subframe, int aa_samples,
+                          float *jitter) {
+  for (unsigned int i = 0; i < count; i++) {
+    unsigned int randseed = tea<4>(pixel_index + i, subframe);
+    for (int s = 0; s < aa_samples; s++) {
+      float2 jxy;
+      jitter_offset2f(randseed, jxy);
+      size_t idx = dome_jitter_index(i, s, aa_samples);
+      jitter[idx] = jxy.x;
+      jitter[idx + DOME_JITTER_LANES] = jxy.y;
+    }
+  }
+}
+
+// Number of floats of pixels [0, count) that differ bitwise between a and b.
+static size_t jitter_mismatches(const float *a, const float *b,
+                                unsigned int count, int aa_samples) {
+  size_t bad = 0;
+  for (unsigned int i = 0; i < count; i++) {
+    for (int s = 0; s < aa_samples; s++) {
+      size_t idx = dome_jitter_index(i, s, aa_samples);
+      bad += memcmp(&a[idx], &b[idx], sizeof(float)) != 0;
+      bad += memcmp(&a[idx + DOME_JITTER_LANES], &b[idx + DOME_JITTER_LANES],
+                    sizeof(float)) != 0;
+    }
+  }
+  return bad;
+}
+
+//
+// -jittertest: generate the AA jitter of nframes subframes of a
+// width x height image row by row, as the camera does, with both
+// dome_jitter_block() and the scalar reference; time both and compare
+// them bit for bit.  Also checks a run that is not a multiple of
+// DOME_JITTER_LANES and whose seed indices wrap around.  Returns
+// EXIT_FAILURE on any difference.
+//
+static int jitter_test(unsigned int width, unsigned int height,
+                       unsigned int nframes, int aa_samples) {
+  size_t size = dome_jitter_block_size(width + DOME_JITTER_LANES, aa_samples);
+  std::vector<float> block(size, 0.0f), scalar(size, 0.0f);
+  double block_secs = 0.0, scalar_secs = 0.0;
+  size_t bad = 0;
+
+  for (unsigned int f = 0; f < nframes; f++) {
+    for (unsigned int y = 0; y < height; y++) {
+      unsigned int pixel_index = y * width;
+      auto t0 = std::chrono::steady_clock::now();
+      dome_jitter_block(pixel_index, width, f, aa_samples, block.data());
+      auto t1 = std::chrono::steady_clock::now();
+      scalar_jitter(pixel_index, width, f, aa_samples, scalar.data());
+      auto t2 = std::chrono::steady_clock::now();
+      block_secs += std::chrono::duration<double>(t1 - t0).count();
+      scalar_secs += std::chrono::duration<double>(t2 - t1).count();
+      bad += jitter_mismatches(block.data(), scalar.data(), width, aa_samples);
+    }
+  }
+
+  // odd-length run across the unsigned wrap of the seed index
+  const unsigned int tail = DOME_JITTER_LANES + 3;
+  dome_jitter_block(0xfffffff8u, tail, 0xffffffffu, aa_samples, block.data());
+  scalar_jitter(0xfffffff8u, tail, 0xffffffffu, aa_samples, scalar.data());
+  bad += jitter_mismatches(block.data(), scalar.data(), tail, aa_samples);
+
+  double npixels = (double) width * height * nframes;
+  printf("jitter test: %ux%u, %u subframes, aa %d, %d lanes\n",
+         width, height, nframes, aa_samples, DOME_JITTER_LANES);
+  printf("  dome_jitter_block: %.2f ns/px\n", 1.0e9 * block_secs / npixels);
+  printf("  scalar:            %.2f ns/px\n", 1.0e9 * scalar_secs / npixels);
+  if (bad) {
+    printf("  FAILED: %zu offsets differ\n", bad);
+    return EXIT_FAILURE;
+  }
+  printf("  all offsets bit-identical\n");
+  return 0;
+}
+
+//
+// Tracer for -cubetest: the color of a ray is its direction mapped from
+// [-1, 1] to [0, 1], so that any pixel of a reprojection can be checked
+// against the direction it should show.
+//
+class direction_tracer : public dome_ray_tracer {
+public:
+  void trace(const dome_ray *rays, size_t count, dome_ray_result *results) const {
+    for (size_t i = 0; i < count; i++) {
+      results[i].color = (rays[i].direction + make_float3(1.0f)) * 0.5f;
+      results[i].alpha = 1.0f;
+    }
+  }
+};
+
+// Largest color error of a dome master image of the direction tracer
+// reprojected with one lookup per pixel from faces of top_res and side_res
+// texels, against the direction of each pixel center.
+static float cube_direction_error(const dome_camera &cam, unsigned int res,
+                                  unsigned int top_res, unsigned int side_res,
+                                  unsigned int nthreads) {
+  direction_tracer tracer;
+  dome_cubemap cube;
+  dome_cubemap_init(cube, cam, top_res, side_res);
+  dome_render_cubemap(cam, tracer, cube, nthreads);
+  std::vector<float4> image((size_t) res * res);
+  dome_reproject_cubemap(cube, res, res, NULL, 1, image.data(), nthreads);
+
+  const float radperpix = M_PIf / res;
+  float max_error = 0.0f;
+  for (unsigned int y = 0; y < res; y++) {
+    for (unsigned int x = 0; x < res; x++) {
+      float2 p = (make_float2(x, y) - make_float2(0.5f * res, 0.5f * res)) * radperpix;
+      float theta = sqrtf(p.x * p.x + p.y * p.y);
+      if (theta >= 0.5f * M_PIf)
+        continue;
+      float3 dir = make_float3(0.0f, 0.0f, 1.0f);
+      if (theta > 0) {
+        float rsin = sinf(theta) / theta;
+        dir = make_float3(rsin * p.x, rsin * p.y, cosf(theta));
+      }
+      const float3 expected = (dir + make_float3(1.0f)) * 0.5f;
+      const float4 &c = image[(size_t) y * res + x];
+      max_error = fmaxf(max_error, fabsf(c.x - expected.x));
+      max_error = fmaxf(max_error, fabsf(c.y - expected.y));
+      max_error = fmaxf(max_error, fabsf(c.z - expected.z));
+    }
+  }
+  return max_error;
+}
+
+//
+// -cubetest: reproject the faces of the direction tracer into a res x res
+// dome master with equal and with unequal top and side face resolutions
+// and check every pixel against its direction.  A texel spans at most
+// 2 / face res radians, so with AA jitter within the texel the error
+// stays below one texel, 1 / face res in color.  Returns EXIT_FAILURE if
+// any configuration exceeds it.
+//
+static int cube_test(unsigned int res, float top_scale, float side_scale,
+                     int aa_samples, unsigned int nthreads) {
+  dome_camera cam;
+  memset(&cam, 0, sizeof(cam));
+  cam.aa_samples = aa_samples;
+  cam.cam_pos = make_float3(0.0f);
+  cam.cam_U = make_float3(1.0f, 0.0f, 0.0f);
+  cam.cam_V = make_float3(0.0f, 1.0f, 0.0f);
+  cam.cam_W = make_float3(0.0f, 0.0f, 1.0f);
+
+  const unsigned int top_res = dome_cube_face_res(res, top_scale);
+  const unsigned int side_res = dome_cube_face_res(res, side_scale);
+  const unsigned int sizes[3][2] = {
+    { top_res, side_res },
+    { dome_cube_face_res(res, 0.5f * top_scale), side_res },
+    { top_res, dome_cube_face_res(res, 0.5f * side_scale) } };
+
+  printf("cube test: %ux%u, aa %d\n", res, res, aa_samples);
+  int failed = 0;
+  for (int i = 0; i < 3; i++) {
+    const unsigned int min_res = sizes[i][0] < sizes[i][1] ? sizes[i][0] : sizes[i][1];
+    const float bound = 1.0f / min_res;
+    const float error = cube_direction_error(cam, res, sizes[i][0], sizes[i][1], nthreads);
+    printf("  top face %ux%u, side faces %ux%u: max error %.2e, bound %.2e%s\n",
+           sizes[i][0], sizes[i][0], sizes[i][1], sizes[i][1] / 2, error, bound,
+           error <= bound ? "" : "  FAILED");
+    failed |= !(error <= bound);
+  }
+  return failed ? EXIT_FAILURE : 0;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  -res N        dome master image size in pixels (default 1024)\n"
+    "  -stereo       over/under stereo, left eye on top (double-high image)\n"
+    "  -eyesep E     stereo eye separation (default 0.3)\n"
+    "  -dof          depth of field\n"
+    "  -aperture R   DoF aperture radius (default 0.05)\n"
+    "  -focaldist D  DoF focal distance (default 8)\n"
+    "  -aa N         AA samples per pixel (default 4)\n"
+    "  -frames N     frames to render, the camera turns about the zenith (default 1)\n"
+    "  -threads N    worker threads (default: all hardware threads)\n"
+    "  -spheres N    spheres in the scene (default 64)\n"
+    "  -nomask       visit all pixels, not just those that can see the dome\n"
+    "  -cube         render cube faces and reproject them (no stereo or DoF)\n"
+    "  -cubescale S  top face resolution relative to the dome master (default 1)\n"
+    "  -sidescale S  side face resolution relative to the dome master\n"
+    "                (default: the -cubescale value)\n"
+    "  -filter N     NxN lookups per pixel in the reprojection (default 2)\n"
+    "  -cubeout N    also reproject the faces to an N x N image, PREFIX.N.NNNN.ppm\n"
+    "                (repeatable, implies -cube)\n"
+    "  -o PREFIX     output files PREFIX.NNNN.ppm (default dome)\n"
+    "  -jittertest   check the block AA jitter generator against the scalar\n"
+    "                one for -res, -aa and -frames, print timings, render nothing\n"
+    "  -cubetest     check the reprojection of -res with the -cubescale and\n"
+    "                -sidescale faces and with either of them halved, render nothing\n",
+    name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  unsigned int res = 1024;
+  unsigned int nframes = 1;
+  unsigned int nthreads = std::thread::hardware_concurrency();
+  unsigned int nspheres = 64;
+  const char *prefix = "dome";
+  int use_mask = 1;
+  int use_cube = 0;
+  float cube_scale = 1.0f;
+  float side_scale = 0.0f;
+  int filter_size = 2;
+  int jitter_only = 0;
+  int cube_test_only = 0;
+  std::vector<unsigned int> cube_outputs;
+
+  dome_camera cam;
+  memset(&cam, 0, sizeof(cam));
+  cam.cam_stereo_eyesep = 0.3f;
+  cam.cam_dof_aperture_rad = 0.05f;
+  cam.cam_dof_focal_dist = 8.0f;
+  cam.aa_samples = 4;
+
+  for (int i = 1; i < argc; i++) {
+    int has_value = (i + 1 < argc);
+    if (!strcmp(argv[i], "-res") && has_value)
+      res = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-stereo"))
+      cam.stereo_on = 1;
+    else if (!strcmp(argv[i], "-eyesep") && has_value)
+      cam.cam_stereo_eyesep = (float) atof(argv[++i]);
+    else if (!strcmp(argv[i], "-dof"))
+      cam.dof_on = 1;
+    else if (!strcmp(argv[i], "-aperture") && has_value)
+      cam.cam_dof_aperture_rad = (float) atof(argv[++i]);
+    else if (!strcmp(argv[i], "-focaldist") && has_value)
+      cam.cam_dof_focal_dist = (float) atof(argv[++i]);
+    else if (!strcmp(argv[i], "-aa") && has_value)
+      cam.aa_samples = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-frames") && has_value)
+      nframes = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-threads") && has_value)
+      nthreads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-spheres") && has_value)
+      nspheres = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-nomask"))
+      use_mask = 0;
+    else if (!strcmp(argv[i], "-cube"))
+      use_cube = 1;
+    else if (!strcmp(argv[i], "-cubescale") && has_value)
+      cube_scale = (float) atof(argv[++i]);
+    else if (!strcmp(argv[i], "-sidescale") && has_value)
+      side_scale = (float) atof(argv[++i]);
+    else if (!strcmp(argv[i], "-filter") && has_value)
+      filter_size = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-cubeout") && has_value) {
+      int n = atoi(argv[++i]);
+      if (n < 1)
+        usage(argv[0]);
+      cube_outputs.push_back((unsigned int) n);
+      use_cube = 1;
+    }
+    else if (!strcmp(argv[i], "-o") && has_value)
+      prefix = argv[++i];
+    else if (!strcmp(argv[i], "-jittertest"))
+      jitter_only = 1;
+    else if (!strcmp(argv[i], "-cubetest"))
+      cube_test_only = 1;
+    else
+      usage(argv[0]);
+  }
+  if (side_scale == 0.0f)
+    side_scale = cube_scale;
+  if (res == 0 || cam.aa_samples < 1 || cube_scale <= 0.0f || side_scale <= 0.0f || filter_size < 1)
+    usage(argv[0]);
+  if (jitter_only)
+    return jitter_test(res, res, nframes, cam.aa_samples);
+  if (cube_test_only)
+    return cube_test(res, cube_scale, side_scale, cam.aa_samples, nthreads < 1 ? 1 : nthreads);
+  if (use_cube && (cam.stereo_on || cam.dof_on)) {
+    fprintf(stderr, "-cube does not support stereo or DoF\n");
+    return EXIT_FAILURE;
+  }
+  if (nthreads < 1)
+    nthreads = 1;
+
+  cam.width = res;
+  cam.height = cam.stereo_on ? 2 * res : res;
+  cam.cam_pos = make_float3(0.0f);
+  cam.cam_W = make_float3(0.0f, 0.0f, 1.0f);
+
+  // in-dome pixel spans, computed once for the resolution
+  std::vector<dome_row_span> spans;
+  if (use_mask) {
+    dome_compute_row_spans(cam.width, cam.height, cam.stereo_on, spans);
+    cam.spans = spans.data();
+    printf("%.1f%% of the pixels can see the dome\n",
+           100.0 * dome_span_pixel_count(spans) / ((double) cam.width * cam.height));
+  }
+
+  sphere_tracer tracer(nspheres, cam.cam_W);
+  std::vector<float4> accum((size_t)cam.width * cam.height);
+
+  // cube faces sized for the largest output
+  dome_cubemap cube;
+  unsigned int top_res = 0, side_res = 0;
+  if (use_cube) {
+    unsigned int max_res = res;
+    for (size_t i = 0; i < cube_outputs.size(); i++)
+      if (cube_outputs[i] > max_res)
+        max_res = cube_outputs[i];
+    top_res = dome_cube_face_res(max_res, cube_scale);
+    side_res = dome_cube_face_res(max_res, side_scale);
+  }
+
+  printf("dome master %ux%u%s%s, %d AA samples, %u threads\n", cam.width, cam.height,
+         cam.stereo_on ? " over/under stereo" : "", cam.dof_on ? " DoF" : "",
+         cam.aa_samples, nthreads);
+  if (use_cube)
+    printf("top face %ux%u, side faces %ux%u, %dx%d reprojection filter\n",
+           top_res, top_res, side_res, side_res / 2, filter_size, filter_size);
+  double total = 0.0;
+  for (unsigned int frame = 0; frame < nframes; frame++) {
+    // turn the camera about the zenith, one degree per frame
+    float phi = frame * (M_PIf / 180.0f);
+    cam.cam_U = make_float3(cosf(phi), sinf(phi), 0.0f);
+    cam.cam_V = make_float3(-sinf(phi), cosf(phi), 0.0f);
+    cam.subframe = frame;
+
+    auto start = std::chrono::steady_clock::now();
+    if (use_cube) {
+      dome_cubemap_init(cube, cam, top_res, side_res);
+      dome_render_cubemap(cam, tracer, cube, nthreads);
+      double face_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      dome_reproject_cubemap(cube, cam.width, cam.height, cam.spans, filter_size,
+                             accum.data(), nthreads);
+      printf("frame %u: cube faces %.3f s, reprojection %.3f s\n", frame, face_secs,
+             std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() - face_secs);
+    } else {
+      dome_render_frame(cam, tracer, accum.data(), nthreads);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    total += secs;
+
+    char filename[4096];
+    snprintf(filename, sizeof(filename), "%s.%04u.ppm", prefix, frame);
+    if (write_ppm(filename, accum.data(), cam.width, cam.height)) {
+      fprintf(stderr, "error writing %s\n", filename);
+      return EXIT_FAILURE;
+    }
+    printf("frame %u: %.3f s, %s\n", frame, secs, filename);
+
+    // the other fisheye sizes from the same cube faces
+    for (size_t i = 0; i < cube_outputs.size(); i++) {
+      unsigned int n = cube_outputs[i];
+      std::vector<dome_row_span> out_spans;
+      if (use_mask)
+        dome_compute_row_spans(n, n, 0, out_spans);
+      std::vector<float4> out((size_t) n * n);
+      auto out_start = std::chrono::steady_clock::now();
+      dome_reproject_cubemap(cube, n, n, use_mask ? out_spans.data() : NULL,
+                             filter_size, out.data(), nthreads);
+      double out_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - out_start).count();
+      snprintf(filename, sizeof(filename), "%s.%u.%04u.ppm", prefix, n, frame);
+      if (write_ppm(filename, out.data(), n, n)) {
+        fprintf(stderr, "error writing %s\n", filename);
+        return EXIT_FAILURE;
+      }
+      printf("frame %u: %ux%u reprojection %.3f s, %s\n", frame, n, n, out_secs, filename);
+    }
+  }
+  if (nframes > 0)
+    printf("%.3f s per frame\n", total / nframes);
+
+  return 0;
+}
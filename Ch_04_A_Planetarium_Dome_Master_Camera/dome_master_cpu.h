@@ -0,0 +1,554 @@
+//
+// Ray Tracing Gems sample code for
+//   "A Planetarium Dome Master Camera"
+//
+// CPU version of the dome master camera in dome_master_camera.cu, for
+// rendering dome content headless on machines without a GPU.  The camera
+// generates the rays of one image row at a time into a batch, hands the
+// batch to a CPU ray tracer, and accumulates the results into the
+// framebuffer.  Rows are distributed over worker threads.
+//
+// The ray generation, random number and jitter code follows
+// dome_master_camera.cu and boilerplate.cuh line by line, so both draw the
+// same jitter sequence for the same pixel and subframe (up to the precision
+// of the fast sine/cosine the GPU uses for DoF samples).
+//
+
+#ifndef DOME_MASTER_CPU_H
+#define DOME_MASTER_CPU_H
+
+#include <math.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace dome_cpu {
+
+#ifndef M_PIf
+#define M_PIf 3.14159265358979323846f
+#endif
+
+//
+// Minimal host versions of the CUDA/OptiX vector types and operators used
+// by the camera code
+//
+struct float2 { float x, y; };
+struct float3 { float x, y, z; };
+struct float4 { float x, y, z, w; };
+
+static inline float2 make_float2(float x, float y) {
+  float2 v = { x, y };
+  return v;
+}
+
+static inline float3 make_float3(float x, float y, float z) {
+  float3 v = { x, y, z };
+  return v;
+}
+
+static inline float3 make_float3(float s) {
+  return make_float3(s, s, s);
+}
+
+static inline float4 make_float4(const float3 &v, float w) {
+  float4 r = { v.x, v.y, v.z, w };
+  return r;
+}
+
+static inline float2 operator+(const float2 &a, const float2 &b) {
+  return make_float2(a.x + b.x, a.y + b.y);
+}
+static inline float2 operator-(const float2 &a, const float2 &b) {
+  return make_float2(a.x - b.x, a.y - b.y);
+}
+static inline float2 operator*(const float2 &a, const float2 &b) {
+  return make_float2(a.x * b.x, a.y * b.y);
+}
+static inline float2 operator*(const float2 &a, float s) {
+  return make_float2(a.x * s, a.y * s);
+}
+static inline float2 operator/(float s, const float2 &a) {
+  return make_float2(s / a.x, s / a.y);
+}
+static inline void operator*=(float2 &a, float s) {
+  a.x *= s; a.y *= s;
+}
+
+static inline float3 operator+(const float3 &a, const float3 &b) {
+  return make_float3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+static inline float3 operator-(const float3 &a, const float3 &b) {
+  return make_float3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+static inline float3 operator-(const float3 &a) {
+  return make_float3(-a.x, -a.y, -a.z);
+}
+static inline float3 operator*(const float3 &a, float s) {
+  return make_float3(a.x * s, a.y * s, a.z * s);
+}
+static inline float3 operator*(float s, const float3 &a) {
+  return a * s;
+}
+static inline void operator+=(float3 &a, const float3 &b) {
+  a.x += b.x; a.y += b.y; a.z += b.z;
+}
+static inline void operator*=(float3 &a, float s) {
+  a.x *= s; a.y *= s; a.z *= s;
+}
+
+static inline float dot(const float3 &a, const float3 &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline float3 cross(const float3 &a, const float3 &b) {
+  return make_float3(a.y * b.z - a.z * b.y,
+                     a.z * b.x - a.x * b.z,
+                     a.x * b.y - a.y * b.x);
+}
+
+static inline float3 normalize(const float3 &v) {
+  return v * (1.0f / sqrtf(dot(v, v)));
+}
+
+
+//
+// Random number routines of boilerplate.cuh
+//
+#ifndef MYRT_RAND_MAX_INV
+#define MYRT_RAND_MAX_INV .00000000023283064365f   /* normalize rt_rand  */
+#endif
+
+// 32-bit LCG [Fishman 1990], see boilerplate.cuh
+static inline unsigned int myrt_rand(unsigned int &idum) {
+  idum *= 1099087573;
+  return idum;
+}
+
+// TEA, used to seed the per-pixel LCG, see boilerplate.cuh
+template<unsigned int N> static inline
+unsigned int tea(unsigned int val0, unsigned int val1) {
+  unsigned int v0 = val0;
+  unsigned int v1 = val1;
+  unsigned int s0 = 0;
+
+  for (unsigned int n = 0; n < N; n++) {
+    s0 += 0x9e3779b9;
+    v0 += ((v1<<4)+0xa341316c)^(v1+s0)^((v1>>5)+0xc8013ea4);
+    v1 += ((v0<<4)+0xad90777d)^(v0+s0)^((v0>>5)+0x7e95761e);
+  }
+
+  return v0;
+}
+
+// AA jitter offset in the image plane
+static inline void jitter_offset2f(unsigned int &pval, float2 &xy) {
+  xy.x = (myrt_rand(pval) * MYRT_RAND_MAX_INV) - 0.5f;
+  xy.y = (myrt_rand(pval) * MYRT_RAND_MAX_INV) - 0.5f;
+}
+
+// DoF jitter offset in the circle of confusion
+static inline void jitter_disc2f(unsigned int &pval, float2 &xy, float radius) {
+  float   r=(myrt_rand(pval) * MYRT_RAND_MAX_INV);
+  float phi=(myrt_rand(pval) * MYRT_RAND_MAX_INV) * 2.0f * M_PIf;
+  xy.x = sinf(phi);
+  xy.y = cosf(phi);
+  xy *= sqrtf(r) * radius;
+}
+
+
+//
+// Lane-parallel version of the per-pixel TEA seeding and the
+// jitter_offset2f() sequence: DOME_JITTER_LANES consecutive pixels run in
+// lockstep, one pixel per SIMD lane, written as plain loops over the lanes
+// so that the compiler vectorizes them for the target (8 lanes fill an
+// AVX2 register of 32-bit integers, 16 an AVX-512 one).
+//
+#ifndef DOME_JITTER_LANES
+#if defined(__AVX512F__)
+#define DOME_JITTER_LANES 16
+#else
+#define DOME_JITTER_LANES 8
+#endif
+#endif
+
+// Exact unsigned to float conversion from two exactly representable
+// halves; unlike (float) u this vectorizes without AVX-512.
+static inline float dome_u32_to_float(unsigned int u) {
+  return (float) (int) (u >> 16) * 65536.0f + (float) (int) (u & 0xffff);
+}
+
+// Number of floats dome_jitter_block() writes for count pixels.
+static inline size_t dome_jitter_block_size(unsigned int count, int aa_samples) {
+  size_t blocks = (count + DOME_JITTER_LANES - 1) / DOME_JITTER_LANES;
+  return blocks * aa_samples * 2 * DOME_JITTER_LANES;
+}
+
+//
+// All aa_samples AA jitter offsets of the pixels with seed indices
+// [pixel_index, pixel_index + count), identical to what
+// tea<4>(pixel_index + i, subframe) followed by aa_samples calls of
+// jitter_offset2f() produces for pixel i.  Pixels are grouped into blocks
+// of DOME_JITTER_LANES; sample s of pixel i is at jitter +
+// dome_jitter_index(i, s, aa_samples), its y offset DOME_JITTER_LANES
+// floats after its x offset.  jitter needs dome_jitter_block_size() floats.
+//
+static inline size_t dome_jitter_index(unsigned int i, int s, int aa_samples) {
+  const unsigned int block = i / DOME_JITTER_LANES;
+  const unsigned int lane = i % DOME_JITTER_LANES;
+  return ((size_t) block * aa_samples + s) * 2 * DOME_JITTER_LANES + lane;
+}
+
+static inline void dome_jitter_block(unsigned int pixel_index, unsigned int count,
+                                     unsigned int subframe, int aa_samples,
+                                     float *jitter) {
+  const int L = DOME_JITTER_LANES;
+  for (unsigned int i = 0; i < count; i += L, pixel_index += L) {
+    // tea<4>
+    unsigned int v0[L], v1[L];
+    for (int l = 0; l < L; l++) {
+      v0[l] = pixel_index + l;
+      v1[l] = subframe;
+    }
+    unsigned int s0 = 0;
+    for (unsigned int n = 0; n < 4; n++) {
+      s0 += 0x9e3779b9;
+      for (int l = 0; l < L; l++) {
+        v0[l] += ((v1[l]<<4)+0xa341316c)^(v1[l]+s0)^((v1[l]>>5)+0xc8013ea4);
+        v1[l] += ((v0[l]<<4)+0xad90777d)^(v0[l]+s0)^((v0[l]>>5)+0x7e95761e);
+      }
+    }
+
+    // jitter_offset2f per sample
+    float *dst = jitter + dome_jitter_index(i, 0, aa_samples);
+    for (int s = 0; s < aa_samples; s++, dst += 2 * L) {
+      for (int l = 0; l < L; l++) {
+        v0[l] *= 1099087573;
+        dst[l] = (dome_u32_to_float(v0[l]) * MYRT_RAND_MAX_INV) - 0.5f;
+        v0[l] *= 1099087573;
+        dst[L + l] = (dome_u32_to_float(v0[l]) * MYRT_RAND_MAX_INV) - 0.5f;
+      }
+    }
+  }
+}
+
+
+// Pixels [x0, x1) of a framebuffer row whose AA samples can land inside
+// the dome FoV; x0 == x1 for rows entirely outside.
+struct dome_row_span {
+  unsigned int x0, x1;
+};
+
+//
+// Camera parameters, the rtDeclareVariables of the OptiX version
+//
+struct dome_camera {
+  unsigned int width;          // launch_dim.x
+  unsigned int height;         // launch_dim.y, twice the eye image height in stereo
+  int stereo_on;
+  int dof_on;
+  float3 cam_pos;
+  float3 cam_U, cam_V, cam_W;  // orthonormal basis, cam_W points to the zenith
+  float cam_stereo_eyesep;
+  float cam_dof_aperture_rad;
+  float cam_dof_focal_dist;
+  int aa_samples;              // samples per pixel and subframe
+  unsigned int subframe;       // subframe_count(), seeds the jitter
+  const dome_row_span *spans;  // in-dome pixels per row, or NULL for all
+};
+
+//
+// Compute the in-dome pixel spans of every row of a width x height
+// framebuffer (double-high in stereo).  A pixel is kept if any point of
+// its jitter square [x - 0.5, x + 0.5] x [y - 0.5, y + 0.5] is within
+// thetamax of the center; the others never trace a ray, so skipping them
+// leaves the image unchanged.  The spans only depend on the resolution and
+// can be reused for all frames.
+//
+static inline void dome_compute_row_spans(unsigned int width, unsigned int height,
+                                   int stereo_on,
+                                   std::vector<dome_row_span> &spans) {
+  const unsigned int viewport_sz_y = stereo_on ? height >> 1 : height;
+  const double fov = M_PIf;
+  const double thetamax = 0.5 * fov;
+  const double radperpix_x = fov / width;
+  const double radperpix_y = fov / viewport_sz_y;
+  const double mid_x = width * 0.5;
+  const double mid_y = viewport_sz_y * 0.5;
+  const double margin = 1e-3; // pixels, covers float rounding in the camera
+
+  spans.resize(height);
+  for (unsigned int y = 0; y < height; y++) {
+    const unsigned int viewport_idx_y = (stereo_on && y >= viewport_sz_y) ? y - viewport_sz_y : y;
+    const double dy = fmax(fabs(viewport_idx_y - mid_y) - 0.5 - margin, 0.0) * radperpix_y;
+    dome_row_span span = { 0, 0 };
+    if (dy < thetamax) {
+      // half width of the disk at this row, in pixels
+      const double hw = sqrt(thetamax * thetamax - dy * dy) / radperpix_x + 0.5 + margin;
+      const double x0 = ceil(mid_x - hw);
+      const double x1 = floor(mid_x + hw) + 1.0;
+      span.x0 = (unsigned int) fmin(fmax(x0, 0.0), (double) width);
+      span.x1 = (unsigned int) fmin(fmax(x1, (double) span.x0), (double) width);
+    }
+    spans[y] = span;
+  }
+}
+
+// Number of pixels covered by spans.
+static inline size_t dome_span_pixel_count(const std::vector<dome_row_span> &spans) {
+  size_t n = 0;
+  for (size_t y = 0; y < spans.size(); y++)
+    n += spans[y].x1 - spans[y].x0;
+  return n;
+}
+
+//
+// Flatten spans to the (x, y) pixel list of the compacted OptiX launch,
+// see dome_pixel_list in dome_master_camera.cu: two unsigned ints per pixel,
+// the layout of a uint2 buffer.
+//
+static inline void dome_pixel_list(const std::vector<dome_row_span> &spans,
+                            std::vector<unsigned int> &xy) {
+  xy.clear();
+  xy.reserve(2 * dome_span_pixel_count(spans));
+  for (unsigned int y = 0; y < spans.size(); y++) {
+    for (unsigned int x = spans[y].x0; x < spans[y].x1; x++) {
+      xy.push_back(x);
+      xy.push_back(y);
+    }
+  }
+}
+
+// One camera ray and the pixel of the current row it belongs to
+struct dome_ray {
+  float3 origin;
+  float3 direction;
+  unsigned int x;
+};
+
+// Result of tracing a ray: color and alpha
+struct dome_ray_result {
+  float3 color;
+  float alpha;
+};
+
+//
+// Interface of the CPU ray tracer the camera feeds.  trace() is called
+// concurrently from all worker threads, each with its own batches.
+//
+class dome_ray_tracer {
+public:
+  virtual ~dome_ray_tracer() {}
+  virtual void trace(const dome_ray *rays, size_t count,
+                     dome_ray_result *results) const = 0;
+};
+
+
+//
+// CUDA device function for computing the new ray origin and direction
+// within the circle of confusion, see boilerplate.cuh
+//
+static inline
+void dof_ray(const dome_camera &cam,
+             const float3 &ray_origin_orig, float3 &ray_origin,
+             const float3 &ray_direction_orig, float3 &ray_direction,
+             unsigned int &randseed, const float3 &up, const float3 &right) {
+  float3 focuspoint = ray_origin_orig + ray_direction_orig * cam.cam_dof_focal_dist;
+  float2 dofjxy;
+  jitter_disc2f(randseed, dofjxy, cam.cam_dof_aperture_rad);
+  ray_origin = ray_origin_orig + dofjxy.x*right + dofjxy.y*up;
+  ray_direction = normalize(focuspoint - ray_origin);
+}
+
+
+//
+// Camera ray generation for row launch_index_y of the framebuffer, the
+// body of camera_dome_general() in dome_master_camera.cu for all pixels of
+// the row.  Rays of samples outside the dome FoV are not generated, and
+// with cam.spans set pixels that cannot see the dome are not visited.
+// Without DoF the AA jitter of the row is generated up front by
+// dome_jitter_block() into the scratch buffer jitter; DoF interleaves its
+// disc samples with the AA jitter in the same sequence and draws both from
+// the scalar generator.
+//
+template<int STEREO_ON, int DOF_ON>
+static void camera_dome_general_row(const dome_camera &cam,
+                                    unsigned int launch_index_y,
+                                    std::vector<dome_ray> &batch,
+                                    std::vector<float> &jitter) {
+  batch.clear();
+
+  // Over/under stereo: left eye in the top half of the double-high
+  // framebuffer, right eye in the lower half.
+  unsigned int viewport_sz_y, viewport_idx_y;
+  float eyeshift;
+  if (STEREO_ON) {
+    viewport_sz_y = cam.height >> 1;
+    if (launch_index_y >= viewport_sz_y) {
+      // left image
+      viewport_idx_y = launch_index_y - viewport_sz_y;
+      eyeshift = -0.5f * cam.cam_stereo_eyesep;
+    } else {
+      // right image
+      viewport_idx_y = launch_index_y;
+      eyeshift =  0.5f * cam.cam_stereo_eyesep;
+    }
+  } else {
+    viewport_sz_y = cam.height;
+    viewport_idx_y = launch_index_y;
+    eyeshift = 0.0f;
+  }
+
+  float fov = M_PIf; // dome FoV in radians
+  float thetamax = 0.5 * fov;
+
+  float2 viewport_sz = make_float2(cam.width, viewport_sz_y);
+  float2 radperpix = fov / viewport_sz;
+  float2 viewport_mid = viewport_sz * 0.5f;
+
+  // only the pixels of the row that can see the dome
+  unsigned int x0 = 0, x1 = cam.width;
+  if (cam.spans) {
+    x0 = cam.spans[launch_index_y].x0;
+    x1 = cam.spans[launch_index_y].x1;
+  }
+  if (!DOF_ON && x1 > x0) {
+    jitter.resize(dome_jitter_block_size(x1 - x0, cam.aa_samples));
+    dome_jitter_block(cam.width*(launch_index_y)+x0, x1 - x0, cam.subframe,
+                      cam.aa_samples, jitter.data());
+  }
+
+  for (unsigned int launch_index_x = x0; launch_index_x < x1; launch_index_x++) {
+    unsigned int randseed = 0;
+    if (DOF_ON)
+      randseed = tea<4>(cam.width*(launch_index_y)+launch_index_x, cam.subframe);
+
+    for (int s=0; s<cam.aa_samples; s++) {
+      // compute the jittered image plane sample coordinate
+      float2 jxy;
+      if (DOF_ON) {
+        jitter_offset2f(randseed, jxy);
+      } else {
+        const float *j = jitter.data() + dome_jitter_index(launch_index_x - x0, s, cam.aa_samples);
+        jxy = make_float2(j[0], j[DOME_JITTER_LANES]);
+      }
+      float2 viewport_idx = make_float2(launch_index_x, viewport_idx_y) + jxy;
+
+      // compute the ray angles in X/Y and total angular distance from center
+      float2 p = (viewport_idx - viewport_mid) * radperpix;
+      float theta = hypotf(p.x, p.y);
+
+      // samples outside the dome FoV contribute nothing
+      if (theta < thetamax) {
+        float3 ray_direction;
+        float3 ray_origin = cam.cam_pos;
+
+        if (theta == 0) {
+          // center of the dome, azimuth undefined: look at the zenith
+          ray_direction = cam.cam_W;
+        } else {
+          float sintheta = sinf(theta);
+          float costheta = cosf(theta);
+          float rsin = sintheta / theta; // normalize component
+          ray_direction = cam.cam_U*rsin*p.x + cam.cam_V*rsin*p.y + cam.cam_W*costheta;
+          if (STEREO_ON) {
+            // assumes a flat dome, where cam_W also points in the
+            // audience "up" direction
+            ray_origin += eyeshift * cross(ray_direction, cam.cam_W);
+          }
+
+          if (DOF_ON) {
+            float rcos = costheta / theta; // normalize component
+            float3 ray_up    = -cam.cam_U*rcos*p.x  -cam.cam_V*rcos*p.y + cam.cam_W*sintheta;
+            float3 ray_right =  cam.cam_U*(p.y/theta) + cam.cam_V*(-p.x/theta);
+            dof_ray(cam, ray_origin, ray_origin, ray_direction, ray_direction,
+                    randseed, ray_up, ray_right);
+          }
+        }
+
+        dome_ray ray;
+        ray.origin = ray_origin;
+        ray.direction = ray_direction;
+        ray.x = launch_index_x;
+        batch.push_back(ray);
+      }
+    }
+  }
+}
+
+
+//
+// Render rows [0, cam.height) on nthreads threads, each taking the next
+// row when done with its last.  accum receives the normalized sum of the
+// samples of every pixel, as accumulate_color() with a normalization of
+// 1 / aa_samples.
+//
+template<int STEREO_ON, int DOF_ON>
+static void dome_render_rows(const dome_camera &cam,
+                             const dome_ray_tracer &tracer,
+                             float4 *accum, unsigned int nthreads) {
+  std::atomic<unsigned int> next_row(0);
+  const float norm = 1.0f / cam.aa_samples;
+
+  auto worker = [&]() {
+    std::vector<dome_ray> batch;
+    std::vector<dome_ray_result> results;
+    std::vector<float> jitter;
+    std::vector<float4> row(cam.width);
+    for (unsigned int y = next_row++; y < cam.height; y = next_row++) {
+      camera_dome_general_row<STEREO_ON, DOF_ON>(cam, y, batch, jitter);
+      results.resize(batch.size());
+      if (!batch.empty())
+        tracer.trace(batch.data(), batch.size(), results.data());
+
+      for (unsigned int x = 0; x < cam.width; x++)
+        row[x] = make_float4(make_float3(0.0f), 0.0f);
+      for (size_t i = 0; i < batch.size(); i++) {
+        float4 &px = row[batch[i].x];
+        px.x += results[i].color.x;
+        px.y += results[i].color.y;
+        px.z += results[i].color.z;
+        px.w += results[i].alpha;
+      }
+      for (unsigned int x = 0; x < cam.width; x++) {
+        float4 px = row[x];
+        accum[(size_t)y * cam.width + x] =
+          make_float4(make_float3(px.x * norm, px.y * norm, px.z * norm), px.w * norm);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < nthreads; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+
+//
+// Render one subframe of the dome master image into accum (cam.width x
+// cam.height, row 0 at the bottom as in the OpenGL framebuffer), with the
+// camera specialization selected by cam.stereo_on and cam.dof_on.
+//
+static inline void dome_render_frame(const dome_camera &cam,
+                              const dome_ray_tracer &tracer,
+                              float4 *accum, unsigned int nthreads) {
+  if (nthreads < 1)
+    nthreads = 1;
+  if (cam.stereo_on) {
+    if (cam.dof_on)
+      dome_render_rows<1, 1>(cam, tracer, accum, nthreads);
+    else
+      dome_render_rows<1, 0>(cam, tracer, accum, nthreads);
+  } else {
+    if (cam.dof_on)
+      dome_render_rows<0, 1>(cam, tracer, accum, nthreads);
+    else
+      dome_render_rows<0, 0>(cam, tracer, accum, nthreads);
+  }
+}
+
+} // namespace dome_cpu
+
+#endif // DOME_MASTER_CPU_H
@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2019 NVIDIA Corporation.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property and proprietary
+ * rights in and to this software, related documentation and any modifications thereto.
+ * Any use, reproduction, disclosure or distribution of this software and related
+ * documentation without an express license agreement from NVIDIA Corporation is strictly
+ * prohibited.
+ *
+ * TO THE MAXIMUM EXTENT PERMITTED BY APPLICABLE LAW, THIS SOFTWARE IS PROVIDED *AS IS*
+ * AND NVIDIA AND ITS SUPPLIERS DISCLAIM ALL WARRANTIES, EITHER EXPRESS OR IMPLIED,
+ * INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE.  IN NO EVENT SHALL NVIDIA OR ITS SUPPLIERS BE LIABLE FOR ANY
+ * SPECIAL, INCIDENTAL, INDIRECT, OR CONSEQUENTIAL DAMAGES WHATSOEVER (INCLUDING, WITHOUT
+ * LIMITATION, DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+ * BUSINESS INFORMATION, OR ANY OTHER PECUNIARY LOSS) ARISING OUT OF THE USE OF OR
+ * INABILITY TO USE THIS SOFTWARE, EVEN IF NVIDIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGES
+ */
+
+// A CPU bounding volume hierarchy over bilinear patches.
+// It plays the role of the OptiX acceleration structure for rqx.cu:
+// leaves run intersectPatchWorldCoordinates or, after moving the patches
+// into the ray's frame, intersectPatchRayCentricCoordinates from patch.h,
+// both as 4-wide versions over a PatchBlock.
+// Patches are passed in the 4 corners + qn layout of cpu_test (5 float3 per
+// patch) and stored as PatchData blocks, one block per leaf, so that a leaf
+// is tested with a single intersectPatchBlock call. Splits are rounded to
+// whole blocks, so all leaves but one fill their block.
+// Ray directions must be normalized (the ray-centric t is a distance).
+// Patches whose padded box is not finite (corners that are inf or NaN, or so
+// large that the box overflows) are left out of the hierarchy.
+
+#pragma once
+
+#include "patch_data.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+struct PatchHit {
+	float t, u, v;
+	int id;         // index of the patch in the input array, -1 if none
+};
+
+enum PatchIntersector {
+	WORLD_COORDINATES,
+	RAY_CENTRIC_COORDINATES
+};
+
+// Traversal stack entries. Below PATCH_BVH_MAX_SAH_DEPTH the build switches to
+// median splits, which halve the patches at every level, so that no leaf of a
+// tree over up to 2^31 patches is deeper than 32 + 30 levels.
+const int PATCH_BVH_STACK_SIZE = 64;
+const int PATCH_BVH_MAX_SAH_DEPTH = 32;
+
+struct BVHNode {
+	float3 lo, hi;  // bounds
+	int start;      // first child for inner nodes, first PatchData slot for leaves
+	int count;      // 0 for inner nodes, number of patches for leaves
+};
+
+// Optional counters filled in by PatchBVH::intersect.
+struct TraversalStats {
+	long long nodes;    // visited nodes
+	long long leaves;   // visited leaves (PatchBlock loads)
+	long long tests;    // ray/patch tests, not counting unused lanes
+	TraversalStats() : nodes(0), leaves(0), tests(0) {}
+};
+
+class PatchBVH {
+public:
+	// q holds 5*num_patches float3 (4 corners + qn per patch), vn optionally
+	// 4*num_patches vertex normals.
+	PatchBVH(const float3* q, int num_patches, const float3* vn = 0);
+
+	// Closest hit in (ray.tmin, ray.tmax); returns false if there is none.
+	bool intersect(const Ray& ray, PatchHit& hit, PatchIntersector mode = WORLD_COORDINATES,
+	               TraversalStats* stats = 0) const;
+
+	// Any hit in (ray.tmin, ray.tmax), for shadow and ambient occlusion rays.
+	bool occluded(const Ray& ray, PatchIntersector mode = WORLD_COORDINATES, TraversalStats* stats = 0) const;
+
+	int numNodes()   const { return int(nodes.size()); }
+	int numPatches() const { return num_patches; } // patches in the hierarchy
+	int depth()      const { return max_depth; }
+	const BVHNode& root() const { return nodes[0]; }
+	const PatchData& patchData() const { return patches; }
+
+private:
+	struct BuildPrim {
+		float3 lo, hi, center;
+		int id;
+	};
+	void build(int node, std::vector<BuildPrim>& prims, int begin, int end, int depth);
+
+	std::vector<BVHNode> nodes;
+	PatchData patches;
+	int num_patches;
+	int max_depth;
+};
+
+// A bilinear patch is a convex combination of its corners, so the box of the
+// 4 corners bounds it even when the quad is not planar. The box is padded by
+// a few ulps so that rounding in the intersector cannot step outside of it.
+inline void patchBounds(const float3* q, float3& lo, float3& hi) {
+	lo = fminf(fminf(q[0], q[1]), fminf(q[2], q[3]));
+	hi = fmaxf(fmaxf(q[0], q[1]), fmaxf(q[2], q[3]));
+	float3 pad = 1e-6f*(fmaxf(hi, -lo) + make_float3(1e-30f));
+	lo -= pad;
+	hi += pad;
+}
+
+inline float area(const float3& lo, const float3& hi) {
+	float3 d = hi - lo;
+	return d.x*d.y + d.y*d.z + d.z*d.x;
+}
+
+// Patches are tested a block at a time, so the SAH counts blocks, not patches.
+inline int blocks(int n) {
+	return (n + PATCH_BLOCK_SIZE - 1)/PATCH_BLOCK_SIZE;
+}
+
+// The multiple of PATCH_BLOCK_SIZE patches closest to mid - begin, but at
+// least one block, for the left child of a node with more than one block.
+inline int roundSplit(int begin, int mid, int end) {
+	int left = (mid - begin + PATCH_BLOCK_SIZE/2)/PATCH_BLOCK_SIZE;
+	left = std::max(1, std::min(left, (end - begin - 1)/PATCH_BLOCK_SIZE));
+	return begin + left*PATCH_BLOCK_SIZE;
+}
+
+inline float component(const float3& a, int axis) {
+	return axis == 0 ? a.x : axis == 1 ? a.y : a.z;
+}
+
+inline bool isFinite(const float3& a) {
+	return std::isfinite(a.x) && std::isfinite(a.y) && std::isfinite(a.z);
+}
+
+// SAH bin of a center at c, for bins of 1/scale starting at cmin. Clamped to
+// the bins, since rounding can put the largest center past the last one.
+inline int binIndex(float c, float cmin, float scale, int num_bins) {
+	float f = (c - cmin)*scale;
+	if (!(f > 0)) return 0;
+	return f < float(num_bins) ? std::min(num_bins - 1, int(f)) : num_bins - 1;
+}
+
+inline PatchBVH::PatchBVH(const float3* input, int num_input, const float3* vn) : max_depth(0) {
+	std::vector<BuildPrim> prims;
+	prims.reserve(num_input);
+	for (int i = 0; i < num_input; i++) {
+		BuildPrim prim;
+		patchBounds(input + 5*i, prim.lo, prim.hi);
+		if (!isFinite(prim.lo) || !isFinite(prim.hi))
+			continue;
+		prim.center = 0.5f*prim.lo + 0.5f*prim.hi; // lo + hi can overflow
+		prim.id = i;
+		prims.push_back(prim);
+	}
+	num_patches = int(prims.size());
+	nodes.reserve(num_patches + 1);
+	nodes.push_back(BVHNode());
+	build(0, prims, 0, num_patches, 0);
+	assert(max_depth < PATCH_BVH_STACK_SIZE);
+
+	// every leaf gets a block of its own
+	int num_leaves = 0;
+	for (size_t i = 0; i < nodes.size(); i++)
+		num_leaves += nodes[i].count != 0;
+	patches.resize(num_leaves);
+	int block = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		BVHNode& node = nodes[i];
+		if (!node.count) continue;
+		for (int k = 0; k < node.count; k++) {
+			int id = prims[node.start + k].id;
+			patches.set(block*PATCH_BLOCK_SIZE + k, input + 5*id, id);
+			if (vn) patches.setVertexNormals(block*PATCH_BLOCK_SIZE + k, vn + 4*id);
+		}
+		node.start = block++*PATCH_BLOCK_SIZE;
+	}
+}
+
+// Binned SAH split over patch box centers (Wald, "On fast Construction of
+// SAH-based Bounding Volume Hierarchies", 2007).
+// Axes whose center extent is 0 or not finite are not binned; if no axis is
+// left, or the node is at PATCH_BVH_MAX_SAH_DEPTH, it is split at the median.
+inline void PatchBVH::build(int node, std::vector<BuildPrim>& prims, int begin, int end, int depth) {
+	const int num_bins = 16;
+	float3 lo = make_float3( std::numeric_limits<float>::max());
+	float3 hi = make_float3(-std::numeric_limits<float>::max());
+	float3 clo = lo, chi = hi;
+	for (int i = begin; i < end; i++) {
+		lo = fminf(lo, prims[i].lo);     hi = fmaxf(hi, prims[i].hi);
+		clo = fminf(clo, prims[i].center); chi = fmaxf(chi, prims[i].center);
+	}
+	nodes[node].lo = lo;
+	nodes[node].hi = hi;
+	nodes[node].start = begin;
+	nodes[node].count = end - begin;
+	max_depth = std::max(max_depth, depth);
+	if (end - begin <= PATCH_BLOCK_SIZE) return;
+
+	int best_axis = -1, best_split = 0;
+	float best_cost = blocks(end - begin)*area(lo, hi); // cost of a leaf, one unit per block test
+	for (int axis = 0; axis < 3 && depth < PATCH_BVH_MAX_SAH_DEPTH; axis++) {
+		float cmin = component(clo, axis), extent = component(chi, axis) - cmin;
+		if (!(extent > 0) || !std::isfinite(extent)) continue;
+		const float scale = num_bins/extent;
+		float3 blo[num_bins], bhi[num_bins];
+		int count[num_bins] = { 0 };
+		for (int b = 0; b < num_bins; b++) {
+			blo[b] = make_float3( std::numeric_limits<float>::max());
+			bhi[b] = make_float3(-std::numeric_limits<float>::max());
+		}
+		for (int i = begin; i < end; i++) {
+			int b = binIndex(component(prims[i].center, axis), cmin, scale, num_bins);
+			count[b]++;
+			blo[b] = fminf(blo[b], prims[i].lo);
+			bhi[b] = fmaxf(bhi[b], prims[i].hi);
+		}
+		// sweep from the right to get the cost of every right side
+		float right_area[num_bins];
+		int right_count[num_bins];
+		float3 rlo = blo[num_bins - 1], rhi = bhi[num_bins - 1];
+		int rc = 0;
+		for (int b = num_bins - 1; b > 0; b--) {
+			rlo = fminf(rlo, blo[b]); rhi = fmaxf(rhi, bhi[b]);
+			rc += count[b];
+			right_area[b] = rc ? area(rlo, rhi) : 0;
+			right_count[b] = rc;
+		}
+		float3 llo = blo[0], lhi = bhi[0];
+		int lc = 0;
+		for (int b = 1; b < num_bins; b++) {
+			llo = fminf(llo, blo[b - 1]); lhi = fmaxf(lhi, bhi[b - 1]);
+			lc += count[b - 1];
+			if (lc == 0 || right_count[b] == 0) continue;
+			float cost = area(lo, hi) + blocks(lc)*area(llo, lhi) + blocks(right_count[b])*right_area[b];
+			if (cost < best_cost) {
+				best_cost = cost; best_axis = axis; best_split = b;
+			}
+		}
+	}
+
+	// The left child always gets a whole number of blocks: then every leaf
+	// is a full block, except for the last leaf of the tree.
+	int mid, axis = best_axis;
+	auto closer = [&](const BuildPrim& a, const BuildPrim& b) {
+		return component(a.center, axis) < component(b.center, axis);
+	};
+	if (best_axis >= 0) {
+		float cmin = component(clo, best_axis), scale = num_bins/(component(chi, best_axis) - cmin);
+		BuildPrim* m = std::partition(&prims[begin], &prims[0] + end, [&](const BuildPrim& p) {
+			return binIndex(component(p.center, best_axis), cmin, scale, num_bins) < best_split;
+		});
+		mid = int(m - &prims[0]);
+		int full = roundSplit(begin, mid, end);
+		// move the patches next to the split plane to the other side
+		if (full < mid) std::nth_element(&prims[begin], &prims[full], &prims[0] + mid, closer);
+		if (full > mid) std::nth_element(&prims[mid], &prims[full], &prims[0] + end, closer);
+		mid = full;
+	} else {
+		// SAH prefers a leaf (or was not tried), but leaves are capped: split in the middle
+		float3 d = chi - clo;
+		axis = 0;
+		if (d.y > d.x) axis = 1;
+		if (d.z > component(d, axis)) axis = 2;
+		mid = roundSplit(begin, (begin + end)/2, end);
+		std::nth_element(&prims[begin], &prims[mid], &prims[0] + end, closer);
+	}
+
+	int left = int(nodes.size());
+	nodes[node].start = left;
+	nodes[node].count = 0;
+	nodes.push_back(BVHNode());
+	nodes.push_back(BVHNode());
+	build(left,     prims, begin, mid, depth + 1);
+	build(left + 1, prims, mid,   end, depth + 1);
+}
+
+// Slab test, returns the entry distance or +inf on a miss.
+inline float intersectBox(const BVHNode& node, const float3& org, const float3& inv_dir, float tmin, float tmax) {
+	float3 t0 = (node.lo - org)*inv_dir;
+	float3 t1 = (node.hi - org)*inv_dir;
+	float3 tn = fminf(t0, t1), tf = fmaxf(t0, t1);
+	float enter = std::max(std::max(tn.x, tn.y), std::max(tn.z, tmin));
+	float exit  = std::min(std::min(tf.x, tf.y), std::min(tf.z, tmax));
+	return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+}
+
+inline bool PatchBVH::intersect(const Ray& ray, PatchHit& hit, PatchIntersector mode, TraversalStats* stats) const {
+	hit.t = ray.tmax;
+	hit.id = -1;
+	float3 inv_dir = make_float3(1.0f/ray.direction.x, 1.0f/ray.direction.y, 1.0f/ray.direction.z);
+	const RayCentricFrame<vfloat4> frame(ray); // for RAY_CENTRIC_COORDINATES, only depends on the ray
+
+	int stack[PATCH_BVH_STACK_SIZE], top = 0;
+	if (!num_patches || intersectBox(nodes[0], ray.origin, inv_dir, ray.tmin, hit.t) == std::numeric_limits<float>::infinity())
+		return false;
+	stack[top++] = 0;
+	while (top) {
+		const BVHNode& node = nodes[stack[--top]];
+		if (stats) stats->nodes++;
+		if (node.count) {
+			const PatchBlock& block = patches.block(node.start/PATCH_BLOCK_SIZE);
+			if (stats) {
+				stats->leaves++;
+				stats->tests += node.count;
+			}
+			vfloat4 t, u, v;
+			vfloat4::mask found = mode == WORLD_COORDINATES ? intersectPatchBlock(block, ray, t, u, v)
+			                                                : intersectPatchBlockRayCentric(block, frame, t, u, v);
+			if (!any(found)) continue;
+			alignas(16) float tt[4], uu[4], vv[4];
+			t.store(tt); u.store(uu); v.store(vv);
+			for (int k = 0; k < node.count; k++)
+				if (ray.tmin < tt[k] && tt[k] < hit.t) {
+					hit.t = tt[k]; hit.u = uu[k]; hit.v = vv[k]; hit.id = block.id[k];
+				}
+			continue;
+		}
+		const BVHNode& a = nodes[node.start];
+		const BVHNode& b = nodes[node.start + 1];
+		float ta = intersectBox(a, ray.origin, inv_dir, ray.tmin, hit.t);
+		float tb = intersectBox(b, ray.origin, inv_dir, ray.tmin, hit.t);
+		// push the far child first, so that the near one is visited next
+		if (ta <= tb) {
+			if (tb != std::numeric_limits<float>::infinity()) stack[top++] = node.start + 1;
+			if (ta != std::numeric_limits<float>::infinity()) stack[top++] = node.start;
+		} else {
+			if (ta != std::numeric_limits<float>::infinity()) stack[top++] = node.start;
+			stack[top++] = node.start + 1;
+		}
+	}
+	return hit.id >= 0;
+}
+
+// Slab test for occlusion rays, which only need to know if the box is hit.
+inline bool overlapsBox(const BVHNode& node, const float3& org, const float3& inv_dir, float tmin, float tmax) {
+	float3 t0 = (node.lo - org)*inv_dir;
+	float3 t1 = (node.hi - org)*inv_dir;
+	float3 tn = fminf(t0, t1), tf = fmaxf(t0, t1);
+	return std::max(std::max(tn.x, tn.y), std::max(tn.z, tmin)) <= std::min(std::min(tf.x, tf.y), std::min(tf.z, tmax));
+}
+
+// No closest hit to keep: the first block with a hit in (tmin, tmax) ends the
+// traversal, and the interval never shrinks. So the children are not sorted
+// by distance either; both are pushed if their box is hit, the first one last.
+inline bool PatchBVH::occluded(const Ray& ray, PatchIntersector mode, TraversalStats* stats) const {
+	float3 inv_dir = make_float3(1.0f/ray.direction.x, 1.0f/ray.direction.y, 1.0f/ray.direction.z);
+	const RayCentricFrame<vfloat4> frame(ray);
+
+	int stack[PATCH_BVH_STACK_SIZE], top = 0;
+	if (!num_patches || !overlapsBox(nodes[0], ray.origin, inv_dir, ray.tmin, ray.tmax))
+		return false;
+	stack[top++] = 0;
+	while (top) {
+		const BVHNode& node = nodes[stack[--top]];
+		if (stats) stats->nodes++;
+		if (node.count) {
+			const PatchBlock& block = patches.block(node.start/PATCH_BLOCK_SIZE);
+			if (stats) {
+				stats->leaves++;
+				stats->tests += node.count;
+			}
+			if (mode == WORLD_COORDINATES ? occludedPatchBlock(block, ray, ray.tmin, ray.tmax)
+			                              : occludedPatchBlockRayCentric(block, frame, ray.tmin, ray.tmax))
+				return true;
+			continue;
+		}
+		if (overlapsBox(nodes[node.start + 1], ray.origin, inv_dir, ray.tmin, ray.tmax)) stack[top++] = node.start + 1;
+		if (overlapsBox(nodes[node.start],     ray.origin, inv_dir, ray.tmin, ray.tmax)) stack[top++] = node.start;
+	}
+	return false;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2019 NVIDIA Corporation.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property and proprietary
+ * rights in and to this software, related documentation and any modifications thereto.
+ * Any use, reproduction, disclosure or distribution of this software and related
+ * documentation without an express license agreement from NVIDIA Corporation is strictly
+ * prohibited.
+ *
+ * TO THE MAXIMUM EXTENT PERMITTED BY APPLICABLE LAW, THIS SOFTWARE IS PROVIDED *AS IS*
+ * AND NVIDIA AND ITS SUPPLIERS DISCLAIM ALL WARRANTIES, EITHER EXPRESS OR IMPLIED,
+ * INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE.  IN NO EVENT SHALL NVIDIA OR ITS SUPPLIERS BE LIABLE FOR ANY
+ * SPECIAL, INCIDENTAL, INDIRECT, OR CONSEQUENTIAL DAMAGES WHATSOEVER (INCLUDING, WITHOUT
+ * LIMITATION, DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+ * BUSINESS INFORMATION, OR ANY OTHER PECUNIARY LOSS) ARISING OUT OF THE USE OF OR
+ * INABILITY TO USE THIS SOFTWARE, EVEN IF NVIDIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGES
+ */
+
+// Precomputed patch records for the intersectors.
+// Instead of the 4 corners + qn of cpu_test (from which e00 and e11 are
+// recomputed on every test), a patch is stored as exactly what the world
+// coordinate intersector reads: q00, q10, e00 = q01 - q00, e11 = q11 - q10
+// and qn = cross(q10 - q00, q01 - q11). Patches are grouped into blocks of
+// PATCH_BLOCK_SIZE in structure-of-arrays order, so that one SSE load fetches
+// a component of 4 patches, and a block is exactly 4 cache lines. A test of
+// a full block reads the same 60 bytes per patch as the q[5] of cpu_test (the
+// ids are only read for hits), but from fewer cache lines; PatchBVH rounds
+// its splits so that all of its leaves but one are full.
+// Vertex normals (for SHADING_NORMALS) live in a separate array, so they are
+// only touched for the reported hit and not on every test.
+//
+// The block part of this file is plain data and can be used from CUDA (rqx.cu).
+
+#pragma once
+
+#if !defined(__CUDACC__)
+#include "patch_simd.h"
+
+#include <vector>
+#endif
+
+#define PATCH_BLOCK_SIZE 4
+
+#if defined(__CUDACC__)
+#define PATCH_HOSTDEVICE __host__ __device__
+#else
+#define PATCH_HOSTDEVICE
+#endif
+
+// What the intersector needs for one patch.
+struct PatchCoefficients {
+	float3 q00, q10, e00, e11, qn;
+};
+
+struct alignas(64) PatchBlock {
+	float q00[3][PATCH_BLOCK_SIZE];
+	float q10[3][PATCH_BLOCK_SIZE];
+	float e00[3][PATCH_BLOCK_SIZE];
+	float e11[3][PATCH_BLOCK_SIZE];
+	float qn [3][PATCH_BLOCK_SIZE];
+	int   id [PATCH_BLOCK_SIZE];    // input index of the patch, -1 for unused lanes
+
+	PATCH_HOSTDEVICE PatchCoefficients coefficients(int i) const {
+		PatchCoefficients c;
+		c.q00 = make_float3(q00[0][i], q00[1][i], q00[2][i]);
+		c.q10 = make_float3(q10[0][i], q10[1][i], q10[2][i]);
+		c.e00 = make_float3(e00[0][i], e00[1][i], e00[2][i]);
+		c.e11 = make_float3(e11[0][i], e11[1][i], e11[2][i]);
+		c.qn  = make_float3(qn [0][i], qn [1][i], qn [2][i]);
+		return c;
+	}
+};
+
+#if !defined(__CUDACC__)
+
+// Host side storage: blocks of patches plus the optional vertex normals.
+// Patch i is lane i % PATCH_BLOCK_SIZE of block i / PATCH_BLOCK_SIZE.
+class PatchData {
+public:
+	// Allocates num_blocks blocks; all lanes start as unused, degenerate patches.
+	void resize(int num_blocks) {
+		PatchBlock empty = {};
+		for (int i = 0; i < PATCH_BLOCK_SIZE; i++) empty.id[i] = -1;
+		blocks.assign(num_blocks, empty);
+	}
+
+	// Stores patch q (4 corners + qn, as in patch.h) in slot i.
+	void set(int i, const float3* q, int id) {
+		PatchBlock& b = blocks[i/PATCH_BLOCK_SIZE];
+		int lane = i%PATCH_BLOCK_SIZE;
+		float3 e00 = q[3] - q[0], e11 = q[2] - q[1];
+		const float3* src[5] = { &q[0], &q[1], &e00, &e11, &q[4] };
+		float (*dst[5])[PATCH_BLOCK_SIZE] = { b.q00, b.q10, b.e00, b.e11, b.qn };
+		for (int k = 0; k < 5; k++) {
+			dst[k][0][lane] = src[k]->x;
+			dst[k][1][lane] = src[k]->y;
+			dst[k][2][lane] = src[k]->z;
+		}
+		b.id[lane] = id;
+	}
+
+	// 4 vertex normals per slot, in the corner order of q.
+	void setVertexNormals(int i, const float3* vn) {
+		if (vertex_normals.size() < 4*blocks.size()*PATCH_BLOCK_SIZE)
+			vertex_normals.resize(4*blocks.size()*PATCH_BLOCK_SIZE);
+		for (int k = 0; k < 4; k++) vertex_normals[4*i + k] = vn[k];
+	}
+
+	PatchCoefficients coefficients(int i) const { return blocks[i/PATCH_BLOCK_SIZE].coefficients(i%PATCH_BLOCK_SIZE); }
+	const PatchBlock& block(int b) const { return blocks[b]; }
+	int id(int i) const { return blocks[i/PATCH_BLOCK_SIZE].id[i%PATCH_BLOCK_SIZE]; }
+	const float3* vertexNormals(int i) const { return vertex_normals.empty() ? 0 : &vertex_normals[4*i]; }
+	int numBlocks() const { return int(blocks.size()); }
+
+private:
+	std::vector<PatchBlock, aligned_allocator<PatchBlock> > blocks;
+	std::vector<float3> vertex_normals;
+};
+
+// intersectPatchWorldCoordinates for the 4 patches of a block.
+inline vfloat4::mask intersectPatchBlock(const PatchBlock& b, const Ray& ray, vfloat4& t, vfloat4& u, vfloat4& v) {
+	return intersectPatchLanes(load3<vfloat4>(b.q00[0]), load3<vfloat4>(b.q10[0]), load3<vfloat4>(b.e00[0]),
+	                           load3<vfloat4>(b.e11[0]), load3<vfloat4>(b.qn[0]),
+	                           vec3<vfloat4>(ray.origin), vec3<vfloat4>(ray.direction), t, u, v);
+}
+
+// The corners of the 4 patches of a block in the ray's frame. q01 and q11 are
+// rebuilt in world space and then transformed like q00 and q10: adding the
+// rotated edges to the transformed q00 and q10 instead would save two
+// subtractions, but loses the cancellation of the origin and is off from the
+// scalar transform() by up to ~10^6 ulps in u and v.
+inline void blockCorners(const PatchBlock& b, const RayCentricFrame<vfloat4>& frame,
+                         vec3<vfloat4>& q00, vec3<vfloat4>& q10, vec3<vfloat4>& q01, vec3<vfloat4>& q11) {
+	vec3<vfloat4> w00 = load3<vfloat4>(b.q00[0]), w10 = load3<vfloat4>(b.q10[0]);
+	q00 = frame.transform(w00);
+	q10 = frame.transform(w10);
+	q01 = frame.transform(w00 + load3<vfloat4>(b.e00[0]));
+	q11 = frame.transform(w10 + load3<vfloat4>(b.e11[0]));
+}
+
+// intersectPatchRayCentricCoordinates for the 4 patches of a block. The frame
+// is built once per ray; the block's corners are moved into it in one pass
+// and solved together.
+inline vfloat4::mask intersectPatchBlockRayCentric(const PatchBlock& b, const RayCentricFrame<vfloat4>& frame,
+                                                   vfloat4& t, vfloat4& u, vfloat4& v) {
+	vec3<vfloat4> q00, q10, q01, q11;
+	blockCorners(b, frame, q00, q10, q01, q11);
+	return intersectPatchRayCentricLanes(q00, q10, q11, q01, t, u, v);
+}
+
+// Any-hit versions of the two functions above: does any patch of the block
+// have a hit with tmin < t < tmax?
+inline bool occludedPatchBlock(const PatchBlock& b, const Ray& ray, float tmin, float tmax) {
+	return any(occludedPatchLanes(load3<vfloat4>(b.q00[0]), load3<vfloat4>(b.q10[0]), load3<vfloat4>(b.e00[0]),
+	                              load3<vfloat4>(b.e11[0]), load3<vfloat4>(b.qn[0]),
+	                              vec3<vfloat4>(ray.origin), vec3<vfloat4>(ray.direction), vfloat4(tmin), vfloat4(tmax)));
+}
+
+inline bool occludedPatchBlockRayCentric(const PatchBlock& b, const RayCentricFrame<vfloat4>& frame, float tmin, float tmax) {
+	vec3<vfloat4> q00, q10, q01, q11;
+	blockCorners(b, frame, q00, q10, q01, q11);
+	return any(occludedPatchRayCentricLanes(q00, q10, q11, q01, vfloat4(tmin), vfloat4(tmax)));
+}
+
+#endif
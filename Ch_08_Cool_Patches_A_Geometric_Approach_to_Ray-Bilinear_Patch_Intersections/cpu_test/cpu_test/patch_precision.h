@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2019 NVIDIA Corporation.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property and proprietary
+ * rights in and to this software, related documentation and any modifications thereto.
+ * Any use, reproduction, disclosure or distribution of this software and related
+ * documentation without an express license agreement from NVIDIA Corporation is strictly
+ * prohibited.
+ *
+ * TO THE MAXIMUM EXTENT PERMITTED BY APPLICABLE LAW, THIS SOFTWARE IS PROVIDED *AS IS*
+ * AND NVIDIA AND ITS SUPPLIERS DISCLAIM ALL WARRANTIES, EITHER EXPRESS OR IMPLIED,
+ * INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE.  IN NO EVENT SHALL NVIDIA OR ITS SUPPLIERS BE LIABLE FOR ANY
+ * SPECIAL, INCIDENTAL, INDIRECT, OR CONSEQUENTIAL DAMAGES WHATSOEVER (INCLUDING, WITHOUT
+ * LIMITATION, DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+ * BUSINESS INFORMATION, OR ANY OTHER PECUNIARY LOSS) ARISING OUT OF THE USE OF OR
+ * INABILITY TO USE THIS SOFTWARE, EVEN IF NVIDIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGES
+ */
+
+// intersectPatchWorldCoordinates templated on the scalar type.
+//   intersectPatchWorldCoordinates<float>          is the code of patch.h, bit for bit;
+//   intersectPatchWorldCoordinates<double>         does everything in double;
+//   intersectPatchWorldCoordinates<float, double>  (mixed) computes only the
+//       discriminant of a + b u + c u^2 and its roots (the "stable" root and
+//       Viete's formula) in double, where the cancellation in b*b - 4*a*c and
+//       -b - copysign(det, b) happens, and the rest in float.
+// Patches and rays stay float; in double, qn is recomputed from the corners
+// instead of using the rounded q[4].
+
+#pragma once
+
+#include "patch_simd.h"
+
+#include <cmath>
+#include <limits>
+
+template <typename Real, typename Quadratic = Real>
+inline void intersectPatchWorldCoordinates(const float3* q, const Ray& ray, Real& t, Real& u, Real& v) {
+	typedef vec3<Real> real3;
+	t = std::numeric_limits<Real>::infinity();
+	real3 q00 = q[0], q10 = q[1], q11 = q[2], q01 = q[3];
+	real3 e11 = q11 - q10;
+	real3 e00 = q01 - q00;
+	real3 qn  = sizeof(Real) > sizeof(float) ? cross(q10 - q00, q01 - q11) : real3(q[4]);
+	real3 dir = ray.direction;
+	q00 = q00 - real3(ray.origin);
+	q10 = q10 - real3(ray.origin);
+	Real a = dot(cross(q00, dir), e00);
+	Real c = dot(qn, dir);
+	Real b = dot(cross(q10, dir), e11);
+	b -= a + c;
+	Quadratic det = Quadratic(b)*b - 4*Quadratic(a)*c;
+	if (det < 0) return;
+	det = std::sqrt(det);
+	Quadratic r1, r2;
+	if (c == 0) {
+		r1 = -Quadratic(a)/b; r2 = -1;
+	} else {
+		r1  = (-Quadratic(b) - std::copysign(det, Quadratic(b)))/2;
+		r2  = a/r1;
+		r1 /= c;
+	}
+	Real u1 = Real(r1), u2 = Real(r2);
+	if (0 <= u1 && u1 <= 1) {
+		real3 pa = lerp(q00, q10, u1);
+		real3 pb = lerp(e00, e11, u1);
+		real3 n  = cross(dir, pb);
+		Real d = dot(n, n);
+		n = cross(n, pa);
+		Real t1 = dot(n, pb);
+		Real v1 = dot(n, dir);
+		if (t1 > 0 && 0 <= v1 && v1 <= d) {
+			t = t1/d; u = u1; v = v1/d;
+		}
+	}
+	if (0 <= u2 && u2 <= 1) {
+		real3 pa = lerp(q00, q10, u2);
+		real3 pb = lerp(e00, e11, u2);
+		real3 n  = cross(dir, pb);
+		Real d = dot(n, n);
+		n = cross(n, pa);
+		Real t2 = dot(n, pb)/d;
+		Real v2 = dot(n, dir);
+		if (0 <= v2 && v2 <= d && t > t2 && t2 > 0) {
+			t = t2; u = u2; v = v2/d;
+		}
+	}
+}
@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2019 NVIDIA Corporation.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property and proprietary
+ * rights in and to this software, related documentation and any modifications thereto.
+ * Any use, reproduction, disclosure or distribution of this software and related
+ * documentation without an express license agreement from NVIDIA Corporation is strictly
+ * prohibited.
+ *
+ * TO THE MAXIMUM EXTENT PERMITTED BY APPLICABLE LAW, THIS SOFTWARE IS PROVIDED *AS IS*
+ * AND NVIDIA AND ITS SUPPLIERS DISCLAIM ALL WARRANTIES, EITHER EXPRESS OR IMPLIED,
+ * INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE.  IN NO EVENT SHALL NVIDIA OR ITS SUPPLIERS BE LIABLE FOR ANY
+ * SPECIAL, INCIDENTAL, INDIRECT, OR CONSEQUENTIAL DAMAGES WHATSOEVER (INCLUDING, WITHOUT
+ * LIMITATION, DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+ * BUSINESS INFORMATION, OR ANY OTHER PECUNIARY LOSS) ARISING OUT OF THE USE OF OR
+ * INABILITY TO USE THIS SOFTWARE, EVEN IF NVIDIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGES
+ */
+
+// Packet versions of intersectPatchWorldCoordinates from patch.h.
+// The same code runs either a packet of rays against one patch or one ray
+// against a packet of patches; the width is picked by the vector type:
+//   vfloat4  - SSE (always available on x64),
+//   vfloat8  - AVX2 (compile with /arch:AVX2 or -mavx2 -mfma),
+//   vfloat16 - AVX-512 (compile with /arch:AVX512 or -mavx512f).
+// All lanes execute the same operations in the same order as the scalar
+// code, so t/u/v agree with it bit for bit as long as the compiler does not
+// contract the scalar code into fused multiply-adds: with FMA enabled, also
+// pass -ffp-contract=off (GCC, Clang) or /fp:strict (MSVC).
+
+#pragma once
+
+#include "patch.h"
+
+#include <immintrin.h>
+
+// SSE, 4 lanes
+struct vbool4 {
+	__m128 m;
+	vbool4(__m128 m) : m(m) {}
+};
+inline vbool4 operator&(vbool4 a, vbool4 b) { return _mm_and_ps(a.m, b.m); }
+inline vbool4 operator|(vbool4 a, vbool4 b) { return _mm_or_ps(a.m, b.m); }
+inline vbool4 andnot(vbool4 a, vbool4 b) { return _mm_andnot_ps(b.m, a.m); } // a & !b
+inline bool any(vbool4 a) { return _mm_movemask_ps(a.m) != 0; }
+inline int  movemask(vbool4 a) { return _mm_movemask_ps(a.m); }
+
+struct vfloat4 {
+	enum { size = 4 };
+	typedef vbool4 mask;
+	__m128 m;
+	vfloat4() {}
+	vfloat4(__m128 m) : m(m) {}
+	vfloat4(float s) : m(_mm_set1_ps(s)) {}
+	static vfloat4 load(const float* p) { return _mm_load_ps(p); }
+	void store(float* p) const { _mm_store_ps(p, m); }
+};
+inline vfloat4 operator+(vfloat4 a, vfloat4 b) { return _mm_add_ps(a.m, b.m); }
+inline vfloat4 operator-(vfloat4 a, vfloat4 b) { return _mm_sub_ps(a.m, b.m); }
+inline vfloat4 operator*(vfloat4 a, vfloat4 b) { return _mm_mul_ps(a.m, b.m); }
+inline vfloat4 operator/(vfloat4 a, vfloat4 b) { return _mm_div_ps(a.m, b.m); }
+inline vfloat4 operator-(vfloat4 a) { return _mm_xor_ps(a.m, _mm_set1_ps(-0.0f)); }
+inline vbool4 operator< (vfloat4 a, vfloat4 b) { return _mm_cmplt_ps(a.m, b.m); }
+inline vbool4 operator<=(vfloat4 a, vfloat4 b) { return _mm_cmple_ps(a.m, b.m); }
+inline vbool4 operator> (vfloat4 a, vfloat4 b) { return _mm_cmpgt_ps(a.m, b.m); }
+inline vbool4 operator==(vfloat4 a, vfloat4 b) { return _mm_cmpeq_ps(a.m, b.m); }
+inline vfloat4 sqrt(vfloat4 a) { return _mm_sqrt_ps(a.m); }
+inline vfloat4 copysign(vfloat4 a, vfloat4 b) {
+	const __m128 s = _mm_set1_ps(-0.0f);
+	return _mm_or_ps(_mm_andnot_ps(s, a.m), _mm_and_ps(s, b.m));
+}
+inline vfloat4 select(vbool4 c, vfloat4 a, vfloat4 b) {
+	return _mm_or_ps(_mm_and_ps(c.m, a.m), _mm_andnot_ps(c.m, b.m));
+}
+
+#if defined(__AVX2__)
+// AVX2, 8 lanes
+struct vbool8 {
+	__m256 m;
+	vbool8(__m256 m) : m(m) {}
+};
+inline vbool8 operator&(vbool8 a, vbool8 b) { return _mm256_and_ps(a.m, b.m); }
+inline vbool8 operator|(vbool8 a, vbool8 b) { return _mm256_or_ps(a.m, b.m); }
+inline vbool8 andnot(vbool8 a, vbool8 b) { return _mm256_andnot_ps(b.m, a.m); }
+inline bool any(vbool8 a) { return _mm256_movemask_ps(a.m) != 0; }
+inline int  movemask(vbool8 a) { return _mm256_movemask_ps(a.m); }
+
+struct vfloat8 {
+	enum { size = 8 };
+	typedef vbool8 mask;
+	__m256 m;
+	vfloat8() {}
+	vfloat8(__m256 m) : m(m) {}
+	vfloat8(float s) : m(_mm256_set1_ps(s)) {}
+	static vfloat8 load(const float* p) { return _mm256_load_ps(p); }
+	void store(float* p) const { _mm256_store_ps(p, m); }
+};
+inline vfloat8 operator+(vfloat8 a, vfloat8 b) { return _mm256_add_ps(a.m, b.m); }
+inline vfloat8 operator-(vfloat8 a, vfloat8 b) { return _mm256_sub_ps(a.m, b.m); }
+inline vfloat8 operator*(vfloat8 a, vfloat8 b) { return _mm256_mul_ps(a.m, b.m); }
+inline vfloat8 operator/(vfloat8 a, vfloat8 b) { return _mm256_div_ps(a.m, b.m); }
+inline vfloat8 operator-(vfloat8 a) { return _mm256_xor_ps(a.m, _mm256_set1_ps(-0.0f)); }
+inline vbool8 operator< (vfloat8 a, vfloat8 b) { return _mm256_cmp_ps(a.m, b.m, _CMP_LT_OQ); }
+inline vbool8 operator<=(vfloat8 a, vfloat8 b) { return _mm256_cmp_ps(a.m, b.m, _CMP_LE_OQ); }
+inline vbool8 operator> (vfloat8 a, vfloat8 b) { return _mm256_cmp_ps(a.m, b.m, _CMP_GT_OQ); }
+inline vbool8 operator==(vfloat8 a, vfloat8 b) { return _mm256_cmp_ps(a.m, b.m, _CMP_EQ_OQ); }
+inline vfloat8 sqrt(vfloat8 a) { return _mm256_sqrt_ps(a.m); }
+inline vfloat8 copysign(vfloat8 a, vfloat8 b) {
+	const __m256 s = _mm256_set1_ps(-0.0f);
+	return _mm256_or_ps(_mm256_andnot_ps(s, a.m), _mm256_and_ps(s, b.m));
+}
+inline vfloat8 select(vbool8 c, vfloat8 a, vfloat8 b) { return _mm256_blendv_ps(b.m, a.m, c.m); }
+#endif
+
+#if defined(__AVX512F__)
+// AVX-512, 16 lanes (comparisons produce k-masks)
+struct vbool16 {
+	__mmask16 m;
+	vbool16(__mmask16 m) : m(m) {}
+};
+inline vbool16 operator&(vbool16 a, vbool16 b) { return (__mmask16)(a.m & b.m); }
+inline vbool16 operator|(vbool16 a, vbool16 b) { return (__mmask16)(a.m | b.m); }
+inline vbool16 andnot(vbool16 a, vbool16 b) { return (__mmask16)(a.m & ~b.m); }
+inline bool any(vbool16 a) { return a.m != 0; }
+inline int  movemask(vbool16 a) { return a.m; }
+
+struct vfloat16 {
+	enum { size = 16 };
+	typedef vbool16 mask;
+	__m512 m;
+	vfloat16() {}
+	vfloat16(__m512 m) : m(m) {}
+	vfloat16(float s) : m(_mm512_set1_ps(s)) {}
+	static vfloat16 load(const float* p) { return _mm512_load_ps(p); }
+	void store(float* p) const { _mm512_store_ps(p, m); }
+};
+inline vfloat16 operator+(vfloat16 a, vfloat16 b) { return _mm512_add_ps(a.m, b.m); }
+inline vfloat16 operator-(vfloat16 a, vfloat16 b) { return _mm512_sub_ps(a.m, b.m); }
+inline vfloat16 operator*(vfloat16 a, vfloat16 b) { return _mm512_mul_ps(a.m, b.m); }
+inline vfloat16 operator/(vfloat16 a, vfloat16 b) { return _mm512_div_ps(a.m, b.m); }
+inline vfloat16 operator-(vfloat16 a) { return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a.m), _mm512_set1_epi32(0x80000000))); }
+inline vbool16 operator< (vfloat16 a, vfloat16 b) { return _mm512_cmp_ps_mask(a.m, b.m, _CMP_LT_OQ); }
+inline vbool16 operator<=(vfloat16 a, vfloat16 b) { return _mm512_cmp_ps_mask(a.m, b.m, _CMP_LE_OQ); }
+inline vbool16 operator> (vfloat16 a, vfloat16 b) { return _mm512_cmp_ps_mask(a.m, b.m, _CMP_GT_OQ); }
+inline vbool16 operator==(vfloat16 a, vfloat16 b) { return _mm512_cmp_ps_mask(a.m, b.m, _CMP_EQ_OQ); }
+inline vfloat16 sqrt(vfloat16 a) { return _mm512_sqrt_ps(a.m); }
+inline vfloat16 copysign(vfloat16 a, vfloat16 b) {
+	const __m512i s = _mm512_set1_epi32(0x80000000);
+	return _mm512_castsi512_ps(_mm512_or_si512(_mm512_andnot_si512(s, _mm512_castps_si512(a.m)),
+	                                           _mm512_and_si512(s, _mm512_castps_si512(b.m))));
+}
+inline vfloat16 select(vbool16 c, vfloat16 a, vfloat16 b) { return _mm512_mask_blend_ps(c.m, b.m, a.m); }
+#endif
+
+// std::allocator ignores alignas(64) before C++17, so containers of packets use this.
+template <typename T>
+struct aligned_allocator {
+	typedef T value_type;
+	aligned_allocator() {}
+	template <typename U> aligned_allocator(const aligned_allocator<U>&) {}
+	T* allocate(size_t n) { return static_cast<T*>(_mm_malloc(n*sizeof(T), 64)); }
+	void deallocate(T* p, size_t) { _mm_free(p); }
+	template <typename U> bool operator==(const aligned_allocator<U>&) const { return true; }
+	template <typename U> bool operator!=(const aligned_allocator<U>&) const { return false; }
+};
+
+// float3 with one component per lane
+template <typename V>
+struct vec3 {
+	V x, y, z;
+	vec3() {}
+	vec3(const V& x, const V& y, const V& z) : x(x), y(y), z(z) {}
+	vec3(const float3& a) : x(a.x), y(a.y), z(a.z) {} // broadcast
+};
+template <typename V> inline vec3<V> operator+(const vec3<V>& a, const vec3<V>& b) { return vec3<V>(a.x + b.x, a.y + b.y, a.z + b.z); }
+template <typename V> inline vec3<V> operator-(const vec3<V>& a, const vec3<V>& b) { return vec3<V>(a.x - b.x, a.y - b.y, a.z - b.z); }
+template <typename V> inline vec3<V> operator*(const V& s, const vec3<V>& a) { return vec3<V>(s * a.x, s * a.y, s * a.z); }
+template <typename V> inline V dot(const vec3<V>& a, const vec3<V>& b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+template <typename V> inline vec3<V> cross(const vec3<V>& a, const vec3<V>& b) {
+	return vec3<V>(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+}
+template <typename V> inline vec3<V> lerp(const vec3<V>& a, const vec3<V>& b, const V& t) { return a + t*(b - a); }
+
+// Loads lane i of every component from a float[3][V::size] SoA block.
+template <typename V>
+inline vec3<V> load3(const float* p) {
+	return vec3<V>(V::load(p), V::load(p + V::size), V::load(p + 2*V::size));
+}
+
+// SoA packet of rays, filled lane by lane with set().
+template <typename V>
+struct RayPacket {
+	alignas(64) float org[3][V::size];
+	alignas(64) float dir[3][V::size];
+	void set(int i, const Ray& ray) {
+		org[0][i] = ray.origin.x;    org[1][i] = ray.origin.y;    org[2][i] = ray.origin.z;
+		dir[0][i] = ray.direction.x; dir[1][i] = ray.direction.y; dir[2][i] = ray.direction.z;
+	}
+};
+
+// SoA packet of patches (4 corners + qn), filled lane by lane with set().
+// Unused lanes should be filled with a degenerate patch (all zeros never hits).
+template <typename V>
+struct PatchPacket {
+	alignas(64) float q[5][3][V::size];
+	void set(int i, const float3* p) {
+		for (int k = 0; k < 5; k++) {
+			q[k][0][i] = p[k].x; q[k][1][i] = p[k].y; q[k][2][i] = p[k].z;
+		}
+	}
+	void clear() {
+		for (int k = 0; k < 5; k++)
+			for (int j = 0; j < 3; j++)
+				for (int i = 0; i < V::size; i++)
+					q[k][j][i] = 0;
+	}
+};
+
+// The body of intersectPatchWorldCoordinates, one ray/patch pair per lane.
+// It takes the edges e00 = q01 - q00 and e11 = q11 - q10 instead of q01 and q11,
+// so that precomputed edges (see patch_data.h) can be passed in directly.
+// Lanes without a hit get t = inf and keep their previous u and v.
+template <typename V>
+inline typename V::mask intersectPatchLanes(vec3<V> q00, vec3<V> q10, const vec3<V>& e00, const vec3<V>& e11,
+                                            const vec3<V>& qn, const vec3<V>& org, const vec3<V>& dir,
+                                            V& t, V& u, V& v) {
+	const V zero(0.0f), one(1.0f), inf(std::numeric_limits<float>::infinity());
+	t = inf;
+	q00 = q00 - org;
+	q10 = q10 - org;
+	V a = dot(cross(q00, dir), e00);
+	V c = dot(qn, dir);
+	V b = dot(cross(q10, dir), e11);
+	b = b - (a + c);
+	V det = b*b - V(4.0f)*a*c;
+	typename V::mask active = zero <= det;
+	if (!any(active)) return active;
+	det = sqrt(det);
+	V r  = (-b - copysign(det, b))/V(2.0f); // c != 0 case, as in the scalar code
+	typename V::mask trapezoid = c == zero;
+	V u1 = select(trapezoid, -a/b, r/c);
+	V u2 = select(trapezoid, -one, a/r);
+
+	typename V::mask hit = (zero <= u1) & (u1 <= one) & active;
+	if (any(hit)) {
+		vec3<V> pa = lerp(q00, q10, u1);
+		vec3<V> pb = lerp(e00, e11, u1);
+		vec3<V> n  = cross(dir, pb);
+		V d = dot(n, n);
+		n = cross(n, pa);
+		V t1 = dot(n, pb);
+		V v1 = dot(n, dir);
+		hit = hit & (zero < t1) & (zero <= v1) & (v1 <= d);
+		t = select(hit, t1/d, t);
+		u = select(hit, u1, u);
+		v = select(hit, v1/d, v);
+	}
+	typename V::mask hit2 = (zero <= u2) & (u2 <= one) & active;
+	if (any(hit2)) {
+		vec3<V> pa = lerp(q00, q10, u2);
+		vec3<V> pb = lerp(e00, e11, u2);
+		vec3<V> n  = cross(dir, pb);
+		V d = dot(n, n);
+		n = cross(n, pa);
+		V t2 = dot(n, pb)/d;
+		V v2 = dot(n, dir);
+		hit2 = hit2 & (zero <= v2) & (v2 <= d) & (t2 < t) & (zero < t2);
+		t = select(hit2, t2, t);
+		u = select(hit2, u2, u);
+		v = select(hit2, v2/d, v);
+	}
+	return hit | hit2;
+}
+
+// Rotation into the ray's frame (donb), built once per ray and broadcast,
+// so that many patches can be moved into it with full-width operations.
+template <typename V>
+struct RayCentricFrame {
+	vec3<V> org, axis1, axis2, axis3;
+	RayCentricFrame(const Ray& ray) : org(ray.origin), axis3(ray.direction) {
+		float3 a1, a2;
+		donb(ray.direction, a1, a2);
+		axis1 = vec3<V>(a1);
+		axis2 = vec3<V>(a2);
+	}
+	vec3<V> rotate(const vec3<V>& p) const { return vec3<V>(dot(p, axis1), dot(p, axis2), dot(p, axis3)); }
+	vec3<V> transform(const vec3<V>& p) const { return rotate(p - org); }
+};
+
+// The body of intersectPatchRayCentricCoordinates, one patch per lane, with
+// the corners q0..q3 already in the ray's frame.
+template <typename V>
+inline typename V::mask intersectPatchRayCentricLanes(const vec3<V>& q0, const vec3<V>& q1, const vec3<V>& q2, const vec3<V>& q3,
+                                                      V& t, V& u, V& v) {
+	const V zero(0.0f), one(1.0f), inf(std::numeric_limits<float>::infinity());
+	t = inf;
+	V a = q0.y*q3.x - q0.x*q3.y;
+	V c = (q0.y - q1.y)*(q3.x - q2.x) + (q0.x - q1.x)*(q2.y - q3.y);
+	V b = q1.y*q2.x - q1.x*q2.y;
+	b = b - (a + c);
+	V det = b*b - V(4.0f)*a*c;
+	typename V::mask active = zero <= det;
+	if (!any(active)) return active;
+	det = sqrt(det);
+	V r  = (-b - copysign(det, b))/V(2.0f);
+	typename V::mask trapezoid = c == zero;
+	V u1 = select(trapezoid, -a/b, r/c);
+	V u2 = select(trapezoid, -one, a/r);
+
+	typename V::mask hit = (zero <= u1) & (u1 <= one) & active;
+	if (any(hit)) {
+		vec3<V> po = lerp(q0, q1, u1);
+		vec3<V> pd = po - lerp(q3, q2, u1);
+		V d  = pd.x*pd.x + pd.y*pd.y;
+		V v1 = pd.x*po.x + pd.y*po.y;
+		hit = hit & (zero <= v1) & (v1 <= d);
+		v1 = v1/d;
+		V t1 = po.z - v1*pd.z;
+		hit = hit & (zero < t1);
+		t = select(hit, t1, t);
+		u = select(hit, u1, u);
+		v = select(hit, v1, v);
+	}
+	typename V::mask hit2 = (zero <= u2) & (u2 <= one) & active;
+	if (any(hit2)) {
+		vec3<V> po = lerp(q0, q1, u2);
+		vec3<V> pd = po - lerp(q3, q2, u2);
+		V d  = pd.x*pd.x + pd.y*pd.y;
+		V v2 = pd.x*po.x + pd.y*po.y;
+		hit2 = hit2 & (zero <= v2) & (v2 <= d);
+		v2 = v2/d;
+		V t2 = po.z - v2*pd.z;
+		hit2 = hit2 & (t2 < t) & (zero < t2);
+		t = select(hit2, t2, t);
+		u = select(hit2, u2, u);
+		v = select(hit2, v2, v);
+	}
+	return hit | hit2;
+}
+
+// Any-hit versions of the two functions above, as occludedPatch*Coordinates
+// in patch.h: the lanes with a root in (tmin, tmax). The second root is only
+// computed for the lanes that did not hit with the first one, so that this
+// also holds for packets of rays, and t and v are not divided.
+template <typename V>
+inline typename V::mask occludedPatchRoot(const V& ui, typename V::mask active, const vec3<V>& q00, const vec3<V>& q10,
+                                          const vec3<V>& e00, const vec3<V>& e11, const vec3<V>& dir,
+                                          const V& tmin, const V& tmax) {
+	const V zero(0.0f), one(1.0f);
+	typename V::mask hit = (zero <= ui) & (ui <= one) & active;
+	if (!any(hit)) return hit;
+	vec3<V> pa = lerp(q00, q10, ui);
+	vec3<V> pb = lerp(e00, e11, ui);
+	vec3<V> n  = cross(dir, pb);
+	V d = dot(n, n);
+	n = cross(n, pa);
+	V ti = dot(n, pb);
+	V vi = dot(n, dir);
+	return hit & (tmin*d < ti) & (ti < tmax*d) & (zero <= vi) & (vi <= d);
+}
+
+template <typename V>
+inline typename V::mask occludedPatchLanes(vec3<V> q00, vec3<V> q10, const vec3<V>& e00, const vec3<V>& e11,
+                                           const vec3<V>& qn, const vec3<V>& org, const vec3<V>& dir,
+                                           const V& tmin, const V& tmax) {
+	const V zero(0.0f), one(1.0f);
+	q00 = q00 - org;
+	q10 = q10 - org;
+	V a = dot(cross(q00, dir), e00);
+	V c = dot(qn, dir);
+	V b = dot(cross(q10, dir), e11);
+	b = b - (a + c);
+	V det = b*b - V(4.0f)*a*c;
+	typename V::mask active = zero <= det;
+	if (!any(active)) return active;
+	det = sqrt(det);
+	V r  = (-b - copysign(det, b))/V(2.0f);
+	typename V::mask trapezoid = c == zero;
+	typename V::mask hit = occludedPatchRoot(select(trapezoid, -a/b, r/c), active, q00, q10, e00, e11, dir, tmin, tmax);
+	active = andnot(active, hit);
+	if (!any(active)) return hit;
+	return hit | occludedPatchRoot(select(trapezoid, -one, a/r), active, q00, q10, e00, e11, dir, tmin, tmax);
+}
+
+template <typename V>
+inline typename V::mask occludedPatchRayCentricRoot(const V& ui, typename V::mask active, const vec3<V>& q0, const vec3<V>& q1,
+                                                    const vec3<V>& q2, const vec3<V>& q3, const V& tmin, const V& tmax) {
+	const V zero(0.0f), one(1.0f);
+	typename V::mask hit = (zero <= ui) & (ui <= one) & active;
+	if (!any(hit)) return hit;
+	vec3<V> po = lerp(q0, q1, ui);
+	vec3<V> pd = po - lerp(q3, q2, ui);
+	V d  = pd.x*pd.x + pd.y*pd.y;
+	V vi = pd.x*po.x + pd.y*po.y;
+	V ti = po.z*d - vi*pd.z;           // t*d
+	return hit & (zero <= vi) & (vi <= d) & (tmin*d < ti) & (ti < tmax*d);
+}
+
+template <typename V>
+inline typename V::mask occludedPatchRayCentricLanes(const vec3<V>& q0, const vec3<V>& q1, const vec3<V>& q2, const vec3<V>& q3,
+                                                     const V& tmin, const V& tmax) {
+	const V zero(0.0f), one(1.0f);
+	V a = q0.y*q3.x - q0.x*q3.y;
+	V c = (q0.y - q1.y)*(q3.x - q2.x) + (q0.x - q1.x)*(q2.y - q3.y);
+	V b = q1.y*q2.x - q1.x*q2.y;
+	b = b - (a + c);
+	V det = b*b - V(4.0f)*a*c;
+	typename V::mask active = zero <= det;
+	if (!any(active)) return active;
+	det = sqrt(det);
+	V r  = (-b - copysign(det, b))/V(2.0f);
+	typename V::mask trapezoid = c == zero;
+	typename V::mask hit = occludedPatchRayCentricRoot(select(trapezoid, -a/b, r/c), active, q0, q1, q2, q3, tmin, tmax);
+	active = andnot(active, hit);
+	if (!any(active)) return hit;
+	return hit | occludedPatchRayCentricRoot(select(trapezoid, -one, a/r), active, q0, q1, q2, q3, tmin, tmax);
+}
+
+// A packet of rays against one patch (q holds 4 corners + qn as in patch.h).
+template <typename V>
+inline typename V::mask intersectPatchRayPacket(const float3* q, const RayPacket<V>& rays, V& t, V& u, V& v) {
+	return intersectPatchLanes(vec3<V>(q[0]), vec3<V>(q[1]), vec3<V>(q[3] - q[0]), vec3<V>(q[2] - q[1]), vec3<V>(q[4]),
+	                           load3<V>(rays.org[0]), load3<V>(rays.dir[0]), t, u, v);
+}
+
+// One ray against a packet of patches.
+template <typename V>
+inline typename V::mask intersectPatchPacket(const PatchPacket<V>& patches, const Ray& ray, V& t, V& u, V& v) {
+	vec3<V> q00 = load3<V>(patches.q[0][0]), q10 = load3<V>(patches.q[1][0]);
+	return intersectPatchLanes(q00, q10, load3<V>(patches.q[3][0]) - q00, load3<V>(patches.q[2][0]) - q10,
+	                           load3<V>(patches.q[4][0]), vec3<V>(ray.origin), vec3<V>(ray.direction), t, u, v);
+}
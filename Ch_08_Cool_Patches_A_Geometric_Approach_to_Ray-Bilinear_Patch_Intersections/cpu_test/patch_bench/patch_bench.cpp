@@ -0,0 +1,653 @@
+/*
+ * Copyright (c) 2019 NVIDIA Corporation.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property and proprietary
+ * rights in and to this software, related documentation and any modifications thereto.
+ * Any use, reproduction, disclosure or distribution of this software and related
+ * documentation without an express license agreement from NVIDIA Corporation is strictly
+ * prohibited.
+ *
+ * TO THE MAXIMUM EXTENT PERMITTED BY APPLICABLE LAW, THIS SOFTWARE IS PROVIDED *AS IS*
+ * AND NVIDIA AND ITS SUPPLIERS DISCLAIM ALL WARRANTIES, EITHER EXPRESS OR IMPLIED,
+ * INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE.  IN NO EVENT SHALL NVIDIA OR ITS SUPPLIERS BE LIABLE FOR ANY
+ * SPECIAL, INCIDENTAL, INDIRECT, OR CONSEQUENTIAL DAMAGES WHATSOEVER (INCLUDING, WITHOUT
+ * LIMITATION, DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+ * BUSINESS INFORMATION, OR ANY OTHER PECUNIARY LOSS) ARISING OUT OF THE USE OF OR
+ * INABILITY TO USE THIS SOFTWARE, EVEN IF NVIDIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGES
+ */
+
+// Throughput benchmark for the ray/patch intersectors of cpu_test.
+//   patch_bench [reps]    compares the packet intersectors from patch_simd.h
+//                         against the scalar intersectPatchWorldCoordinates,
+//                         both for accuracy (ULPs) and speed, and exits with
+//                         1 if the batched ray-centric leaf test is not within
+//                         its error bounds;
+//   patch_bench mesh.obj  (or .ply) builds a PatchBVH over the faces of the mesh
+//                         and reports rays/s for primary and incoherent rays,
+//                         and for shadow and AO rays with any-hit traversal.
+//                         The patches are converted once and then mapped from
+//                         mesh.obj.patches, see patch_mesh.h;
+//   patch_bench --precision [reps]
+//                         compares the float, mixed and double intersectors of
+//                         patch_precision.h for speed and for rays leaking
+//                         through the shared edges of a patch grid.
+// Build with FMA contraction off, so that the scalar reference rounds like the
+// packet code, e.g.
+//   g++ -O2 -mavx2 -mfma -ffp-contract=off -I../cpu_test -I<Ch_29>/sutil ...
+// (patch_bench.vcxproj sets /fp:strict).
+
+#include "patch_simd.h"
+#include "patch_bvh.h"
+#include "patch_precision.h"
+#include "patch_mesh.h"
+
+#define _USE_MATH_DEFINES
+#include <cctype>
+#include <cstddef>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock timer;
+
+static double seconds(timer::time_point start) {
+	return std::chrono::duration<double>(timer::now() - start).count();
+}
+
+static uint32_t ulps(float a, float b) {
+	if (a == b) return 0;
+	int32_t ia, ib;
+	memcpy(&ia, &a, 4);
+	memcpy(&ib, &b, 4);
+	if (ia < 0) ia = 0x80000000 - ia; // map to a monotonic integer line
+	if (ib < 0) ib = 0x80000000 - ib;
+	return ia > ib ? uint32_t(ia - ib) : uint32_t(ib - ia);
+}
+
+// True if the compiler fuses a*b - c into one FMA here, as it then does in
+// the scalar intersector but never in the packet code.
+static bool fusedMultiplyAdd() {
+	volatile float x = 1.0f + 1.0f/4096; // x*x = 1 + 2^-11 + 2^-24 rounds to 1 + 2^-11
+	const float a = x;
+	return a*a - (1.0f + 1.0f/2048) != 0.0f;
+}
+
+// Random non-planar patches in [-1,1]^3 with rays aimed at a random point
+// of each patch, so that most tests are hits and both roots get exercised.
+struct Scene {
+	std::vector<float3> q; // 5 per patch
+	std::vector<Ray> rays; // one per patch
+	Scene(int n, unsigned seed) {
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> r(-1, 1), s(0, 1);
+		for (int i = 0; i < n; i++) {
+			float3 c = make_float3(r(rng), r(rng), r(rng));
+			float3 p[4];
+			p[0] = c + 0.25f*make_float3(-1 + 0.5f*r(rng), -1 + 0.5f*r(rng), r(rng));
+			p[1] = c + 0.25f*make_float3( 1 + 0.5f*r(rng), -1 + 0.5f*r(rng), r(rng));
+			p[2] = c + 0.25f*make_float3( 1 + 0.5f*r(rng),  1 + 0.5f*r(rng), r(rng));
+			p[3] = c + 0.25f*make_float3(-1 + 0.5f*r(rng),  1 + 0.5f*r(rng), r(rng));
+			for (int k = 0; k < 4; k++) q.push_back(p[k]);
+			q.push_back(cross(p[1] - p[0], p[3] - p[2]));
+			float u = 1.2f*s(rng) - 0.1f, v = 1.2f*s(rng) - 0.1f; // some misses too
+			float3 target = lerp(lerp(p[0], p[1], u), lerp(p[3], p[2], u), v);
+			Ray ray;
+			ray.direction = normalize(make_float3(r(rng), r(rng), r(rng)));
+			ray.origin = target - 3.0f*ray.direction;
+			rays.push_back(ray);
+		}
+	}
+	int size() const { return int(rays.size()); }
+};
+
+// Rays j..j+V::size-1 against patch j and patch j..j+V::size-1 against ray j
+// must give the same answer as the scalar code.
+template <typename V>
+static void check(const Scene& scene, const char* name) {
+	const int W = V::size;
+	uint32_t max_ulps[3] = { 0, 0, 0 };
+	int mismatches = 0, hits = 0, tests = 0;
+	alignas(64) float t[W], u[W], v[W];
+	for (int j = 0; j + W <= scene.size(); j += W) {
+		RayPacket<V> rays;
+		PatchPacket<V> patches;
+		for (int i = 0; i < W; i++) {
+			rays.set(i, scene.rays[j + i]);
+			patches.set(i, &scene.q[5*(j + i)]);
+		}
+		for (int pass = 0; pass < 2; pass++) {
+			V vt, vu(0.0f), vv(0.0f);
+			if (pass == 0) intersectPatchRayPacket(&scene.q[5*j], rays, vt, vu, vv);
+			else           intersectPatchPacket(patches, scene.rays[j], vt, vu, vv);
+			vt.store(t); vu.store(u); vv.store(v);
+			for (int i = 0; i < W; i++) {
+				const float3* q = &scene.q[5*(pass == 0 ? j : j + i)];
+				float st, su = 0, sv = 0;
+				intersectPatchWorldCoordinates(q, scene.rays[pass == 0 ? j + i : j], st, su, sv);
+				tests++;
+				if ((st == std::numeric_limits<float>::infinity()) != (t[i] == std::numeric_limits<float>::infinity())) {
+					mismatches++;
+					continue;
+				}
+				if (st == std::numeric_limits<float>::infinity()) continue;
+				hits++;
+				uint32_t d[3] = { ulps(st, t[i]), ulps(su, u[i]), ulps(sv, v[i]) };
+				for (int k = 0; k < 3; k++)
+					if (d[k] > max_ulps[k]) max_ulps[k] = d[k];
+			}
+		}
+	}
+	std::cout << name << ": " << tests << " tests, " << hits << " hits, " << mismatches << " hit/miss mismatches, "
+	          << "max ulps t = " << max_ulps[0] << ", u = " << max_ulps[1] << ", v = " << max_ulps[2] << std::endl;
+}
+
+static void benchScalar(const Scene& scene, int reps) {
+	float sum = 0;
+	auto start = timer::now();
+	for (int r = 0; r < reps; r++)
+		for (int j = 0; j < scene.size(); j++) {
+			float t, u, v;
+			intersectPatchWorldCoordinates(&scene.q[5*j], scene.rays[(j + r) % scene.size()], t, u, v);
+			if (t < 1e30f) sum += t;
+		}
+	double sec = seconds(start);
+	std::cout << "scalar  : " << reps*double(scene.size())/sec*1e-6 << " M tests/s (checksum " << sum << ")" << std::endl;
+}
+
+template <typename V>
+static void bench(const Scene& scene, int reps, const char* name) {
+	const int W = V::size;
+	const int n = scene.size()/W*W;
+	std::vector<RayPacket<V>, aligned_allocator<RayPacket<V>>> rays(n/W);
+	std::vector<PatchPacket<V>, aligned_allocator<PatchPacket<V>>> patches(n/W);
+	for (int j = 0; j < n; j++) {
+		rays[j/W].set(j%W, scene.rays[j]);
+		patches[j/W].set(j%W, &scene.q[5*j]);
+	}
+	alignas(64) float t[W];
+	float sum = 0;
+
+	auto start = timer::now();
+	for (int r = 0; r < reps; r++)
+		for (int j = 0; j < n; j += W) {
+			V vt, vu, vv;
+			intersectPatchRayPacket(&scene.q[5*((j + r) % n)], rays[j/W], vt, vu, vv);
+			vt.store(t);
+			if (t[0] < 1e30f) sum += t[0];
+		}
+	double sec = seconds(start);
+	std::cout << name << ": " << reps*double(n)/sec*1e-6 << " M tests/s ray packet vs patch, ";
+
+	start = timer::now();
+	for (int r = 0; r < reps; r++)
+		for (int j = 0; j < n; j += W) {
+			V vt, vu, vv;
+			intersectPatchPacket(patches[j/W], scene.rays[(j + r) % n], vt, vu, vv);
+			vt.store(t);
+			if (t[0] < 1e30f) sum += t[0];
+		}
+	sec = seconds(start);
+	std::cout << reps*double(n)/sec*1e-6 << " M tests/s ray vs patch packet (checksum " << sum << ")" << std::endl;
+}
+
+// The batched ray-centric path rebuilds q01 and q11 from the stored edges, so
+// it is not bit-exact: a corner that is off by half an ulp moves u and v of
+// a badly conditioned (grazing) hit by much more. Its errors against the
+// scalar path must stay below these: ulps for t, and units of 2^-24 for u and
+// v, which are in [0, 1] (ulps near 0 would overstate tiny errors).
+const uint32_t RAY_CENTRIC_MAX_T_ULPS = 1024;
+const uint32_t RAY_CENTRIC_MAX_UV_ERROR = 4096;
+
+static uint32_t uvError(float a, float b) {
+	return uint32_t(std::fabs(a - b)*16777216.0f);
+}
+
+// A BVH leaf: one ray against the 4 patches of a PatchBlock. The scalar
+// ray-centric path sets up the basis and transforms every patch on its own,
+// as in cpu_test; the batched one builds the frame once per ray. Returns
+// false if the batched path is not within the bounds above.
+static bool benchBlocks(const Scene& scene, int reps) {
+	const int n = scene.size()/PATCH_BLOCK_SIZE*PATCH_BLOCK_SIZE;
+	PatchData data;
+	data.resize(n/PATCH_BLOCK_SIZE);
+	for (int i = 0; i < n; i++)
+		data.set(i, &scene.q[5*i], i);
+
+	uint32_t max_ulps[3] = { 0, 0, 0 };
+	int mismatches = 0;
+	alignas(16) float t[4], u[4], v[4];
+	for (int j = 0; j < n; j += 4) {
+		const Ray& ray = scene.rays[j];
+		vfloat4 vt, vu(0.0f), vv(0.0f);
+		intersectPatchBlockRayCentric(data.block(j/4), RayCentricFrame<vfloat4>(ray), vt, vu, vv);
+		vt.store(t); vu.store(u); vv.store(v);
+		for (int i = 0; i < 4; i++) {
+			float3 axis1, axis2, q[4] = { scene.q[5*(j + i)], scene.q[5*(j + i) + 1], scene.q[5*(j + i) + 2], scene.q[5*(j + i) + 3] };
+			donb(ray.direction, axis1, axis2);
+			transform(ray.origin, axis1, axis2, ray.direction, q);
+			float st, su = 0, sv = 0;
+			intersectPatchRayCentricCoordinates(q, st, su, sv);
+			if ((st == std::numeric_limits<float>::infinity()) != (t[i] == std::numeric_limits<float>::infinity())) {
+				mismatches++;
+				continue;
+			}
+			if (st == std::numeric_limits<float>::infinity()) continue;
+			uint32_t d[3] = { ulps(st, t[i]), uvError(su, u[i]), uvError(sv, v[i]) };
+			for (int k = 0; k < 3; k++)
+				if (d[k] > max_ulps[k]) max_ulps[k] = d[k];
+		}
+	}
+	bool within = mismatches == 0 && max_ulps[0] <= RAY_CENTRIC_MAX_T_ULPS &&
+	              max_ulps[1] <= RAY_CENTRIC_MAX_UV_ERROR && max_ulps[2] <= RAY_CENTRIC_MAX_UV_ERROR;
+	std::cout << "ray-centric block vs scalar: " << mismatches << " hit/miss mismatches, "
+	          << "max ulps t = " << max_ulps[0] << ", max error (2^-24) u = " << max_ulps[1] << ", v = " << max_ulps[2]
+	          << (within ? " (within bounds)" : " EXCEEDS the bounds") << std::endl;
+
+	float sum = 0;
+	auto start = timer::now();
+	for (int r = 0; r < reps; r++)
+		for (int j = 0; j < n; j += 4) {
+			const Ray& ray = scene.rays[(j + r) % n];
+			for (int i = 0; i < 4; i++) {
+				float tt, uu, vv;
+				intersectPatchWorldCoordinates(&scene.q[5*(j + i)], ray, tt, uu, vv);
+				if (tt < 1e30f) sum += tt;
+			}
+		}
+	double world = seconds(start);
+
+	start = timer::now();
+	for (int r = 0; r < reps; r++)
+		for (int j = 0; j < n; j += 4) {
+			const Ray& ray = scene.rays[(j + r) % n];
+			for (int i = 0; i < 4; i++) {
+				const float3* p = &scene.q[5*(j + i)];
+				float3 axis1, axis2, q[4] = { p[0], p[1], p[2], p[3] };
+				donb(ray.direction, axis1, axis2);
+				transform(ray.origin, axis1, axis2, ray.direction, q);
+				float tt, uu, vv;
+				intersectPatchRayCentricCoordinates(q, tt, uu, vv);
+				if (tt < 1e30f) sum += tt;
+			}
+		}
+	double centric = seconds(start);
+
+	start = timer::now();
+	for (int r = 0; r < reps; r++)
+		for (int j = 0; j < n; j += 4) {
+			RayCentricFrame<vfloat4> frame(scene.rays[(j + r) % n]);
+			vfloat4 vt, vu, vv;
+			intersectPatchBlockRayCentric(data.block(j/4), frame, vt, vu, vv);
+			vt.store(t);
+			if (t[0] < 1e30f) sum += t[0];
+		}
+	double batched = seconds(start);
+
+	// any-hit, as for shadow rays, against the closest hit of the same blocks
+	int occluded = 0;
+	start = timer::now();
+	for (int r = 0; r < reps; r++)
+		for (int j = 0; j < n; j += 4) {
+			const Ray& ray = scene.rays[(j + r) % n];
+			vfloat4 vt, vu, vv;
+			intersectPatchBlock(data.block(j/4), ray, vt, vu, vv);
+			vt.store(t);
+			occluded += (t[0] < 1e30f) | (t[1] < 1e30f) | (t[2] < 1e30f) | (t[3] < 1e30f);
+		}
+	double closest_block = seconds(start);
+
+	start = timer::now();
+	for (int r = 0; r < reps; r++)
+		for (int j = 0; j < n; j += 4)
+			occluded += occludedPatchBlock(data.block(j/4), scene.rays[(j + r) % n], 0, std::numeric_limits<float>::infinity());
+	double any_block = seconds(start);
+
+	start = timer::now();
+	for (int r = 0; r < reps; r++)
+		for (int j = 0; j < n; j += 4) {
+			RayCentricFrame<vfloat4> frame(scene.rays[(j + r) % n]);
+			occluded += occludedPatchBlockRayCentric(data.block(j/4), frame, 0, std::numeric_limits<float>::infinity());
+		}
+	double any_batched = seconds(start);
+
+	double tests = reps*double(n)*1e-9;
+	std::cout << "ns/patch for 4-patch leaves: world " << world/tests << ", ray-centric " << centric/tests
+	          << ", batched ray-centric " << batched/tests << " (checksum " << sum << ")" << std::endl;
+	std::cout << "ns/patch for 4-patch leaves: block closest hit " << closest_block/tests << ", any hit " << any_block/tests
+	          << ", batched ray-centric any hit " << any_batched/tests << " (checksum " << occluded << ")" << std::endl;
+	return within;
+}
+
+// Cost of the precision variants of patch_precision.h on the random scene;
+// the float instantiation must agree with patch.h bit for bit.
+template <typename Real, typename Quadratic>
+static void benchPrecision(const Scene& scene, int reps, const char* name) {
+	int mismatches = 0;
+	for (int j = 0; j < scene.size(); j++) {
+		float t, u = 0, v = 0;
+		Real rt, ru = 0, rv = 0;
+		intersectPatchWorldCoordinates(&scene.q[5*j], scene.rays[j], t, u, v);
+		intersectPatchWorldCoordinates<Real, Quadratic>(&scene.q[5*j], scene.rays[j], rt, ru, rv);
+		mismatches += float(rt) != t || (t < 1e30f && (float(ru) != u || float(rv) != v));
+	}
+	Real sum = 0;
+	auto start = timer::now();
+	for (int r = 0; r < reps; r++)
+		for (int j = 0; j < scene.size(); j++) {
+			Real t, u, v;
+			intersectPatchWorldCoordinates<Real, Quadratic>(&scene.q[5*j], scene.rays[(j + r) % scene.size()], t, u, v);
+			if (t < 1e30f) sum += t;
+		}
+	double sec = seconds(start);
+	std::cout << name << ": " << reps*double(scene.size())/sec*1e-6 << " M tests/s, "
+	          << mismatches << " results differ from float (checksum " << sum << ")" << std::endl;
+}
+
+// Normal of patch q at (u, v), in double.
+static vec3<double> patchNormal(const float3* q, double u, double v) {
+	vec3<double> q00 = q[0], q10 = q[1], q11 = q[2], q01 = q[3];
+	vec3<double> du = (1 - v)*(q10 - q00) + v*(q11 - q01);
+	vec3<double> dv = (1 - u)*(q01 - q00) + u*(q11 - q10);
+	return cross(du, dv);
+}
+
+// A dense grid of bumpy patches moved away from the origin by offset, and
+// rays aimed at random points of the edges shared by two patches. Each ray
+// enters the front side of both patches at the edge (it does not just graze
+// a crease), so a ray that misses both of them leaked through a crack.
+struct EdgeRays {
+	std::vector<float3> q;
+	std::vector<Ray> rays;
+	std::vector<int> patch;    // the two patches next to each ray's edge
+	EdgeRays(int n, double offset, int rays_per_edge, unsigned seed) {
+		std::vector<float3> p((n + 1)*(n + 1));
+		for (int y = 0; y <= n; y++)
+			for (int x = 0; x <= n; x++)
+				p[y*(n + 1) + x] = make_float3(float(offset + x), float(offset + y),
+				                               float(offset + 0.3*std::sin(1.7*x)*std::cos(2.3*y)));
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++) {
+				int i = y*(n + 1) + x;
+				float3 c[4] = { p[i], p[i + 1], p[i + n + 2], p[i + n + 1] };
+				for (int k = 0; k < 4; k++) q.push_back(c[k]);
+				q.push_back(cross(c[1] - c[0], c[3] - c[2]));
+			}
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<double> s(0, 1);
+		for (int y = 1; y < n; y++)
+			for (int x = 1; x < n; x++)
+				for (int k = 0; k < rays_per_edge; k++) {
+					// the edge from (x, y) to (x + 1, y), which is v = 0 of patch (x, y)
+					// and v = 1 of patch (x, y - 1), or the edge from (x, y) to (x, y + 1),
+					// which is u = 0 of patch (x, y) and u = 1 of patch (x - 1, y)
+					bool vertical = (k & 1) != 0;
+					int p0 = y*n + x, p1 = vertical ? p0 - 1 : p0 - n;
+					float3 a = p[y*(n + 1) + x], b = p[(y + vertical)*(n + 1) + x + !vertical];
+					vec3<double> target, dir;
+					for (;;) {
+						double w = s(rng);
+						target = vec3<double>(a) + w*(vec3<double>(b) - vec3<double>(a));
+						double z = 0.17 + 0.83*s(rng), phi = 2*M_PI*s(rng), r = std::sqrt(1 - z*z);
+						dir = vec3<double>(-r*std::cos(phi), -r*std::sin(phi), -z);
+						vec3<double> n0 = vertical ? patchNormal(&q[5*p0], 0, w) : patchNormal(&q[5*p0], w, 0);
+						vec3<double> n1 = vertical ? patchNormal(&q[5*p1], 1, w) : patchNormal(&q[5*p1], w, 1);
+						if (dot(dir, n0) < -0.01*std::sqrt(dot(n0, n0)) && dot(dir, n1) < -0.01*std::sqrt(dot(n1, n1)))
+							break;
+					}
+					Ray ray;
+					ray.origin = make_float3(float(target.x - 4*dir.x), float(target.y - 4*dir.y), float(target.z - 4*dir.z));
+					ray.direction = make_float3(float(dir.x), float(dir.y), float(dir.z));
+					ray.tmin = 0;
+					ray.tmax = std::numeric_limits<float>::infinity();
+					rays.push_back(ray);
+					patch.push_back(p0);
+					patch.push_back(p1);
+				}
+	}
+};
+
+template <typename Real, typename Quadratic>
+static double leaks(const EdgeRays& grid) {
+	int leaked = 0;
+	for (size_t i = 0; i < grid.rays.size(); i++) {
+		Real t0, t1, u, v;
+		intersectPatchWorldCoordinates<Real, Quadratic>(&grid.q[5*grid.patch[2*i]], grid.rays[i], t0, u, v);
+		intersectPatchWorldCoordinates<Real, Quadratic>(&grid.q[5*grid.patch[2*i + 1]], grid.rays[i], t1, u, v);
+		leaked += t0 == std::numeric_limits<Real>::infinity() && t1 == std::numeric_limits<Real>::infinity();
+	}
+	return double(leaked)/grid.rays.size();
+}
+
+static int precisionBench(int reps) {
+	Scene scene(1 << 16, 2019);
+	std::cout << "throughput, " << scene.size() << " patches x " << reps << " repetitions" << std::endl;
+	benchPrecision<float,  float> (scene, reps, "float ");
+	benchPrecision<float,  double>(scene, reps, "mixed ");
+	benchPrecision<double, double>(scene, reps, "double");
+
+	std::cout << "rays leaking through the shared edges of a 64x64 grid" << std::endl;
+	const double offsets[] = { 0, 1e2, 1e3, 1e4, 1e5 };
+	for (double offset : offsets) {
+		EdgeRays grid(64, offset, 64, 2019);
+		std::cout << "offset " << offset << ": float " << leaks<float, float>(grid)
+		          << ", mixed " << leaks<float, double>(grid) << ", double " << leaks<double, double>(grid)
+		          << " (" << grid.rays.size() << " rays)" << std::endl;
+	}
+	return 0;
+}
+
+// Primary rays of a pinhole camera looking down -z at the whole mesh, and
+// incoherent rays with random origins inside of the bounds and random directions.
+static std::vector<Ray> primaryRays(const BVHNode& bounds, int res) {
+	float3 center = 0.5f*(bounds.lo + bounds.hi);
+	float radius = 0.5f*length(bounds.hi - bounds.lo);
+	float3 eye = center + make_float3(0, 0, 2.5f*radius);
+	std::vector<Ray> rays;
+	for (int y = 0; y < res; y++)
+		for (int x = 0; x < res; x++) {
+			float3 p = center + radius*make_float3(2*(x + 0.5f)/res - 1, 2*(y + 0.5f)/res - 1, 0);
+			rays.push_back(make_Ray(eye, normalize(p - eye), 0, 0, std::numeric_limits<float>::infinity()));
+		}
+	return rays;
+}
+
+static std::vector<Ray> incoherentRays(const BVHNode& bounds, int n) {
+	std::mt19937 rng(2019);
+	std::uniform_real_distribution<float> s(0, 1);
+	std::vector<Ray> rays;
+	for (int i = 0; i < n; i++) {
+		float3 org = bounds.lo + make_float3(s(rng), s(rng), s(rng))*(bounds.hi - bounds.lo);
+		float z = 2*s(rng) - 1, phi = 2*float(M_PI)*s(rng), r = std::sqrt(std::max(0.0f, 1 - z*z));
+		rays.push_back(make_Ray(org, make_float3(r*std::cos(phi), r*std::sin(phi), z), 0, 0, std::numeric_limits<float>::infinity()));
+	}
+	return rays;
+}
+
+static void traceRays(const PatchBVH& bvh, const std::vector<Ray>& rays, PatchIntersector mode, const char* name) {
+	int hits = 0;
+	auto start = timer::now();
+	for (size_t i = 0; i < rays.size(); i++) {
+		PatchHit hit;
+		hits += bvh.intersect(rays[i], hit, mode);
+	}
+	double sec = seconds(start);
+	std::cout << name << ": " << rays.size()/sec*1e-6 << " M rays/s, " << hits << " hits" << std::endl;
+}
+
+// Shadow rays toward a point light above the mesh and short ambient occlusion
+// rays, both from the hits of the primary rays, traced with occluded() and,
+// for comparison, as closest-hit queries with the same (tmin, tmax). Shadows
+// need a mesh that occludes itself: on a height field most rays see the light.
+static void benchOcclusion(const PatchBVH& bvh, const float3* q, const std::vector<Ray>& primary) {
+	const BVHNode& bounds = bvh.root();
+	float radius = 0.5f*length(bounds.hi - bounds.lo);
+	float3 light = 0.5f*(bounds.lo + bounds.hi) + make_float3(radius, radius, 2*radius);
+	std::mt19937 rng(2019);
+	std::uniform_real_distribution<float> s(0, 1);
+	std::vector<Ray> shadow, ao;
+	for (size_t i = 0; i < primary.size(); i++) {
+		PatchHit hit;
+		if (!bvh.intersect(primary[i], hit)) continue;
+		const float3* p = q + 5*hit.id;
+		float3 du = lerp(p[1] - p[0], p[2] - p[3], hit.v);
+		float3 dv = lerp(p[3] - p[0], p[2] - p[1], hit.u);
+		float3 n = normalize(cross(du, dv));
+		if (dot(n, primary[i].direction) > 0) n = -n;
+		float3 org = primary[i].origin + hit.t*primary[i].direction + 1e-4f*radius*n;
+		float3 to_light = light - org;
+		shadow.push_back(make_Ray(org, normalize(to_light), 1, 0, length(to_light)));
+		// cosine distributed around n
+		float3 axis1, axis2;
+		donb(n, axis1, axis2);
+		float r = std::sqrt(s(rng)), phi = 2*float(M_PI)*s(rng);
+		float3 d = r*std::cos(phi)*axis1 + r*std::sin(phi)*axis2 + std::sqrt(std::max(0.0f, 1 - r*r))*n;
+		ao.push_back(make_Ray(org, normalize(d), 1, 0, 0.1f*radius));
+	}
+
+	const std::vector<Ray>* sets[2] = { &shadow, &ao };
+	const char* names[2] = { "shadow", "ao    " };
+	const PatchIntersector modes[2] = { WORLD_COORDINATES, RAY_CENTRIC_COORDINATES };
+	const char* mode_names[2] = { "world      ", "ray-centric" };
+	for (int k = 0; k < 2; k++)
+		for (int m = 0; m < 2; m++) {
+			const std::vector<Ray>& rays = *sets[k];
+			int closest = 0, any = 0, mismatches = 0;
+			double closest_sec = std::numeric_limits<double>::infinity(), any_sec = closest_sec;
+			for (int rep = 0; rep < 3; rep++) { // best of 3, alternating
+				closest = any = 0;
+				auto start = timer::now();
+				for (size_t i = 0; i < rays.size(); i++) {
+					PatchHit hit;
+					closest += bvh.intersect(rays[i], hit, modes[m]);
+				}
+				closest_sec = std::min(closest_sec, seconds(start));
+				start = timer::now();
+				for (size_t i = 0; i < rays.size(); i++)
+					any += bvh.occluded(rays[i], modes[m]);
+				any_sec = std::min(any_sec, seconds(start));
+			}
+			TraversalStats closest_stats, any_stats;
+			for (size_t i = 0; i < rays.size(); i++) {
+				PatchHit hit;
+				mismatches += bvh.intersect(rays[i], hit, modes[m], &closest_stats) != bvh.occluded(rays[i], modes[m], &any_stats);
+			}
+			std::cout << names[k] << " " << mode_names[m] << ": " << any << "/" << rays.size() << " occluded ("
+			          << closest << " by closest hit), " << mismatches << " mismatches" << std::endl;
+			std::cout << "  closest hit " << rays.size()/closest_sec*1e-6 << " M rays/s, "
+			          << double(closest_stats.nodes)/rays.size() << " nodes/ray, " << double(closest_stats.tests)/rays.size() << " tests/ray" << std::endl;
+			std::cout << "  any hit     " << rays.size()/any_sec*1e-6 << " M rays/s ("
+			          << (closest_sec/any_sec > 1 ? "+" : "") << 100*(closest_sec/any_sec - 1) << "%), "
+			          << double(any_stats.nodes)/rays.size() << " nodes/ray, " << double(any_stats.tests)/rays.size() << " tests/ray" << std::endl;
+		}
+}
+
+// Patch memory read per ray/patch test: the coefficients of a PatchBlock per
+// visited leaf (the ids are only read for hits), against the q[5] records of
+// cpu_test and rqx.cu stored contiguously per leaf. Both hold the same 15
+// floats per patch, so with full leaves the bytes are the same; blocks touch
+// fewer cache lines, since a range of L bytes at a 4-byte aligned address
+// touches (L + 60)/64 lines on average, and a block is 64-byte aligned.
+static void reportBytes(const PatchBVH& bvh, const std::vector<Ray>& rays, const char* name) {
+	TraversalStats stats;
+	for (size_t i = 0; i < rays.size(); i++) {
+		PatchHit hit;
+		bvh.intersect(rays[i], hit, WORLD_COORDINATES, &stats);
+	}
+	const double coefficients = offsetof(PatchBlock, id);
+	double tests = double(stats.tests), leaves = double(stats.leaves);
+	double aos = 5*sizeof(float3), block_bytes = leaves*coefficients/tests;
+	double aos_lines = (aos*tests + 60*leaves)/64/tests, block_lines = leaves*std::ceil(coefficients/64)/tests;
+	std::cout << name << ": " << tests/rays.size() << " tests/ray, " << tests/leaves << " patches/leaf" << std::endl;
+	std::cout << "  bytes/test: " << aos << " q[5], " << block_bytes << " blocks ("
+	          << (block_bytes > aos ? "+" : "") << 100*(block_bytes/aos - 1) << "%)" << std::endl;
+	std::cout << "  lines/test: " << aos_lines << " q[5], " << block_lines << " blocks ("
+	          << (block_lines > aos_lines ? "+" : "") << 100*(block_lines/aos_lines - 1) << "%)" << std::endl;
+}
+
+static int meshBench(const char* filename) {
+	PatchFile file;
+	PairingStats pairing = {};
+	auto start = timer::now();
+	if (!loadPatchMesh(filename, file, &pairing)) {
+		std::cerr << "cannot load " << filename << std::endl;
+		return 1;
+	}
+	const int n = file.numPatches();
+	const float3* q = file.patches();
+	if (pairing.triangles)
+		std::cout << filename << ": " << pairing.triangles << " triangles paired into " << pairing.quads
+		          << " quads + " << pairing.singles << " triangles, converted in " << seconds(start) << " s" << std::endl;
+	else
+		std::cout << filename << ": " << n << " patches, mapped in " << seconds(start) << " s" << std::endl;
+	start = timer::now();
+	PatchBVH bvh(q, n, file.vertexNormals());
+	std::cout << "bvh: " << bvh.numNodes() << " nodes, built in " << seconds(start) << " s" << std::endl;
+
+	std::vector<Ray> primary = primaryRays(bvh.root(), 1024);
+	std::vector<Ray> incoherent = incoherentRays(bvh.root(), 1 << 20);
+
+	// the closest hit must match brute force on a few rays
+	int mismatches = 0;
+	for (int i = 0; i < 64; i++) {
+		const Ray& ray = incoherent[i];
+		PatchHit hit;
+		bvh.intersect(ray, hit);
+		float best = std::numeric_limits<float>::infinity();
+		for (int j = 0; j < n; j++) {
+			float t, u, v;
+			intersectPatchWorldCoordinates(&q[5*j], ray, t, u, v);
+			if (0 < t && t < best) best = t;
+		}
+		if (best != hit.t) mismatches++;
+	}
+	std::cout << "bvh vs brute force: " << mismatches << " mismatches in 64 rays" << std::endl;
+
+	reportBytes(bvh, primary,    "primary   ");
+	reportBytes(bvh, incoherent, "incoherent");
+	traceRays(bvh, primary,    WORLD_COORDINATES,       "primary    world      ");
+	traceRays(bvh, primary,    RAY_CENTRIC_COORDINATES, "primary    ray-centric");
+	traceRays(bvh, incoherent, WORLD_COORDINATES,       "incoherent world      ");
+	traceRays(bvh, incoherent, RAY_CENTRIC_COORDINATES, "incoherent ray-centric");
+	benchOcclusion(bvh, q, primary);
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc > 1 && strcmp(argv[1], "--precision") == 0)
+		return precisionBench(argc > 2 ? atoi(argv[2]) : 50);
+	if (argc > 1 && !isdigit(argv[1][0]))
+		return meshBench(argv[1]);
+
+	const int n = 1 << 16, reps = argc > 1 ? atoi(argv[1]) : 50;
+	Scene scene(n, 2019);
+
+	std::cout << "accuracy against intersectPatchWorldCoordinates" << std::endl;
+	if (fusedMultiplyAdd())
+		std::cout << "warning: the scalar code is contracted into FMAs, rebuild with -ffp-contract=off (/fp:strict)"
+		          << " for a bit-exact comparison" << std::endl;
+	check<vfloat4>(scene, "sse     ");
+#if defined(__AVX2__)
+	check<vfloat8>(scene, "avx2    ");
+#endif
+#if defined(__AVX512F__)
+	check<vfloat16>(scene, "avx512  ");
+#endif
+
+	std::cout << "throughput, " << n << " patches x " << reps << " repetitions" << std::endl;
+	benchScalar(scene, reps);
+	bench<vfloat4>(scene, reps, "sse     ");
+#if defined(__AVX2__)
+	bench<vfloat8>(scene, reps, "avx2    ");
+#endif
+#if defined(__AVX512F__)
+	bench<vfloat16>(scene, reps, "avx512  ");
+#endif
+	return benchBlocks(scene, reps) ? 0 : 1;
+}
@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2019 NVIDIA Corporation.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property and proprietary
+ * rights in and to this software, related documentation and any modifications thereto.
+ * Any use, reproduction, disclosure or distribution of this software and related
+ * documentation without an express license agreement from NVIDIA Corporation is strictly
+ * prohibited.
+ *
+ * TO THE MAXIMUM EXTENT PERMITTED BY APPLICABLE LAW, THIS SOFTWARE IS PROVIDED *AS IS*
+ * AND NVIDIA AND ITS SUPPLIERS DISCLAIM ALL WARRANTIES, EITHER EXPRESS OR IMPLIED,
+ * INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE.  IN NO EVENT SHALL NVIDIA OR ITS SUPPLIERS BE LIABLE FOR ANY
+ * SPECIAL, INCIDENTAL, INDIRECT, OR CONSEQUENTIAL DAMAGES WHATSOEVER (INCLUDING, WITHOUT
+ * LIMITATION, DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+ * BUSINESS INFORMATION, OR ANY OTHER PECUNIARY LOSS) ARISING OUT OF THE USE OF OR
+ * INABILITY TO USE THIS SOFTWARE, EVEN IF NVIDIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGES
+ */
+
+#include "patch_mesh.h"
+
+#include "Mesh.h"
+#include "rply-1.01/rply.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const char patch_magic[8] = "PATCHES";
+
+static float3 vertex(const std::vector<float>& a, int i) {
+	return make_float3(a[3*i], a[3*i + 1], a[3*i + 2]);
+}
+
+// Welds vertices with the same position, so that triangles are paired even
+// where the loader split a vertex (different normals or texcoords).
+static std::vector<int> weld(const std::vector<float>& positions) {
+	int n = int(positions.size()/3);
+	std::vector<int> order(n), id(n);
+	for (int i = 0; i < n; i++) order[i] = i;
+	const float* p = positions.data();
+	std::sort(order.begin(), order.end(), [p](int a, int b) {
+		return std::lexicographical_compare(p + 3*a, p + 3*a + 3, p + 3*b, p + 3*b + 3);
+	});
+	for (int i = 0; i < n; i++)
+		id[order[i]] = i > 0 && std::equal(p + 3*order[i], p + 3*order[i] + 3, p + 3*order[i - 1]) ?
+		               id[order[i - 1]] : order[i];
+	return id;
+}
+
+// Index k of the longest edge (v[k], v[k+1]) of a triangle, the first one on ties.
+static int longestEdge(const std::vector<float>& positions, const int32_t* v) {
+	int longest = 0;
+	float length = -1;
+	for (int k = 0; k < 3; k++) {
+		float3 e = vertex(positions, v[(k + 1)%3]) - vertex(positions, v[k]);
+		if (dot(e, e) > length) {
+			length = dot(e, e);
+			longest = k;
+		}
+	}
+	return longest;
+}
+
+struct Edge {
+	uint64_t key;             // welded (min, max) vertex pair
+	int tri, k;               // edge k of triangle tri
+	bool operator<(const Edge& e) const { return key < e.key || (key == e.key && tri < e.tri); }
+};
+
+void pairTriangles(const std::vector<float>& positions, const std::vector<float>& normals,
+                   const std::vector<int32_t>& indices, std::vector<float3>& q, std::vector<float3>& vn,
+                   PairingStats* stats) {
+	const int n = int(indices.size()/3);
+	std::vector<int> id = weld(positions);
+
+	// the neighbour across the longest edge of each triangle, if that edge is
+	// shared by exactly 2 consistently oriented triangles
+	std::vector<Edge> edges(n);
+	std::vector<int> longest(n), neighbour(n, -1);
+	for (int t = 0; t < n; t++) {
+		const int32_t* v = &indices[3*t];
+		longest[t] = longestEdge(positions, v);
+		uint64_t a = id[v[longest[t]]], b = id[v[(longest[t] + 1)%3]];
+		edges[t].key = a < b ? a << 32 | b : b << 32 | a;
+		edges[t].tri = t;
+		edges[t].k = longest[t];
+	}
+	std::sort(edges.begin(), edges.end());
+	for (int i = 0; i + 1 < n; i++) {
+		const Edge& e0 = edges[i];
+		const Edge& e1 = edges[i + 1];
+		if (e0.key != e1.key || (i + 2 < n && edges[i + 2].key == e0.key) || (i > 0 && edges[i - 1].key == e0.key))
+			continue;
+		const int32_t* v0 = &indices[3*e0.tri];
+		const int32_t* v1 = &indices[3*e1.tri];
+		if (id[v0[e0.k]] == id[v1[(e1.k + 1)%3]] && id[v0[(e0.k + 1)%3]] == id[v1[e1.k]]) {
+			neighbour[e0.tri] = e1.tri;
+			neighbour[e1.tri] = e0.tri;
+		}
+	}
+
+	// area weighted vertex normals if the mesh has none
+	std::vector<float> computed;
+	const std::vector<float>* vertex_normals = &normals;
+	if (normals.size() != positions.size()) {
+		computed.assign(positions.size(), 0.0f);
+		for (int t = 0; t < n; t++) {
+			const int32_t* v = &indices[3*t];
+			float3 p0 = vertex(positions, v[0]), p1 = vertex(positions, v[1]), p2 = vertex(positions, v[2]);
+			float3 nt = cross(p1 - p0, p2 - p0);
+			for (int k = 0; k < 3; k++) {
+				float* nv = &computed[3*id[v[k]]];
+				nv[0] += nt.x;
+				nv[1] += nt.y;
+				nv[2] += nt.z;
+			}
+		}
+		for (size_t i = 0; i < id.size(); i++) {
+			float3 nv = vertex(computed, id[i]);
+			float length = sqrtf(dot(nv, nv));
+			nv = length > 0 ? nv/length : make_float3(0);
+			computed[3*i] = nv.x;
+			computed[3*i + 1] = nv.y;
+			computed[3*i + 2] = nv.z;
+		}
+		vertex_normals = &computed;
+	}
+
+	PairingStats s = { n, 0, 0 };
+	for (int t = 0; t < n; t++) {
+		int u = neighbour[t];
+		if (u >= 0 && u < t) continue;  // already merged into patch u
+		const int32_t* v = &indices[3*t];
+		int k = longest[t], f[4];
+		if (u >= 0) {
+			// (v[k], v[k+1]) is the diagonal; the quad goes around it as
+			// v[k+1], v[k+2], v[k], then the far corner of the neighbour
+			f[0] = v[(k + 1)%3];
+			f[1] = v[(k + 2)%3];
+			f[2] = v[k];
+			f[3] = indices[3*u + (longest[u] + 2)%3];
+			s.quads++;
+		} else {
+			f[0] = v[0];
+			f[1] = v[1];
+			f[2] = v[2];
+			f[3] = v[2];
+			s.singles++;
+		}
+		float3 p[4];
+		for (int c = 0; c < 4; c++) {
+			p[c] = vertex(positions, f[c]);
+			q.push_back(p[c]);
+		}
+		q.push_back(cross(p[1] - p[0], p[3] - p[2]));
+		for (int c = 0; c < 4; c++)
+			vn.push_back(vertex(*vertex_normals, f[c]));
+	}
+	if (stats) *stats = s;
+}
+
+static bool loadOBJ(const std::string& filename, std::vector<float>& positions, std::vector<float>& normals,
+                    std::vector<int32_t>& indices) {
+	try {
+		MeshLoader loader(filename);
+		Mesh mesh;
+		loader.scanMesh(mesh);
+		allocMesh(mesh);
+		loader.loadMesh(mesh);
+		positions.assign(mesh.positions, mesh.positions + 3*mesh.num_vertices);
+		if (mesh.has_normals)
+			normals.assign(mesh.normals, mesh.normals + 3*mesh.num_vertices);
+		indices.assign(mesh.tri_indices, mesh.tri_indices + 3*mesh.num_triangles);
+		freeMesh(mesh);
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+struct PlyState {
+	std::vector<float>* positions;
+	std::vector<float>* normals;
+	std::vector<int32_t>* indices;
+	std::vector<int32_t> face;
+};
+
+// rply calls back property by property within each vertex, so x, y, z (and
+// nx, ny, nz) arrive vertex by vertex.
+static int plyVertex(p_ply_argument argument) {
+	PlyState* state;
+	int which;
+	ply_get_argument_user_data(argument, reinterpret_cast<void**>(&state), &which);
+	(which < 3 ? state->positions : state->normals)->push_back(float(ply_get_argument_value(argument)));
+	return 1;
+}
+
+// Splits a polygon into a fan of triangles around its first vertex, as
+// tinyobjloader does, so that quads come out paired along v0-v2.
+static int plyFace(p_ply_argument argument) {
+	PlyState* state;
+	int length, index;
+	ply_get_argument_user_data(argument, reinterpret_cast<void**>(&state), NULL);
+	ply_get_argument_property(argument, NULL, &length, &index);
+	if (index < 0) {          // the list length comes first
+		state->face.clear();
+		return 1;
+	}
+	int32_t i = int32_t(ply_get_argument_value(argument));
+	if (i < 0 || 3*size_t(i) >= state->positions->size()) return 0;
+	state->face.push_back(i);
+	if (index == length - 1) {
+		for (size_t k = 1; k + 1 < state->face.size(); k++) {
+			state->indices->push_back(state->face[0]);
+			state->indices->push_back(state->face[k]);
+			state->indices->push_back(state->face[k + 1]);
+		}
+	}
+	return 1;
+}
+
+static bool loadPLY(const std::string& filename, std::vector<float>& positions, std::vector<float>& normals,
+                    std::vector<int32_t>& indices) {
+	p_ply ply = ply_open(filename.c_str(), NULL);
+	if (!ply) return false;
+	PlyState state = { &positions, &normals, &indices };
+	bool ok = ply_read_header(ply) != 0;
+	if (ok) {
+		const char* names[6] = { "x", "y", "z", "nx", "ny", "nz" };
+		for (int k = 0; k < 6; k++)
+			ply_set_read_cb(ply, "vertex", names[k], plyVertex, &state, k);
+		ok = ply_set_read_cb(ply, "face", "vertex_indices", plyFace, &state, 0) > 0 && ply_read(ply) != 0;
+	}
+	ply_close(ply);
+	return ok;
+}
+
+static bool loadTriangles(const std::string& filename, std::vector<float>& positions, std::vector<float>& normals,
+                          std::vector<int32_t>& indices) {
+	std::string ext = filename.substr(filename.find_last_of('.') + 1);
+	for (size_t i = 0; i < ext.size(); i++) ext[i] = char(tolower(ext[i]));
+	if (ext == "obj") return loadOBJ(filename, positions, normals, indices);
+	if (ext == "ply") return loadPLY(filename, positions, normals, indices);
+	return false;
+}
+
+static bool fileStamp(const std::string& filename, uint64_t& size, int64_t& time) {
+#if defined(_WIN32)
+	struct _stat64 s;
+	if (_stat64(filename.c_str(), &s) != 0) return false;
+#else
+	struct stat s;
+	if (stat(filename.c_str(), &s) != 0) return false;
+#endif
+	size = uint64_t(s.st_size);
+	time = int64_t(s.st_mtime);
+	return true;
+}
+
+static uint64_t align64(uint64_t offset) {
+	return (offset + 63) & ~uint64_t(63);
+}
+
+static bool writeZeros(FILE* file, uint64_t n) {
+	static const char zeros[64] = {};
+	return fwrite(zeros, 1, size_t(n), file) == n;
+}
+
+bool writePatchFile(const std::string& filename, uint64_t source_size, int64_t source_time,
+                    const std::vector<float3>& q, const std::vector<float3>& vn) {
+	PatchFileHeader header = {};
+	memcpy(header.magic, patch_magic, sizeof(header.magic));
+	header.version = PATCH_FILE_VERSION;
+	header.num_patches = uint32_t(q.size()/5);
+	header.has_normals = !vn.empty();
+	header.source_size = source_size;
+	header.source_time = source_time;
+	header.patch_offset = align64(sizeof(header));
+	header.normal_offset = vn.empty() ? 0 : align64(header.patch_offset + q.size()*sizeof(float3));
+
+	// written under a temporary name, so that a failed write never leaves a
+	// valid looking but truncated file behind
+	std::string temp = filename + ".tmp";
+	FILE* file = fopen(temp.c_str(), "wb");
+	if (!file) return false;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && writeZeros(file, header.patch_offset - sizeof(header));
+	ok = ok && fwrite(q.data(), sizeof(float3), q.size(), file) == q.size();
+	if (!vn.empty()) {
+		ok = ok && writeZeros(file, header.normal_offset - header.patch_offset - q.size()*sizeof(float3));
+		ok = ok && fwrite(vn.data(), sizeof(float3), vn.size(), file) == vn.size();
+	}
+	ok = fclose(file) == 0 && ok;
+	if (ok) {
+		remove(filename.c_str());
+		ok = rename(temp.c_str(), filename.c_str()) == 0;
+	}
+	if (!ok) remove(temp.c_str());
+	return ok;
+}
+
+PatchFile::PatchFile() : data(0), size(0) {
+#if defined(_WIN32)
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#endif
+}
+
+PatchFile::~PatchFile() {
+	close();
+}
+
+bool PatchFile::open(const std::string& filename) {
+	close();
+#if defined(_WIN32)
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(file, &length) || length.QuadPart < LONGLONG(sizeof(PatchFileHeader))) {
+		close();
+		return false;
+	}
+	size = size_t(length.QuadPart);
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping) data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat s;
+	if (fstat(fd, &s) == 0 && s.st_size >= off_t(sizeof(PatchFileHeader))) {
+		size = size_t(s.st_size);
+		void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) data = static_cast<const char*>(p);
+	}
+	::close(fd);
+#endif
+	if (!data) {
+		close();
+		return false;
+	}
+
+	const PatchFileHeader& h = header();
+	uint64_t patch_end = h.patch_offset + uint64_t(h.num_patches)*5*sizeof(float3);
+	uint64_t normal_end = h.normal_offset + uint64_t(h.num_patches)*4*sizeof(float3);
+	if (memcmp(h.magic, patch_magic, sizeof(h.magic)) != 0 || h.version != PATCH_FILE_VERSION ||
+	    h.patch_offset % 64 != 0 || h.normal_offset % 64 != 0 || patch_end > size ||
+	    (h.has_normals && normal_end > size)) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void PatchFile::close() {
+#if defined(_WIN32)
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else
+	if (data) munmap(const_cast<char*>(data), size);
+#endif
+	data = 0;
+	size = 0;
+}
+
+bool loadPatchMesh(const std::string& model, PatchFile& file, PairingStats* stats) {
+	const std::string suffix = ".patches";
+	if (model.size() > suffix.size() && model.compare(model.size() - suffix.size(), suffix.size(), suffix) == 0)
+		return file.open(model);
+
+	std::string cache = model + suffix;
+	uint64_t source_size;
+	int64_t source_time;
+	if (!fileStamp(model, source_size, source_time))
+		return file.open(cache);
+	if (file.open(cache) && file.header().source_size == source_size && file.header().source_time == source_time)
+		return true;
+	file.close();
+
+	std::vector<float> positions, normals;
+	std::vector<int32_t> indices;
+	if (!loadTriangles(model, positions, normals, indices))
+		return false;
+	std::vector<float3> q, vn;
+	pairTriangles(positions, normals, indices, q, vn, stats);
+	if (!writePatchFile(cache, source_size, source_time, q, vn)) {
+		std::cerr << "cannot write " << cache << std::endl;
+		return false;
+	}
+	return file.open(cache);
+}
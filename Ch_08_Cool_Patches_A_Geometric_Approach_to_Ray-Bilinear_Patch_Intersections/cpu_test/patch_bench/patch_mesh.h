@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2019 NVIDIA Corporation.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property and proprietary
+ * rights in and to this software, related documentation and any modifications thereto.
+ * Any use, reproduction, disclosure or distribution of this software and related
+ * documentation without an express license agreement from NVIDIA Corporation is strictly
+ * prohibited.
+ *
+ * TO THE MAXIMUM EXTENT PERMITTED BY APPLICABLE LAW, THIS SOFTWARE IS PROVIDED *AS IS*
+ * AND NVIDIA AND ITS SUPPLIERS DISCLAIM ALL WARRANTIES, EITHER EXPRESS OR IMPLIED,
+ * INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE.  IN NO EVENT SHALL NVIDIA OR ITS SUPPLIERS BE LIABLE FOR ANY
+ * SPECIAL, INCIDENTAL, INDIRECT, OR CONSEQUENTIAL DAMAGES WHATSOEVER (INCLUDING, WITHOUT
+ * LIMITATION, DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+ * BUSINESS INFORMATION, OR ANY OTHER PECUNIARY LOSS) ARISING OUT OF THE USE OF OR
+ * INABILITY TO USE THIS SOFTWARE, EVEN IF NVIDIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGES
+ */
+
+// Converts triangle meshes to bilinear patches in the 4 corners + qn layout
+// of patch.h, and caches the result in a binary file that is used in place.
+//
+// OBJ files are read with MeshLoader from Chapter 29 (tinyobjloader splits
+// every polygon into a fan of triangles); PLY files are read with rply
+// directly, since MeshLoader keeps only the first triangle of a PLY face.
+// Two triangles that share an edge which is the longest edge of both (the
+// diagonal of the quad they were split from) are merged back into one patch;
+// the remaining triangles become patches with a collapsed q11-q01 edge.
+//
+// The result goes to <model>.patches, next to the model. A later load of
+// the same model (same size and modification time) maps that file and does
+// no parsing or pairing at all.
+
+#pragma once
+
+#include "patch.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define PATCH_FILE_VERSION 1
+
+// The file is this header, followed by 5 float3 per patch at patch_offset
+// and, if has_normals, 4 vertex normals per patch at normal_offset (in the
+// corner order of q, for SHADING_NORMALS). Both offsets are multiples of 64.
+struct PatchFileHeader {
+	char     magic[8];        // "PATCHES\0"
+	uint32_t version;         // PATCH_FILE_VERSION
+	uint32_t num_patches;
+	uint32_t has_normals;
+	uint32_t reserved;
+	uint64_t source_size;     // size and modification time of the model
+	int64_t  source_time;     // the file was made from
+	uint64_t patch_offset;
+	uint64_t normal_offset;
+};
+
+struct PairingStats {
+	int triangles;            // input triangles
+	int quads;                // patches made of 2 triangles
+	int singles;              // patches made of 1 triangle
+};
+
+// Pairs the triangles (3 indices each into positions and normals, 3 floats
+// per vertex) and appends 5 float3 per patch to q and 4 vertex normals per
+// patch to vn. Without normals, vn gets area weighted vertex normals.
+void pairTriangles(const std::vector<float>& positions, const std::vector<float>& normals,
+                   const std::vector<int32_t>& indices, std::vector<float3>& q, std::vector<float3>& vn,
+                   PairingStats* stats = 0);
+
+// Writes q and vn (may be empty) as a patch file; returns false on I/O errors.
+bool writePatchFile(const std::string& filename, uint64_t source_size, int64_t source_time,
+                    const std::vector<float3>& q, const std::vector<float3>& vn);
+
+// A read-only mapping of a patch file.
+class PatchFile {
+public:
+	PatchFile();
+	~PatchFile();
+
+	// Maps filename; returns false if it is missing or not a valid patch file.
+	bool open(const std::string& filename);
+	void close();
+
+	const PatchFileHeader& header() const { return *reinterpret_cast<const PatchFileHeader*>(data); }
+	int numPatches() const { return data ? int(header().num_patches) : 0; }
+	const float3* patches() const { return reinterpret_cast<const float3*>(data + header().patch_offset); }
+	const float3* vertexNormals() const {
+		return header().has_normals ? reinterpret_cast<const float3*>(data + header().normal_offset) : 0;
+	}
+
+private:
+	PatchFile(const PatchFile&);
+	PatchFile& operator=(const PatchFile&);
+
+	const char* data;
+	size_t size;
+#if defined(_WIN32)
+	void* file;
+	void* mapping;
+#endif
+};
+
+// Maps <model>.patches, first converting the OBJ or PLY model if that file
+// is missing or was made from a different version of the model; a .patches
+// file can also be passed directly. stats is only filled in by a conversion.
+// Returns false if neither the model nor its patch file can be read.
+bool loadPatchMesh(const std::string& model, PatchFile& file, PairingStats* stats = 0);
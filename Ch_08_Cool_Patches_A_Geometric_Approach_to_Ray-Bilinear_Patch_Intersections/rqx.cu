@@ -1,12 +1,16 @@
 RT_PROGRAM void intersectPatch(int prim_idx) {
 	// ray is rtDeclareVariable(Ray,ray,rtCurrentRay,) in OptiX
-	const PatchData& patch = patchdata[prim_idx]; // patchdata is optix::rtBuffer
-	const float3* q = patch.coefficients();       // 4 corners + "normal" qn
-	float3 q00 = q[0], q10 = q[1], q11 = q[2], q01 = q[3];
+	// patchdata is optix::rtBuffer<PatchBlock>, see cpu_test/cpu_test/patch_data.h
+	// vertex_normals is optix::rtBuffer<float3>, 4 per patch (SHADING_NORMALS only)
+	const PatchBlock& block = patchdata[prim_idx/PATCH_BLOCK_SIZE];
+	const PatchCoefficients q = block.coefficients(prim_idx%PATCH_BLOCK_SIZE);
+	float3 q00 = q.q00, q10 = q.q10;
+	// e10 is only used for the normal of a reported hit, so it is not stored
+	// (that would add 12 bytes to every test) but recomputed
 	float3 e10 = q10 - q00; // q01---------------q11
-	float3 e11 = q11 - q10; // |                   |
-	float3 e00 = q01 - q00; // | e00           e11 |  we precompute
-	float3 qn  = q[4];      // |        e10        |  qn = cross(q10-q00,q01-q11)
+	float3 e11 = q.e11;     // |                   |  we precompute
+	float3 e00 = q.e00;     // | e00           e11 |  e00 = q01-q00, e11 = q11-q10
+	float3 qn  = q.qn;      // |        e10        |  qn = cross(q10-q00,q01-q11)
 	q00 -= ray.origin;      // q00---------------q10
 	q10 -= ray.origin;
 	float a = dot(cross(q00, ray.direction), e00); // the equation is
@@ -52,11 +56,11 @@ RT_PROGRAM void intersectPatch(int prim_idx) {
 	if (rtPotentialIntersection(t)) {
 		// Fill the intersection structure irec.
 		// Normal(s) for the closest hit will be normalized in a shader.
-		float3 du = lerp(e10, q11 - q01, v);
+		float3 du = lerp(e10, e10 + e11 - e00, v); // q11 - q01 = e10 + e11 - e00
 		float3 dv = lerp(e00, e11, u);
 		irec.geometric_normal = cross(du, dv);
 		#if defined(SHADING_NORMALS)
-		const float3* vn = patch.vertex_normals;
+		const float3* vn = &vertex_normals[4*prim_idx];
 		irec.shading_normal = lerp(lerp(vn[0],vn[1],u), 
 		                           lerp(vn[3],vn[2],u),v);
 		#else
@@ -0,0 +1,220 @@
+//
+// utility code to save and restore the progressive rendering state (the
+// accumulation buffer, the adaptive sampling state, the iteration count and
+// the Kernel_params that determine the image) of the host renderer
+//
+// File layout, little-endian:
+//   char magic[4] = "VCKP"; uint32 version = 2;
+//   uint32 width, height, iteration;
+//   checkpoint_params_t params;
+//   uint32 env_name_length; char env_name[env_name_length];
+//   uint32 grid_name_length; char grid_name[grid_name_length];
+//   float accum[width * height * 3]; uint32 collisions[width * height];
+//   uint32 adaptive; /* 1 if followed by the adaptive sampling state */
+//   Pixel_stats stats[width * height]; uint8 convergence_mask[width * height];
+//   uint32 checksum; /* FNV-1a of everything before it */
+//
+// A checkpoint is written to "<name>.tmp" and renamed over the previous one
+// when complete, so that an interrupted write never destroys the last good
+// checkpoint.
+//
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "volume_kernel.h"
+
+/* the image-defining part of Kernel_params, in a fixed layout */
+typedef struct {
+    float cam_pos[3], cam_dir[3], cam_right[3], cam_up[3];
+    float cam_focal;
+    uint32_t max_interactions;
+    uint32_t environment_type, environment_sampling;
+    uint32_t volume_type, majorant_type;
+    uint32_t transmittance_type;
+    float max_extinction, albedo, residual_control;
+    float convergence_threshold;
+    uint32_t min_samples;
+} checkpoint_params_t;
+
+/* host side rendering state */
+typedef struct {
+    unsigned int width, height;
+    unsigned int iteration;
+    checkpoint_params_t params;
+    std::string env_name, grid_name; /* empty if none */
+    std::vector<float3> accum;
+    std::vector<unsigned int> collisions;
+    std::vector<Pixel_stats> stats;         /* empty without adaptive sampling */
+    std::vector<unsigned char> convergence_mask;
+} checkpoint_t;
+
+static void checkpoint_get_params(checkpoint_params_t *params, const Kernel_params &kernel_params)
+{
+    memset(params, 0, sizeof(checkpoint_params_t));
+    const float3 *vectors[4] = {
+        &kernel_params.cam_pos, &kernel_params.cam_dir, &kernel_params.cam_right, &kernel_params.cam_up };
+    float *dst[4] = { params->cam_pos, params->cam_dir, params->cam_right, params->cam_up };
+    for (unsigned int i = 0; i < 4; ++i) {
+        dst[i][0] = vectors[i]->x;
+        dst[i][1] = vectors[i]->y;
+        dst[i][2] = vectors[i]->z;
+    }
+    params->cam_focal = kernel_params.cam_focal;
+    params->max_interactions = kernel_params.max_interactions;
+    params->environment_type = kernel_params.environment_type;
+    params->environment_sampling = kernel_params.environment_sampling;
+    params->volume_type = kernel_params.volume_type;
+    params->majorant_type = kernel_params.majorant_type;
+    params->transmittance_type = kernel_params.transmittance_type;
+    params->max_extinction = kernel_params.max_extinction;
+    params->albedo = kernel_params.albedo;
+    params->residual_control = kernel_params.residual_control;
+    params->convergence_threshold = kernel_params.convergence_threshold;
+    params->min_samples = kernel_params.min_samples;
+}
+
+static void checkpoint_set_params(Kernel_params &kernel_params, const checkpoint_params_t *params)
+{
+    float3 *vectors[4] = {
+        &kernel_params.cam_pos, &kernel_params.cam_dir, &kernel_params.cam_right, &kernel_params.cam_up };
+    const float *src[4] = { params->cam_pos, params->cam_dir, params->cam_right, params->cam_up };
+    for (unsigned int i = 0; i < 4; ++i)
+        *vectors[i] = make_float3(src[i][0], src[i][1], src[i][2]);
+    kernel_params.cam_focal = params->cam_focal;
+    kernel_params.max_interactions = params->max_interactions;
+    kernel_params.environment_type = params->environment_type;
+    kernel_params.environment_sampling = params->environment_sampling;
+    kernel_params.volume_type = params->volume_type;
+    kernel_params.majorant_type = params->majorant_type;
+    kernel_params.transmittance_type = params->transmittance_type;
+    kernel_params.max_extinction = params->max_extinction;
+    kernel_params.albedo = params->albedo;
+    kernel_params.residual_control = params->residual_control;
+    kernel_params.convergence_threshold = params->convergence_threshold;
+    kernel_params.min_samples = params->min_samples;
+}
+
+/* FNV-1a, continued from hash */
+static uint32_t checkpoint_hash(uint32_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+/* fwrite/fread that also update the checksum */
+static bool checkpoint_write(FILE *fp, uint32_t *hash, const void *data, size_t size)
+{
+    *hash = checkpoint_hash(*hash, data, size);
+    return fwrite(data, 1, size, fp) == size;
+}
+
+static bool checkpoint_read(FILE *fp, uint32_t *hash, void *data, size_t size)
+{
+    if (fread(data, 1, size, fp) != size)
+        return false;
+    *hash = checkpoint_hash(*hash, data, size);
+    return true;
+}
+
+static bool checkpoint_write_string(FILE *fp, uint32_t *hash, const std::string &s)
+{
+    const uint32_t length = (uint32_t)s.size();
+    return checkpoint_write(fp, hash, &length, sizeof(length)) && checkpoint_write(fp, hash, s.data(), length);
+}
+
+static bool checkpoint_read_string(FILE *fp, uint32_t *hash, std::string &s)
+{
+    uint32_t length;
+    if (!checkpoint_read(fp, hash, &length, sizeof(length)) || length > 4096)
+        return false;
+    s.resize(length);
+    return length == 0 || checkpoint_read(fp, hash, &s[0], length);
+}
+
+static bool save_checkpoint(const checkpoint_t *checkpoint, const char *filename)
+{
+    const size_t n = (size_t)checkpoint->width * checkpoint->height;
+    const uint32_t adaptive = checkpoint->stats.empty() ? 0 : 1;
+    if (checkpoint->accum.size() != n || checkpoint->collisions.size() != n ||
+        (adaptive && (checkpoint->stats.size() != n || checkpoint->convergence_mask.size() != n)))
+        return false;
+
+    const std::string tmp_name = std::string(filename) + ".tmp";
+    FILE *fp = fopen(tmp_name.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    uint32_t hash = 2166136261u;
+    const uint32_t header[4] = { 2, checkpoint->width, checkpoint->height, checkpoint->iteration };
+    bool ok = checkpoint_write(fp, &hash, "VCKP", 4) &&
+        checkpoint_write(fp, &hash, header, sizeof(header)) &&
+        checkpoint_write(fp, &hash, &checkpoint->params, sizeof(checkpoint_params_t)) &&
+        checkpoint_write_string(fp, &hash, checkpoint->env_name) &&
+        checkpoint_write_string(fp, &hash, checkpoint->grid_name) &&
+        checkpoint_write(fp, &hash, checkpoint->accum.data(), n * sizeof(float3)) &&
+        checkpoint_write(fp, &hash, checkpoint->collisions.data(), n * sizeof(unsigned int)) &&
+        checkpoint_write(fp, &hash, &adaptive, sizeof(adaptive));
+    if (adaptive)
+        ok = ok && checkpoint_write(fp, &hash, checkpoint->stats.data(), n * sizeof(Pixel_stats)) &&
+            checkpoint_write(fp, &hash, checkpoint->convergence_mask.data(), n);
+    ok = ok && fwrite(&hash, sizeof(hash), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        remove(tmp_name.c_str());
+        return false;
+    }
+
+#if defined(_WIN32)
+    remove(filename); /* rename does not replace existing files */
+#endif
+    return rename(tmp_name.c_str(), filename) == 0;
+}
+
+static bool load_checkpoint(checkpoint_t *checkpoint, const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return false;
+
+    uint32_t hash = 2166136261u;
+    char magic[4];
+    uint32_t header[4]; /* version, width, height, iteration */
+    bool ok = checkpoint_read(fp, &hash, magic, 4) && memcmp(magic, "VCKP", 4) == 0 &&
+        checkpoint_read(fp, &hash, header, sizeof(header)) && header[0] == 2 &&
+        header[1] > 0 && header[2] > 0 &&
+        checkpoint_read(fp, &hash, &checkpoint->params, sizeof(checkpoint_params_t)) &&
+        checkpoint_read_string(fp, &hash, checkpoint->env_name) &&
+        checkpoint_read_string(fp, &hash, checkpoint->grid_name);
+    if (ok) {
+        checkpoint->width = header[1];
+        checkpoint->height = header[2];
+        checkpoint->iteration = header[3];
+        const size_t n = (size_t)checkpoint->width * checkpoint->height;
+        checkpoint->accum.resize(n);
+        checkpoint->collisions.resize(n);
+        uint32_t adaptive = 0, stored_hash;
+        ok = checkpoint_read(fp, &hash, checkpoint->accum.data(), n * sizeof(float3)) &&
+            checkpoint_read(fp, &hash, checkpoint->collisions.data(), n * sizeof(unsigned int)) &&
+            checkpoint_read(fp, &hash, &adaptive, sizeof(adaptive));
+        checkpoint->stats.resize(adaptive ? n : 0);
+        checkpoint->convergence_mask.resize(adaptive ? n : 0);
+        if (adaptive)
+            ok = ok && checkpoint_read(fp, &hash, checkpoint->stats.data(), n * sizeof(Pixel_stats)) &&
+                checkpoint_read(fp, &hash, checkpoint->convergence_mask.data(), n);
+        ok = ok && fread(&stored_hash, sizeof(stored_hash), 1, fp) == 1 && stored_hash == hash;
+    }
+    fclose(fp);
+    return ok;
+}
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,109 @@
+//
+// Counter-based random numbers for the volume path tracer, header-only for
+// both the CUDA kernel and the host backend
+//
+// Every number is a pure function of (pixel, sample, dimension): the
+// Philox4x32-10 block cipher [Salmon et al. 2011] encrypts the counter
+// (dimension / 4, sample, pixel, 0) under a fixed key, and the four words of
+// the result are dimensions 4 * (dimension / 4) to 4 * (dimension / 4) + 3.
+// Since the cipher is a bijection, no two (pixel, sample) pairs ever share a
+// number, however many dimensions a path consumes (up to 2^34), which an
+// offset into one sequence per pixel can not guarantee.
+//
+// Rand_state walks the dimensions of one (pixel, sample) pair in order with
+// one Philox evaluation per four numbers, like curand_uniform, but without
+// the 128-bit counter carries and converting only the upper 24 bits.
+//
+
+#ifndef COUNTER_RNG_H
+#define COUNTER_RNG_H
+
+#define RAND_KEY_X 0x8A5CD789u
+#define RAND_KEY_Y 0x635D8DB5u
+
+__device__ inline unsigned int rand_mulhi(const unsigned int a, const unsigned int b)
+{
+#if defined(__CUDA_ARCH__)
+    return __umulhi(a, b);
+#else
+    return (unsigned int)(((unsigned long long)a * b) >> 32);
+#endif
+}
+
+__device__ inline uint4 rand_philox4x32_10(uint4 c)
+{
+    unsigned int kx = RAND_KEY_X, ky = RAND_KEY_Y;
+    for (unsigned int i = 0; i < 10; ++i) {
+        const unsigned int hi0 = rand_mulhi(0xD2511F53u, c.x);
+        const unsigned int lo0 = 0xD2511F53u * c.x;
+        const unsigned int hi1 = rand_mulhi(0xCD9E8D57u, c.z);
+        const unsigned int lo1 = 0xCD9E8D57u * c.z;
+        c = make_uint4(hi1 ^ c.y ^ kx, lo1, hi0 ^ c.w ^ ky, lo0);
+        kx += 0x9E3779B9u;
+        ky += 0xBB67AE85u;
+    }
+    return c;
+}
+
+// Uniform float in [0, 1) from the upper 24 bits, so that 1 - u is never 0.
+__device__ inline float rand_to_float(const unsigned int r)
+{
+    return (float)(r >> 8) * (1.0f / 16777216.0f);
+}
+
+// Random number of dimension dimension of sample sample of pixel pixel,
+// without any state.
+__device__ inline float rand_uniform_at(
+    const unsigned int pixel,
+    const unsigned int sample,
+    const unsigned int dimension)
+{
+    const uint4 r = rand_philox4x32_10(make_uint4(dimension >> 2, sample, pixel, 0));
+    switch (dimension & 3) {
+        case 0: return rand_to_float(r.x);
+        case 1: return rand_to_float(r.y);
+        case 2: return rand_to_float(r.z);
+        default: return rand_to_float(r.w);
+    }
+}
+
+// Consecutive dimensions of one (pixel, sample) pair.
+struct Rand_state {
+    uint4 output;           // dimensions 4 * block to 4 * block + 3
+    unsigned int pixel;
+    unsigned int sample;
+    unsigned int block;
+    unsigned int index;     // next word of output
+};
+
+// Start at dimension dimension of sample sample of pixel pixel.
+__device__ inline void rand_init(
+    Rand_state &state,
+    const unsigned int pixel,
+    const unsigned int sample,
+    const unsigned int dimension = 0)
+{
+    state.pixel = pixel;
+    state.sample = sample;
+    state.block = dimension >> 2;
+    state.index = dimension & 3;
+    state.output = rand_philox4x32_10(make_uint4(state.block, sample, pixel, 0));
+}
+
+__device__ inline float rand_uniform(Rand_state *state)
+{
+    if (state->index == 4) {
+        state->output = rand_philox4x32_10(make_uint4(++state->block, state->sample, state->pixel, 0));
+        state->index = 0;
+    }
+    unsigned int r;
+    switch (state->index++) {
+        case 0: r = state->output.x; break;
+        case 1: r = state->output.y; break;
+        case 2: r = state->output.z; break;
+        default: r = state->output.w; break;
+    }
+    return rand_to_float(r);
+}
+
+#endif // COUNTER_RNG_H
@@ -0,0 +1,99 @@
+//
+// Host-side stand-ins for the CUDA types and functions used by the volume
+// path tracer, so that volume_path_tracer.h also compiles as plain C++
+//
+
+#ifndef CUDA_COMPAT_H
+#define CUDA_COMPAT_H
+
+#if !defined(__CUDACC__)
+
+#include <cmath>
+
+#define __device__
+#define __host__
+#define __global__
+
+// Vector types.
+struct float3 { float x, y, z; };
+struct float4 { float x, y, z, w; };
+struct uint2 { unsigned int x, y; };
+struct uint3 { unsigned int x, y, z; };
+struct uint4 { unsigned int x, y, z, w; };
+
+inline float3 make_float3(const float x, const float y, const float z)
+{
+    float3 v = { x, y, z };
+    return v;
+}
+inline float4 make_float4(const float x, const float y, const float z, const float w)
+{
+    float4 v = { x, y, z, w };
+    return v;
+}
+inline uint2 make_uint2(const unsigned int x, const unsigned int y)
+{
+    uint2 v = { x, y };
+    return v;
+}
+inline uint3 make_uint3(const unsigned int x, const unsigned int y, const unsigned int z)
+{
+    uint3 v = { x, y, z };
+    return v;
+}
+inline uint4 make_uint4(
+    const unsigned int x, const unsigned int y, const unsigned int z, const unsigned int w)
+{
+    uint4 v = { x, y, z, w };
+    return v;
+}
+
+// A float4 texture in host memory, standing in for a texture object with
+// normalized coordinates, linear filtering, wrap mode in x and clamp mode in y
+// (the setup of create_environment in main.cpp).
+struct Cpu_texture {
+    const float4 *data;
+    unsigned int width, height;
+};
+typedef const Cpu_texture *cudaTextureObject_t;
+
+template <typename T>
+T tex2D(cudaTextureObject_t tex, float x, float y);
+
+template <>
+inline float4 tex2D<float4>(cudaTextureObject_t tex, float x, float y)
+{
+    x = (x - floorf(x)) * (float)tex->width - 0.5f;
+    y = y * (float)tex->height - 0.5f;
+    const float fx = floorf(x);
+    const float fy = floorf(y);
+    const float ax = x - fx;
+    const float ay = y - fy;
+
+    const int w = (int)tex->width;
+    const int h = (int)tex->height;
+    int x0 = (int)fx % w;
+    if (x0 < 0)
+        x0 += w;
+    const int x1 = x0 + 1 < w ? x0 + 1 : 0;
+    const int y0 = (int)fy < 0 ? 0 : ((int)fy >= h ? h - 1 : (int)fy);
+    const int y1 = (int)fy + 1 < 0 ? 0 : ((int)fy + 1 >= h ? h - 1 : (int)fy + 1);
+
+    const float4 &a = tex->data[y0 * w + x0];
+    const float4 &b = tex->data[y0 * w + x1];
+    const float4 &c = tex->data[y1 * w + x0];
+    const float4 &d = tex->data[y1 * w + x1];
+    const float wa = (1.0f - ax) * (1.0f - ay);
+    const float wb = ax * (1.0f - ay);
+    const float wc = (1.0f - ax) * ay;
+    const float wd = ax * ay;
+    return make_float4(
+        wa * a.x + wb * b.x + wc * c.x + wd * d.x,
+        wa * a.y + wb * b.y + wc * c.y + wd * d.y,
+        wa * a.z + wb * b.z + wc * c.z + wd * d.z,
+        wa * a.w + wb * b.w + wc * c.w + wd * d.w);
+}
+
+#endif // !__CUDACC__
+
+#endif // CUDA_COMPAT_H
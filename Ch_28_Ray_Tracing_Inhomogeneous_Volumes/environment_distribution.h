@@ -0,0 +1,134 @@
+//
+// utility code to build the importance sampling distribution of a lat-long
+// environment map (Environment_distribution in volume_kernel.h)
+//
+// The distribution is piecewise constant over the texels, with a marginal
+// CDF over the rows and a conditional CDF per row. A texel's weight is the
+// largest luminance in its 3x3 neighborhood times sin(theta). Taking the
+// neighborhood maximum keeps every direction the bilinear texture lookup can
+// return light from inside the support of the distribution.
+//
+
+#ifndef ENVIRONMENT_DISTRIBUTION_H
+#define ENVIRONMENT_DISTRIBUTION_H
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "volume_kernel.h"
+
+/* host side distribution */
+typedef struct {
+    unsigned int rx, ry;   /* texels */
+    float *marginal_cdf;   /* ry + 1 entries */
+    float *conditional_cdf;/* ry * (rx + 1) entries */
+    float *pdf;            /* rx * ry entries, density over [0, 1]^2 */
+} environment_distribution_t;
+
+static void free_environment_distribution(environment_distribution_t *dist)
+{
+    free(dist->marginal_cdf);
+    free(dist->conditional_cdf);
+    free(dist->pdf);
+    memset(dist, 0, sizeof(environment_distribution_t));
+}
+
+/* build the distribution of a float4 lat-long map as returned by
+   load_hdr_float4; fails for maps without any light */
+static bool build_environment_distribution(
+    environment_distribution_t *dist,
+    const float *pixels,
+    unsigned int rx,
+    unsigned int ry)
+{
+    memset(dist, 0, sizeof(environment_distribution_t));
+    if (rx == 0 || ry == 0)
+        return false;
+    dist->rx = rx;
+    dist->ry = ry;
+    dist->marginal_cdf = (float *)malloc((ry + 1) * sizeof(float));
+    dist->conditional_cdf = (float *)malloc((size_t)ry * (rx + 1) * sizeof(float));
+    dist->pdf = (float *)malloc((size_t)rx * ry * sizeof(float));
+    float *luminance = (float *)malloc((size_t)rx * ry * sizeof(float));
+    double *row_sums = (double *)malloc(ry * sizeof(double));
+    if (!dist->marginal_cdf || !dist->conditional_cdf || !dist->pdf || !luminance || !row_sums) {
+        free(luminance);
+        free(row_sums);
+        free_environment_distribution(dist);
+        return false;
+    }
+
+    for (size_t i = 0; i < (size_t)rx * ry; ++i) {
+        const float *p = pixels + 4 * i;
+        const float l = 0.2126f * p[0] + 0.7152f * p[1] + 0.0722f * p[2];
+        luminance[i] = l > 0.0f ? l : 0.0f;
+    }
+
+    /* texel weights (kept in pdf for now) and the conditional CDFs */
+    double sum = 0.0;
+    for (unsigned int y = 0; y < ry; ++y) {
+        const float sin_theta = (float)sin(M_PI * (y + 0.5) / ry);
+        const unsigned int y0 = y > 0 ? y - 1 : 0;
+        const unsigned int y1 = y + 1 < ry ? y + 1 : ry - 1;
+        double row_sum = 0.0;
+        float *cdf = dist->conditional_cdf + (size_t)y * (rx + 1);
+        cdf[0] = 0.0f;
+        for (unsigned int x = 0; x < rx; ++x) {
+            const unsigned int xs[3] = { x > 0 ? x - 1 : rx - 1, x, x + 1 < rx ? x + 1 : 0 };
+            float m = 0.0f;
+            for (unsigned int j = y0; j <= y1; ++j)
+                for (unsigned int i = 0; i < 3; ++i) {
+                    const float l = luminance[(size_t)j * rx + xs[i]];
+                    if (l > m)
+                        m = l;
+                }
+            const float f = m * sin_theta;
+            dist->pdf[(size_t)y * rx + x] = f;
+            row_sum += f;
+            cdf[x + 1] = (float)row_sum;
+        }
+        for (unsigned int x = 1; x <= rx; ++x)
+            cdf[x] = row_sum > 0.0 ? (float)(cdf[x] / row_sum) : (float)x / (float)rx;
+        cdf[rx] = 1.0f;
+        row_sums[y] = row_sum;
+        sum += row_sum;
+    }
+    free(luminance);
+
+    if (!(sum > 0.0)) {
+        free(row_sums);
+        free_environment_distribution(dist);
+        return false;
+    }
+
+    double acc = 0.0;
+    dist->marginal_cdf[0] = 0.0f;
+    for (unsigned int y = 0; y < ry; ++y) {
+        acc += row_sums[y];
+        dist->marginal_cdf[y + 1] = (float)(acc / sum);
+    }
+    dist->marginal_cdf[ry] = 1.0f;
+    free(row_sums);
+
+    /* the mean weight has density 1 */
+    const float scale = (float)((double)rx * ry / sum);
+    for (size_t i = 0; i < (size_t)rx * ry; ++i)
+        dist->pdf[i] *= scale;
+    return true;
+}
+
+/* kernel view of a host distribution; the CUDA application copies the three
+   arrays to the device and replaces the pointers */
+static Environment_distribution environment_distribution_view(const environment_distribution_t *dist)
+{
+    Environment_distribution d;
+    d.size = make_uint2(dist->rx, dist->ry);
+    d.marginal_cdf = dist->marginal_cdf;
+    d.conditional_cdf = dist->conditional_cdf;
+    d.pdf = dist->pdf;
+    return d;
+}
+
+#endif // ENVIRONMENT_DISTRIBUTION_H
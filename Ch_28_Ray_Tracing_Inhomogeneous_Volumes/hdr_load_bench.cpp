@@ -0,0 +1,96 @@
+//
+// Load time benchmark for hdr_loader.h: loads an environment map with the
+// stream loader and with the mapped, multithreaded loader and checks that
+// both give the same pixels
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+#include "hdr_loader.h"
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options] envmap.hdr\n"
+        "  --repeat N      loads per loader, the fastest is reported (default 5)\n"
+        "  --threads N     decoding threads of the mapped loader (default: all hardware threads)\n",
+        name);
+    exit(EXIT_FAILURE);
+}
+
+// Fastest of num_repeats loads, in seconds; the pixels of the last load are
+// returned.
+template <typename Load>
+static double time_load(
+    Load load,
+    unsigned int num_repeats,
+    float **pixels,
+    unsigned int *rx,
+    unsigned int *ry)
+{
+    double best = 0.0;
+    *pixels = NULL;
+    for (unsigned int i = 0; i < num_repeats; ++i) {
+        free(*pixels);
+        const auto start = std::chrono::steady_clock::now();
+        if (!load(pixels, rx, ry))
+            return -1.0;
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+int main(const int argc, const char* argv[])
+{
+    const char *filename = NULL;
+    unsigned int num_repeats = 5;
+    unsigned int num_threads = 0;
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--repeat") == 0 && has_value)
+            num_repeats = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && has_value)
+            num_threads = (unsigned int)atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !filename)
+            filename = argv[i];
+        else
+            usage(argv[0]);
+    }
+    if (!filename)
+        usage(argv[0]);
+    if (num_repeats == 0)
+        num_repeats = 1;
+
+    float *reference, *pixels;
+    unsigned int ref_rx, ref_ry, rx, ry;
+    const double stream_seconds = time_load(
+        [&](float **p, unsigned int *x, unsigned int *y) { return load_hdr_float4_stream(p, x, y, filename); },
+        num_repeats, &reference, &ref_rx, &ref_ry);
+    const double mapped_seconds = time_load(
+        [&](float **p, unsigned int *x, unsigned int *y) { return load_hdr_float4(p, x, y, filename, num_threads); },
+        num_repeats, &pixels, &rx, &ry);
+    if (stream_seconds < 0.0 || mapped_seconds < 0.0) {
+        fprintf(stderr, "error loading environment map file %s\n", filename);
+        return EXIT_FAILURE;
+    }
+
+    const double megapixels = double(rx) * ry * 1e-6;
+    printf("%s: %ux%u\n", filename, rx, ry);
+    printf("stream loader: %8.2f ms, %7.1f Mpixels/s\n", 1e3 * stream_seconds, megapixels / stream_seconds);
+    printf("mapped loader: %8.2f ms, %7.1f Mpixels/s (%u threads), %.2fx\n", 1e3 * mapped_seconds,
+           megapixels / mapped_seconds, num_threads ? num_threads : std::thread::hardware_concurrency(),
+           stream_seconds / mapped_seconds);
+
+    const bool identical = rx == ref_rx && ry == ref_ry &&
+        memcmp(pixels, reference, size_t(rx) * ry * sizeof(float) * 4) == 0;
+    printf("pixels %s\n", identical ? "bit-identical" : "DIFFER");
+
+    free(reference);
+    free(pixels);
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,8 +2,27 @@
 // utility code to load HDR image files in Radiance's RGBE-encoded ".hdr" file format
 //
 
+#include <atomic>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HDR_USE_SSE2
+#endif
 
 static const char *find_identifier(const char *line, const char *identifier)
 {
@@ -246,7 +265,8 @@ static hdr_error_code_t hdr_read_image_pixels_float(
     return HDR_SUCCESS;
 }
 
-static bool load_hdr_float4(float **pixels, unsigned int *rx, unsigned int *ry, const char *filename)
+/* reference loader, reading the file as a stream one scanline at a time */
+static bool load_hdr_float4_stream(float **pixels, unsigned int *rx, unsigned int *ry, const char *filename)
 {
     *pixels = NULL;
     *rx = *ry = 0;
@@ -275,3 +295,298 @@ static bool load_hdr_float4(float **pixels, unsigned int *rx, unsigned int *ry,
     return true;
 }
 
+/* read-only mapping of a whole file */
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+#if defined(_WIN32)
+    HANDLE file, mapping;
+#endif
+} hdr_mapped_file_t;
+
+static bool hdr_map_file(hdr_mapped_file_t *const map, const char *filename)
+{
+    memset(map, 0, sizeof(hdr_mapped_file_t));
+#if defined(_WIN32)
+    map->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (map->file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(map->file, &size) || size.QuadPart == 0 ||
+        !(map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL))) {
+        CloseHandle(map->file);
+        return false;
+    }
+    map->data = (const unsigned char *)MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!map->data) {
+        CloseHandle(map->mapping);
+        CloseHandle(map->file);
+        return false;
+    }
+    map->size = (size_t)size.QuadPart;
+#else
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    madvise(data, (size_t)st.st_size, MADV_WILLNEED);
+    map->data = (const unsigned char *)data;
+    map->size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+static void hdr_unmap_file(hdr_mapped_file_t *const map)
+{
+#if defined(_WIN32)
+    UnmapViewOfFile(map->data);
+    CloseHandle(map->mapping);
+    CloseHandle(map->file);
+#else
+    munmap((void *)map->data, map->size);
+#endif
+    memset(map, 0, sizeof(hdr_mapped_file_t));
+}
+
+/* is the scanline at p run length encoded? (same test as hdr_read_image_scanline_rle) */
+static bool hdr_is_rle_scanline(const unsigned char *const p, const size_t avail)
+{
+    return avail >= 4 && p[0] == 2 && p[1] == 2 && !(p[2] & 128);
+}
+
+/* find the start of every scanline in the pixel data without decoding it,
+   validating the run lengths on the way, so that the scanlines can then be
+   decoded independently */
+static hdr_error_code_t hdr_find_scanlines(
+    const hdr_image_header_t * const header,
+    const unsigned char * const data,
+    const size_t size,
+    size_t * const offsets)
+{
+    const int rle = !(header->rx < 8 || header->rx > 0x7fff);
+    const unsigned int len = header->rx;
+
+    size_t p = 0;
+    for (unsigned int j = 0; j < header->ry; ++j)
+    {
+        offsets[j] = p;
+        if (!rle || !hdr_is_rle_scanline(data + p, size - p))
+        {
+            if (size - p < (size_t)len * 4)
+                return HDR_ERROR_READING_PIXELS;
+            p += (size_t)len * 4;
+            continue;
+        }
+
+        if ((unsigned int)(data[p + 2] << 8 | data[p + 3]) != len)
+            return HDR_ERROR_READING_PIXELS;
+        p += 4;
+
+        for (unsigned int i = 0; i < 4; ++i) /* components */
+        {
+            for (unsigned int pos = 0; pos < len;) /* position in scanline */
+            {
+                if (p >= size)
+                    return HDR_ERROR_READING_PIXELS;
+                unsigned int num = data[p++];
+                if (num > 128) /* run: one value */
+                {
+                    num &= 127;
+                    p += 1;
+                }
+                else /* non-run: num values */
+                    p += num;
+                if (pos + num > len || p > size)
+                    return HDR_ERROR_READING_PIXELS;
+                pos += num;
+            }
+        }
+    }
+    return HDR_SUCCESS;
+}
+
+/* decode a run length encoded scanline already checked by hdr_find_scanlines */
+static void hdr_decode_scanline_rle(
+    unsigned char *const rgbe_buf,
+    const unsigned int len,
+    const unsigned char *p)
+{
+    p += 4;
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        unsigned char *dst = rgbe_buf + i;
+        unsigned char *const end = dst + (size_t)len * 4;
+        while (dst < end)
+        {
+            unsigned int num = *p++;
+            if (num > 128)
+            {
+                num &= 127;
+                const unsigned char val = *p++;
+                for (unsigned int j = 0; j < num; ++j, dst += 4)
+                    *dst = val;
+            }
+            else
+            {
+                for (unsigned int j = 0; j < num; ++j, dst += 4)
+                    *dst = *p++;
+            }
+        }
+    }
+}
+
+/* convert n RGBE pixels to float4 (alpha 0), giving the same bits as
+   hdr_rgbe_to_color: the mantissa + 0.5 is exact in float and the scale is a
+   power of two, so the single rounding of the product is the same in SIMD */
+static void hdr_rgbe_to_float4(
+    float *const out,
+    const unsigned char *const rgbe,
+    const unsigned int n)
+{
+    unsigned int i = 0;
+#ifdef HDR_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i nine = _mm_set1_epi32(9);
+    const __m128i exp_mask = _mm_set1_epi32(0x7f800000);
+    const __m128i rgb_mask = _mm_set_epi32(0, -1, -1, -1);
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128i b = _mm_loadu_si128((const __m128i *)(rgbe + 4 * i));
+        const __m128i lo = _mm_unpacklo_epi8(b, zero);
+        const __m128i hi = _mm_unpackhi_epi8(b, zero);
+        const __m128i c[4] = {
+            _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+            _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+        for (unsigned int k = 0; k < 4; ++k)
+        {
+            /* 2^(e - 136) in the color channels, 0 in alpha and for e == 0 */
+            const __m128i e = _mm_shuffle_epi32(c[k], _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i scale = _mm_and_si128(_mm_slli_epi32(_mm_sub_epi32(e, nine), 23), exp_mask);
+            scale = _mm_and_si128(scale, _mm_and_si128(_mm_cmpgt_epi32(e, zero), rgb_mask));
+            const __m128 v = _mm_add_ps(_mm_cvtepi32_ps(c[k]), half);
+            _mm_storeu_ps(out + 4 * (i + k), _mm_mul_ps(v, _mm_castsi128_ps(scale)));
+        }
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        hdr_rgbe_to_color(out + 4 * i, rgbe + 4 * i);
+        out[4 * i + 3] = 0.0f;
+    }
+}
+
+/* decode all scanlines into float4 pixels; the threads take blocks of
+   scanlines in turn */
+static hdr_error_code_t hdr_decode_image_pixels_float4(
+    const hdr_image_header_t * const header,
+    float * const pixels,
+    const unsigned char * const data,
+    const size_t size,
+    const size_t * const offsets,
+    unsigned int num_threads)
+{
+    const unsigned int block = 16;
+    const unsigned int num_blocks = (header->ry + block - 1) / block;
+    if (num_threads > num_blocks)
+        num_threads = num_blocks;
+    if (num_threads == 0)
+        num_threads = 1;
+
+    std::atomic<unsigned int> next_block(0);
+    std::atomic<bool> failed(false);
+    auto work = [&]() {
+        unsigned char *rgbe_buf = (unsigned char *)malloc(header->rx * 4);
+        if (!rgbe_buf) {
+            failed = true;
+            return;
+        }
+        for (unsigned int b = next_block++; b < num_blocks; b = next_block++)
+        {
+            const unsigned int j1 = (b + 1) * block < header->ry ? (b + 1) * block : header->ry;
+            for (unsigned int j = b * block; j < j1; ++j)
+            {
+                const unsigned char *rgbe = data + offsets[j];
+                if (!(header->rx < 8 || header->rx > 0x7fff) &&
+                    hdr_is_rle_scanline(rgbe, size - offsets[j]))
+                {
+                    hdr_decode_scanline_rle(rgbe_buf, header->rx, rgbe);
+                    rgbe = rgbe_buf;
+                }
+                hdr_rgbe_to_float4(pixels + 4 * (size_t)j * header->rx, rgbe, header->rx);
+            }
+        }
+        free(rgbe_buf);
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < num_threads; ++t)
+        threads.emplace_back(work);
+    work();
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+
+    return failed ? HDR_ERROR_ALLOCATION_FAILURE : HDR_SUCCESS;
+}
+
+/* load an image as float4 pixels (alpha 0): the file is mapped into memory,
+   the scanline starts are found in one pass and the scanlines are then
+   decoded on num_threads threads (0: all hardware threads); falls back to the
+   stream loader if the file cannot be mapped */
+static bool load_hdr_float4(
+    float **pixels, unsigned int *rx, unsigned int *ry, const char *filename,
+    unsigned int num_threads = 0)
+{
+    *pixels = NULL;
+    *rx = *ry = 0;
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return false;
+
+    hdr_image_header_t header;
+    if (hdr_read_image_header(&header, fp) != HDR_SUCCESS) {
+        fclose(fp);
+        return false;
+    }
+    const long data_offset = ftell(fp);
+    fclose(fp);
+
+    hdr_mapped_file_t map;
+    if (data_offset < 0 || !hdr_map_file(&map, filename))
+        return load_hdr_float4_stream(pixels, rx, ry, filename);
+    if ((size_t)data_offset > map.size) {
+        hdr_unmap_file(&map);
+        return false;
+    }
+    const unsigned char *data = map.data + data_offset;
+    const size_t size = map.size - data_offset;
+
+    size_t *offsets = (size_t *)malloc((header.ry ? header.ry : 1) * sizeof(size_t));
+    *pixels = (float *)malloc((size_t)header.rx * header.ry * sizeof(float) * 4);
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+
+    const bool ok = offsets && *pixels &&
+        hdr_find_scanlines(&header, data, size, offsets) == HDR_SUCCESS &&
+        hdr_decode_image_pixels_float4(&header, *pixels, data, size, offsets, num_threads) == HDR_SUCCESS;
+
+    free(offsets);
+    hdr_unmap_file(&map);
+    if (!ok) {
+        free(*pixels);
+        *pixels = NULL;
+        return false;
+    }
+    *rx = header.rx;
+    *ry = header.ry;
+    return true;
+}
@@ -16,8 +16,10 @@
 #include <cstring>
 #include <algorithm>
 
+#include "environment_distribution.h"
 #include "hdr_loader.h"
 #include "volume_kernel.h"
+#include "voxel_grid.h"
 
 #define check_success(expr) \
     do { \
@@ -166,6 +168,9 @@ struct Window_context
     float exposure;
 
     unsigned int config_type;
+    bool no_env_sampling;
+    unsigned int transmittance_type;
+    bool adaptive_sampling;
 };
 
 // GLFW scroll callback.
@@ -197,6 +202,16 @@ static void handle_key(GLFWwindow *window, int key, int scancode, int action, in
                 break;
             case GLFW_KEY_SPACE:
                 ++ctx->config_type;
+                break;
+            case GLFW_KEY_N:
+                ctx->no_env_sampling = !ctx->no_env_sampling;
+                break;
+            case GLFW_KEY_T:
+                ctx->transmittance_type = (ctx->transmittance_type + 1) % 3;
+                break;
+            case GLFW_KEY_A:
+                ctx->adaptive_sampling = !ctx->adaptive_sampling;
+                break;
             default:
                 break;
         }
@@ -234,6 +249,9 @@ static void handle_mouse_pos(GLFWwindow *window, double xpos, double ypos)
 // Resize OpenGL and CUDA buffers for a given resolution.
 static void resize_buffers(
     float3 **accum_buffer_cuda,
+    Pixel_stats **pixel_stats_cuda,
+    unsigned char **convergence_mask_cuda,
+    unsigned int *pixel_lists_cuda[2],
     cudaGraphicsResource_t *display_buffer_cuda, int width, int height, GLuint display_buffer)
 {
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, display_buffer);
@@ -242,22 +260,39 @@ static void resize_buffers(
 
     check_success(glGetError() == GL_NO_ERROR);
 
+    // Not write-discard: with adaptive sampling converged pixels keep the
+    // display value of an earlier launch.
     if (*display_buffer_cuda)
         check_success(cudaGraphicsUnregisterResource(*display_buffer_cuda) == cudaSuccess);
     check_success(
         cudaGraphicsGLRegisterBuffer(
-            display_buffer_cuda, display_buffer, cudaGraphicsRegisterFlagsWriteDiscard) == cudaSuccess);
+            display_buffer_cuda, display_buffer, cudaGraphicsRegisterFlagsNone) == cudaSuccess);
 
     if (*accum_buffer_cuda)
         check_success(cudaFree(*accum_buffer_cuda) == cudaSuccess);
     check_success(cudaMalloc(accum_buffer_cuda, width * height * sizeof(float3)) == cudaSuccess);
+
+    if (*pixel_stats_cuda)
+        check_success(cudaFree(*pixel_stats_cuda) == cudaSuccess);
+    check_success(cudaMalloc(pixel_stats_cuda, width * height * sizeof(Pixel_stats)) == cudaSuccess);
+    if (*convergence_mask_cuda)
+        check_success(cudaFree(*convergence_mask_cuda) == cudaSuccess);
+    check_success(cudaMalloc(convergence_mask_cuda, width * height) == cudaSuccess);
+    for (unsigned int i = 0; i < 2; ++i) {
+        if (pixel_lists_cuda[i])
+            check_success(cudaFree(pixel_lists_cuda[i]) == cudaSuccess);
+        check_success(cudaMalloc(&pixel_lists_cuda[i], width * height * sizeof(unsigned int)) == cudaSuccess);
+    }
 }
 
 
-// Create enviroment texture.
+// Create enviroment texture and its importance sampling distribution (left
+// empty for a map without light).
 static bool create_environment(
     cudaTextureObject_t *env_tex,
     cudaArray_t *env_tex_data,
+    Environment_distribution *env_dist_cuda,
+    void *env_dist_data[3],
     const char *envmap_name)
 {
     unsigned int rx, ry;
@@ -267,6 +302,25 @@ static bool create_environment(
         return false;
     }
 
+    environment_distribution_t env_dist;
+    if (build_environment_distribution(&env_dist, pixels, rx, ry)) {
+        const size_t sizes[3] = {
+            (ry + 1) * sizeof(float),
+            (size_t)ry * (rx + 1) * sizeof(float),
+            (size_t)rx * ry * sizeof(float)
+        };
+        const void *host_data[3] = { env_dist.marginal_cdf, env_dist.conditional_cdf, env_dist.pdf };
+        for (unsigned int i = 0; i < 3; ++i) {
+            check_success(cudaMalloc(&env_dist_data[i], sizes[i]) == cudaSuccess);
+            check_success(cudaMemcpy(env_dist_data[i], host_data[i], sizes[i], cudaMemcpyHostToDevice) == cudaSuccess);
+        }
+        *env_dist_cuda = environment_distribution_view(&env_dist);
+        env_dist_cuda->marginal_cdf = static_cast<const float *>(env_dist_data[0]);
+        env_dist_cuda->conditional_cdf = static_cast<const float *>(env_dist_data[1]);
+        env_dist_cuda->pdf = static_cast<const float *>(env_dist_data[2]);
+        free_environment_distribution(&env_dist);
+    }
+
     const cudaChannelFormatDesc channel_desc = cudaCreateChannelDesc<float4>();
     check_success(cudaMallocArray(env_tex_data, &channel_desc, rx, ry) == cudaSuccess);
     
@@ -289,6 +343,41 @@ static bool create_environment(
     tex_desc.normalizedCoords = 1;
 
     check_success(cudaCreateTextureObject(env_tex, &res_desc, &tex_desc, NULL) == cudaSuccess);
+    free(pixels);
+    return true;
+}
+
+
+// Copy a voxel grid to the device.
+static bool create_voxel_grid(
+    Voxel_grid *grid_cuda,
+    void *grid_data[4],
+    const char *grid_name)
+{
+    voxel_grid_t grid;
+    if (!load_voxel_grid(&grid, grid_name)) {
+        fprintf(stderr, "error loading voxel grid file %s\n", grid_name);
+        return false;
+    }
+
+    const size_t sizes[4] = {
+        (size_t)grid.bx * grid.by * grid.bz * sizeof(unsigned int),
+        (size_t)grid.num_bricks * VOXEL_BRICK_VOXELS * sizeof(float),
+        (size_t)grid.bx * grid.by * grid.bz * sizeof(float),
+        (size_t)grid.bx * grid.by * grid.bz * sizeof(float)
+    };
+    const void *host_data[4] = { grid.brick_index, grid.bricks, grid.majorants, grid.minorants };
+    for (unsigned int i = 0; i < 4; ++i) {
+        check_success(cudaMalloc(&grid_data[i], sizes[i] ? sizes[i] : 1) == cudaSuccess);
+        check_success(cudaMemcpy(grid_data[i], host_data[i], sizes[i], cudaMemcpyHostToDevice) == cudaSuccess);
+    }
+
+    *grid_cuda = voxel_grid_view(&grid);
+    grid_cuda->brick_index = static_cast<const unsigned int *>(grid_data[0]);
+    grid_cuda->bricks = static_cast<const float *>(grid_data[1]);
+    grid_cuda->majorants = static_cast<const float *>(grid_data[2]);
+    grid_cuda->minorants = static_cast<const float *>(grid_data[3]);
+    free_voxel_grid(&grid);
     return true;
 }
 
@@ -323,6 +412,7 @@ int main(const int argc, const char* argv[])
 {
     Window_context window_context;
     memset(&window_context, 0, sizeof(Window_context));
+    window_context.transmittance_type = 2;
 
     GLuint display_buffer = 0;
     GLuint display_tex = 0;
@@ -351,8 +441,18 @@ int main(const int argc, const char* argv[])
     init_cuda();
 
     float3 *accum_buffer = NULL;
+    Pixel_stats *pixel_stats = NULL;
+    unsigned char *convergence_mask = NULL;
     cudaGraphicsResource_t display_buffer_cuda = NULL;
 
+    // Adaptive sampling: the pixels still to sample in the next launch and
+    // their count, double buffered (pixel_list_index is the current list).
+    unsigned int *pixel_lists[2] = { NULL, NULL };
+    unsigned int *num_pixels = NULL;
+    unsigned int pixel_list_index = 0;
+    check_success(cudaMalloc(&num_pixels, 2 * sizeof(unsigned int)) == cudaSuccess);
+    float display_exposure_scale = 0.0f;
+
     // Setup initial CUDA kernel parameters.
     Kernel_params kernel_params;
     memset(&kernel_params, 0, sizeof(Kernel_params));
@@ -364,6 +464,12 @@ int main(const int argc, const char* argv[])
     kernel_params.volume_type = 0;
     kernel_params.max_extinction = 100.0f;
     kernel_params.albedo = 0.8f;
+    kernel_params.majorant_type = 1;
+    kernel_params.transmittance_type = 2;
+    kernel_params.residual_control = 0.0f;
+    kernel_params.convergence_threshold = 0.02f;
+    kernel_params.min_samples = 16;
+    bool adaptive_sampling = false;
 
     // Setup initial camera.
     double phi = -0.084823;
@@ -372,14 +478,31 @@ int main(const int argc, const char* argv[])
     int zoom = 0;
     update_camera(kernel_params, phi, theta, base_dist, zoom);
 
+    // Command line: [envmap.hdr] [--grid volume]
+    const char *envmap_name = NULL;
+    const char *grid_name = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc)
+            grid_name = argv[++i];
+        else
+            envmap_name = argv[i];
+    }
+
+    // A voxel grid is a third volume to toggle through.
+    void *grid_data[4] = { NULL, NULL, NULL, NULL };
+    unsigned int num_volumes = 2;
+    if (grid_name && create_voxel_grid(&kernel_params.grid, grid_data, grid_name))
+        num_volumes = 3;
+
     cudaArray_t env_tex_data = 0;
+    void *env_dist_data[3] = { NULL, NULL, NULL };
     bool env_tex = false;
-    if (argc >= 2) 
+    if (envmap_name) 
         env_tex = create_environment(
-            &kernel_params.env_tex, &env_tex_data, argv[1]);
+            &kernel_params.env_tex, &env_tex_data, &kernel_params.env_dist, env_dist_data, envmap_name);
     if (env_tex) {
         kernel_params.environment_type = 1;
-        window_context.config_type = 2;
+        window_context.config_type = num_volumes;
     }
 
     while (!glfwWindowShouldClose(window)) {
@@ -388,12 +511,19 @@ int main(const int argc, const char* argv[])
         glfwPollEvents();
         Window_context *ctx = static_cast<Window_context *>(glfwGetWindowUserPointer(window));
         kernel_params.exposure_scale = powf(2.0f, ctx->exposure);        
-        const unsigned int volume_type = ctx->config_type & 1;
-        const unsigned int environment_type = env_tex ? ((ctx->config_type >> 1) & 1) : 0;
+        const unsigned int volume_type = ctx->config_type % num_volumes;
+        const unsigned int environment_type = env_tex ? ((ctx->config_type / num_volumes) & 1) : 0;
+        const unsigned int environment_sampling = (env_dist_data[0] && !ctx->no_env_sampling) ? 1 : 0;
         if (kernel_params.volume_type != volume_type ||
-            kernel_params.environment_type != environment_type) {
+            kernel_params.environment_type != environment_type ||
+            kernel_params.environment_sampling != environment_sampling ||
+            kernel_params.transmittance_type != ctx->transmittance_type ||
+            adaptive_sampling != ctx->adaptive_sampling) {
             kernel_params.volume_type = volume_type;
             kernel_params.environment_type = environment_type;
+            kernel_params.environment_sampling = environment_sampling;
+            kernel_params.transmittance_type = ctx->transmittance_type;
+            adaptive_sampling = ctx->adaptive_sampling;
             kernel_params.iteration = 0;
         }
         if (ctx->move_dx != 0.0 || ctx->move_dy != 0.0 || ctx->zoom_delta) {
@@ -421,7 +551,8 @@ int main(const int argc, const char* argv[])
             height = nheight;
             
             resize_buffers(
-                &accum_buffer, &display_buffer_cuda, width, height, display_buffer);
+                &accum_buffer, &pixel_stats, &convergence_mask, pixel_lists, &display_buffer_cuda,
+                width, height, display_buffer);
             kernel_params.accum_buffer = accum_buffer;
             
             glViewport(0, 0, width, height);
@@ -445,15 +576,57 @@ int main(const int argc, const char* argv[])
             cudaGraphicsResourceGetMappedPointer(&p, &size_p, display_buffer_cuda) == cudaSuccess);
         kernel_params.display_buffer = reinterpret_cast<unsigned int *>(p);
 
-        // Launch volume rendering kernel.
+        kernel_params.pixel_stats = adaptive_sampling ? pixel_stats : NULL;
+        kernel_params.convergence_mask = adaptive_sampling ? convergence_mask : NULL;
+
+        // Launch volume rendering kernel. The first adaptive launch (and
+        // every one without adaptive sampling) covers the whole image, later
+        // ones only the pixels that were still unconverged after the previous
+        // one, compacted into the current pixel list.
         dim3 threads_per_block(16, 16);
         dim3 num_blocks((width + 15) / 16, (height + 15) / 16);
-        void *params[] = { &kernel_params };
-        check_success(cudaLaunchKernel(
-                               (const void *)&volume_rt_kernel,
-                               num_blocks,
-                               threads_per_block,
-                               params) == cudaSuccess);
+        unsigned int *next_pixel_list = NULL;
+        unsigned int *next_num_pixels = NULL;
+        if (adaptive_sampling) {
+            next_pixel_list = pixel_lists[1 - pixel_list_index];
+            next_num_pixels = num_pixels + (1 - pixel_list_index);
+            check_success(cudaMemset(next_num_pixels, 0, sizeof(unsigned int)) == cudaSuccess);
+        }
+        if (!adaptive_sampling || kernel_params.iteration == 0) {
+            void *params[] = { &kernel_params, &next_pixel_list, &next_num_pixels };
+            check_success(cudaLaunchKernel(
+                                   (const void *)&volume_rt_kernel,
+                                   num_blocks,
+                                   threads_per_block,
+                                   params) == cudaSuccess);
+        } else {
+            // Converged pixels keep their display value unless the exposure
+            // changed.
+            if (kernel_params.exposure_scale != display_exposure_scale) {
+                void *params[] = { &kernel_params };
+                check_success(cudaLaunchKernel(
+                                       (const void *)&display_kernel,
+                                       num_blocks,
+                                       threads_per_block,
+                                       params) == cudaSuccess);
+            }
+
+            unsigned int *pixel_list = pixel_lists[pixel_list_index];
+            unsigned int num_list_pixels;
+            check_success(cudaMemcpy(
+                &num_list_pixels, num_pixels + pixel_list_index, sizeof(unsigned int),
+                cudaMemcpyDeviceToHost) == cudaSuccess);
+            if (num_list_pixels > 0) {
+                void *params[] = { &kernel_params, &pixel_list, &num_list_pixels, &next_pixel_list, &next_num_pixels };
+                check_success(cudaLaunchKernel(
+                                       (const void *)&volume_rt_list_kernel,
+                                       dim3((num_list_pixels + 255) / 256),
+                                       dim3(256),
+                                       params) == cudaSuccess);
+            }
+        }
+        pixel_list_index = 1 - pixel_list_index;
+        display_exposure_scale = kernel_params.exposure_scale;
         ++kernel_params.iteration;
         
         // Unmap GL buffer.
@@ -480,7 +653,18 @@ int main(const int argc, const char* argv[])
         check_success(cudaDestroyTextureObject(kernel_params.env_tex) == cudaSuccess);
         check_success(cudaFreeArray(env_tex_data) == cudaSuccess);
     }
+    for (unsigned int i = 0; i < 4; ++i)
+        if (grid_data[i])
+            check_success(cudaFree(grid_data[i]) == cudaSuccess);
+    for (unsigned int i = 0; i < 3; ++i)
+        if (env_dist_data[i])
+            check_success(cudaFree(env_dist_data[i]) == cudaSuccess);
     check_success(cudaFree(accum_buffer) == cudaSuccess);
+    check_success(cudaFree(pixel_stats) == cudaSuccess);
+    check_success(cudaFree(convergence_mask) == cudaSuccess);
+    for (unsigned int i = 0; i < 2; ++i)
+        check_success(cudaFree(pixel_lists[i]) == cudaSuccess);
+    check_success(cudaFree(num_pixels) == cudaSuccess);
 
     // Cleanup OpenGL.
     glDeleteVertexArrays(1, &quad_vao);
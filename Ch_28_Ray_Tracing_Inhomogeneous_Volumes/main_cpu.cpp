@@ -0,0 +1,490 @@
+//
+// Headless application running the volume path tracer on the CPU, for batch
+// renders and benchmarks on machines without a GPU or display
+//
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <csignal>
+#include <thread>
+#include <vector>
+
+#include "hdr_loader.h"
+#include "volume_kernel_cpu.h"
+#include "environment_distribution.h"
+#include "checkpoint.h"
+#include "voxel_grid.h"
+
+#define check_success(expr) \
+    do { \
+        if(!(expr)) { \
+            fprintf(stderr, "Error in file %s, line %u: \"%s\".\n", __FILE__, __LINE__, #expr); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while(false)
+
+// Load the environment map into a host texture and build its importance
+// sampling distribution.
+static bool create_environment(
+    Cpu_texture *env_tex,
+    environment_distribution_t *env_dist,
+    const char *envmap_name)
+{
+    unsigned int rx, ry;
+    float *pixels;
+    if (!load_hdr_float4(&pixels, &rx, &ry, envmap_name)) {
+        fprintf(stderr, "error loading environment map file %s\n", envmap_name);
+        return false;
+    }
+    if (!build_environment_distribution(env_dist, pixels, rx, ry))
+        fprintf(stderr, "environment map %s has no light to sample\n", envmap_name);
+
+    env_tex->data = reinterpret_cast<const float4 *>(pixels);
+    env_tex->width = rx;
+    env_tex->height = ry;
+    return true;
+}
+
+// Same camera setup as in main.cpp.
+static void update_camera(
+    Kernel_params &kernel_params,
+    double phi,
+    double theta,
+    float base_dist,
+    int zoom)
+{
+    kernel_params.cam_dir.x = float(-sin(phi) * sin(theta));
+    kernel_params.cam_dir.y = float(-cos(theta));
+    kernel_params.cam_dir.z = float(-cos(phi) * sin(theta));
+
+    kernel_params.cam_right.x = float(cos(phi));
+    kernel_params.cam_right.y = 0.0f;
+    kernel_params.cam_right.z = float(-sin(phi));
+
+    kernel_params.cam_up.x = float(-sin(phi) * cos(theta));
+    kernel_params.cam_up.y = float(sin(theta));
+    kernel_params.cam_up.z = float(-cos(phi) * cos(theta));
+
+    const float dist = float(base_dist * pow(0.95, double(zoom)));
+    kernel_params.cam_pos.x = -kernel_params.cam_dir.x * dist;
+    kernel_params.cam_pos.y = -kernel_params.cam_dir.y * dist;
+    kernel_params.cam_pos.z = -kernel_params.cam_dir.z * dist;
+}
+
+// Write the accumulation buffer as a little-endian PFM image. PFM stores the
+// bottom row first, which is row 0 of the buffer.
+static bool write_pfm(
+    const char *filename,
+    const float3 *pixels,
+    unsigned int width,
+    unsigned int height)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+        return false;
+    fprintf(fp, "PF\n%u %u\n-1.0\n", width, height);
+    const size_t n = size_t(width) * height;
+    const bool ok = fwrite(pixels, sizeof(float3), n, fp) == n;
+    return (fclose(fp) == 0) && ok;
+}
+
+// Read a PFM image written by write_pfm.
+static bool read_pfm(
+    const char *filename,
+    std::vector<float3> &pixels,
+    unsigned int &width,
+    unsigned int &height)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return false;
+    float scale;
+    bool ok = fscanf(fp, "PF %u %u %f", &width, &height, &scale) == 3 && scale < 0.0f &&
+        fgetc(fp) != EOF;
+    if (ok) {
+        pixels.resize(size_t(width) * height);
+        ok = fread(pixels.data(), sizeof(float3), pixels.size(), fp) == pixels.size();
+    }
+    fclose(fp);
+    return ok;
+}
+
+// Set by SIGTERM and SIGINT while checkpointing, to save and stop after the
+// current iteration.
+static volatile sig_atomic_t s_stop_requested = 0;
+
+static void request_stop(int)
+{
+    s_stop_requested = 1;
+}
+
+// RMS error of an image against a reference of the same size.
+static double rms_error(
+    const std::vector<float3> &pixels,
+    const std::vector<float3> &reference)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < reference.size(); ++i) {
+        const float3 &a = pixels[i], &b = reference[i];
+        sum += double(a.x - b.x) * (a.x - b.x) + double(a.y - b.y) * (a.y - b.y) + double(a.z - b.z) * (a.z - b.z);
+    }
+    return sqrt(sum / (3.0 * reference.size()));
+}
+
+// Pixels that adaptive sampling has not marked converged.
+static size_t count_active_pixels(const std::vector<unsigned char> &convergence_mask)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < convergence_mask.size(); ++i)
+        n += convergence_mask[i] ? 0 : 1;
+    return n;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options] [envmap.hdr]\n"
+        "  --frames N      progressive iterations to render in total (default 64)\n"
+        "  --out FILE      write the accumulated image as PFM (default volume.pfm)\n"
+        "  --reference FILE  print the RMS error against a converged PFM render\n"
+        "  --target-error E  stop once the RMS error against the reference is at\n"
+        "                  most E and report the time it took\n"
+        "  --res WxH       resolution (default 1024x1024)\n"
+        "  --threads N     worker threads (default: all hardware threads)\n"
+        "  --volume N      0 = Menger cube, 1 = spiral (default 0)\n"
+        "  --grid FILE     render a dense (.vol) or sparse voxel grid instead, see voxel_grid.h\n"
+        "  --majorant M    delta tracking majorant for grids: global or grid (default grid)\n"
+        "  --max-interactions N  path length limit (default 1024)\n"
+        "  --transmittance T  shadow ray estimator: delta, ratio or residual (default)\n"
+        "  --residual-control C  control of residual ratio tracking between the\n"
+        "                  minorant (0, default) and the majorant (1)\n"
+        "  --env-sampling S  environment light: escape (escaping paths only) or nee\n"
+        "                  (next-event estimation at scattering vertices, default)\n"
+        "  --wavefront     advance all paths one interaction per stage instead of\n"
+        "                  tracing each pixel's path to the end\n"
+        "  --adaptive E    adaptive sampling: stop sampling pixels whose 95%% confidence\n"
+        "                  interval is within E times their mean (e.g. 0.05)\n"
+        "  --min-samples N  samples before a pixel can converge (default 16)\n"
+        "  --checkpoint FILE  save the progressive state periodically, when done and\n"
+        "                  on SIGTERM/SIGINT (see checkpoint.h)\n"
+        "  --checkpoint-interval S  seconds between checkpoints (default 600)\n"
+        "  --resume        continue from the checkpoint file if it exists; camera,\n"
+        "                  volume and resolution are taken from it\n",
+        name);
+    exit(EXIT_FAILURE);
+}
+
+int main(const int argc, const char* argv[])
+{
+    unsigned int num_frames = 64;
+    const char *out_name = "volume.pfm";
+    const char *reference_name = NULL;
+    double target_error = 0.0;
+    bool adaptive = false;
+    const char *envmap_name = NULL;
+    const char *grid_name = NULL;
+    bool wavefront = false;
+    const char *checkpoint_name = NULL;
+    double checkpoint_interval = 600.0;
+    bool resume = false;
+    unsigned int width = 1024, height = 1024;
+    unsigned int num_threads = std::thread::hardware_concurrency();
+
+    // Setup initial kernel parameters, as in main.cpp.
+    Kernel_params kernel_params;
+    memset(&kernel_params, 0, sizeof(Kernel_params));
+    kernel_params.cam_focal = float(1.0 / tan(90.0 / 2.0 * (2.0 * M_PI / 360.0)));
+    kernel_params.iteration = 0;
+    kernel_params.max_interactions = 1024;
+    kernel_params.exposure_scale = 1.0f;
+    kernel_params.environment_type = 0;
+    kernel_params.volume_type = 0;
+    kernel_params.max_extinction = 100.0f;
+    kernel_params.albedo = 0.8f;
+    kernel_params.majorant_type = 1;
+    kernel_params.environment_sampling = 1;
+    kernel_params.transmittance_type = 2;
+    kernel_params.residual_control = 0.0f;
+    kernel_params.convergence_threshold = 0.0f;
+    kernel_params.min_samples = 16;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value)
+            num_frames = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && has_value)
+            out_name = argv[++i];
+        else if (strcmp(argv[i], "--reference") == 0 && has_value)
+            reference_name = argv[++i];
+        else if (strcmp(argv[i], "--target-error") == 0 && has_value)
+            target_error = atof(argv[++i]);
+        else if (strcmp(argv[i], "--res") == 0 && has_value) {
+            if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0)
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && has_value)
+            num_threads = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--volume") == 0 && has_value) {
+            ++i;
+            if (strcmp(argv[i], "0") == 0)
+                kernel_params.volume_type = 0;
+            else if (strcmp(argv[i], "1") == 0)
+                kernel_params.volume_type = 1;
+            else
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--grid") == 0 && has_value)
+            grid_name = argv[++i];
+        else if (strcmp(argv[i], "--majorant") == 0 && has_value) {
+            ++i;
+            if (strcmp(argv[i], "global") == 0)
+                kernel_params.majorant_type = 0;
+            else if (strcmp(argv[i], "grid") == 0)
+                kernel_params.majorant_type = 1;
+            else
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--transmittance") == 0 && has_value) {
+            ++i;
+            if (strcmp(argv[i], "delta") == 0)
+                kernel_params.transmittance_type = 0;
+            else if (strcmp(argv[i], "ratio") == 0)
+                kernel_params.transmittance_type = 1;
+            else if (strcmp(argv[i], "residual") == 0)
+                kernel_params.transmittance_type = 2;
+            else
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--residual-control") == 0 && has_value)
+            kernel_params.residual_control = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--env-sampling") == 0 && has_value) {
+            ++i;
+            if (strcmp(argv[i], "escape") == 0)
+                kernel_params.environment_sampling = 0;
+            else if (strcmp(argv[i], "nee") == 0)
+                kernel_params.environment_sampling = 1;
+            else
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--max-interactions") == 0 && has_value)
+            kernel_params.max_interactions = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--wavefront") == 0)
+            wavefront = true;
+        else if (strcmp(argv[i], "--adaptive") == 0 && has_value) {
+            adaptive = true;
+            kernel_params.convergence_threshold = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--min-samples") == 0 && has_value)
+            kernel_params.min_samples = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--checkpoint") == 0 && has_value)
+            checkpoint_name = argv[++i];
+        else if (strcmp(argv[i], "--checkpoint-interval") == 0 && has_value)
+            checkpoint_interval = atof(argv[++i]);
+        else if (strcmp(argv[i], "--resume") == 0)
+            resume = true;
+        else if (argv[i][0] != '-' && !envmap_name)
+            envmap_name = argv[i];
+        else
+            usage(argv[0]);
+    }
+    if (num_threads == 0)
+        num_threads = 1;
+    if ((resume && !checkpoint_name) || (target_error > 0.0 && !reference_name))
+        usage(argv[0]);
+
+    // Setup initial camera.
+    update_camera(kernel_params, -0.084823, 1.423141, 1.3f, 0);
+
+    Cpu_texture env_tex;
+    environment_distribution_t env_dist;
+    memset(&env_tex, 0, sizeof(Cpu_texture));
+    memset(&env_dist, 0, sizeof(environment_distribution_t));
+    if (envmap_name) {
+        const auto start = std::chrono::steady_clock::now();
+        check_success(create_environment(&env_tex, &env_dist, envmap_name));
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("environment %ux%u loaded in %.3f s\n", env_tex.width, env_tex.height, seconds);
+        kernel_params.env_tex = &env_tex;
+        kernel_params.environment_type = 1;
+        if (env_dist.pdf)
+            kernel_params.env_dist = environment_distribution_view(&env_dist);
+        else
+            kernel_params.environment_sampling = 0;
+    }
+
+    voxel_grid_t grid;
+    memset(&grid, 0, sizeof(voxel_grid_t));
+    if (grid_name) {
+        const auto start = std::chrono::steady_clock::now();
+        if (!load_voxel_grid(&grid, grid_name)) {
+            fprintf(stderr, "error loading voxel grid file %s\n", grid_name);
+            exit(EXIT_FAILURE);
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const unsigned int total_bricks = grid.bx * grid.by * grid.bz;
+        printf("grid %ux%ux%u: %u of %u bricks stored, loaded in %.3f s\n",
+               grid.nx, grid.ny, grid.nz, grid.num_bricks, total_bricks, seconds);
+        kernel_params.grid = voxel_grid_view(&grid);
+        kernel_params.volume_type = 2;
+    }
+
+    // The progressive state, also the buffers rendered into.
+    checkpoint_t state;
+    state.width = width;
+    state.height = height;
+    state.iteration = 0;
+    state.env_name = envmap_name ? envmap_name : "";
+    state.grid_name = grid_name ? grid_name : "";
+    if (resume && load_checkpoint(&state, checkpoint_name)) {
+        if (state.env_name.empty() != !envmap_name || state.grid_name.empty() != !grid_name) {
+            fprintf(stderr, "checkpoint %s was rendered with%s environment map and with%s voxel grid\n",
+                    checkpoint_name, state.env_name.empty() ? "out" : "", state.grid_name.empty() ? "out" : "");
+            exit(EXIT_FAILURE);
+        }
+        if ((envmap_name && state.env_name != envmap_name) || (grid_name && state.grid_name != grid_name))
+            fprintf(stderr, "warning: checkpoint %s was rendered with %s %s\n", checkpoint_name,
+                    state.env_name.c_str(), state.grid_name.c_str());
+        checkpoint_set_params(kernel_params, &state.params);
+        kernel_params.iteration = state.iteration;
+        adaptive = !state.stats.empty();
+        width = state.width;
+        height = state.height;
+        printf("resuming %s at iteration %u\n", checkpoint_name, state.iteration);
+    } else {
+        if (resume) {
+            // Do not overwrite a damaged checkpoint with a fresh start.
+            FILE *fp = fopen(checkpoint_name, "rb");
+            if (fp) {
+                fclose(fp);
+                fprintf(stderr, "error loading checkpoint file %s\n", checkpoint_name);
+                exit(EXIT_FAILURE);
+            }
+            printf("no checkpoint %s to resume, starting from iteration 0\n", checkpoint_name);
+        }
+        state.accum.resize(size_t(width) * height);
+        state.collisions.resize(size_t(width) * height);
+        if (adaptive) {
+            state.stats.resize(size_t(width) * height);
+            state.convergence_mask.resize(size_t(width) * height);
+        }
+    }
+    std::vector<float3> &accum_buffer = state.accum;
+    std::vector<unsigned int> &collision_buffer = state.collisions;
+    kernel_params.accum_buffer = accum_buffer.data();
+    kernel_params.collision_buffer = collision_buffer.data();
+    kernel_params.display_buffer = NULL;
+    kernel_params.resolution = make_uint2(width, height);
+    if (adaptive) {
+        kernel_params.pixel_stats = state.stats.data();
+        kernel_params.convergence_mask = state.convergence_mask.data();
+    }
+
+    std::vector<float3> reference;
+    if (reference_name) {
+        unsigned int ref_width, ref_height;
+        check_success(read_pfm(reference_name, reference, ref_width, ref_height));
+        check_success(ref_width == width && ref_height == height);
+    }
+
+    if (checkpoint_name) {
+        signal(SIGTERM, request_stop);
+        signal(SIGINT, request_stop);
+    }
+
+    Cpu_workers workers(num_threads);
+    Wavefront_state wavefront_state;
+    double stages = 0.0, path_stages = 0.0;
+
+    // Render up to num_frames iterations in total, saving the state every
+    // checkpoint_interval seconds, when done and when asked to stop.
+    const auto start = std::chrono::steady_clock::now();
+    auto last_checkpoint = start;
+    double checkpoint_seconds = 0.0;
+    unsigned int num_checkpoints = 0;
+    const unsigned int first_frame = kernel_params.iteration;
+    size_t num_active = (adaptive && kernel_params.iteration > 0) ?
+        count_active_pixels(state.convergence_mask) : size_t(width) * height;
+    double num_samples = 0.0;
+    bool target_reached = false;
+    while (kernel_params.iteration < num_frames && num_active && !target_reached && !s_stop_requested) {
+        num_samples += (double)num_active;
+        if (wavefront) {
+            volume_rt_cpu_wavefront(kernel_params, workers, wavefront_state);
+            stages += wavefront_state.num_stages;
+            path_stages += (double)wavefront_state.num_path_stages;
+        } else
+            volume_rt_cpu(kernel_params, workers);
+        ++kernel_params.iteration;
+
+        // Pixels left to sample in the next iteration.
+        if (adaptive)
+            num_active = count_active_pixels(state.convergence_mask);
+        if (target_error > 0.0 && rms_error(accum_buffer, reference) <= target_error) {
+            target_reached = true;
+            printf("RMS error %g reached after %.3f s, %u iterations, %.2f samples per pixel\n", target_error,
+                   std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+                   kernel_params.iteration, num_samples / (double(width) * height));
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (checkpoint_name && (kernel_params.iteration == num_frames || !num_active ||
+            target_reached || s_stop_requested ||
+            std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval)) {
+            state.iteration = kernel_params.iteration;
+            checkpoint_get_params(&state.params, kernel_params);
+            if (!save_checkpoint(&state, checkpoint_name))
+                fprintf(stderr, "error writing checkpoint %s\n", checkpoint_name);
+            last_checkpoint = std::chrono::steady_clock::now();
+            checkpoint_seconds += std::chrono::duration<double>(last_checkpoint - now).count();
+            ++num_checkpoints;
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (s_stop_requested)
+        printf("stopped at iteration %u of %u\n", kernel_params.iteration, num_frames);
+    if (target_error > 0.0 && !target_reached)
+        printf("RMS error %g not reached\n", target_error);
+    if (adaptive)
+        printf("adaptive sampling: %.1f%% of pixels converged, %.2f samples per pixel this run\n",
+               100.0 * (1.0 - double(num_active) / (double(width) * height)),
+               num_samples / (double(width) * height));
+    if (num_checkpoints)
+        printf("%u checkpoints written to %s in %.3f s\n", num_checkpoints, checkpoint_name, checkpoint_seconds);
+
+    const unsigned int frames = kernel_params.iteration - first_frame;
+    const double paths = num_samples;
+    printf("%u frames of %ux%u on %u threads: %.3f s, %.2f ms/frame, %.3f M paths/s\n",
+           frames, width, height, num_threads, seconds,
+           frames ? 1e3 * seconds / frames : 0.0, paths / seconds * 1e-6);
+    printf("%s: %.1f%% thread utilization\n", wavefront ? "wavefront" : "per-pixel paths",
+           100.0 * workers.busy_seconds() / (workers.num_threads() * seconds));
+    if (wavefront && stages > 0.0)
+        printf("%.1f stages per iteration, %.0f live paths per stage on average\n",
+               stages / frames, path_stages / stages);
+
+    // The collision counts cover all iterations, including resumed ones.
+    double collisions = 0.0, total_paths = double(width) * height * kernel_params.iteration;
+    for (size_t i = 0; i < collision_buffer.size(); ++i)
+        collisions += collision_buffer[i];
+    if (adaptive) {
+        total_paths = 0.0;
+        for (size_t i = 0; i < state.stats.size(); ++i)
+            total_paths += state.stats[i].num_samples;
+    }
+    printf("%.3f collisions per path (%s majorant)\n", collisions / total_paths,
+           kernel_params.volume_type == 2 && kernel_params.majorant_type == 1 ? "brick" : "global");
+
+    if (reference_name)
+        printf("RMS error %.6g against %s\n", rms_error(accum_buffer, reference), reference_name);
+
+    check_success(write_pfm(out_name, accum_buffer.data(), width, height));
+
+    free(const_cast<float4 *>(env_tex.data));
+    free_environment_distribution(&env_dist);
+    free_voxel_grid(&grid);
+    return 0;
+}
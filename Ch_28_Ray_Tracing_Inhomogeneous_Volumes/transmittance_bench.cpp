@@ -0,0 +1,180 @@
+//
+// Variance versus cost of the transmittance estimators of volume_path_tracer.h
+// (delta, ratio and residual ratio tracking) for random rays in a volume
+//
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+#include "volume_path_tracer.h"
+#include "voxel_grid.h"
+
+struct Estimator {
+    const char *name;
+    unsigned int transmittance_type;
+    float residual_control;
+};
+
+struct Result {
+    double mean;            // transmittance, averaged over all rays
+    double variance;        // of a single estimate, averaged over all rays
+    double collisions;      // per estimate
+    double seconds;         // per estimate
+};
+
+// Random ray with its origin uniformly in the volume box and a uniform
+// direction; the same for every estimator.
+static void generate_ray(
+    const unsigned int ray,
+    float3 &pos,
+    float3 &dir)
+{
+    Rand_state rand_state;
+    rand_init(rand_state, ray, 1);
+    pos = make_float3(rand(&rand_state) - 0.5f, rand(&rand_state) - 0.5f, rand(&rand_state) - 0.5f);
+    const float phi = (float)(2.0 * M_PI) * rand(&rand_state);
+    const float cos_theta = 1.0f - 2.0f * rand(&rand_state);
+    const float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+    dir = make_float3(cosf(phi) * sin_theta, sinf(phi) * sin_theta, cos_theta);
+}
+
+static Result run_estimator(
+    Kernel_params kernel_params,
+    const Estimator &estimator,
+    const unsigned int num_rays,
+    const unsigned int num_samples)
+{
+    kernel_params.transmittance_type = estimator.transmittance_type;
+    kernel_params.residual_control = estimator.residual_control;
+
+    Result result;
+    memset(&result, 0, sizeof(Result));
+    unsigned int num_collisions = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int ray = 0; ray < num_rays; ++ray) {
+        float3 pos, dir;
+        generate_ray(ray, pos, dir);
+
+        Rand_state rand_state;
+        rand_init(rand_state, ray, 0);
+        double sum = 0.0, sum2 = 0.0;
+        for (unsigned int i = 0; i < num_samples; ++i) {
+            const double t = estimate_transmittance(rand_state, pos, dir, kernel_params, num_collisions);
+            sum += t;
+            sum2 += t * t;
+        }
+        const double mean = sum / num_samples;
+        result.mean += mean;
+        result.variance += (sum2 - sum * mean) / (num_samples - 1);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const double num_estimates = double(num_rays) * num_samples;
+    result.mean /= num_rays;
+    result.variance /= num_rays;
+    result.collisions = num_collisions / num_estimates;
+    result.seconds = seconds / num_estimates;
+    return result;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --volume N      0 = Menger cube, 1 = spiral (default 0)\n"
+        "  --grid FILE     use a voxel grid instead, see voxel_grid.h\n"
+        "  --majorant M    majorant for grids: global or grid (default grid)\n"
+        "  --rays N        random rays (default 4096)\n"
+        "  --samples N     estimates per ray (default 64)\n",
+        name);
+    exit(EXIT_FAILURE);
+}
+
+int main(const int argc, const char* argv[])
+{
+    unsigned int num_rays = 4096;
+    unsigned int num_samples = 64;
+    const char *grid_name = NULL;
+
+    // Same volume parameters as the applications.
+    Kernel_params kernel_params;
+    memset(&kernel_params, 0, sizeof(Kernel_params));
+    kernel_params.volume_type = 0;
+    kernel_params.max_extinction = 100.0f;
+    kernel_params.majorant_type = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--volume") == 0 && has_value) {
+            ++i;
+            if (strcmp(argv[i], "0") == 0)
+                kernel_params.volume_type = 0;
+            else if (strcmp(argv[i], "1") == 0)
+                kernel_params.volume_type = 1;
+            else
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--grid") == 0 && has_value)
+            grid_name = argv[++i];
+        else if (strcmp(argv[i], "--majorant") == 0 && has_value) {
+            ++i;
+            if (strcmp(argv[i], "global") == 0)
+                kernel_params.majorant_type = 0;
+            else if (strcmp(argv[i], "grid") == 0)
+                kernel_params.majorant_type = 1;
+            else
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--rays") == 0 && has_value)
+            num_rays = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--samples") == 0 && has_value)
+            num_samples = (unsigned int)atoi(argv[++i]);
+        else
+            usage(argv[0]);
+    }
+    if (num_rays == 0 || num_samples < 2)
+        usage(argv[0]);
+
+    voxel_grid_t grid;
+    memset(&grid, 0, sizeof(voxel_grid_t));
+    if (grid_name) {
+        if (!load_voxel_grid(&grid, grid_name)) {
+            fprintf(stderr, "error loading voxel grid file %s\n", grid_name);
+            return EXIT_FAILURE;
+        }
+        kernel_params.grid = voxel_grid_view(&grid);
+        kernel_params.volume_type = 2;
+    }
+
+    const Estimator estimators[] = {
+        { "delta tracking", 0, 0.0f },
+        { "ratio tracking", 1, 0.0f },
+        { "residual, c=0", 2, 0.0f },
+        { "residual, c=0.25", 2, 0.25f },
+        { "residual, c=0.5", 2, 0.5f },
+    };
+    const unsigned int num_estimators = sizeof(estimators) / sizeof(estimators[0]);
+
+    printf("%u rays x %u estimates, %s\n", num_rays, num_samples,
+           grid_name ? grid_name : (kernel_params.volume_type == 0 ? "cube" : "spiral"));
+    printf("%-18s %10s %10s %12s %12s %12s\n",
+           "estimator", "mean", "variance", "collisions", "ns/estimate", "efficiency");
+    double reference_efficiency = 0.0;
+    for (unsigned int i = 0; i < num_estimators; ++i) {
+        const Result r = run_estimator(kernel_params, estimators[i], num_rays, num_samples);
+        // Efficiency: inverse of variance times cost, relative to delta tracking.
+        const double efficiency = 1.0 / (r.variance * r.seconds);
+        if (i == 0)
+            reference_efficiency = efficiency;
+        printf("%-18s %10.5f %10.5f %12.2f %12.1f %11.2fx\n", estimators[i].name,
+               r.mean, r.variance, r.collisions, 1e9 * r.seconds, efficiency / reference_efficiency);
+    }
+
+    free_voxel_grid(&grid);
+    return 0;
+}
@@ -2,6 +2,45 @@
 // CUDA volume path tracing kernel interface
 //
 
+#ifndef VOLUME_KERNEL_H
+#define VOLUME_KERNEL_H
+
+// Voxel grid volume (volume_type 2): densities in [0, 1] in bricks of
+// VOXEL_BRICK_SIZE^3 voxels, of which only the non-empty ones are stored.
+// The grid fills the volume box and is interpolated trilinearly between voxel
+// centers. See voxel_grid.h for loading.
+#define VOXEL_BRICK_BITS 3
+#define VOXEL_BRICK_SIZE (1 << VOXEL_BRICK_BITS)
+#define VOXEL_BRICK_EMPTY 0xffffffffu
+
+struct Voxel_grid {
+    uint3 dims;                      // voxels per axis
+    uint3 brick_dims;                // bricks per axis, also the resolution of the majorant grid
+    const unsigned int *brick_index; // per brick (x fastest): index into bricks, or VOXEL_BRICK_EMPTY
+    const float *bricks;             // VOXEL_BRICK_SIZE^3 densities per stored brick (x fastest)
+    const float *majorants;          // per brick: maximum interpolated density inside it
+    const float *minorants;          // per brick: minimum interpolated density inside it
+};
+
+// Importance sampling distribution of the environment map, over the texture
+// coordinates (u, v) of the lat-long lookup. It is piecewise constant over the
+// texels. See environment_distribution.h for building it.
+struct Environment_distribution {
+    uint2 size;                   // texels
+    const float *marginal_cdf;    // size.y + 1 entries, over the rows
+    const float *conditional_cdf; // size.y rows of size.x + 1 entries
+    const float *pdf;             // per texel: density over (u, v) in [0, 1]^2
+};
+
+// Running statistics of a pixel's samples for adaptive sampling: the
+// number of samples and the mean and sum of squared deviations (Welford) of
+// their luminance.
+struct Pixel_stats {
+    unsigned int num_samples;
+    float mean;
+    float m2;
+};
+
 struct Kernel_params {
     // Display
     uint2 resolution;
@@ -26,12 +65,65 @@ struct Kernel_params {
     unsigned int environment_type;
     cudaTextureObject_t env_tex;
 
+    // Environment light sampling: 0 = only paths that escape, 1 = also
+    // next-event estimation at every scattering vertex with env_dist,
+    // combined with escaping paths by multiple importance sampling
+    // (environment_type 1 only)
+    unsigned int environment_sampling;
+    Environment_distribution env_dist;
+
     // Volume definition
     unsigned int volume_type;
     float max_extinction;
     float albedo; // sigma / kappa
+    Voxel_grid grid;
+
+    // Majorant for delta tracking: 0 = max_extinction everywhere, 1 = per
+    // brick majorant grid walked with a DDA (voxel grids only)
+    unsigned int majorant_type;
+
+    // Transmittance estimator for shadow rays: 0 = delta tracking, 1 = ratio
+    // tracking, 2 = residual ratio tracking. The control extinction of the
+    // latter is the minorant (0, or the brick minorant with majorant_type 1)
+    // plus residual_control times the majorant - minorant range.
+    unsigned int transmittance_type;
+    float residual_control;
+
+    // Optional statistics: tentative (real and null) collisions per pixel,
+    // summed over iterations
+    unsigned int *collision_buffer;
+
+    // Adaptive sampling (optional): with pixel_stats set, accum_buffer holds
+    // the mean of each pixel's own samples. Once a pixel has min_samples
+    // samples and the 95% confidence interval of its mean luminance is
+    // within convergence_threshold times the mean, it is marked in
+    // convergence_mask and takes no more samples until iteration 0.
+    Pixel_stats *pixel_stats;
+    unsigned char *convergence_mask;
+    float convergence_threshold;
+    unsigned int min_samples;
 };
 
+// One progressive sample for every pixel. With next_pixel_list set (adaptive
+// sampling), the indices of the pixels that have not converged after it are
+// appended to next_pixel_list, counting in *next_num_pixels.
 extern "C" __global__ void volume_rt_kernel(
+   const Kernel_params kernel_params,
+   unsigned int *next_pixel_list,
+   unsigned int *next_num_pixels);
+
+// One progressive sample for each of the num_pixels pixel indices in
+// pixel_list only, compacting the unconverged ones as above.
+extern "C" __global__ void volume_rt_list_kernel(
+   const Kernel_params kernel_params,
+   const unsigned int *pixel_list,
+   const unsigned int num_pixels,
+   unsigned int *next_pixel_list,
+   unsigned int *next_num_pixels);
+
+// Refresh the display value of every pixel from accum_buffer, e.g. after an
+// exposure change while most pixels have converged.
+extern "C" __global__ void display_kernel(
    const Kernel_params kernel_params);
 
+#endif // VOLUME_KERNEL_H
@@ -0,0 +1,289 @@
+//
+// CPU volume path tracing backend implementation
+//
+
+#include <algorithm>
+#include <chrono>
+
+#include "volume_kernel_cpu.h"
+#include "volume_path_tracer.h"
+
+Cpu_workers::Cpu_workers(unsigned int num_threads)
+    : busy(std::max(num_threads, 1u), 0.0), job(NULL), job_size(0), job_chunk_size(1),
+      next_index(0), generation(0), pending(0), quit(false)
+{
+    for (unsigned int i = 1; i < busy.size(); ++i)
+        threads.emplace_back(&Cpu_workers::run, this, i);
+}
+
+Cpu_workers::~Cpu_workers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    start_cv.notify_all();
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+}
+
+void Cpu_workers::parallel_for(
+    size_t n,
+    size_t chunk_size,
+    const std::function<void(size_t, size_t)> &func)
+{
+    if (n == 0)
+        return;
+    chunk_size = std::max(chunk_size, (size_t)1);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &func;
+        job_size = n;
+        job_chunk_size = chunk_size;
+        next_index = 0;
+    }
+
+    // A single chunk is not worth waking the other threads for.
+    if (threads.empty() || n <= chunk_size) {
+        work(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = (unsigned int)threads.size();
+        ++generation;
+    }
+    start_cv.notify_all();
+    work(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [this]() { return pending == 0; });
+}
+
+void Cpu_workers::run(unsigned int thread)
+{
+    unsigned int seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start_cv.wait(lock, [&]() { return quit || generation != seen; });
+            if (quit)
+                return;
+            seen = generation;
+        }
+
+        work(thread);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+            done_cv.notify_one();
+    }
+}
+
+void Cpu_workers::work(unsigned int thread)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t begin = next_index.fetch_add(job_chunk_size); begin < job_size;
+         begin = next_index.fetch_add(job_chunk_size))
+        (*job)(begin, std::min(begin + job_chunk_size, job_size));
+    busy[thread] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double Cpu_workers::busy_seconds() const
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < busy.size(); ++i)
+        sum += busy[i];
+    return sum;
+}
+
+void Cpu_workers::reset_busy_seconds()
+{
+    std::fill(busy.begin(), busy.end(), 0.0);
+}
+
+void volume_rt_cpu(
+    const Kernel_params &kernel_params,
+    Cpu_workers &workers)
+{
+    const unsigned int tiles_x = (kernel_params.resolution.x + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+    const unsigned int tiles_y = (kernel_params.resolution.y + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+
+    workers.parallel_for(tiles_x * tiles_y, 1, [&](size_t begin, size_t end) {
+        for (size_t tile = begin; tile < end; ++tile) {
+            const unsigned int x0 = (unsigned int)(tile % tiles_x) * CPU_TILE_SIZE;
+            const unsigned int y0 = (unsigned int)(tile / tiles_x) * CPU_TILE_SIZE;
+            const unsigned int x1 = std::min(x0 + CPU_TILE_SIZE, kernel_params.resolution.x);
+            const unsigned int y1 = std::min(y0 + CPU_TILE_SIZE, kernel_params.resolution.y);
+            for (unsigned int y = y0; y < y1; ++y)
+                for (unsigned int x = x0; x < x1; ++x)
+                    render_pixel(kernel_params, x, y);
+        }
+    });
+}
+
+void Wavefront_paths::resize(size_t n)
+{
+    pos_x.resize(n); pos_y.resize(n); pos_z.resize(n);
+    dir_x.resize(n); dir_y.resize(n); dir_z.resize(n);
+    weight.resize(n);
+    num_interactions.resize(n);
+    pixel.resize(n);
+    rand_state.resize(n);
+}
+
+// Chunk size for a stage over n paths: small enough near the end of an
+// iteration that the last few thousand paths are still spread over all
+// threads.
+static size_t stage_chunk_size(
+    const Cpu_workers &workers,
+    size_t n)
+{
+    return std::max((size_t)64, std::min((size_t)WAVEFRONT_CHUNK_SIZE, n / (4 * workers.num_threads())));
+}
+
+// Move the live entries of state.paths[0] to the front of state.paths[1],
+// keeping their order, and swap the two queues. state.alive and the number of
+// live entries per chunk of chunk_size paths (in state.chunk_offsets) were
+// set by the stage.
+static size_t compact_paths(
+    Wavefront_state &state,
+    Cpu_workers &workers,
+    size_t num_paths,
+    size_t chunk_size)
+{
+    const size_t num_chunks = (num_paths + chunk_size - 1) / chunk_size;
+    size_t num_live = 0;
+    for (size_t c = 0; c < num_chunks; ++c) {
+        const size_t count = state.chunk_offsets[c];
+        state.chunk_offsets[c] = num_live;
+        num_live += count;
+    }
+
+    Wavefront_paths &src = state.paths[0];
+    Wavefront_paths &dst = state.paths[1];
+    workers.parallel_for(num_paths, chunk_size, [&](size_t begin, size_t end) {
+        size_t j = state.chunk_offsets[begin / chunk_size];
+        for (size_t i = begin; i < end; ++i) {
+            if (!state.alive[i])
+                continue;
+            dst.pos_x[j] = src.pos_x[i]; dst.pos_y[j] = src.pos_y[i]; dst.pos_z[j] = src.pos_z[i];
+            dst.dir_x[j] = src.dir_x[i]; dst.dir_y[j] = src.dir_y[i]; dst.dir_z[j] = src.dir_z[i];
+            dst.weight[j] = src.weight[i];
+            dst.num_interactions[j] = src.num_interactions[i];
+            dst.pixel[j] = src.pixel[i];
+            dst.rand_state[j] = src.rand_state[i];
+            ++j;
+        }
+    });
+
+    std::swap(state.paths[0], state.paths[1]);
+    return num_live;
+}
+
+void volume_rt_cpu_wavefront(
+    const Kernel_params &kernel_params,
+    Cpu_workers &workers,
+    Wavefront_state &state)
+{
+    const size_t num_pixels = (size_t)kernel_params.resolution.x * kernel_params.resolution.y;
+    const size_t max_chunks = (num_pixels + 63) / 64;
+    state.paths[0].resize(num_pixels);
+    state.paths[1].resize(num_pixels);
+    state.alive.resize(num_pixels);
+    state.chunk_offsets.resize(max_chunks);
+    state.values.resize(num_pixels);
+    state.collisions.resize(num_pixels);
+    state.num_stages = 0;
+    state.num_path_stages = 0;
+
+    // Camera paths, entry i for pixel i. Paths that miss the volume box are
+    // done right away, converged pixels get none.
+    workers.parallel_for(num_pixels, WAVEFRONT_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        Wavefront_paths &paths = state.paths[0];
+        size_t num_live = 0;
+        for (size_t i = begin; i < end; ++i) {
+            const unsigned int x = (unsigned int)(i % kernel_params.resolution.x);
+            const unsigned int y = (unsigned int)(i / kernel_params.resolution.x);
+            if (pixel_converged(kernel_params, (unsigned int)i)) {
+                state.alive[i] = 0;
+                continue;
+            }
+            Rand_state rand_state;
+            float3 ray_pos, ray_dir;
+            generate_camera_ray(rand_state, ray_pos, ray_dir, kernel_params, x, y);
+            state.collisions[i] = 0;
+
+            float t0;
+            state.alive[i] = intersect_volume_box(t0, ray_pos, ray_dir);
+            if (!state.alive[i]) {
+                state.values[i] = lookup_environment(ray_dir, 1.0f, kernel_params);
+                continue;
+            }
+            ray_pos += ray_dir * t0;
+            state.values[i] = make_float3(0.0f, 0.0f, 0.0f);
+            paths.pos_x[i] = ray_pos.x; paths.pos_y[i] = ray_pos.y; paths.pos_z[i] = ray_pos.z;
+            paths.dir_x[i] = ray_dir.x; paths.dir_y[i] = ray_dir.y; paths.dir_z[i] = ray_dir.z;
+            paths.weight[i] = 1.0f;
+            paths.num_interactions[i] = 0;
+            paths.pixel[i] = (unsigned int)i;
+            paths.rand_state[i] = rand_state;
+            ++num_live;
+        }
+        state.chunk_offsets[begin / WAVEFRONT_CHUNK_SIZE] = num_live;
+    });
+    size_t num_live = compact_paths(state, workers, num_pixels, WAVEFRONT_CHUNK_SIZE);
+
+    // One interaction per live path and stage: sample the next collision,
+    // then either escape to the environment, terminate or scatter (with a
+    // light sample of the environment, if enabled).
+    while (num_live) {
+        ++state.num_stages;
+        state.num_path_stages += num_live;
+
+        const size_t chunk_size = stage_chunk_size(workers, num_live);
+        workers.parallel_for(num_live, chunk_size, [&](size_t begin, size_t end) {
+            Wavefront_paths &paths = state.paths[0];
+            size_t num_alive = 0;
+            for (size_t i = begin; i < end; ++i) {
+                const unsigned int pixel = paths.pixel[i];
+                Rand_state rand_state = paths.rand_state[i];
+                float3 ray_pos = make_float3(paths.pos_x[i], paths.pos_y[i], paths.pos_z[i]);
+                float3 ray_dir = make_float3(paths.dir_x[i], paths.dir_y[i], paths.dir_z[i]);
+                float w = paths.weight[i];
+                unsigned int num_interactions = paths.num_interactions[i];
+
+                bool alive = false;
+                if (!sample_interaction(rand_state, ray_pos, ray_dir, kernel_params, state.collisions[pixel]))
+                    state.values[pixel] += lookup_environment(
+                        ray_dir, w * environment_mis_weight(ray_dir, num_interactions, kernel_params), kernel_params);
+                else if (scatter(rand_state, ray_dir, w, num_interactions, kernel_params)) {
+                    if (sample_environment_light(kernel_params))
+                        state.values[pixel] += sample_environment(
+                            rand_state, ray_pos, w, kernel_params, state.collisions[pixel]);
+                    alive = true;
+                }
+
+                state.alive[i] = alive;
+                if (!alive)
+                    continue;
+                paths.pos_x[i] = ray_pos.x; paths.pos_y[i] = ray_pos.y; paths.pos_z[i] = ray_pos.z;
+                paths.dir_x[i] = ray_dir.x; paths.dir_y[i] = ray_dir.y; paths.dir_z[i] = ray_dir.z;
+                paths.weight[i] = w;
+                paths.num_interactions[i] = num_interactions;
+                paths.rand_state[i] = rand_state;
+                ++num_alive;
+            }
+            state.chunk_offsets[begin / chunk_size] = num_alive;
+        });
+        num_live = compact_paths(state, workers, num_live, chunk_size);
+    }
+
+    workers.parallel_for(num_pixels, WAVEFRONT_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            if (!pixel_converged(kernel_params, (unsigned int)i))
+                accumulate_pixel(kernel_params, (unsigned int)i, state.values[i], state.collisions[i]);
+    });
+}
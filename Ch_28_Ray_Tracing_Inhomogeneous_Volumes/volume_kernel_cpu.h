@@ -0,0 +1,112 @@
+//
+// CPU volume path tracing backend interface
+//
+
+#ifndef VOLUME_KERNEL_CPU_H
+#define VOLUME_KERNEL_CPU_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cuda_compat.h"
+#include "counter_rng.h"
+#include "volume_kernel.h"
+
+// Image tiles handed out to the worker threads, the size of a CUDA block.
+#define CPU_TILE_SIZE 16
+
+// Paths per work item of the wavefront stages (at most; smaller when few
+// paths are left).
+#define WAVEFRONT_CHUNK_SIZE 1024
+
+// Worker threads of the CPU backend. parallel_for hands out chunks of an
+// index range to all threads (the calling thread included) and returns when
+// the whole range is done. The time each thread spends working is recorded,
+// so that utilization = busy_seconds() / (num_threads() * wall clock time).
+class Cpu_workers {
+public:
+    explicit Cpu_workers(unsigned int num_threads);
+    ~Cpu_workers();
+
+    unsigned int num_threads() const { return (unsigned int)busy.size(); }
+
+    // Call func(begin, end) for consecutive chunks of [0, n) of at most
+    // chunk_size indices.
+    void parallel_for(
+        size_t n,
+        size_t chunk_size,
+        const std::function<void(size_t, size_t)> &func);
+
+    double busy_seconds() const;
+    void reset_busy_seconds();
+
+private:
+    Cpu_workers(const Cpu_workers &);
+    Cpu_workers &operator=(const Cpu_workers &);
+
+    void run(unsigned int thread);
+    void work(unsigned int thread);
+
+    std::vector<std::thread> threads;
+    std::vector<double> busy;
+
+    std::mutex mutex;
+    std::condition_variable start_cv, done_cv;
+    const std::function<void(size_t, size_t)> *job;
+    size_t job_size, job_chunk_size;
+    std::atomic<size_t> next_index;
+    unsigned int generation;
+    unsigned int pending;
+    bool quit;
+};
+
+// Render one progressive iteration (one sample for every pixel, or every
+// unconverged one with adaptive sampling) into kernel_params.accum_buffer,
+// the host equivalent of a volume_rt_kernel launch. The image is split into
+// tiles that the workers pick up in turn, so threads that draw empty or
+// converged tiles simply take more of them.
+void volume_rt_cpu(
+    const Kernel_params &kernel_params,
+    Cpu_workers &workers);
+
+// Path state of the wavefront renderer in structure-of-arrays order, one
+// entry per live path.
+struct Wavefront_paths {
+    std::vector<float> pos_x, pos_y, pos_z;
+    std::vector<float> dir_x, dir_y, dir_z;
+    std::vector<float> weight;
+    std::vector<unsigned int> num_interactions;
+    std::vector<unsigned int> pixel;
+    std::vector<Rand_state> rand_state;
+
+    void resize(size_t n);
+};
+
+// Buffers of the wavefront renderer, kept across iterations.
+struct Wavefront_state {
+    Wavefront_paths paths[2];               // live paths, and their compacted copy
+    std::vector<unsigned char> alive;       // per queue entry, after a stage
+    std::vector<size_t> chunk_offsets;      // compaction output offset per chunk
+    std::vector<float3> values;             // per pixel sample of the current iteration
+    std::vector<unsigned int> collisions;   // per pixel collisions of the current iteration
+
+    // Statistics of the last iteration.
+    unsigned int num_stages;                // interaction stages until all paths ended
+    size_t num_path_stages;                 // sum of the live paths over all stages
+};
+
+// The same iteration as volume_rt_cpu, computed in wavefront order: all
+// camera paths are generated into a queue, then every stage advances all live
+// paths by one interaction and compacts the finished ones out of the queue,
+// until none is left. A path draws the same random numbers as in
+// volume_rt_cpu, so both give the same image.
+void volume_rt_cpu_wavefront(
+    const Kernel_params &kernel_params,
+    Cpu_workers &workers,
+    Wavefront_state &state);
+
+#endif // VOLUME_KERNEL_CPU_H
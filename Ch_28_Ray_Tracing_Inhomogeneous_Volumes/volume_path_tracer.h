@@ -0,0 +1,705 @@
+//
+// Volume path tracing code shared by the CUDA kernel (volume_kernel.cu) and
+// the CPU backend (volume_kernel_cpu.cpp)
+//
+
+#ifndef VOLUME_PATH_TRACER_H
+#define VOLUME_PATH_TRACER_H
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include "cuda_compat.h"
+#include "volume_kernel.h"
+
+// 3d vector math utilities.
+__device__ inline float3 operator+(const float3& a, const float3& b)
+{
+    return make_float3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+__device__ inline float3 operator-(const float3& a, const float3& b)
+{
+    return make_float3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+__device__ inline float3 operator*(const float3& a, const float s)
+{
+    return make_float3(a.x * s, a.y * s, a.z * s);
+}
+__device__ inline float3 operator/(const float3& a, const float s)
+{
+    return make_float3(a.x / s, a.y / s, a.z / s);
+}
+__device__ inline void operator+=(float3& a, const float3& b)
+{
+    a.x += b.x; a.y += b.y; a.z += b.z;
+}
+__device__ inline void operator*=(float3& a, const float& s)
+{
+    a.x *= s; a.y *= s; a.z *= s;
+}
+__device__ inline float3 normalize(const float3 &d)
+{
+    const float inv_len = 1.0f / sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+    return make_float3(d.x * inv_len, d.y * inv_len, d.z * inv_len);
+}
+__device__ inline float dot(const float3 &u, const float3 &v)
+{
+    return u.x * v.x + u.y * v.y + u.z * v.z;
+}
+
+#include "counter_rng.h"
+#define rand(state) rand_uniform(state)
+
+__device__ inline bool intersect_volume_box(
+    float &tmin, const float3 &raypos, const float3 &raydir)
+{
+    const float x0 = (-0.5f - raypos.x) / raydir.x;
+    const float y0 = (-0.5f - raypos.y) / raydir.y;
+    const float z0 = (-0.5f - raypos.z) / raydir.z;
+    const float x1 = ( 0.5f - raypos.x) / raydir.x;
+    const float y1 = ( 0.5f - raypos.y) / raydir.y;
+    const float z1 = ( 0.5f - raypos.z) / raydir.z;
+
+    tmin = fmaxf(fmaxf(fmaxf(fminf(z0,z1), fminf(y0,y1)), fminf(x0,x1)), 0.0f);
+    const float tmax = fminf(fminf(fmaxf(z0,z1), fmaxf(y0,y1)), fmaxf(x0,x1));
+    return (tmin < tmax);
+}
+
+__device__ inline bool in_volume(
+    const float3 &pos)
+{
+    return fmaxf(fabsf(pos.x), fmaxf(fabsf(pos.y), fabsf(pos.z))) < 0.5f;
+}
+
+__device__ inline unsigned int clamp_index(
+    const int i,
+    const unsigned int n)
+{
+    return i < 0 ? 0 : ((unsigned int)i >= n ? n - 1 : (unsigned int)i);
+}
+
+__device__ inline float get_voxel(
+    const Voxel_grid &grid,
+    const unsigned int x,
+    const unsigned int y,
+    const unsigned int z)
+{
+    const unsigned int brick = grid.brick_index[
+        ((z >> VOXEL_BRICK_BITS) * grid.brick_dims.y + (y >> VOXEL_BRICK_BITS)) * grid.brick_dims.x +
+        (x >> VOXEL_BRICK_BITS)];
+    if (brick == VOXEL_BRICK_EMPTY)
+        return 0.0f;
+    const unsigned int mask = VOXEL_BRICK_SIZE - 1;
+    return grid.bricks[(size_t)brick * (VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE) +
+                       (((z & mask) << VOXEL_BRICK_BITS) + (y & mask)) * VOXEL_BRICK_SIZE + (x & mask)];
+}
+
+// Trilinear interpolation between voxel centers, clamped at the faces.
+__device__ inline float get_grid_density(
+    const Voxel_grid &grid,
+    const float3 &p)
+{
+    const float gx = (p.x + 0.5f) * (float)grid.dims.x - 0.5f;
+    const float gy = (p.y + 0.5f) * (float)grid.dims.y - 0.5f;
+    const float gz = (p.z + 0.5f) * (float)grid.dims.z - 0.5f;
+    const float fx = floorf(gx), fy = floorf(gy), fz = floorf(gz);
+    const float ax = gx - fx, ay = gy - fy, az = gz - fz;
+
+    const unsigned int x0 = clamp_index((int)fx, grid.dims.x), x1 = clamp_index((int)fx + 1, grid.dims.x);
+    const unsigned int y0 = clamp_index((int)fy, grid.dims.y), y1 = clamp_index((int)fy + 1, grid.dims.y);
+    const unsigned int z0 = clamp_index((int)fz, grid.dims.z), z1 = clamp_index((int)fz + 1, grid.dims.z);
+
+    const float d00 = get_voxel(grid, x0, y0, z0) * (1.0f - ax) + get_voxel(grid, x1, y0, z0) * ax;
+    const float d10 = get_voxel(grid, x0, y1, z0) * (1.0f - ax) + get_voxel(grid, x1, y1, z0) * ax;
+    const float d01 = get_voxel(grid, x0, y0, z1) * (1.0f - ax) + get_voxel(grid, x1, y0, z1) * ax;
+    const float d11 = get_voxel(grid, x0, y1, z1) * (1.0f - ax) + get_voxel(grid, x1, y1, z1) * ax;
+    return ((d00 * (1.0f - ay) + d10 * ay) * (1.0f - az) +
+            (d01 * (1.0f - ay) + d11 * ay) * az);
+}
+
+__device__ inline float get_extinction(
+    const Kernel_params &kernel_params,
+    const float3 &p)
+{
+    if (kernel_params.volume_type == 0) {
+        float3 pos = p + make_float3(0.5f, 0.5f, 0.5f);
+        const unsigned int steps = 3;
+        for (unsigned int i = 0; i < steps; ++i) {
+            pos *= 3.0f;
+            const int s =
+                ((int)pos.x & 1) + ((int)pos.y & 1) + ((int)pos.z & 1);
+            if (s >= 2)
+                return 0.0f;
+        }
+        return kernel_params.max_extinction;
+    } else if (kernel_params.volume_type == 1) {
+        const float r = 0.5f * (0.5f - fabsf(p.y));
+        const float a = (float)(M_PI * 8.0) * p.y;
+        const float dx = (cosf(a) * r - p.x) * 2.0f;
+        const float dy = (sinf(a) * r - p.z) * 2.0f;
+        return powf(fmaxf((1.0f - dx * dx - dy * dy), 0.0f), 8.0f) * kernel_params.max_extinction;
+    } else {
+        return get_grid_density(kernel_params.grid, p) * kernel_params.max_extinction;
+    }
+}
+
+// 3D DDA over the bricks of a voxel grid, which are also the cells of its
+// majorant grid.
+struct Majorant_dda {
+    int ix, iy, iz;             // current brick
+    int step_x, step_y, step_z;
+    float dt_x, dt_y, dt_z;     // ray distance across one brick
+    float t_next_x, t_next_y, t_next_z;
+};
+
+__device__ inline void init_majorant_dda(
+    Majorant_dda &dda,
+    const Voxel_grid &grid,
+    const float3 &ray_pos,
+    const float3 &ray_dir)
+{
+    // Brick extent in the volume box (the last bricks may reach past the box).
+    const float cell_x = (float)VOXEL_BRICK_SIZE / (float)grid.dims.x;
+    const float cell_y = (float)VOXEL_BRICK_SIZE / (float)grid.dims.y;
+    const float cell_z = (float)VOXEL_BRICK_SIZE / (float)grid.dims.z;
+    dda.ix = (int)clamp_index((int)floorf((ray_pos.x + 0.5f) / cell_x), grid.brick_dims.x);
+    dda.iy = (int)clamp_index((int)floorf((ray_pos.y + 0.5f) / cell_y), grid.brick_dims.y);
+    dda.iz = (int)clamp_index((int)floorf((ray_pos.z + 0.5f) / cell_z), grid.brick_dims.z);
+
+    dda.step_x = ray_dir.x < 0.0f ? -1 : 1;
+    dda.step_y = ray_dir.y < 0.0f ? -1 : 1;
+    dda.step_z = ray_dir.z < 0.0f ? -1 : 1;
+    const float inv_x = ray_dir.x != 0.0f ? 1.0f / ray_dir.x : 1e30f;
+    const float inv_y = ray_dir.y != 0.0f ? 1.0f / ray_dir.y : 1e30f;
+    const float inv_z = ray_dir.z != 0.0f ? 1.0f / ray_dir.z : 1e30f;
+    dda.dt_x = cell_x * fabsf(inv_x);
+    dda.dt_y = cell_y * fabsf(inv_y);
+    dda.dt_z = cell_z * fabsf(inv_z);
+    dda.t_next_x = ((float)(dda.ix + (dda.step_x > 0)) * cell_x - 0.5f - ray_pos.x) * inv_x;
+    dda.t_next_y = ((float)(dda.iy + (dda.step_y > 0)) * cell_y - 0.5f - ray_pos.y) * inv_y;
+    dda.t_next_z = ((float)(dda.iz + (dda.step_z > 0)) * cell_z - 0.5f - ray_pos.z) * inv_z;
+}
+
+// Ray distance at which the current brick is left.
+__device__ inline float majorant_dda_exit(
+    const Majorant_dda &dda)
+{
+    return fminf(dda.t_next_x, fminf(dda.t_next_y, dda.t_next_z));
+}
+
+// Majorant extinction of the current brick.
+__device__ inline float majorant_dda_value(
+    const Majorant_dda &dda,
+    const Kernel_params &kernel_params)
+{
+    const Voxel_grid &grid = kernel_params.grid;
+    return kernel_params.max_extinction *
+        grid.majorants[(dda.iz * grid.brick_dims.y + dda.iy) * grid.brick_dims.x + dda.ix];
+}
+
+// Minorant extinction of the current brick.
+__device__ inline float minorant_dda_value(
+    const Majorant_dda &dda,
+    const Kernel_params &kernel_params)
+{
+    const Voxel_grid &grid = kernel_params.grid;
+    return kernel_params.max_extinction *
+        grid.minorants[(dda.iz * grid.brick_dims.y + dda.iy) * grid.brick_dims.x + dda.ix];
+}
+
+// Step to the next brick; false if the ray leaves the grid.
+__device__ inline bool step_majorant_dda(
+    Majorant_dda &dda,
+    const Voxel_grid &grid)
+{
+    if (dda.t_next_x <= dda.t_next_y && dda.t_next_x <= dda.t_next_z) {
+        dda.ix += dda.step_x;
+        if (dda.ix < 0 || dda.ix >= (int)grid.brick_dims.x)
+            return false;
+        dda.t_next_x += dda.dt_x;
+    } else if (dda.t_next_y <= dda.t_next_z) {
+        dda.iy += dda.step_y;
+        if (dda.iy < 0 || dda.iy >= (int)grid.brick_dims.y)
+            return false;
+        dda.t_next_y += dda.dt_y;
+    } else {
+        dda.iz += dda.step_z;
+        if (dda.iz < 0 || dda.iz >= (int)grid.brick_dims.z)
+            return false;
+        dda.t_next_z += dda.dt_z;
+    }
+    return true;
+}
+
+// Delta tracking with the majorant grid of a voxel grid volume: the ray walks
+// the bricks with a 3D DDA and samples tentative collisions with the majorant
+// of the current brick. Free-flight distances are memoryless, so a sample
+// that leaves a brick restarts at its boundary with the next majorant, and
+// empty bricks are crossed without any collision.
+__device__ inline bool sample_interaction_majorant_grid(
+    Rand_state &rand_state,
+    float3 &ray_pos,
+    const float3 &ray_dir,
+    const Kernel_params &kernel_params,
+    unsigned int &num_collisions)
+{
+    Majorant_dda dda;
+    init_majorant_dda(dda, kernel_params.grid, ray_pos, ray_dir);
+
+    float t = 0.0f;
+    while (true) {
+        const float t_exit = majorant_dda_exit(dda);
+        const float majorant = majorant_dda_value(dda, kernel_params);
+        if (majorant > 0.0f) {
+            while (true) {
+                const float ts = t - logf(1.0f - rand(&rand_state)) / majorant;
+                if (ts >= t_exit)
+                    break;
+                t = ts;
+
+                const float3 pos = ray_pos + ray_dir * t;
+                if (!in_volume(pos))
+                    return false;
+                ++num_collisions;
+                if (get_extinction(kernel_params, pos) >= rand(&rand_state) * majorant) {
+                    ray_pos = pos;
+                    return true;
+                }
+            }
+        }
+
+        // Step to the next brick.
+        t = t_exit;
+        if (!step_majorant_dda(dda, kernel_params.grid))
+            return false;
+    }
+}
+
+__device__ inline bool sample_interaction(
+    Rand_state &rand_state,
+    float3 &ray_pos,
+    const float3 &ray_dir,
+    const Kernel_params &kernel_params,
+    unsigned int &num_collisions)
+{
+    if (kernel_params.volume_type == 2 && kernel_params.majorant_type == 1)
+        return sample_interaction_majorant_grid(rand_state, ray_pos, ray_dir, kernel_params, num_collisions);
+
+    float t = 0.0f;
+    float3 pos;
+    do {
+        t -= logf(1.0f - rand(&rand_state)) / kernel_params.max_extinction;
+
+        pos = ray_pos + ray_dir * t;
+        if (!in_volume(pos))
+            return false;
+        ++num_collisions;
+        
+    } while (get_extinction(kernel_params, pos) < rand(&rand_state) * kernel_params.max_extinction);
+
+    ray_pos = pos;
+    return true;
+}
+
+// Ray distance to the volume box boundary from a point inside it.
+__device__ inline float volume_box_exit(
+    const float3 &raypos, const float3 &raydir)
+{
+    const float x0 = (-0.5f - raypos.x) / raydir.x;
+    const float y0 = (-0.5f - raypos.y) / raydir.y;
+    const float z0 = (-0.5f - raypos.z) / raydir.z;
+    const float x1 = ( 0.5f - raypos.x) / raydir.x;
+    const float y1 = ( 0.5f - raypos.y) / raydir.y;
+    const float z1 = ( 0.5f - raypos.z) / raydir.z;
+    return fminf(fminf(fmaxf(z0,z1), fmaxf(y0,y1)), fmaxf(x0,x1));
+}
+
+// (Residual) ratio tracking over the ray segment [t, t_end], in which the
+// extinction lies between minorant and majorant. The constant control
+// extinction minorant + control * (majorant - minorant) is accounted for in
+// closed form. Only the residual extinction is tracked, with tentative
+// collisions at the rate of its largest magnitude that weight the estimate by
+// 1 - residual / residual majorant. Ratio tracking is control = 0 with a
+// minorant of 0; with control = 0 the weights stay in [0, 1]. Low estimates
+// are terminated by Russian roulette.
+__device__ inline void ratio_track_segment(
+    Rand_state &rand_state,
+    const float3 &ray_pos,
+    const float3 &ray_dir,
+    float t,
+    const float t_end,
+    const float minorant,
+    const float majorant,
+    const float control,
+    float &transmittance,
+    const Kernel_params &kernel_params,
+    unsigned int &num_collisions)
+{
+    const float control_extinction = minorant + control * (majorant - minorant);
+    const float residual_majorant = fmaxf(control, 1.0f - control) * (majorant - minorant);
+    transmittance *= expf(-control_extinction * (t_end - t));
+    if (residual_majorant <= 0.0f)
+        return;
+
+    while (transmittance > 0.0f) {
+        t -= logf(1.0f - rand(&rand_state)) / residual_majorant;
+        if (t >= t_end)
+            return;
+        ++num_collisions;
+        const float residual = get_extinction(kernel_params, ray_pos + ray_dir * t) - control_extinction;
+        transmittance *= 1.0f - residual / residual_majorant;
+        if (transmittance < 0.1f) {
+            if (rand(&rand_state) * 0.1f >= transmittance)
+                transmittance = 0.0f;
+            else
+                transmittance = 0.1f;
+        }
+    }
+}
+
+// Estimate the transmittance from ray_pos (inside the volume box) to the box
+// boundary: 0 or 1 by delta tracking, or a fractional value by (residual)
+// ratio tracking, walking the majorant grid if one is used for delta
+// tracking (its minorants then give the control for residual ratio tracking).
+// See transmittance_type in Kernel_params.
+__device__ inline float estimate_transmittance(
+    Rand_state &rand_state,
+    const float3 &ray_pos,
+    const float3 &ray_dir,
+    const Kernel_params &kernel_params,
+    unsigned int &num_collisions)
+{
+    if (kernel_params.transmittance_type == 0) {
+        float3 pos = ray_pos;
+        return sample_interaction(rand_state, pos, ray_dir, kernel_params, num_collisions) ? 0.0f : 1.0f;
+    }
+
+    const bool residual = kernel_params.transmittance_type == 2;
+    const float control = residual ? kernel_params.residual_control : 0.0f;
+    const float t_box = volume_box_exit(ray_pos, ray_dir);
+    float transmittance = 1.0f;
+    if (kernel_params.volume_type != 2 || kernel_params.majorant_type != 1) {
+        ratio_track_segment(rand_state, ray_pos, ray_dir, 0.0f, t_box, 0.0f, kernel_params.max_extinction,
+                            control, transmittance, kernel_params, num_collisions);
+        return transmittance;
+    }
+
+    Majorant_dda dda;
+    init_majorant_dda(dda, kernel_params.grid, ray_pos, ray_dir);
+    float t = 0.0f;
+    while (transmittance > 0.0f) {
+        const float t_end = fminf(majorant_dda_exit(dda), t_box);
+        const float minorant = residual ? minorant_dda_value(dda, kernel_params) : 0.0f;
+        ratio_track_segment(rand_state, ray_pos, ray_dir, t, t_end, minorant, majorant_dda_value(dda, kernel_params),
+                            control, transmittance, kernel_params, num_collisions);
+        if (t_end >= t_box || !step_majorant_dda(dda, kernel_params.grid))
+            break;
+        t = t_end;
+    }
+    return transmittance;
+}
+
+// Scattering at an interaction found by sample_interaction: path length
+// limit, albedo with Russian roulette, and a new direction from the isotropic
+// phase function. Returns false if the path is terminated.
+__device__ inline bool scatter(
+    Rand_state &rand_state,
+    float3 &ray_dir,
+    float &w,
+    unsigned int &num_interactions,
+    const Kernel_params &kernel_params)
+{
+    // Is the path length exeeded?
+    if (num_interactions++ >= kernel_params.max_interactions)
+        return false;
+
+    w *= kernel_params.albedo;
+    // Russian roulette absorption
+    if (w < 0.2f) {
+        if (rand(&rand_state) > w * 5.0f) {
+            return false;
+        }
+        w = 0.2f;
+    }
+
+    // Sample isotropic phase function.
+    const float phi = (float)(2.0 * M_PI) * rand(&rand_state);
+    const float cos_theta = 1.0f - 2.0f * rand(&rand_state);
+    const float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+    ray_dir = make_float3(
+        cosf(phi) * sin_theta,
+        sinf(phi) * sin_theta,
+        cos_theta);
+    return true;
+}
+
+// Environment radiance along ray_dir for a path of weight w.
+__device__ inline float3 lookup_environment(
+    const float3 &ray_dir,
+    const float w,
+    const Kernel_params &kernel_params)
+{
+    if (kernel_params.environment_type == 0) {
+        const float f = (0.5f + 0.5f * ray_dir.y) * w;
+        return make_float3(f, f, f);
+    } else {
+        const float4 texval = tex2D<float4>(
+            kernel_params.env_tex,
+            atan2f(ray_dir.z, ray_dir.x) * (float)(0.5 / M_PI) + 0.5f,
+            acosf(fmaxf(fminf(ray_dir.y, 1.0f), -1.0f)) * (float)(1.0 / M_PI));
+        return make_float3(texval.x * w, texval.y * w, texval.z * w);
+    }
+}
+
+// Is next-event estimation of the environment light enabled?
+__device__ inline bool sample_environment_light(
+    const Kernel_params &kernel_params)
+{
+    return kernel_params.environment_type == 1 && kernel_params.environment_sampling == 1;
+}
+
+// Index of the CDF bin containing u, and the relative position of u in it.
+__device__ inline unsigned int sample_cdf(
+    const float *cdf,
+    const unsigned int n,
+    float u,
+    float &offset)
+{
+    u = fminf(u, 0.99999994f);
+    unsigned int lo = 0, hi = n;
+    while (hi - lo > 1) {
+        const unsigned int mid = (lo + hi) / 2;
+        if (cdf[mid] <= u)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    const float width = cdf[lo + 1] - cdf[lo];
+    offset = width > 0.0f ? (u - cdf[lo]) / width : 0.5f;
+    return lo;
+}
+
+// Solid angle density of env_dist for direction dir.
+__device__ inline float environment_pdf(
+    const float3 &dir,
+    const Kernel_params &kernel_params)
+{
+    const Environment_distribution &dist = kernel_params.env_dist;
+    const float cos_theta = fmaxf(fminf(dir.y, 1.0f), -1.0f);
+    const float sin_theta = sqrtf(fmaxf(1.0f - cos_theta * cos_theta, 0.0f));
+    if (sin_theta <= 0.0f)
+        return 0.0f;
+    const float u = atan2f(dir.z, dir.x) * (float)(0.5 / M_PI) + 0.5f;
+    const float v = acosf(cos_theta) * (float)(1.0 / M_PI);
+    const unsigned int x = clamp_index((int)(u * (float)dist.size.x), dist.size.x);
+    const unsigned int y = clamp_index((int)(v * (float)dist.size.y), dist.size.y);
+    return dist.pdf[y * dist.size.x + x] / ((float)(2.0 * M_PI * M_PI) * sin_theta);
+}
+
+// Power heuristic weight of a phase function sample that escaped to the
+// environment after num_interactions scattering events (camera rays are not
+// light sampled and keep their full weight).
+__device__ inline float environment_mis_weight(
+    const float3 &ray_dir,
+    const unsigned int num_interactions,
+    const Kernel_params &kernel_params)
+{
+    if (num_interactions == 0 || !sample_environment_light(kernel_params))
+        return 1.0f;
+    const float phase_pdf = (float)(0.25 / M_PI);
+    const float light_pdf = environment_pdf(ray_dir, kernel_params);
+    return phase_pdf * phase_pdf / (phase_pdf * phase_pdf + light_pdf * light_pdf);
+}
+
+// Next-event estimation at scattering vertex ray_pos for a path of weight w:
+// sample a direction from env_dist and estimate the transmittance towards
+// the environment.
+__device__ inline float3 sample_environment(
+    Rand_state &rand_state,
+    const float3 &ray_pos,
+    const float w,
+    const Kernel_params &kernel_params,
+    unsigned int &num_collisions)
+{
+    const Environment_distribution &dist = kernel_params.env_dist;
+    float dv, du;
+    const unsigned int y = sample_cdf(dist.marginal_cdf, dist.size.y, rand(&rand_state), dv);
+    const unsigned int x = sample_cdf(dist.conditional_cdf + y * (dist.size.x + 1), dist.size.x, rand(&rand_state), du);
+
+    const float phi = (float)(2.0 * M_PI) * (((float)x + du) / (float)dist.size.x - 0.5f);
+    const float theta = (float)M_PI * ((float)y + dv) / (float)dist.size.y;
+    const float sin_theta = sinf(theta);
+    if (sin_theta <= 0.0f)
+        return make_float3(0.0f, 0.0f, 0.0f);
+    const float3 dir = make_float3(cosf(phi) * sin_theta, cosf(theta), sinf(phi) * sin_theta);
+    const float light_pdf = dist.pdf[y * dist.size.x + x] / ((float)(2.0 * M_PI * M_PI) * sin_theta);
+
+    const float transmittance = estimate_transmittance(rand_state, ray_pos, dir, kernel_params, num_collisions);
+    if (transmittance <= 0.0f)
+        return make_float3(0.0f, 0.0f, 0.0f);
+
+    const float phase_pdf = (float)(0.25 / M_PI);
+    const float mis_weight = light_pdf * light_pdf / (light_pdf * light_pdf + phase_pdf * phase_pdf);
+    return lookup_environment(dir, w * transmittance * phase_pdf * mis_weight / light_pdf, kernel_params);
+}
+
+__device__ inline float3 trace_volume(
+    Rand_state &rand_state,
+    float3 &ray_pos,
+    float3 &ray_dir,
+    const Kernel_params &kernel_params,
+    unsigned int &num_collisions)
+{
+    float t0;
+    float w = 1.0f;
+    float3 value = make_float3(0.0f, 0.0f, 0.0f);
+    if (intersect_volume_box(t0, ray_pos, ray_dir)) {
+
+        ray_pos += ray_dir * t0;
+
+        unsigned int num_interactions = 0;
+        while (sample_interaction(rand_state, ray_pos, ray_dir, kernel_params, num_collisions))
+        {
+            if (!scatter(rand_state, ray_dir, w, num_interactions, kernel_params))
+                return value;
+            if (sample_environment_light(kernel_params))
+                value += sample_environment(rand_state, ray_pos, w, kernel_params, num_collisions);
+        }
+        w *= environment_mis_weight(ray_dir, num_interactions, kernel_params);
+    }
+
+    // Lookup environment.
+    return value + lookup_environment(ray_dir, w, kernel_params);
+}
+
+// Initialize the pseudorandom number generator (PRNG) of pixel idx and
+// generate its primary ray from the pinhole camera.
+__device__ inline void generate_camera_ray(
+    Rand_state &rand_state,
+    float3 &ray_pos,
+    float3 &ray_dir,
+    const Kernel_params &kernel_params,
+    const unsigned int x,
+    const unsigned int y)
+{
+    // The path of pixel idx in this iteration draws the dimensions of its own
+    // (pixel, sample) stream, starting with the jitter of the camera ray.
+    const unsigned int idx = y * kernel_params.resolution.x + x;
+    rand_init(rand_state, idx, kernel_params.iteration);
+
+    const float inv_res_x = 1.0f / (float)kernel_params.resolution.x;
+    const float inv_res_y = 1.0f / (float)kernel_params.resolution.y;
+    const float pr = (2.0f * ((float)x + rand(&rand_state)) * inv_res_x - 1.0f);
+    const float pu = (2.0f * ((float)y + rand(&rand_state)) * inv_res_y - 1.0f);
+    const float aspect = (float)kernel_params.resolution.y * inv_res_x;
+    ray_pos = kernel_params.cam_pos;
+    ray_dir = normalize(
+        kernel_params.cam_dir * kernel_params.cam_focal + kernel_params.cam_right * pr + kernel_params.cam_up * aspect * pu);
+}
+
+// Whether pixel idx is skipped in this iteration because it has converged.
+__device__ inline bool pixel_converged(
+    const Kernel_params &kernel_params,
+    const unsigned int idx)
+{
+    return kernel_params.convergence_mask && kernel_params.iteration > 0 &&
+        kernel_params.convergence_mask[idx];
+}
+
+// Add a sample to the statistics of pixel idx and test the pixel for
+// convergence, as in the variance tracking of Ch_23. Returns the number of
+// samples before this one.
+__device__ inline unsigned int update_pixel_stats(
+    const Kernel_params &kernel_params,
+    const unsigned int idx,
+    const float3 &value)
+{
+    Pixel_stats &stats = kernel_params.pixel_stats[idx];
+    const unsigned int n = kernel_params.iteration == 0 ? 0 : stats.num_samples;
+    const float mean = n == 0 ? 0.0f : stats.mean;
+    const float m2 = n == 0 ? 0.0f : stats.m2;
+
+    const float l = 0.2126f * value.x + 0.7152f * value.y + 0.0722f * value.z;
+    const float delta = l - mean;
+    stats.num_samples = n + 1;
+    stats.mean = mean + delta / (float)(n + 1);
+    stats.m2 = m2 + delta * (l - stats.mean);
+
+    bool converged = false;
+    if (n + 1 >= kernel_params.min_samples && n > 0) {
+        const float quantile = 1.959964f; // 95% confidence interval
+        const float variance_of_mean = stats.m2 / ((float)n * (float)(n + 1));
+        const float std_error = sqrtf(variance_of_mean);
+        converged = std_error * quantile <= kernel_params.convergence_threshold * stats.mean;
+    }
+    kernel_params.convergence_mask[idx] = converged ? 1 : 0;
+    return n;
+}
+
+// Update the display value of pixel idx (simple Reinhard tonemapper + gamma);
+// headless renders have none.
+__device__ inline void update_display(
+    const Kernel_params &kernel_params,
+    const unsigned int idx)
+{
+    if (!kernel_params.display_buffer)
+        return;
+    float3 val = kernel_params.accum_buffer[idx] * kernel_params.exposure_scale;
+    val.x *= (1.0f + val.x * 0.1f) / (1.0f + val.x);
+    val.y *= (1.0f + val.y * 0.1f) / (1.0f + val.y);
+    val.z *= (1.0f + val.z * 0.1f) / (1.0f + val.z);
+    const unsigned int r = (unsigned int)(255.0f *
+                  fminf(powf(fmaxf(val.x, 0.0f), (float)(1.0 / 2.2)), 1.0f));
+    const unsigned int g = (unsigned int)(255.0f *
+                  fminf(powf(fmaxf(val.y, 0.0f), (float)(1.0 / 2.2)), 1.0f));
+    const unsigned int b = (unsigned int)(255.0f *
+                  fminf(powf(fmaxf(val.z, 0.0f), (float)(1.0 / 2.2)), 1.0f));
+    kernel_params.display_buffer[idx] = 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+// Accumulate the sample value of pixel idx and update its display value.
+__device__ inline void accumulate_pixel(
+    const Kernel_params &kernel_params,
+    const unsigned int idx,
+    const float3 &value,
+    const unsigned int num_collisions)
+{
+    // Samples so far: one per iteration, unless adaptive sampling skipped
+    // some.
+    const unsigned int n = kernel_params.pixel_stats ?
+        update_pixel_stats(kernel_params, idx, value) : kernel_params.iteration;
+    if (n == 0)
+        kernel_params.accum_buffer[idx] = value;
+    else
+        kernel_params.accum_buffer[idx] = kernel_params.accum_buffer[idx] +
+            (value - kernel_params.accum_buffer[idx]) / (float)(n + 1);
+    if (kernel_params.collision_buffer)
+        kernel_params.collision_buffer[idx] =
+            (n == 0 ? 0 : kernel_params.collision_buffer[idx]) + num_collisions;
+
+    update_display(kernel_params, idx);
+}
+
+// Render one progressive sample for pixel (x, y) and accumulate it; converged
+// pixels only refresh their display value.
+__device__ inline void render_pixel(
+    const Kernel_params &kernel_params,
+    const unsigned int x,
+    const unsigned int y)
+{
+    const unsigned int idx = y * kernel_params.resolution.x + x;
+    if (pixel_converged(kernel_params, idx)) {
+        update_display(kernel_params, idx);
+        return;
+    }
+
+    Rand_state rand_state;
+    float3 ray_pos, ray_dir;
+    generate_camera_ray(rand_state, ray_pos, ray_dir, kernel_params, x, y);
+
+    unsigned int num_collisions = 0;
+    const float3 value = trace_volume(rand_state, ray_pos, ray_dir, kernel_params, num_collisions);
+
+    accumulate_pixel(kernel_params, idx, value, num_collisions);
+}
+
+#endif // VOLUME_PATH_TRACER_H
@@ -0,0 +1,263 @@
+//
+// utility code to load voxel grid volumes, dense or sparse, into the brick
+// storage and majorant grid of Voxel_grid (volume_kernel.h)
+//
+// Supported files:
+// - dense: Mitsuba's "VOL" grid format (version 3, float32 encoding); only
+//   the first channel is used and the bounding box is ignored, the grid
+//   always fills the volume box.
+// - sparse: a list of non-zero voxels, little-endian:
+//     char magic[4] = "SVOX"; uint32 version = 1; uint32 nx, ny, nz;
+//     uint64 count; count * { uint32 x, y, z; float density; }
+//
+// Densities are normalized to a maximum of 1, the extinction is then
+// density * max_extinction as for the procedural volumes.
+//
+
+#ifndef VOXEL_GRID_H
+#define VOXEL_GRID_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include "volume_kernel.h"
+
+#define VOXEL_BRICK_VOXELS (VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE)
+
+/* host side grid */
+typedef struct {
+    unsigned int nx, ny, nz;   /* voxels */
+    unsigned int bx, by, bz;   /* bricks */
+    unsigned int num_bricks;   /* stored (non-empty) bricks */
+    unsigned int capacity;     /* allocated bricks */
+    unsigned int *brick_index; /* bx * by * bz entries */
+    float *bricks;             /* num_bricks * VOXEL_BRICK_VOXELS densities */
+    float *majorants;          /* bx * by * bz entries */
+    float *minorants;          /* bx * by * bz entries */
+    float max_density;         /* the densities were divided by this */
+} voxel_grid_t;
+
+static void free_voxel_grid(voxel_grid_t *grid)
+{
+    free(grid->brick_index);
+    free(grid->bricks);
+    free(grid->majorants);
+    free(grid->minorants);
+    memset(grid, 0, sizeof(voxel_grid_t));
+}
+
+static bool voxel_grid_init(voxel_grid_t *grid, unsigned int nx, unsigned int ny, unsigned int nz)
+{
+    memset(grid, 0, sizeof(voxel_grid_t));
+    if (nx == 0 || ny == 0 || nz == 0)
+        return false;
+    grid->nx = nx;
+    grid->ny = ny;
+    grid->nz = nz;
+    grid->bx = (nx + VOXEL_BRICK_SIZE - 1) / VOXEL_BRICK_SIZE;
+    grid->by = (ny + VOXEL_BRICK_SIZE - 1) / VOXEL_BRICK_SIZE;
+    grid->bz = (nz + VOXEL_BRICK_SIZE - 1) / VOXEL_BRICK_SIZE;
+    const size_t n = (size_t)grid->bx * grid->by * grid->bz;
+    grid->brick_index = (unsigned int *)malloc(n * sizeof(unsigned int));
+    grid->majorants = (float *)calloc(n, sizeof(float));
+    grid->minorants = (float *)calloc(n, sizeof(float));
+    if (!grid->brick_index || !grid->majorants || !grid->minorants) {
+        free_voxel_grid(grid);
+        return false;
+    }
+    for (size_t i = 0; i < n; ++i)
+        grid->brick_index[i] = VOXEL_BRICK_EMPTY;
+    return true;
+}
+
+static inline size_t voxel_grid_brick(const voxel_grid_t *grid, unsigned int x, unsigned int y, unsigned int z)
+{
+    return ((size_t)(z / VOXEL_BRICK_SIZE) * grid->by + y / VOXEL_BRICK_SIZE) * grid->bx + x / VOXEL_BRICK_SIZE;
+}
+
+static inline size_t voxel_grid_offset(unsigned int x, unsigned int y, unsigned int z)
+{
+    const unsigned int m = VOXEL_BRICK_SIZE - 1;
+    return ((z & m) * VOXEL_BRICK_SIZE + (y & m)) * VOXEL_BRICK_SIZE + (x & m);
+}
+
+static inline float voxel_grid_get(const voxel_grid_t *grid, unsigned int x, unsigned int y, unsigned int z)
+{
+    const unsigned int b = grid->brick_index[voxel_grid_brick(grid, x, y, z)];
+    return b == VOXEL_BRICK_EMPTY ? 0.0f : grid->bricks[(size_t)b * VOXEL_BRICK_VOXELS + voxel_grid_offset(x, y, z)];
+}
+
+/* store one voxel, allocating its brick on the first non-zero value */
+static bool voxel_grid_set(voxel_grid_t *grid, unsigned int x, unsigned int y, unsigned int z, float density)
+{
+    if (!(density > 0.0f))
+        return true;
+    if (x >= grid->nx || y >= grid->ny || z >= grid->nz)
+        return false;
+
+    unsigned int &b = grid->brick_index[voxel_grid_brick(grid, x, y, z)];
+    if (b == VOXEL_BRICK_EMPTY) {
+        if (grid->num_bricks == grid->capacity) {
+            const unsigned int capacity = grid->capacity ? 2 * grid->capacity : 64;
+            float *bricks = (float *)realloc(grid->bricks, (size_t)capacity * VOXEL_BRICK_VOXELS * sizeof(float));
+            if (!bricks)
+                return false;
+            grid->bricks = bricks;
+            grid->capacity = capacity;
+        }
+        b = grid->num_bricks++;
+        memset(grid->bricks + (size_t)b * VOXEL_BRICK_VOXELS, 0, VOXEL_BRICK_VOXELS * sizeof(float));
+    }
+    grid->bricks[(size_t)b * VOXEL_BRICK_VOXELS + voxel_grid_offset(x, y, z)] = density;
+    if (density > grid->max_density)
+        grid->max_density = density;
+    return true;
+}
+
+/* normalize the densities and compute the majorant and minorant of every
+   brick: trilinear interpolation inside a brick reads the voxels of the brick
+   plus a one voxel border, so they are the maximum and minimum over that
+   range */
+static void voxel_grid_finalize(voxel_grid_t *grid)
+{
+    if (grid->max_density > 0.0f) {
+        const float scale = 1.0f / grid->max_density;
+        const size_t n = (size_t)grid->num_bricks * VOXEL_BRICK_VOXELS;
+        for (size_t i = 0; i < n; ++i)
+            grid->bricks[i] *= scale;
+    }
+
+    for (unsigned int bz = 0; bz < grid->bz; ++bz)
+    for (unsigned int by = 0; by < grid->by; ++by)
+    for (unsigned int bx = 0; bx < grid->bx; ++bx) {
+        float majorant = 0.0f, minorant = 0.0f;
+
+        /* skip the voxel loop if the brick and all its neighbors are empty */
+        bool empty = true;
+        for (int k = -1; k <= 1 && empty; ++k)
+        for (int j = -1; j <= 1 && empty; ++j)
+        for (int i = -1; i <= 1 && empty; ++i) {
+            const int nx = (int)bx + i, ny = (int)by + j, nz = (int)bz + k;
+            if (nx >= 0 && ny >= 0 && nz >= 0 && nx < (int)grid->bx && ny < (int)grid->by && nz < (int)grid->bz)
+                empty = grid->brick_index[((size_t)nz * grid->by + ny) * grid->bx + nx] == VOXEL_BRICK_EMPTY;
+        }
+
+        if (!empty) {
+            const unsigned int x0 = bx * VOXEL_BRICK_SIZE > 0 ? bx * VOXEL_BRICK_SIZE - 1 : 0;
+            const unsigned int y0 = by * VOXEL_BRICK_SIZE > 0 ? by * VOXEL_BRICK_SIZE - 1 : 0;
+            const unsigned int z0 = bz * VOXEL_BRICK_SIZE > 0 ? bz * VOXEL_BRICK_SIZE - 1 : 0;
+            const unsigned int x1 = (bx + 1) * VOXEL_BRICK_SIZE < grid->nx ? (bx + 1) * VOXEL_BRICK_SIZE : grid->nx - 1;
+            const unsigned int y1 = (by + 1) * VOXEL_BRICK_SIZE < grid->ny ? (by + 1) * VOXEL_BRICK_SIZE : grid->ny - 1;
+            const unsigned int z1 = (bz + 1) * VOXEL_BRICK_SIZE < grid->nz ? (bz + 1) * VOXEL_BRICK_SIZE : grid->nz - 1;
+            minorant = 1.0f;
+            for (unsigned int z = z0; z <= z1; ++z)
+                for (unsigned int y = y0; y <= y1; ++y)
+                    for (unsigned int x = x0; x <= x1; ++x) {
+                        const float d = voxel_grid_get(grid, x, y, z);
+                        if (d > majorant)
+                            majorant = d;
+                        if (d < minorant)
+                            minorant = d;
+                    }
+        }
+        grid->majorants[((size_t)bz * grid->by + by) * grid->bx + bx] = majorant;
+        grid->minorants[((size_t)bz * grid->by + by) * grid->bx + bx] = minorant;
+    }
+}
+
+static bool load_voxel_grid_dense(voxel_grid_t *grid, FILE *fp)
+{
+    unsigned char magic[4];
+    int32_t header[5]; /* encoding, xres, yres, zres, channels */
+    float bbox[6];
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, "VOL", 3) != 0 || magic[3] != 3 ||
+        fread(header, sizeof(int32_t), 5, fp) != 5 || fread(bbox, sizeof(float), 6, fp) != 6)
+        return false;
+    if (header[0] != 1 || header[1] <= 0 || header[2] <= 0 || header[3] <= 0 || header[4] <= 0)
+        return false;
+
+    const unsigned int nx = header[1], ny = header[2], nz = header[3], channels = header[4];
+    if (!voxel_grid_init(grid, nx, ny, nz))
+        return false;
+
+    /* one z slice at a time */
+    const size_t slice = (size_t)nx * ny * channels;
+    float *values = (float *)malloc(slice * sizeof(float));
+    bool ok = values != NULL;
+    for (unsigned int z = 0; ok && z < nz; ++z) {
+        ok = fread(values, sizeof(float), slice, fp) == slice;
+        for (unsigned int y = 0; ok && y < ny; ++y)
+            for (unsigned int x = 0; ok && x < nx; ++x)
+                ok = voxel_grid_set(grid, x, y, z, values[((size_t)y * nx + x) * channels]);
+    }
+    free(values);
+    return ok;
+}
+
+static bool load_voxel_grid_sparse(voxel_grid_t *grid, FILE *fp)
+{
+    char magic[4];
+    uint32_t header[4]; /* version, nx, ny, nz */
+    uint64_t count;
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, "SVOX", 4) != 0 ||
+        fread(header, sizeof(uint32_t), 4, fp) != 4 || header[0] != 1 ||
+        fread(&count, sizeof(uint64_t), 1, fp) != 1)
+        return false;
+    if (!voxel_grid_init(grid, header[1], header[2], header[3]))
+        return false;
+
+    struct {
+        uint32_t x, y, z;
+        float density;
+    } records[4096];
+    while (count) {
+        const size_t n = count < 4096 ? (size_t)count : 4096;
+        if (fread(records, sizeof(records[0]), n, fp) != n)
+            return false;
+        for (size_t i = 0; i < n; ++i)
+            if (!voxel_grid_set(grid, records[i].x, records[i].y, records[i].z, records[i].density))
+                return false;
+        count -= n;
+    }
+    return true;
+}
+
+/* load a dense or sparse grid (detected from the file contents) */
+static bool load_voxel_grid(voxel_grid_t *grid, const char *filename)
+{
+    memset(grid, 0, sizeof(voxel_grid_t));
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return false;
+
+    char magic[4] = { 0 };
+    const bool sparse = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "SVOX", 4) == 0;
+    rewind(fp);
+    const bool ok = sparse ? load_voxel_grid_sparse(grid, fp) : load_voxel_grid_dense(grid, fp);
+    fclose(fp);
+
+    if (!ok) {
+        free_voxel_grid(grid);
+        return false;
+    }
+    voxel_grid_finalize(grid);
+    return true;
+}
+
+/* kernel view of a host grid; the CUDA application copies the four arrays
+   to the device and replaces the pointers */
+static Voxel_grid voxel_grid_view(const voxel_grid_t *grid)
+{
+    Voxel_grid g;
+    g.dims = make_uint3(grid->nx, grid->ny, grid->nz);
+    g.brick_dims = make_uint3(grid->bx, grid->by, grid->bz);
+    g.brick_index = grid->brick_index;
+    g.bricks = grid->bricks;
+    g.majorants = grid->majorants;
+    g.minorants = grid->minorants;
+    return g;
+}
+
+#endif // VOXEL_GRID_H
@@ -52,6 +52,8 @@
 #include <sutil.h>
 #include <Camera.h>
 #include "commonStructs.h"
+#include "particleCache.h"
+#include "particleFile.h"
 #include <Arcball.h>
 
 #include <cstring>
@@ -61,20 +63,10 @@
 #include <sstream>
 #include <algorithm>
 #include <stdint.h>
-#include <map>
+#include <memory>
 
 using namespace optix;
 
-struct ParticleFrameData {
-  std::vector<float4> positions;
-  std::vector<float3> velocities;
-  std::vector<float3> colors;
-  std::vector<float>  radii;
-  float3 bbox_min, bbox_max;
-};
-
-std::map<int, ParticleFrameData> dataCache;
-
 const char* const SAMPLE_NAME = "optixParticleVolumes";
 const unsigned int WIDTH  = 1024u;
 const unsigned int HEIGHT = 768u;
@@ -128,7 +120,14 @@ std::string     particles_file;
 std::string     particles_file_extension;
 std::string     particles_file_base;
 int             current_particle_frame = 1;
+int             first_particle_frame = 1;
 int             max_particle_frames = 25;
+int             loaded_particle_frame = -1;
+
+// Frames of a sequence, loaded ahead of playback
+std::unique_ptr<ParticleFrameCache> frame_cache;
+size_t          frame_cache_mb = 4096;
+int             prefetch_frames = 2;
 
 // Accumulation frame
 unsigned int    accumulation_frame = 0;
@@ -237,6 +236,7 @@ void setParticlesBaseName( const std::string &particles_file )
     std::string frame_str = particles_file.substr( first_dot_pos+1, second_dot_pos-first_dot_pos-1 );
 
     current_particle_frame = atoi( frame_str.c_str() );
+    first_particle_frame = current_particle_frame;
     particles_file_base = particles_file.substr( 0, first_dot_pos );
 }
 
@@ -282,15 +282,6 @@ void createContext( int usage_report_level, UsageReportLogger* logger )
 }
 
 
-static inline float parseFloat( const char *&token )
-{
-  token += strspn( token, " \t" );
-  float f = (float) atof( token );
-  token += strcspn( token, " \t\r" );
-  return f;
-}
-
-
 static inline float3 get_min(
     const float3 &v1,
     const float3 &v2)
@@ -315,52 +306,44 @@ static inline float3 get_max(
 }
 
 
-static void fillBuffers(
-    const std::vector<float4> &positions,
-    const std::vector<float3> &velocities,
-    const std::vector<float3> &colors,
-    const std::vector<float>  &radii)
+// data of block of the frame, or NULL if the frame does not have it
+static const float* particleBlock( const ParticleFrame& frame, ParticleBlock block )
 {
-    buffers.positions->setSize( positions.size() );
-    float *pos = reinterpret_cast<float*> ( buffers.positions->map() );
-    for ( int i=0, index = 0; i<static_cast<int>(positions.size()); ++i ) {
-        float4 p = positions[i];
+    if ( frame.file )
+        return frame.file->block( block );
 
-        pos[index++] = p.x;
-        pos[index++] = p.y;
-        pos[index++] = p.z;
-        pos[index++] = p.w;
-    }
-    buffers.positions->unmap();
-
-    buffers.velocities->setSize( velocities.size() );
-    float *vel = reinterpret_cast<float*> ( buffers.velocities->map() );
-    for ( int i=0, index = 0; i<static_cast<int>(velocities.size()); ++i ) {
-        float3 v = velocities[i];
-
-        vel[index++] = v.x;
-        vel[index++] = v.y;
-        vel[index++] = v.z;
-    }
-    buffers.velocities->unmap();
+    const std::vector<float>* data[PARTICLE_BLOCK_COUNT] = {
+        &frame.data.positions, &frame.data.velocities, &frame.data.colors, &frame.data.radii };
+    return data[block]->empty() ? NULL : &( *data[block] )[0];
+}
 
-    buffers.colors->setSize( colors.size() );
-    float *col = reinterpret_cast<float*> ( buffers.colors->map() );
-    for ( int i=0, index = 0; i<static_cast<int>(colors.size()); ++i ) {
-        float3 c = colors[i];
 
-        col[index++] = c.x;
-        col[index++] = c.y;
-        col[index++] = c.z;
+static void fillBuffers( const ParticleFrame& frame )
+{
+    // positions, with the attribute normalized for the transfer function
+    const float *src = particleBlock( frame, PARTICLE_BLOCK_POSITIONS );
+    buffers.positions->setSize( frame.count );
+    float *pos = reinterpret_cast<float*> ( buffers.positions->map() );
+    for ( size_t i=0; i<frame.count*4; i+=4 ) {
+        pos[i+0] = src[i+0];
+        pos[i+1] = src[i+1];
+        pos[i+2] = src[i+2];
+        pos[i+3] = src[i+3] * frame.w_scale + frame.w_offset;
     }
-    buffers.colors->unmap();
+    buffers.positions->unmap();
 
-    buffers.radii->setSize( radii.size() );
-    float *rad = reinterpret_cast<float*> ( buffers.radii->map() );
-    for ( int i=0; i<static_cast<int>(radii.size()); ++i ) {
-        rad[i] = radii[i];
+    // the other blocks as they are, empty if the frame does not have them
+    const ParticleBlock blocks[] = { PARTICLE_BLOCK_VELOCITIES, PARTICLE_BLOCK_COLORS, PARTICLE_BLOCK_RADII };
+    Buffer block_buffers[] = { buffers.velocities, buffers.colors, buffers.radii };
+    for ( int b=0; b<3; ++b ) {
+        src = particleBlock( frame, blocks[b] );
+        const size_t count = src ? frame.count : 0;
+        block_buffers[b]->setSize( count );
+        if ( count ) {
+            memcpy( block_buffers[b]->map(), src, count * particleBlockComponents[blocks[b]] * sizeof(float) );
+            block_buffers[b]->unmap();
+        }
     }
-    buffers.radii->unmap();
 }
 
 
@@ -397,296 +380,131 @@ Program createIntersectionProgram( Context context )
   return context->createProgramFromPTXFile( ptxPath("geometry.cu"), "particle_intersect" );
 }
 
-void readFile( std::vector<float4>& positions, 
-               std::vector<float3>& velocities, 
-               std::vector<float3>& colors, 
-               std::vector<float>& radii, 
-               float3& bbox_min, 
-               float3& bbox_max )
+// the file of a frame of a sequence, or the particles file itself
+static std::string particlesFrameFileName( int frame )
 {
-	//read raw data file.
-    if (particles_file_extension == "raw")
-    {
-        std::cout << "Reading raw file" << particles_file << std::endl;
-
-        FILE* fp = fopen(particles_file.c_str(), "r");
-        fseek(fp, 0L, SEEK_END);
-        size_t sz = ftell(fp);
-        rewind(fp);
-
-        size_t numParticles = sz / 16;
-        std::cout << "# particles = " << numParticles << std::endl;
-
-        if (max_particles > 0 && numParticles > max_particles)
-        {
-          std::cout << "only reading " << max_particles << " particles." << std::endl;
-          numParticles = max_particles;
-        }
-
-        positions.resize(numParticles);
-        size_t b = fread(&positions[0], sizeof(float), numParticles, fp);
-        fclose(fp);
-
-        float4 pmin, pmax;
-
-        pmin.x = pmin.y = pmin.z = pmin.w = 1e16f;
-        pmax.x = pmax.y = pmax.z = pmax.w = -1e16f;
-
-        const float rd = fixed_radius;
-
-        #pragma omp parallel for
-        for(size_t i=0; i<numParticles; i++)
-        {
-            const float4& p = positions[i];
-
-            pmin.x = fminf(pmin.x, p.x);
-            pmin.y = fminf(pmin.y, p.y);
-            pmin.z = fminf(pmin.z, p.z);
-            pmin.w = fminf(pmin.w, p.w);
-
-            pmax.x = fmaxf(pmax.x, p.x);
-            pmax.y = fmaxf(pmax.y, p.y);
-            pmax.z = fmaxf(pmax.z, p.z);
-            pmax.w = fmaxf(pmax.w, p.w);
-        }
+    if ( frame <= 0 )
+        return particles_file;
 
-        std::cout << "Particle pmin = " << pmin << std::endl;
-        std::cout << "Particle pmax = " << pmax << std::endl;
-
-        bbox_min = make_float3(pmin.x - rd, pmin.y - rd, pmin.z - rd);
-        bbox_max = make_float3(pmax.x + rd, pmax.y + rd, pmax.z + rd);
+    std::ostringstream s;
+    s << particles_file_base << "." << std::setw( 4 ) << std::setfill( '0' ) << frame
+      << "." << particles_file_extension;
+    return s.str();
+}
 
-        if (fixed_radius == 0.f)
-          fixed_radius = length(bbox_max - bbox_min) / powf(float(numParticles), 0.33333f);  
 
-        std::cout << "Particle fixed_radius = " << fixed_radius << std::endl;
+// Loads a frame for the frame cache, on the render thread or a prefetch worker:
+// reads only the file settings, which do not change after startup.
+void readFile( int frame_number, ParticleFrame& frame )
+{
+    const std::string filename = particlesFrameFileName( frame_number );
 
-        float wRange, wOff;
-        if (pmin.w < 0.f)
-        {
-          if (-pmin.w > pmax.w)
-            wRange = float(0.5f / -pmin.w);
-          else
-            wRange = float(0.5f / pmax.w);
+    //map binary particle file, the header has the bounds
+    if ( particles_file_extension == "pbf" )
+    {
+        frame.file = std::make_shared<ParticleFile>( filename );
+        const ParticleFileHeader& header = frame.file->header();
 
-          tf_type = 3;
-          wOff = .5f;
+        frame.count = frame.file->count();
+        for ( int k = 0; k < 3; ++k ) {
+            frame.bounds_min[k] = header.bbox_min[k];
+            frame.bounds_max[k] = header.bbox_max[k];
         }
-        else
-        {
-          wRange = float( 1.0 / double(pmax.w - pmin.w) );
-          wOff = 0.f;
-        }
-
-        std::cout << "Transfer function tf_type = " << tf_type << std::endl;
+        frame.bounds_min[3] = header.attribute_min;
+        frame.bounds_max[3] = header.attribute_max;
 
-        #pragma omp parallel for
-        for(size_t i=0; i<numParticles; i++)
-            positions[i].w = positions[i].w * wRange + wOff;
+        // the bounds of the whole file still enclose the first particles
+        if ( max_particles > 0 && frame.count > max_particles )
+            frame.count = max_particles;
 
-        float wmin = 1e16f;
-        float wmax = -1e16f;
-        for(size_t i=0; i<numParticles; i++){
-            wmin = fminf(wmin, positions[i].w);
-            wmax = fmaxf(wmax, positions[i].w);
-        }
-        std::cout << "Attribute range wmin = " << wmin << ", wmax = " << wmax << std::endl;
+        // fault the pages in here rather than during the upload
+        frame.file->pageIn( frame.count );
     }
-     
-    //read txt data file
+
+    //read raw or txt data file
     else
     {
-        std::cout << "Reading txt file" << particles_file << std::endl;
-
-        std::string filename = particles_file_base;
-
-        if ( current_particle_frame > 0 ) {
-            std::ostringstream s;
-            s << current_particle_frame;
-
-            if ( current_particle_frame < 10 )
-                filename += ".000" + s.str() + ".txt";
-            else
-                filename += ".00" + s.str() + ".txt";
-        }
+        if ( particles_file_extension == "raw" )
+            readParticlesRaw( filename, max_particles, frame.data );
         else
-            filename = particles_file_base;
-
-
-        std::ifstream ifs( filename.c_str() );
-
-        bbox_min.x = bbox_min.y = bbox_min.z = 1e16f;
-        bbox_max.x = bbox_max.y = bbox_max.z = -1e16f;
-
-        int maxchars = 8192;
-        std::vector<char> buf(static_cast<size_t>(maxchars)); // Alloc enough size
-
-        float wmin = 1e16f;
-        float wmax = -1e16f;
-
-        while ( ifs.peek() != -1 ) {
-            ifs.getline( &buf[0], maxchars );
-
-            std::string linebuf(&buf[0]);
-
-            // Trim newline '\r\n' or '\n'
-            if ( linebuf.size() > 0 ) {
-                if ( linebuf[linebuf.size() - 1] == '\n' )
-                    linebuf.erase(linebuf.size() - 1);
-            }
-
-            if ( linebuf.size() > 0 ) {
-                if ( linebuf[linebuf.size() - 1] == '\r' )
-                    linebuf.erase( linebuf.size() - 1 );
-            }
-
-            // Skip if empty line.
-            if ( linebuf.empty() ) {
-                continue;
-            }
-
-            // Skip leading space.
-            const char *token = linebuf.c_str();
-            token += strspn( token, " \t" );
-
-            assert( token );
-            if ( token[0] == '\0' )
-                continue; // empty line
-
-            if ( token[0] == '#' )
-                continue; // comment line
-
-            // meaningful line here. The expected format is: position, velocity, color and radius
-
-            // position
-            float x  = parseFloat( token );
-            float y  = parseFloat( token );
-            float z  = parseFloat( token );
-
-            // velocity
-            float vx = parseFloat( token );
-            float vy = parseFloat( token );
-            float vz = parseFloat( token );
+            readParticlesText( filename, particles_file_colors, particles_file_radius, max_particles, frame.data );
 
-            float3 vel = make_float3(vx,vy,vz);
-            float vel_magnitude = length(vel);
-
-            wmin = fminf(wmin, vel_magnitude);
-            wmax = fmaxf(wmax, vel_magnitude);
-
-            float r,g,b;
-            r=g=b=.9f;
-
-            if (particles_file_colors)
-            {
-              // color
-              r  = parseFloat( token );
-              g  = parseFloat( token );
-              b  = parseFloat( token );
-            }
-            
-            float rd = fixed_radius;
-            if (particles_file_radius)
-            {
-              // radius
-              rd = parseFloat( token );
-            }
-
-            positions.push_back( make_float4( x, y, z, vel_magnitude ) );
-            velocities.push_back( make_float3( vx, vy, vz ) );
-            colors.push_back( make_float3( r, g, b ) );
-            radii.push_back( rd );
-        }
-
-        const size_t numParticles = positions.size();
-        std::cout << "# particles = " << numParticles << std::endl;
-
-        float4 pmin, pmax;
-        pmin.x = pmin.y = pmin.z = pmin.w = 1e16f;
-        pmax.x = pmax.y = pmax.z = pmax.w = -1e16f;
-
-        for(size_t i=0; i<numParticles; i++)
-        {
-            const float4& p = positions[i];
-
-            pmin.x = fminf(pmin.x, p.x);
-            pmin.y = fminf(pmin.y, p.y);
-            pmin.z = fminf(pmin.z, p.z);
-            pmin.w = fminf(pmin.w, p.w);
-
-            pmax.x = fmaxf(pmax.x, p.x);
-            pmax.y = fmaxf(pmax.y, p.y);
-            pmax.z = fmaxf(pmax.z, p.z);
-            pmax.w = fmaxf(pmax.w, p.w);
-        }
+        frame.count = frame.data.count();
+        std::copy( frame.data.bounds_min, frame.data.bounds_min + 4, frame.bounds_min );
+        std::copy( frame.data.bounds_max, frame.data.bounds_max + 4, frame.bounds_max );
+    }
 
-        std::cout << "Particle pmin = " << pmin << std::endl;
-        std::cout << "Particle pmax = " << pmax << std::endl;
+    // attribute scale and offset to [0, 1], with signed data centered at .5
+    computeAttributeNormalization( frame.bounds_min[3], frame.bounds_max[3], frame.w_scale, frame.w_offset );
+}
 
-        bbox_min = make_float3(pmin.x, pmin.y, pmin.z);
-        bbox_max = make_float3(pmax.x, pmax.y, pmax.z);
 
-        if (fixed_radius == 0.f)
-          fixed_radius = length(bbox_max - bbox_min) / powf(float(numParticles), 0.333333f);  
+// the next frames of the sequence after the current one, wrapping around
+static std::vector<int> prefetchFrames()
+{
+    std::vector<int> frames;
+    if ( current_particle_frame <= 0 )
+        return frames;
 
-        std::cout << "Using fixed_radius = " << fixed_radius << std::endl;
+    for ( int i = 1; i <= std::min( prefetch_frames, max_particle_frames - 1 ); ++i )
+        frames.push_back( first_particle_frame + ( current_particle_frame - first_particle_frame + i ) % max_particle_frames );
+    return frames;
+}
 
-        bbox_min -= make_float3(fixed_radius);
-        bbox_max += make_float3(fixed_radius);
 
-        std::cout << "Attribute range wmin = " << wmin << ", wmax = " << wmax << std::endl;
+// loads up the particles file corresponding to the current frame (if it is a sequence)
+void loadParticles()
+{
+    const std::shared_ptr<const ParticleFrame> frame = frame_cache->get( current_particle_frame );
+    loaded_particle_frame = current_particle_frame;
 
-        float wRange = float( 1.0 / double(wmax - wmin) );
+    // start on the next frames while this one is uploaded and rendered
+    frame_cache->prefetch( prefetchFrames() );
 
-        //#pragma omp parallel for
-        for(size_t i=0; i<positions.size(); i++)
-            positions[i].w = positions[i].w * wRange;
-    }
+    const float* pmin = frame->bounds_min;
+    const float* pmax = frame->bounds_max;
 
-}
+    std::cout << "Frame " << particlesFrameFileName( current_particle_frame )
+              << " (loaded in " << frame->load_seconds * 1000.0 << " ms)" << std::endl;
+    std::cout << "# particles = " << frame->count << std::endl;
+    std::cout << "Particle pmin = " << make_float4( pmin[0], pmin[1], pmin[2], pmin[3] ) << std::endl;
+    std::cout << "Particle pmax = " << make_float4( pmax[0], pmax[1], pmax[2], pmax[3] ) << std::endl;
 
+    float3 bbox_min = make_float3( pmin[0], pmin[1], pmin[2] );
+    float3 bbox_max = make_float3( pmax[0], pmax[1], pmax[2] );
 
-// loads up the particles file corresponding to the current frame (if it is a sequence)
-void loadParticles()
-{
-    float3 bbox_min, bbox_max;
+    if (fixed_radius == 0.f)
+      fixed_radius = length(bbox_max - bbox_min) / powf(float(frame->count), 0.333333f);
 
-    std::map<int, ParticleFrameData>::iterator cacheIt = dataCache.find(current_particle_frame);
-    if(cacheIt == dataCache.end())
-    {
-        ParticleFrameData newCacheEntry;
+    std::cout << "Using fixed_radius = " << fixed_radius << std::endl;
 
-        std::vector<float4>& positions = newCacheEntry.positions;
-        std::vector<float3>& velocities = newCacheEntry.velocities;
-        std::vector<float3>& colors = newCacheEntry.colors;
-        std::vector<float>&  radii = newCacheEntry.radii;
+    bbox_min -= make_float3(fixed_radius);
+    bbox_max += make_float3(fixed_radius);
 
-	    readFile(positions, velocities, colors, radii, bbox_min, bbox_max);
+    std::cout << "Attribute range wmin = " << pmin[3] << ", wmax = " << pmax[3] << std::endl;
 
-        context[ "fixed_radius"     ]->setFloat(fixed_radius);
-        context[ "particlesPerSlab"     ]->setFloat(particlesPerSlab);
-        context[ "wScale" ] ->setFloat(wScale);
-        context[ "opacity" ] ->setFloat(opacity);
-        context[ "tf_type" ]->setInt(tf_type);
+    if (pmin[3] < 0.f)
+      tf_type = 3;
 
-        context[ "bbox_min"     ]->setFloat(bbox_min);
-        context[ "bbox_max"     ]->setFloat(bbox_max);
+    std::cout << "Transfer function tf_type = " << tf_type << std::endl;
 
-        newCacheEntry.bbox_min = bbox_min;
-        newCacheEntry.bbox_max = bbox_max;
-        cacheIt = dataCache.insert(std::make_pair(current_particle_frame, newCacheEntry)).first;
-    }
+    context[ "fixed_radius"     ]->setFloat(fixed_radius);
+    context[ "particlesPerSlab"     ]->setFloat(particlesPerSlab);
+    context[ "wScale" ] ->setFloat(wScale);
+    context[ "opacity" ] ->setFloat(opacity);
+    context[ "tf_type" ]->setInt(tf_type);
 
-    ParticleFrameData& cacheEntry = cacheIt->second;
+    context[ "bbox_min"     ]->setFloat(bbox_min);
+    context[ "bbox_max"     ]->setFloat(bbox_max);
 
     // all vectors have the same size
-    geometry->setPrimitiveCount( (int) cacheEntry.positions.size() );
+    geometry->setPrimitiveCount( (int) frame->count );
 
     // fills up the buffers
-    fillBuffers( cacheEntry.positions, cacheEntry.velocities, cacheEntry.colors, cacheEntry.radii );
+    fillBuffers( *frame );
 
     // the bounding box will actually be used only for the first frame
-    aabb.set( cacheEntry.bbox_min, cacheEntry.bbox_max );
+    aabb.set( bbox_min, bbox_max );
 
     // builds the BVH (or re-builds it if already existing)
     Acceleration accel = geometry_group->getAcceleration();
@@ -865,6 +683,23 @@ void keyCallback( GLFWwindow* window, int key, int scancode, int action, int mod
                handled = true;
                break;
             }
+            case( GLFW_KEY_P ):
+            {
+               play = !play;
+               handled = true;
+               break;
+            }
+            case( GLFW_KEY_RIGHT ):
+            case( GLFW_KEY_LEFT ):
+            {
+               if ( current_particle_frame > 0 ) {
+                   const int step = key == GLFW_KEY_RIGHT ? 1 : max_particle_frames - 1;
+                   current_particle_frame = first_particle_frame +
+                       ( current_particle_frame - first_particle_frame + step ) % max_particle_frames;
+               }
+               handled = true;
+               break;
+            }
 
         }
     }
@@ -929,6 +764,7 @@ void glfwRun( GLFWwindow* window, sutil::Camera& camera, RenderBuffers& buffers
 
     unsigned int frame_count = 0;
     unsigned int accumulation_frame = 0;
+    unsigned int animation_iterations = 0;
     bool do_animate = true;
 
     double previous_time = sutil::currentTime();
@@ -1012,12 +848,35 @@ void glfwRun( GLFWwindow* window, sutil::Camera& camera, RenderBuffers& buffers
             if ( ImGui::Checkbox( "camera rotate", &camera_slow_rotate ) ) {
             }
 
+            if ( current_particle_frame > 0 ) {
+                ImGui::SliderInt( "frame", &current_particle_frame, first_particle_frame,
+                                  first_particle_frame + max_particle_frames - 1 );
+                ImGui::Checkbox( "play", &play );
+
+                const ParticleFrameCacheStats stats = frame_cache->stats();
+                ImGui::Text( "cache: %d frames, %.0f MB, hit rate %.0f%%",
+                             (int) stats.frames, stats.bytes / ( 1024.0 * 1024.0 ), stats.hitRate() * 100.0 );
+                ImGui::Text( "load: %.0f ms mean, %.0f ms max, stalled %.1f s",
+                             stats.meanLoadSeconds() * 1000.0, stats.max_load_seconds * 1000.0, stats.stall_seconds );
+            }
+
             ImGui::End();
         }
 
         // imgui pops
         ImGui::PopStyleVar( 3 );
 
+        // step through the sequence, the frame cache has the next frames loaded ahead
+        if ( play && current_particle_frame > 0 && ++animation_iterations >= iterations_per_animation_frame ) {
+            animation_iterations = 0;
+            current_particle_frame = first_particle_frame +
+                ( current_particle_frame - first_particle_frame + 1 ) % max_particle_frames;
+        }
+        if ( current_particle_frame != loaded_particle_frame ) {
+            loadParticles();
+            accumulation_frame = 0;
+        }
+
         if ( do_animate ) {
 
             // update animation time
@@ -1066,7 +925,7 @@ void printUsageAndExit( const std::string& argv0 )
         "  -h | --help                         Print this usage message and exit.\n"
         "  -f | --file                         Save single frame to file and exit.\n"
         "  -n | --nopbo                        Disable GL interop for display buffer.\n"
-        "  -p | --particles <particles_file>   Specify path to particles file to be loaded.\n"
+        "  -p | --particles <particles_file>   Specify path to particles file to be loaded (.txt/.xyz, .raw or .pbf).\n"
         "  -r | --report <LEVEL>               Enable usage reporting and report level [1-3].\n"
         "  --no-rotate                         Disable camera rotation (default on).\n"
         "  --wScale <float>                    Rescale particle attribute range by a fixed multiple.\n"
@@ -1074,8 +933,13 @@ void printUsageAndExit( const std::string& argv0 )
         "  --fixed_radius <float>              Specify default (world space) radius of a particle.\n"
         "  --max_particles <int M>             Only read the first M particles of the dataset.\n"
         "  --tf_type <int>                     Use preset transfer function (0,1,2 = unsigned data, 3 = signed data).\n"
+        "  --frames <int N>                    Number of frames of a sequence (file.NNNN.ext, default 25).\n"
+        "  --prefetch <int K>                  Load the next K frames of a sequence ahead of playback (default 2).\n"
+        "  --cache_mb <int MB>                 Memory budget of the loaded frames of a sequence (default 4096, 0 = unlimited).\n"
         "App Keystrokes:\n"
         "  q  Quit\n"
+        "  p  Play or pause a sequence\n"
+        "  left/right  Previous/next frame of a sequence\n"
         << std::endl;
 
     exit(1);
@@ -1127,6 +991,33 @@ int main( int argc, char** argv )
             }
             tf_type = atoi(argv[++i]);
         }
+        else if( arg == "--frames"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            max_particle_frames = std::max( 1, atoi(argv[++i]) );
+        }
+        else if( arg == "--prefetch"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            prefetch_frames = std::max( 0, atoi(argv[++i]) );
+        }
+        else if( arg == "--cache_mb"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            frame_cache_mb = strtoul( argv[++i], NULL, 10 );
+        }
         else if( arg == "--no_radius"  )
         {
             particles_file_radius = false;
@@ -1221,6 +1112,11 @@ int main( int argc, char** argv )
         createContext( usage_report_level, &logger );
         setupParticles();
         setParticlesBaseName( particles_file );
+
+        // one prefetch worker, the text parser has threads of its own
+        const bool sequence = current_particle_frame > 0;
+        frame_cache.reset( new ParticleFrameCache( readFile, frame_cache_mb * 1024 * 1024,
+                                                   sequence && prefetch_frames > 0 ? 1 : 0 ) );
         loadParticles();
         setupCamera();
         setupLights();
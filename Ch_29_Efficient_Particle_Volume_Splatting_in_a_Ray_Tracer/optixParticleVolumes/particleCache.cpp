@@ -0,0 +1,229 @@
+//-----------------------------------------------------------------------------
+//
+// particleCache: memory-budgeted LRU cache of particle frames with prefetch,
+// see particleCache.h
+//
+//-----------------------------------------------------------------------------
+
+#include "particleCache.h"
+
+#include <algorithm>
+#include <chrono>
+
+
+size_t ParticleFrame::bytes() const
+{
+    if ( file )
+        return file->size();
+
+    return ( data.positions.capacity() + data.velocities.capacity() +
+             data.colors.capacity() + data.radii.capacity() ) * sizeof( float );
+}
+
+
+//------------------------------------------------------------------------------
+//
+// ParticleFrameCache
+//
+//------------------------------------------------------------------------------
+
+ParticleFrameCache::ParticleFrameCache( const LoadFunction& load, size_t budget_bytes, unsigned int num_workers )
+    : m_load( load ),
+      m_budget( budget_bytes ),
+      m_quit( false ),
+      m_stats()
+{
+    for ( unsigned int i = 0; i < num_workers; ++i )
+        m_workers.push_back( std::thread( &ParticleFrameCache::work, this ) );
+}
+
+
+ParticleFrameCache::~ParticleFrameCache()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_quit = true;
+        m_queue.clear();
+    }
+    m_queued.notify_all();
+
+    for ( size_t i = 0; i < m_workers.size(); ++i )
+        m_workers[i].join();
+}
+
+
+std::shared_ptr<const ParticleFrame> ParticleFrameCache::get( int frame )
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    std::map<int, Entry>::iterator it = m_entries.find( frame );
+    if ( it != m_entries.end() && it->second.frame ) {
+        ++m_stats.hits;
+        m_lru.splice( m_lru.begin(), m_lru, it->second.lru );
+        return it->second.frame;
+    }
+
+    ++m_stats.misses;
+
+    if ( it == m_entries.end() ) {
+        // not queued for long enough to have been started: load it here
+        m_entries[frame] = Entry();
+        m_queue.erase( std::remove( m_queue.begin(), m_queue.end(), frame ), m_queue.end() );
+
+        lock.unlock();
+        std::exception_ptr error;
+        const std::shared_ptr<ParticleFrame> loaded = load( frame, error );
+        lock.lock();
+
+        finishLoad( frame, loaded, error );
+        it = m_entries.find( frame );
+    }
+    else if ( !it->second.error ) {
+        // a worker is loading it
+        m_loaded.wait( lock, [&]() {
+            it = m_entries.find( frame );
+            return it == m_entries.end() || it->second.frame || it->second.error;
+        } );
+    }
+
+    m_stats.stall_seconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    if ( it == m_entries.end() ) {
+        // failed and dropped by a concurrent get(); try again
+        lock.unlock();
+        return get( frame );
+    }
+
+    if ( it->second.error ) {
+        // forget the failure, so that a later get() tries again
+        const std::exception_ptr error = it->second.error;
+        m_entries.erase( it );
+        std::rethrow_exception( error );
+    }
+
+    m_lru.splice( m_lru.begin(), m_lru, it->second.lru );
+    return it->second.frame;
+}
+
+
+void ParticleFrameCache::prefetch( const std::vector<int>& frames )
+{
+    if ( m_workers.empty() )
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        m_queue.clear();
+
+        // the resident frames of the window are used soon, the nearest first
+        for ( std::vector<int>::const_reverse_iterator f = frames.rbegin(); f != frames.rend(); ++f ) {
+            std::map<int, Entry>::iterator it = m_entries.find( *f );
+            if ( it != m_entries.end() && it->second.frame )
+                m_lru.splice( m_lru.begin(), m_lru, it->second.lru );
+        }
+
+        for ( size_t i = 0; i < frames.size(); ++i ) {
+            if ( m_entries.find( frames[i] ) == m_entries.end() &&
+                 std::find( m_queue.begin(), m_queue.end(), frames[i] ) == m_queue.end() )
+                m_queue.push_back( frames[i] );
+        }
+    }
+    m_queued.notify_all();
+}
+
+
+ParticleFrameCacheStats ParticleFrameCache::stats() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_stats;
+}
+
+
+std::shared_ptr<ParticleFrame> ParticleFrameCache::load( int frame, std::exception_ptr& error )
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::shared_ptr<ParticleFrame> loaded = std::make_shared<ParticleFrame>();
+    try {
+        m_load( frame, *loaded );
+    }
+    catch ( ... ) {
+        error = std::current_exception();
+        return std::shared_ptr<ParticleFrame>();
+    }
+
+    loaded->load_seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    return loaded;
+}
+
+
+void ParticleFrameCache::finishLoad( int frame, const std::shared_ptr<ParticleFrame>& loaded, const std::exception_ptr& error )
+{
+    Entry& entry = m_entries[frame];
+
+    if ( loaded ) {
+        entry.frame = loaded;
+        entry.bytes = loaded->bytes();
+        m_lru.push_front( frame );
+        entry.lru = m_lru.begin();
+
+        ++m_stats.loads;
+        ++m_stats.frames;
+        m_stats.bytes += entry.bytes;
+        m_stats.load_seconds += loaded->load_seconds;
+        m_stats.max_load_seconds = std::max( m_stats.max_load_seconds, loaded->load_seconds );
+
+        evict();
+    }
+    else {
+        entry.error = error;
+    }
+
+    m_loaded.notify_all();
+}
+
+
+void ParticleFrameCache::evict()
+{
+    // never the most recently used frame, even if it alone exceeds the budget
+    while ( m_budget > 0 && m_stats.bytes > m_budget && m_lru.size() > 1 ) {
+        const std::map<int, Entry>::iterator it = m_entries.find( m_lru.back() );
+        m_lru.pop_back();
+
+        m_stats.bytes -= it->second.bytes;
+        --m_stats.frames;
+        ++m_stats.evictions;
+        m_entries.erase( it );
+    }
+}
+
+
+void ParticleFrameCache::work()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    for ( ;; ) {
+        m_queued.wait( lock, [this]() { return m_quit || !m_queue.empty(); } );
+        if ( m_quit )
+            return;
+
+        const int frame = m_queue.front();
+        m_queue.pop_front();
+        if ( m_entries.find( frame ) != m_entries.end() )
+            continue;
+
+        m_entries[frame] = Entry();
+
+        lock.unlock();
+        std::exception_ptr error;
+        const std::shared_ptr<ParticleFrame> loaded = load( frame, error );
+        lock.lock();
+
+        if ( loaded )
+            ++m_stats.prefetched;
+        finishLoad( frame, loaded, error );
+    }
+}
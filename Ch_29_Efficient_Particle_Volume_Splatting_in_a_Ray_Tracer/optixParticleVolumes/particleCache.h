@@ -0,0 +1,119 @@
+//-----------------------------------------------------------------------------
+//
+// particleCache: the loaded frames of a particle sequence, kept within a
+// memory budget and evicted least recently used first.  Worker threads load
+// the frames queued with prefetch() ahead of playback, so that stepping to
+// the next frame finds it loaded instead of reading it on the render thread.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include "particleFile.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// One loaded frame
+//
+//------------------------------------------------------------------------------
+struct ParticleFrame
+{
+    ParticleData                  data;             // particles of a text or raw file
+    std::shared_ptr<ParticleFile> file;             // or the memory-mapped .pbf file
+    size_t                        count;
+    float                         bounds_min[4];    // bounds of the centers and
+    float                         bounds_max[4];    // range of the attribute
+    float                         w_scale;          // attribute normalization, applied when
+    float                         w_offset;         // the positions are uploaded
+    double                        load_seconds;     // time the load took
+
+    // memory held by the frame, decoded arrays or mapped file
+    size_t bytes() const;
+};
+
+
+struct ParticleFrameCacheStats
+{
+    size_t  hits;               // get() found the frame loaded
+    size_t  misses;             // get() had to load the frame or wait for a worker
+    size_t  loads;              // frames loaded, by get() or the workers
+    size_t  prefetched;         // frames loaded by the workers
+    size_t  evictions;
+    size_t  frames;             // frames resident
+    size_t  bytes;              // bytes resident
+    double  load_seconds;       // total time of the loads
+    double  max_load_seconds;
+    double  stall_seconds;      // total time get() spent loading or waiting
+
+    double hitRate() const      { return hits + misses ? double( hits ) / double( hits + misses ) : 0.0; }
+    double meanLoadSeconds() const { return loads ? load_seconds / double( loads ) : 0.0; }
+};
+
+
+class ParticleFrameCache
+{
+public:
+    // Loads frame number frame into the (default constructed) frame; may throw,
+    // and runs on the worker threads concurrently with the caller of get().
+    typedef std::function<void( int frame, ParticleFrame& )> LoadFunction;
+
+    // A budget_bytes of 0 does not limit the cache; without workers prefetch()
+    // does nothing.
+    ParticleFrameCache( const LoadFunction& load, size_t budget_bytes, unsigned int num_workers );
+    ~ParticleFrameCache();
+
+    // The frame, loaded on this thread unless it is resident or being loaded by
+    // a worker.  It stays valid while referenced, even if it is evicted.
+    // Rethrows the exception of a failed load.
+    std::shared_ptr<const ParticleFrame> get( int frame );
+
+    // Replaces the frames queued for the workers with frames, nearest first.
+    // Resident frames among them are marked as recently used.
+    void prefetch( const std::vector<int>& frames );
+
+    ParticleFrameCacheStats stats() const;
+
+private:
+    ParticleFrameCache( const ParticleFrameCache& );
+    ParticleFrameCache& operator=( const ParticleFrameCache& );
+
+    struct Entry
+    {
+        std::shared_ptr<ParticleFrame>  frame;      // NULL while loading or after a failure
+        std::exception_ptr              error;
+        std::list<int>::iterator        lru;        // valid once loaded
+        size_t                          bytes;
+    };
+
+    // load() runs without the lock, the others with it
+    std::shared_ptr<ParticleFrame> load( int frame, std::exception_ptr& error );
+    void finishLoad( int frame, const std::shared_ptr<ParticleFrame>& loaded, const std::exception_ptr& error );
+    void evict();
+    void work();
+
+    LoadFunction                m_load;
+    size_t                      m_budget;
+
+    mutable std::mutex          m_mutex;
+    std::condition_variable     m_loaded;           // an entry finished loading
+    std::condition_variable     m_queued;           // frames queued, or shutting down
+    std::map<int, Entry>        m_entries;          // resident, loading and failed frames
+    std::list<int>              m_lru;              // loaded frames, most recently used first
+    std::deque<int>             m_queue;            // frames to prefetch
+    bool                        m_quit;
+    ParticleFrameCacheStats     m_stats;
+
+    std::vector<std::thread>    m_workers;
+};
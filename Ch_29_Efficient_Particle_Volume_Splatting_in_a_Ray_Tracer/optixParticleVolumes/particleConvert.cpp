@@ -0,0 +1,266 @@
+//-----------------------------------------------------------------------------
+//
+// optixParticleConvert:
+// Converts text (.txt, .xyz) and raw particle files of optixParticleVolumes
+// to the binary .pbf container the viewer memory-maps, see particleFile.h.
+// With --bench_bounds it instead times sutil::computeBounds against a scalar
+// loop and checks that both give the same box.
+//
+//-----------------------------------------------------------------------------
+
+#include "particleFile.h"
+
+#include <Bounds.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+void printUsageAndExit( const std::string& argv0 )
+{
+    std::cout << "\nUsage: " << argv0 << " [options] <input> <output.pbf>\n";
+    std::cout <<
+        "Converts a text (x y z vx vy vz [r g b] [radius] per line) or raw (float4 per\n"
+        "particle, .raw extension) particle file to a binary .pbf file.\n"
+        "Options:\n"
+        "  -h | --help                         Print this usage message and exit.\n"
+        "  --colors                            Text input has r g b columns after the velocity.\n"
+        "  --radius                            Text input has a radius column.\n"
+        "  --max_particles <int M>             Only convert the first M particles.\n"
+        "  --threads <int N>                   Parse text input with N threads (default: all).\n"
+        "  --bench_bounds <int M>              Instead of converting, time sutil::computeBounds on M\n"
+        "                                      random particles and vertices against a scalar loop\n"
+        "                                      for 1..N threads and check that the boxes match.\n"
+        << std::endl;
+
+    exit(1);
+}
+
+
+//------------------------------------------------------------------------------
+//
+// --bench_bounds: sutil::computeBounds against the plain loop it replaced
+//
+//------------------------------------------------------------------------------
+
+static void scalarBounds( const float* data, size_t count, size_t components, size_t stride,
+                          float* bmin, float* bmax )
+{
+    for( size_t k = 0; k < components; ++k )
+    {
+        bmin[k] = 1e16f;
+        bmax[k] = -1e16f;
+    }
+    for( size_t i = 0; i < count; ++i, data += stride )
+    {
+        for( size_t k = 0; k < components; ++k )
+        {
+            bmin[k] = std::min( bmin[k], data[k] );
+            bmax[k] = std::max( bmax[k], data[k] );
+        }
+    }
+}
+
+// Best of a few runs of f, in milliseconds
+template <typename F>
+static double bestTime( F f )
+{
+    double best = 0.0;
+    for( int run = 0; run < 5; ++run )
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        f();
+        const double ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+        if( run == 0 || ms < best )
+            best = ms;
+    }
+    return best;
+}
+
+// Returns the number of thread counts whose box differs from the scalar one.
+static int benchBounds( const char* name, const std::vector<float>& data, size_t components, size_t stride,
+                        unsigned int max_threads )
+{
+    const size_t count = data.size() / stride;
+    float smin[4], smax[4];
+    const double scalar_ms = bestTime( [&]() { scalarBounds( data.data(), count, components, stride, smin, smax ); } );
+
+    std::cout << name << ", " << count << " records: scalar loop " << scalar_ms << " ms" << std::endl;
+
+    int failures = 0;
+    for( unsigned int t = 1; t <= max_threads; ++t )
+    {
+        float bmin[4], bmax[4];
+        const double ms = bestTime( [&]() {
+            for( size_t k = 0; k < components; ++k )
+            {
+                bmin[k] = 1e16f;
+                bmax[k] = -1e16f;
+            }
+            sutil::computeBounds( data.data(), count, components, stride, bmin, bmax, t );
+        } );
+        const bool same = memcmp( bmin, smin, components * sizeof( float ) ) == 0 &&
+                          memcmp( bmax, smax, components * sizeof( float ) ) == 0;
+        if( !same )
+            ++failures;
+        std::cout << "  computeBounds, " << t << " thread(s): " << ms << " ms (" << scalar_ms / ms << "x)"
+                  << ( same ? "" : "  MISMATCH" ) << std::endl;
+    }
+    return failures;
+}
+
+static int runBoundsBenchmark( size_t count, unsigned int max_threads )
+{
+    if( max_threads == 0 )
+        max_threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+    // Particles (x y z attribute) and mesh vertices (x y z), with a few NaNs
+    // that both versions skip; no zeros, whose sign could depend on the order.
+    std::mt19937 rng( 1234 );
+    std::uniform_real_distribution<float> coord( 1.f, 1000.f );
+    std::vector<float> particles( count * 4 ), vertices( count * 3 );
+    for( size_t i = 0; i < particles.size(); ++i )
+        particles[i] = ( rng() & 1 ? -1.f : 1.f ) * coord( rng );
+    for( size_t i = 0; i < vertices.size(); ++i )
+        vertices[i] = ( rng() & 1 ? -1.f : 1.f ) * coord( rng );
+    for( size_t i = 0; i < 16 && count > 0; ++i )
+    {
+        particles[rng() % particles.size()] = NAN;
+        vertices[rng() % vertices.size()] = NAN;
+    }
+
+    const int failures = benchBounds( "particles (float4)", particles, 4, 4, max_threads ) +
+                         benchBounds( "vertices (float3)", vertices, 3, 3, max_threads );
+    if( failures )
+    {
+        std::cerr << failures << " box(es) differ from the scalar loop" << std::endl;
+        return 1;
+    }
+    std::cout << "All boxes match the scalar loop." << std::endl;
+    return 0;
+}
+
+
+int main( int argc, char** argv )
+{
+    std::string input, output;
+    bool has_colors = false;
+    bool has_radius = false;
+    size_t max_particles = 0;
+    unsigned int num_threads = 0;
+    size_t bench_bounds = 0;
+
+    for( int i=1; i<argc; ++i )
+    {
+        const std::string arg( argv[i] );
+
+        if( arg == "-h" || arg == "--help" )
+        {
+            printUsageAndExit( argv[0] );
+        }
+        else if( arg == "--colors" )
+        {
+            has_colors = true;
+        }
+        else if( arg == "--radius" )
+        {
+            has_radius = true;
+        }
+        else if( arg == "--max_particles" )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            max_particles = strtoul( argv[++i], NULL, 10 );
+        }
+        else if( arg == "--threads" )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            num_threads = static_cast<unsigned int>( strtoul( argv[++i], NULL, 10 ) );
+        }
+        else if( arg == "--bench_bounds" )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            bench_bounds = strtoul( argv[++i], NULL, 10 );
+            if( bench_bounds == 0 )
+                printUsageAndExit( argv[0] );
+        }
+        else if( input.empty() )
+        {
+            input = arg;
+        }
+        else if( output.empty() )
+        {
+            output = arg;
+        }
+        else
+        {
+            std::cout << "Unknown option '" << arg << "'\n";
+            printUsageAndExit( argv[0] );
+        }
+    }
+    if( bench_bounds )
+        return runBoundsBenchmark( bench_bounds, num_threads );
+    if( output.empty() )
+        printUsageAndExit( argv[0] );
+
+    try
+    {
+        const std::string::size_type dot_pos = input.rfind( "." );
+        const std::string extension = dot_pos == std::string::npos ? std::string() : input.substr( dot_pos+1 );
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        ParticleData data;
+        if( extension == "raw" )
+            readParticlesRaw( input, max_particles, data );
+        else
+            readParticlesText( input, has_colors, has_radius, max_particles, data, num_threads );
+
+        const std::chrono::steady_clock::time_point read = std::chrono::steady_clock::now();
+
+        writeParticleFile( output, data );
+
+        const std::chrono::steady_clock::time_point written = std::chrono::steady_clock::now();
+
+        const double read_time = std::chrono::duration<double>( read - start ).count();
+        double input_mb = 0.0;
+        if( FILE* fp = fopen( input.c_str(), "rb" ) )
+        {
+            fseek( fp, 0L, SEEK_END );
+            input_mb = ftell( fp ) / ( 1024.0 * 1024.0 );
+            fclose( fp );
+        }
+
+        std::cout << "Converted " << data.count() << " particles from '" << input << "' to '" << output << "'"
+                  << " (read " << read_time << " s, " << ( read_time > 0.0 ? input_mb / read_time : 0.0 ) << " MB/s"
+                  << ", write " << std::chrono::duration<double>( written - read ).count() << " s)" << std::endl;
+    }
+    catch( const std::exception& e )
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,597 @@
+//-----------------------------------------------------------------------------
+//
+// particleFile: particle file readers and the memory-mapped .pbf container,
+// see particleFile.h
+//
+//-----------------------------------------------------------------------------
+
+#include "particleFile.h"
+
+#include <Bounds.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#if defined( _WIN32 )
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+static const char particleFileMagic[4] = { 'P', 'B', 'F', '\0' };
+
+static_assert( sizeof( ParticleFileHeader ) == 128, "ParticleFileHeader layout" );
+
+const size_t particleBlockComponents[PARTICLE_BLOCK_COUNT] = { 4, 3, 3, 1 };
+
+
+//------------------------------------------------------------------------------
+//
+// Text and raw files
+//
+//------------------------------------------------------------------------------
+
+// Powers of ten that are exact in double precision
+static const double exactPowersOf10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// Parses the plain decimal [+-]digits[.digits][(e|E)[+-]digits] that spans
+// exactly [begin, end) to the float atof would return, (float) of the
+// correctly rounded double.  A mantissa of at most 15 digits and a power of
+// ten up to 22 are both exact doubles, so one multiplication or division
+// rounds correctly [Clinger 1990].  Returns false for anything else.
+static inline bool parseDecimal( const char* begin, const char* end, float& f )
+{
+#if defined( FLT_EVAL_METHOD ) && FLT_EVAL_METHOD != 0
+    // excess precision would round twice
+    return false;
+#endif
+    const char* p = begin;
+    const bool negative = ( p < end && *p == '-' );
+    if ( p < end && ( *p == '-' || *p == '+' ) )
+        ++p;
+
+    uint64_t mantissa = 0;
+    int digits = 0, significant = 0, exponent = 0;
+    for ( ; p < end && *p >= '0' && *p <= '9'; ++p, ++digits ) {
+        if ( mantissa || *p != '0' )
+            ++significant;
+        mantissa = mantissa * 10 + ( *p - '0' );
+    }
+    if ( p < end && *p == '.' ) {
+        for ( ++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits, --exponent ) {
+            if ( mantissa || *p != '0' )
+                ++significant;
+            mantissa = mantissa * 10 + ( *p - '0' );
+        }
+    }
+    if ( digits == 0 || significant > 15 )
+        return false;
+
+    if ( p < end && ( *p == 'e' || *p == 'E' ) ) {
+        ++p;
+        const bool negative_exponent = ( p < end && *p == '-' );
+        if ( p < end && ( *p == '-' || *p == '+' ) )
+            ++p;
+        if ( p == end )
+            return false;
+        int e = 0;
+        for ( ; p < end && *p >= '0' && *p <= '9'; ++p ) {
+            if ( e > 1000 )
+                return false;
+            e = e * 10 + ( *p - '0' );
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+    if ( p != end || exponent < -22 || exponent > 22 )
+        return false;
+
+    double d = double( mantissa );
+    d = exponent < 0 ? d / exactPowersOf10[-exponent] : d * exactPowersOf10[exponent];
+    f = float( negative ? -d : d );
+    return true;
+}
+
+// Next number of the line [token, line_end), as parseFloat of the original
+// line by line reader: skip blanks, convert as atof, then skip the token.
+static inline float parseFloat( const char *&token, const char* line_end )
+{
+    while ( token < line_end && ( *token == ' ' || *token == '\t' ) )
+        ++token;
+
+    const char* token_end = token;
+    while ( token_end < line_end && *token_end != ' ' && *token_end != '\t' && *token_end != '\r' )
+        ++token_end;
+
+    float f;
+    if ( !parseDecimal( token, token_end, f ) )
+        f = (float) atof( std::string( token, line_end ).c_str() );
+
+    token = token_end;
+    return f;
+}
+
+
+// Particles of the lines that start in [begin, end), with their bounds
+static void parseParticlesText( const char* begin,
+                                const char* end,
+                                bool has_colors,
+                                bool has_radius,
+                                ParticleData& data )
+{
+    // at least 40 characters per particle line; the untouched excess costs
+    // address space only
+    const size_t reserve = size_t( end - begin ) / 40 + 1;
+    data.positions.reserve( reserve * 4 );
+    data.velocities.reserve( reserve * 3 );
+    if ( has_colors )
+        data.colors.reserve( reserve * 3 );
+    if ( has_radius )
+        data.radii.reserve( reserve );
+
+    for ( int k = 0; k < 4; ++k ) {
+        data.bounds_min[k] = 1e16f;
+        data.bounds_max[k] = -1e16f;
+    }
+
+    const char* line = begin;
+    while ( line < end ) {
+        const char* newline = static_cast<const char*>( memchr( line, '\n', size_t( end - line ) ) );
+        const char* line_end = newline ? newline : end;
+        const char* next = newline ? newline + 1 : end;
+
+        // Trim '\r' of '\r\n'
+        if ( line_end > line && line_end[-1] == '\r' )
+            --line_end;
+
+        // Skip leading space.
+        const char *token = line;
+        while ( token < line_end && ( *token == ' ' || *token == '\t' ) )
+            ++token;
+
+        if ( token == line_end || token[0] == '#' ) {
+            line = next;
+            continue; // empty or comment line
+        }
+
+        // meaningful line here. The expected format is: position, velocity, color and radius
+
+        // position
+        float x  = parseFloat( token, line_end );
+        float y  = parseFloat( token, line_end );
+        float z  = parseFloat( token, line_end );
+
+        // velocity
+        float vx = parseFloat( token, line_end );
+        float vy = parseFloat( token, line_end );
+        float vz = parseFloat( token, line_end );
+
+        float vel_magnitude = sqrtf( vx*vx + vy*vy + vz*vz );
+
+        data.positions.push_back( x );
+        data.positions.push_back( y );
+        data.positions.push_back( z );
+        data.positions.push_back( vel_magnitude );
+
+        data.velocities.push_back( vx );
+        data.velocities.push_back( vy );
+        data.velocities.push_back( vz );
+
+        if ( has_colors )
+        {
+            // color
+            data.colors.push_back( parseFloat( token, line_end ) );
+            data.colors.push_back( parseFloat( token, line_end ) );
+            data.colors.push_back( parseFloat( token, line_end ) );
+        }
+
+        if ( has_radius )
+        {
+            // radius
+            data.radii.push_back( parseFloat( token, line_end ) );
+        }
+
+        const float p[4] = { x, y, z, vel_magnitude };
+        for ( int k = 0; k < 4; ++k ) {
+            data.bounds_min[k] = fminf( data.bounds_min[k], p[k] );
+            data.bounds_max[k] = fmaxf( data.bounds_max[k], p[k] );
+        }
+
+        line = next;
+    }
+}
+
+
+static void appendParticleBlock( std::vector<float>& dst, const std::vector<float>& src, size_t max_size )
+{
+    dst.insert( dst.end(), src.begin(), src.begin() + std::min( src.size(), max_size - dst.size() ) );
+}
+
+
+void readParticlesText( const std::string& filename,
+                        bool has_colors,
+                        bool has_radius,
+                        size_t max_particles,
+                        ParticleData& data,
+                        unsigned int num_threads )
+{
+    FILE* fp = fopen( filename.c_str(), "rb" );
+    if ( !fp )
+        throw std::runtime_error( "ParticleFile: Unable to open '" + filename + "'" );
+
+    fseek( fp, 0L, SEEK_END );
+    const long sz = ftell( fp );
+    rewind( fp );
+
+    std::vector<char> text( sz > 0 ? size_t( sz ) : 0 );
+    const size_t n = text.empty() ? 0 : fread( &text[0], 1, text.size(), fp );
+    fclose( fp );
+    if ( sz < 0 || n != text.size() )
+        throw std::runtime_error( "ParticleFile: Unable to read '" + filename + "'" );
+
+    if ( num_threads == 0 )
+        num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+    // Newline-aligned chunks of at least 1MB, a few per thread to even out
+    // the load; every chunk begins at the start of a line.
+    const char* const text_begin = text.empty() ? NULL : &text[0];
+    const char* const text_end   = text_begin + text.size();
+    const size_t chunk_size = std::max( size_t( 1 ) << 20, text.size() / ( 4 * num_threads ) + 1 );
+    std::vector<const char*> chunk_begin( 1, text_begin );
+    while ( size_t( text_end - chunk_begin.back() ) > chunk_size ) {
+        const char* split = chunk_begin.back() + chunk_size;
+        const char* newline = static_cast<const char*>( memchr( split, '\n', size_t( text_end - split ) ) );
+        if ( !newline || newline + 1 == text_end )
+            break;
+        chunk_begin.push_back( newline + 1 );
+    }
+    chunk_begin.push_back( text_end );
+    const size_t num_chunks = chunk_begin.size() - 1;
+
+    std::vector<ParticleData> chunks( num_chunks );
+    std::atomic<size_t> next_chunk( 0 );
+    std::vector<std::thread> threads;
+    for ( unsigned int t = 0; t < std::min<size_t>( num_threads, num_chunks ); ++t ) {
+        threads.push_back( std::thread( [&]() {
+            for ( size_t c = next_chunk++; c < num_chunks; c = next_chunk++ )
+                parseParticlesText( chunk_begin[c], chunk_begin[c+1], has_colors, has_radius, chunks[c] );
+        } ) );
+    }
+    for ( size_t t = 0; t < threads.size(); ++t )
+        threads[t].join();
+
+    // concatenate the chunks in file order and merge their bounds
+    size_t total = 0;
+    for ( size_t c = 0; c < num_chunks; ++c )
+        total += chunks[c].count();
+    if ( max_particles > 0 && total > max_particles )
+        total = max_particles;
+
+    data = ParticleData();
+    data.positions.reserve( total * 4 );
+    data.velocities.reserve( total * 3 );
+    data.colors.reserve( has_colors ? total * 3 : 0 );
+    data.radii.reserve( has_radius ? total : 0 );
+    for ( int k = 0; k < 4; ++k ) {
+        data.bounds_min[k] = 1e16f;
+        data.bounds_max[k] = -1e16f;
+    }
+    for ( size_t c = 0; c < num_chunks && data.count() < total; ++c ) {
+        ParticleData& chunk = chunks[c];
+        const bool whole = data.count() + chunk.count() <= total;
+        appendParticleBlock( data.positions,  chunk.positions,  total * 4 );
+        appendParticleBlock( data.velocities, chunk.velocities, total * 3 );
+        appendParticleBlock( data.colors,     chunk.colors,     has_colors ? total * 3 : 0 );
+        appendParticleBlock( data.radii,      chunk.radii,      has_radius ? total : 0 );
+        if ( !whole ) {
+            // only the first particles of this chunk were kept
+            computeParticleBounds( &data.positions[0], data.count(), data.bounds_min, data.bounds_max );
+            break;
+        }
+        for ( int k = 0; k < 4; ++k ) {
+            data.bounds_min[k] = fminf( data.bounds_min[k], chunk.bounds_min[k] );
+            data.bounds_max[k] = fmaxf( data.bounds_max[k], chunk.bounds_max[k] );
+        }
+        chunk = ParticleData();
+    }
+}
+
+
+void readParticlesRaw( const std::string& filename,
+                       size_t max_particles,
+                       ParticleData& data )
+{
+    FILE* fp = fopen( filename.c_str(), "rb" );
+    if ( !fp )
+        throw std::runtime_error( "ParticleFile: Unable to open '" + filename + "'" );
+
+    fseek( fp, 0L, SEEK_END );
+    const long sz = ftell( fp );
+    rewind( fp );
+
+    size_t numParticles = sz > 0 ? size_t( sz ) / 16 : 0;
+    if ( max_particles > 0 && numParticles > max_particles )
+        numParticles = max_particles;
+
+    data = ParticleData();
+    data.positions.resize( numParticles * 4 );
+    const size_t n = numParticles ? fread( &data.positions[0], sizeof(float) * 4, numParticles, fp ) : 0;
+    fclose( fp );
+
+    if ( n != numParticles )
+        throw std::runtime_error( "ParticleFile: Unable to read '" + filename + "'" );
+
+    computeParticleBounds( numParticles ? &data.positions[0] : NULL, numParticles, data.bounds_min, data.bounds_max );
+}
+
+
+void computeParticleBounds( const float* positions,
+                            size_t count,
+                            float pmin[4],
+                            float pmax[4] )
+{
+    for ( int k = 0; k < 4; ++k ) {
+        pmin[k] = 1e16f;
+        pmax[k] = -1e16f;
+    }
+
+    sutil::computeBounds( positions, count, 4, 4, pmin, pmax );
+}
+
+
+void computeAttributeNormalization( float wmin, float wmax, float& scale, float& offset )
+{
+    if ( wmin < 0.f ) {
+        scale  = 0.5f / std::max( -wmin, wmax );
+        offset = .5f;
+    }
+    else {
+        scale  = float( 1.0 / double( wmax - wmin ) );
+        offset = 0.f;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//
+// .pbf writer
+//
+//------------------------------------------------------------------------------
+
+static const std::vector<float>& particleBlockData( const ParticleData& data, int block )
+{
+    switch ( block ) {
+        case PARTICLE_BLOCK_VELOCITIES: return data.velocities;
+        case PARTICLE_BLOCK_COLORS:     return data.colors;
+        case PARTICLE_BLOCK_RADII:      return data.radii;
+        default:                        return data.positions;
+    }
+}
+
+
+static inline uint64_t alignParticleOffset( uint64_t offset )
+{
+    return ( offset + PARTICLE_FILE_ALIGNMENT - 1 ) / PARTICLE_FILE_ALIGNMENT * PARTICLE_FILE_ALIGNMENT;
+}
+
+
+void writeParticleFile( const std::string& filename, const ParticleData& data )
+{
+    const size_t count = data.count();
+
+    ParticleFileHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, particleFileMagic, 4 );
+    header.version = PARTICLE_FILE_VERSION;
+    header.count   = count;
+
+    float pmin[4], pmax[4];
+    computeParticleBounds( count ? &data.positions[0] : NULL, count, pmin, pmax );
+    for ( int k = 0; k < 3; ++k ) {
+        header.bbox_min[k] = pmin[k];
+        header.bbox_max[k] = pmax[k];
+    }
+    header.attribute_min = pmin[3];
+    header.attribute_max = pmax[3];
+
+    uint64_t offset = alignParticleOffset( sizeof( header ) );
+    for ( int b = 0; b < PARTICLE_BLOCK_COUNT; ++b ) {
+        const std::vector<float>& block = particleBlockData( data, b );
+        if ( block.empty() && b != PARTICLE_BLOCK_POSITIONS )
+            continue;
+        if ( block.size() != count * particleBlockComponents[b] )
+            throw std::runtime_error( "ParticleFile: Inconsistent particle attributes for '" + filename + "'" );
+        header.offset[b] = offset;
+        offset = alignParticleOffset( offset + block.size() * sizeof( float ) );
+    }
+
+    FILE* fp = fopen( filename.c_str(), "wb" );
+    if ( !fp )
+        throw std::runtime_error( "ParticleFile: Unable to create '" + filename + "'" );
+
+    bool ok = fwrite( &header, sizeof( header ), 1, fp ) == 1;
+    uint64_t pos = sizeof( header );
+    const std::vector<char> padding( PARTICLE_FILE_ALIGNMENT, 0 );
+    for ( int b = 0; ok && b < PARTICLE_BLOCK_COUNT; ++b ) {
+        if ( !header.offset[b] )
+            continue;
+        const std::vector<float>& block = particleBlockData( data, b );
+        const size_t pad = size_t( header.offset[b] - pos );
+        ok = ( pad == 0 || fwrite( &padding[0], 1, pad, fp ) == pad ) &&
+             ( block.empty() || fwrite( &block[0], sizeof( float ), block.size(), fp ) == block.size() );
+        pos = header.offset[b] + block.size() * sizeof( float );
+    }
+    ok = ( fclose( fp ) == 0 ) && ok;
+
+    if ( !ok ) {
+        remove( filename.c_str() );
+        throw std::runtime_error( "ParticleFile: Unable to write '" + filename + "'" );
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//
+// ParticleFile
+//
+//------------------------------------------------------------------------------
+
+ParticleFile::ParticleFile( const std::string& filename )
+    : m_filename( filename ),
+      m_data( NULL ),
+      m_size( 0 )
+#if defined( _WIN32 )
+      , m_file( NULL ),
+      m_mapping( NULL )
+#endif
+{
+#if defined( _WIN32 )
+    HANDLE file = CreateFileA( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if ( file == INVALID_HANDLE_VALUE )
+        throw std::runtime_error( "ParticleFile: Unable to open '" + filename + "'" );
+    m_file = file;
+
+    LARGE_INTEGER size;
+    bool too_small = !GetFileSizeEx( file, &size ) || size.QuadPart < (LONGLONG) sizeof( ParticleFileHeader );
+    if ( !too_small ) {
+        m_size = size_t( size.QuadPart );
+        m_mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+        if ( m_mapping )
+            m_data = static_cast<const char*>( MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) );
+    }
+#else
+    const int fd = open( filename.c_str(), O_RDONLY );
+    if ( fd < 0 )
+        throw std::runtime_error( "ParticleFile: Unable to open '" + filename + "'" );
+
+    struct stat st;
+    bool too_small = fstat( fd, &st ) != 0 || st.st_size < (off_t) sizeof( ParticleFileHeader );
+    if ( !too_small ) {
+        m_size = size_t( st.st_size );
+        void* data = mmap( NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( data != MAP_FAILED ) {
+            m_data = static_cast<const char*>( data );
+            // the blocks are read front to back when uploaded
+            madvise( data, m_size, MADV_SEQUENTIAL );
+        }
+    }
+    close( fd );
+#endif
+
+    if ( !m_data ) {
+        unmap();
+        throw std::runtime_error( too_small ? "ParticleFile: '" + filename + "' is truncated or damaged"
+                                            : "ParticleFile: Unable to map '" + filename + "'" );
+    }
+
+    // validate the header and that all blocks are within the file
+    const ParticleFileHeader& h = header();
+    std::string error;
+    if ( memcmp( h.magic, particleFileMagic, 4 ) != 0 )
+        error = "not a particle file";
+    else if ( h.version != PARTICLE_FILE_VERSION )
+        error = "unsupported version";
+    else if ( !h.offset[PARTICLE_BLOCK_POSITIONS] )
+        error = "no positions";
+    for ( int b = 0; error.empty() && b < PARTICLE_BLOCK_COUNT; ++b ) {
+        if ( !h.offset[b] )
+            continue;
+        const uint64_t bytes = h.count * particleBlockComponents[b] * sizeof( float );
+        if ( h.offset[b] % PARTICLE_FILE_ALIGNMENT != 0 || h.offset[b] > m_size ||
+             h.count > m_size || bytes > m_size - h.offset[b] )
+            error = "truncated or damaged";
+    }
+    if ( !error.empty() ) {
+        unmap();
+        throw std::runtime_error( "ParticleFile: '" + filename + "' is " + error );
+    }
+}
+
+
+ParticleFile::~ParticleFile()
+{
+    unmap();
+}
+
+
+void ParticleFile::unmap()
+{
+#if defined( _WIN32 )
+    if ( m_data )
+        UnmapViewOfFile( m_data );
+    if ( m_mapping )
+        CloseHandle( m_mapping );
+    if ( m_file )
+        CloseHandle( m_file );
+    m_mapping = m_file = NULL;
+#else
+    if ( m_data )
+        munmap( const_cast<char*>( m_data ), m_size );
+#endif
+    m_data = NULL;
+    m_size = 0;
+}
+
+
+const ParticleFileHeader& ParticleFile::header() const
+{
+    return *reinterpret_cast<const ParticleFileHeader*>( m_data );
+}
+
+
+size_t ParticleFile::count() const
+{
+    return size_t( header().count );
+}
+
+
+size_t ParticleFile::size() const
+{
+    return m_size;
+}
+
+
+void ParticleFile::pageIn( size_t count ) const
+{
+    count = std::min( count, this->count() );
+
+    unsigned int sum = 0;
+    for ( int b = 0; b < PARTICLE_BLOCK_COUNT; ++b ) {
+        const char* data = reinterpret_cast<const char*>( block( ParticleBlock( b ) ) );
+        if ( !data )
+            continue;
+
+        const size_t bytes = count * particleBlockComponents[b] * sizeof( float );
+        for ( size_t i = 0; i < bytes; i += PARTICLE_FILE_ALIGNMENT )
+            sum += static_cast<unsigned char>( data[i] );
+    }
+
+    // keep the reads
+    volatile unsigned int sink = sum;
+    (void) sink;
+}
+
+
+const float* ParticleFile::block( ParticleBlock block ) const
+{
+    const uint64_t offset = header().offset[block];
+    return offset ? reinterpret_cast<const float*>( m_data + offset ) : NULL;
+}
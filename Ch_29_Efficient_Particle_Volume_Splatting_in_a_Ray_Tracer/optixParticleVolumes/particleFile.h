@@ -0,0 +1,146 @@
+//-----------------------------------------------------------------------------
+//
+// particleFile: readers for the particle file formats of optixParticleVolumes
+// and the binary particle container (.pbf) that the viewer memory-maps.
+//
+// The text format has one particle per line, "x y z vx vy vz [r g b] [radius]",
+// with '#' comment lines; the raw format is a headerless array of float4
+// (x, y, z, attribute).  Both have to be parsed or scanned on every load.
+//
+// A .pbf file is a ParticleFileHeader followed by one block per attribute
+// (structure of arrays), each starting at a multiple of PARTICLE_FILE_ALIGNMENT
+// bytes.  The header carries the particle count, the bounds of the particle
+// centers and the range of the scalar attribute, so a reader needs to touch
+// nothing but the header before uploading the blocks straight from the
+// mapping.  All values are little-endian.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define PARTICLE_FILE_VERSION   1
+#define PARTICLE_FILE_ALIGNMENT 4096
+
+enum ParticleBlock
+{
+    PARTICLE_BLOCK_POSITIONS = 0,   // float4: x, y, z, attribute
+    PARTICLE_BLOCK_VELOCITIES,      // float3, optional
+    PARTICLE_BLOCK_COLORS,          // float3, optional
+    PARTICLE_BLOCK_RADII,           // float,  optional
+    PARTICLE_BLOCK_COUNT
+};
+
+struct ParticleFileHeader
+{
+    char        magic[4];                           // "PBF\0"
+    uint32_t    version;                            // PARTICLE_FILE_VERSION
+    uint64_t    count;                              // number of particles
+    float       bbox_min[3];                        // bounds of the particle centers
+    float       bbox_max[3];
+    float       attribute_min;                      // range of the attribute (positions w)
+    float       attribute_max;
+    uint64_t    offset[PARTICLE_BLOCK_COUNT];       // file offset of each block, 0 if absent
+    uint32_t    reserved[12];                       // zero
+};
+
+
+//------------------------------------------------------------------------------
+//
+// Particles read from a text or raw file, in the layout of the .pbf blocks
+//
+//------------------------------------------------------------------------------
+struct ParticleData
+{
+    std::vector<float>  positions;      // 4 floats per particle: x, y, z, attribute
+    std::vector<float>  velocities;     // 3 floats per particle, or empty
+    std::vector<float>  colors;         // 3 floats per particle, or empty
+    std::vector<float>  radii;          // 1 float per particle, or empty
+    float               bounds_min[4];  // bounds of positions, set by the readers
+    float               bounds_max[4];
+
+    size_t count() const { return positions.size() / 4; }
+};
+
+// Number of floats per particle of each block
+extern const size_t particleBlockComponents[PARTICLE_BLOCK_COUNT];
+
+// Reads a text particle file; the attribute is the velocity magnitude.  Colors
+// and radii are only read (and stored) if the file has those columns.  Reads
+// at most max_particles particles unless max_particles is 0.  The file is
+// split into newline-aligned chunks that num_threads threads (0: one per
+// hardware thread) parse in parallel; the result does not depend on the
+// number of threads.  Throws std::runtime_error if the file cannot be read.
+void readParticlesText( const std::string& filename,
+                        bool has_colors,
+                        bool has_radius,
+                        size_t max_particles,
+                        ParticleData& data,
+                        unsigned int num_threads = 0 );
+
+// Reads a raw float4 particle file, see readParticlesText.
+void readParticlesRaw( const std::string& filename,
+                       size_t max_particles,
+                       ParticleData& data );
+
+// Bounds of count particles of 4 floats each (x, y, z, attribute).
+void computeParticleBounds( const float* positions,
+                            size_t count,
+                            float pmin[4],
+                            float pmax[4] );
+
+// Scale and offset that map the attribute range [wmin, wmax] to [0, 1], with a
+// signed range centered at .5, as the viewer uploads the attribute.
+void computeAttributeNormalization( float wmin, float wmax, float& scale, float& offset );
+
+// Writes data as a .pbf file, with the velocity, color and radius blocks if
+// data has them.  Throws std::runtime_error on failure.
+void writeParticleFile( const std::string& filename, const ParticleData& data );
+
+
+//------------------------------------------------------------------------------
+//
+// A .pbf file mapped into memory read-only.  The blocks are used in place and
+// only paged in when they are read.
+//
+//------------------------------------------------------------------------------
+class ParticleFile
+{
+public:
+    // Maps and validates filename; throws std::runtime_error on failure.
+    explicit ParticleFile( const std::string& filename );
+    ~ParticleFile();
+
+    const ParticleFileHeader&   header() const;
+    size_t                      count() const;
+    size_t                      size() const;       // bytes mapped
+
+    // Reads every page of the blocks of the first count particles, so that
+    // the pages are resident before the blocks are used.
+    void                        pageIn( size_t count ) const;
+
+    // Block data, or NULL for blocks the file does not have
+    const float*                block( ParticleBlock block ) const;
+    const float*                positions() const   { return block( PARTICLE_BLOCK_POSITIONS ); }
+    const float*                velocities() const  { return block( PARTICLE_BLOCK_VELOCITIES ); }
+    const float*                colors() const      { return block( PARTICLE_BLOCK_COLORS ); }
+    const float*                radii() const       { return block( PARTICLE_BLOCK_RADII ); }
+
+private:
+    ParticleFile( const ParticleFile& );
+    ParticleFile& operator=( const ParticleFile& );
+
+    void unmap();
+
+    std::string     m_filename;
+    const char*     m_data;
+    size_t          m_size;
+#if defined( _WIN32 )
+    void*           m_file;
+    void*           m_mapping;
+#endif
+};
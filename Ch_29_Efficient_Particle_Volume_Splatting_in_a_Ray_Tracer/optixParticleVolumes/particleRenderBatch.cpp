@@ -0,0 +1,350 @@
+//-----------------------------------------------------------------------------
+//
+// optixParticleRenderBatch:
+// Renders a particle file of optixParticleVolumes on the CPU, with the
+// initial camera and settings of the viewer, and writes the image as a PPM
+// file.  Without a GPU it is a batch mode; compared to a stored image it is a
+// regression test of the splatting, see particleRenderCPU.h.
+//
+//-----------------------------------------------------------------------------
+
+#include "particleFile.h"
+#include "particleRenderCPU.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace optix;
+
+
+void printUsageAndExit( const std::string& argv0 )
+{
+    std::cout << "\nUsage: " << argv0 << " [options] -p <particles_file>\n";
+    std::cout <<
+        "Renders a particle file (.txt/.xyz, .raw or .pbf) on the CPU from the initial camera of the viewer.\n"
+        "Options:\n"
+        "  -h | --help                         Print this usage message and exit.\n"
+        "  -p | --particles <particles_file>   Specify path to particles file to be loaded.\n"
+        "  -f | --file <image.ppm>             Save the image to a PPM file.\n"
+        "  --compare <image.ppm>               Compare the image to a PPM file, fail if a channel differs by more than the tolerance.\n"
+        "  --tolerance <int>                   Largest channel difference --compare accepts (default 0).\n"
+        "  --dim <W>x<H>                       Image size (default 1024x768).\n"
+        "  --threads <int N>                   Render with N threads (default: all).\n"
+        "  --colors                            Text input has r g b columns after the velocity.\n"
+        "  --radius                            Text input has a radius column.\n"
+        "  --max_particles <int M>             Only read the first M particles of the dataset.\n"
+        "  --fixed_radius <float>              World space radius of a particle (default 100, 0 = from the density).\n"
+        "  --particlesPerSlab <float>          Slab spacing in buffers of particles (default 16).\n"
+        "  --wScale <float>                    Rescale particle attribute range by a fixed multiple.\n"
+        "  --opacity <float>                   Opacity scale (alpha) for each particle.\n"
+        "  --redshift <float>                  Redshift scale (default 1).\n"
+        "  --tf_type <int>                     Use preset transfer function (0,1,2 = unsigned data, 3 = signed data).\n"
+        << std::endl;
+
+    exit(1);
+}
+
+
+// writes BGRA pixels with the bottom row first as a binary PPM, top row first
+static void writePPM( const std::string& filename, const std::vector<unsigned char>& pixels,
+                      unsigned int width, unsigned int height )
+{
+    FILE* fp = fopen( filename.c_str(), "wb" );
+    if( !fp )
+        throw std::runtime_error( "ParticleRender: cannot open '" + filename + "' for writing" );
+
+    fprintf( fp, "P6\n%u %u\n255\n", width, height );
+
+    std::vector<unsigned char> row( width * 3 );
+    bool ok = true;
+    for( unsigned int y = height; y-- > 0; )
+    {
+        const unsigned char* src = &pixels[size_t( y ) * width * 4];
+        for( unsigned int x = 0; x < width; ++x )
+        {
+            row[3*x+0] = src[4*x+2];
+            row[3*x+1] = src[4*x+1];
+            row[3*x+2] = src[4*x+0];
+        }
+        ok = ok && fwrite( &row[0], 1, row.size(), fp ) == row.size();
+    }
+
+    if( fclose( fp ) != 0 || !ok )
+        throw std::runtime_error( "ParticleRender: cannot write '" + filename + "'" );
+}
+
+
+// reads a binary PPM written by writePPM, RGB with the top row first
+static void readPPM( const std::string& filename, std::vector<unsigned char>& rgb,
+                     unsigned int& width, unsigned int& height )
+{
+    FILE* fp = fopen( filename.c_str(), "rb" );
+    if( !fp )
+        throw std::runtime_error( "ParticleRender: cannot open '" + filename + "'" );
+
+    unsigned int max_value = 0;
+    const bool ok = fscanf( fp, "P6 %u %u %u", &width, &height, &max_value ) == 3 && max_value == 255 &&
+                    fgetc( fp ) != EOF;
+    if( ok )
+        rgb.resize( size_t( width ) * height * 3 );
+    const bool read = ok && fread( rgb.empty() ? NULL : &rgb[0], 1, rgb.size(), fp ) == rgb.size();
+    fclose( fp );
+
+    if( !read )
+        throw std::runtime_error( "ParticleRender: '" + filename + "' is not an 8 bit binary PPM file" );
+}
+
+
+int main( int argc, char** argv )
+{
+    std::string particles_file, out_file, compare_file;
+    int tolerance = 0;
+    unsigned int width = 1024u, height = 768u;
+    unsigned int num_threads = 0;
+    bool has_colors = false;
+    bool has_radius = false;
+    size_t max_particles = 0;
+
+    float fixed_radius = 100.f;
+    float particlesPerSlab = 16.f;
+    float wScale = 3.5f;
+    float opacity = .5f;
+    float redshift = 1.f;
+    int tf_type = 2;
+
+    for( int i=1; i<argc; ++i )
+    {
+        const std::string arg( argv[i] );
+
+        if( arg == "-h" || arg == "--help" )
+        {
+            printUsageAndExit( argv[0] );
+        }
+        else if( arg == "--colors" )
+        {
+            has_colors = true;
+        }
+        else if( arg == "--radius" )
+        {
+            has_radius = true;
+        }
+        else if( i == argc-1 )
+        {
+            std::cout << "Unknown option or missing argument '" << arg << "'\n";
+            printUsageAndExit( argv[0] );
+        }
+        else if( arg == "-p" || arg == "--particles" )
+        {
+            particles_file = argv[++i];
+        }
+        else if( arg == "-f" || arg == "--file" )
+        {
+            out_file = argv[++i];
+        }
+        else if( arg == "--compare" )
+        {
+            compare_file = argv[++i];
+        }
+        else if( arg == "--tolerance" )
+        {
+            tolerance = atoi( argv[++i] );
+        }
+        else if( arg == "--dim" )
+        {
+            if( sscanf( argv[++i], "%ux%u", &width, &height ) != 2 || width == 0 || height == 0 )
+            {
+                std::cout << "Invalid image size '" << argv[i] << "'\n";
+                printUsageAndExit( argv[0] );
+            }
+        }
+        else if( arg == "--threads" )
+        {
+            num_threads = static_cast<unsigned int>( strtoul( argv[++i], NULL, 10 ) );
+        }
+        else if( arg == "--max_particles" )
+        {
+            max_particles = strtoul( argv[++i], NULL, 10 );
+        }
+        else if( arg == "--fixed_radius" )
+        {
+            fixed_radius = (float) atof( argv[++i] );
+        }
+        else if( arg == "--particlesPerSlab" )
+        {
+            particlesPerSlab = (float) atof( argv[++i] );
+        }
+        else if( arg == "--wScale" )
+        {
+            wScale = (float) atof( argv[++i] );
+        }
+        else if( arg == "--opacity" )
+        {
+            opacity = (float) atof( argv[++i] );
+        }
+        else if( arg == "--redshift" )
+        {
+            redshift = (float) atof( argv[++i] );
+        }
+        else if( arg == "--tf_type" )
+        {
+            tf_type = atoi( argv[++i] );
+        }
+        else
+        {
+            std::cout << "Unknown option '" << arg << "'\n";
+            printUsageAndExit( argv[0] );
+        }
+    }
+    if( particles_file.empty() )
+        printUsageAndExit( argv[0] );
+
+    try
+    {
+        const std::string::size_type dot_pos = particles_file.rfind( "." );
+        const std::string extension = dot_pos == std::string::npos ? std::string() : particles_file.substr( dot_pos+1 );
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // the positions and their bounds, as the viewer's readFile()
+        std::unique_ptr<ParticleFile> file;
+        ParticleData data;
+        const float* positions;
+        size_t count;
+        float pmin[4], pmax[4];
+        if( extension == "pbf" )
+        {
+            file.reset( new ParticleFile( particles_file ) );
+            const ParticleFileHeader& header = file->header();
+            positions = file->positions();
+            count = file->count();
+            if( max_particles > 0 && count > max_particles )
+                count = max_particles;
+            std::copy( header.bbox_min, header.bbox_min + 3, pmin );
+            std::copy( header.bbox_max, header.bbox_max + 3, pmax );
+            pmin[3] = header.attribute_min;
+            pmax[3] = header.attribute_max;
+        }
+        else
+        {
+            if( extension == "raw" )
+                readParticlesRaw( particles_file, max_particles, data );
+            else
+                readParticlesText( particles_file, has_colors, has_radius, max_particles, data );
+            positions = data.positions.empty() ? NULL : &data.positions[0];
+            count = data.count();
+            std::copy( data.bounds_min, data.bounds_min + 4, pmin );
+            std::copy( data.bounds_max, data.bounds_max + 4, pmax );
+        }
+
+        const std::chrono::steady_clock::time_point loaded = std::chrono::steady_clock::now();
+
+        // the settings of loadParticles() in the viewer
+        float3 bbox_min = make_float3( pmin[0], pmin[1], pmin[2] );
+        float3 bbox_max = make_float3( pmax[0], pmax[1], pmax[2] );
+        if( fixed_radius == 0.f )
+            fixed_radius = length( bbox_max - bbox_min ) / powf( float( count ), 0.333333f );
+        bbox_min -= make_float3( fixed_radius );
+        bbox_max += make_float3( fixed_radius );
+        if( pmin[3] < 0.f )
+            tf_type = 3;
+
+        float w_scale, w_offset;
+        computeAttributeNormalization( pmin[3], pmax[3], w_scale, w_offset );
+
+        const ParticleBVH bvh( positions, count, fixed_radius, w_scale, w_offset );
+
+        const std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+
+        // the initial camera of setupCamera() and updateCamera() in the viewer
+        const float3 center = ( bbox_min + bbox_max ) * 0.5f;
+        const float max_dim = fmaxf( bbox_max.x - bbox_min.x, bbox_max.y - bbox_min.y );
+        const float3 eye = center + make_float3( 0.0f, 0.0f, max_dim*1.1f );
+        const float3 up = make_float3( 0.0f, 1.0f, 0.0f );
+        const float vfov = 35.0f;
+        const float aspect_ratio = static_cast<float>( width ) / static_cast<float>( height );
+
+        ParticleRenderParams params;
+        params.eye = eye;
+        params.W = center - eye;
+        params.U = normalize( cross( params.W, up ) );
+        params.V = normalize( cross( params.U, params.W ) );
+        const float vlen = length( params.W ) * tanf( 0.5f * vfov * M_PIf / 180.0f );
+        params.V *= vlen;
+        params.U *= vlen * aspect_ratio;
+        params.bbox_min = bbox_min;
+        params.bbox_max = bbox_max;
+        params.fixed_radius = fixed_radius;
+        params.particles_per_slab = particlesPerSlab;
+        params.w_scale = wScale;
+        params.opacity = opacity;
+        params.redshift = redshift;
+        params.tf_type = tf_type;
+
+        std::vector<unsigned char> pixels;
+        ParticleRenderStats stats;
+        renderParticlesCPU( bvh, params, width, height, pixels, stats, num_threads );
+
+        std::cout << "Rendered " << count << " particles from '" << particles_file << "' at "
+                  << width << "x" << height << " (fixed_radius = " << fixed_radius << ", tf_type = " << tf_type << ")\n"
+                  << "  load " << std::chrono::duration<double>( loaded - start ).count() << " s"
+                  << ", BVH build " << std::chrono::duration<double>( built - loaded ).count() << " s ("
+                  << bvh.nodes().size() << " nodes)"
+                  << ", render " << stats.seconds << " s\n"
+                  << "  " << stats.raysPerSecond() / 1.0e6 << " Mrays/s, per ray: "
+                  << stats.particlesTestedPerRay() << " particles tested, "
+                  << stats.particlesHitPerRay() << " composited, "
+                  << stats.slabsPerRay() << " slabs, "
+                  << ( stats.rays ? double( stats.nodes_visited ) / double( stats.rays ) : 0.0 ) << " nodes; "
+                  << stats.full_buffers << " full buffers" << std::endl;
+
+        if( !out_file.empty() )
+            writePPM( out_file, pixels, width, height );
+
+        if( !compare_file.empty() )
+        {
+            std::vector<unsigned char> reference;
+            unsigned int ref_width, ref_height;
+            readPPM( compare_file, reference, ref_width, ref_height );
+            if( ref_width != width || ref_height != height )
+                throw std::runtime_error( "ParticleRender: '" + compare_file + "' has a different size" );
+
+            int max_diff = 0;
+            size_t differing = 0;
+            for( unsigned int y = 0; y < height; ++y )
+            {
+                const unsigned char* src = &pixels[size_t( height - 1 - y ) * width * 4];
+                const unsigned char* ref = &reference[size_t( y ) * width * 3];
+                for( unsigned int x = 0; x < width; ++x )
+                {
+                    int diff = 0;
+                    for( int c = 0; c < 3; ++c )
+                        diff = std::max( diff, std::abs( int( src[4*x+2-c] ) - int( ref[3*x+c] ) ) );
+                    max_diff = std::max( max_diff, diff );
+                    differing += diff > tolerance;
+                }
+            }
+
+            std::cout << "Compared to '" << compare_file << "': " << differing << " pixels differ by more than "
+                      << tolerance << " (largest difference " << max_diff << ")" << std::endl;
+            if( differing > 0 )
+                return 2;
+        }
+    }
+    catch( const std::exception& e )
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
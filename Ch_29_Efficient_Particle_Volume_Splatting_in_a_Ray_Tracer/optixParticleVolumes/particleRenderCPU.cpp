@@ -0,0 +1,398 @@
+//-----------------------------------------------------------------------------
+//
+// particleRenderCPU: slab-based particle volume splatting on the CPU,
+// see particleRenderCPU.h
+//
+//-----------------------------------------------------------------------------
+
+#include "particleRenderCPU.h"
+#include "commonStructs.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+using namespace optix;
+
+// tf() uses the optix vector math unqualified, as in the .cu files
+#include "transferFunction.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+
+// Largest number of particles in a leaf
+static const size_t BVH_LEAF_SIZE = 4;
+
+// Deep enough for the median split of 2^32 particles
+static const int BVH_STACK_SIZE = 64;
+
+// Pixels along a side of the tiles the threads take in turn
+static const unsigned int TILE_SIZE = 16;
+
+
+//------------------------------------------------------------------------------
+//
+// ParticleBVH
+//
+//------------------------------------------------------------------------------
+
+ParticleBVH::ParticleBVH( const float* positions, size_t count, float radius, float w_scale, float w_offset )
+    : m_radius( radius )
+{
+    if ( count > std::numeric_limits<uint32_t>::max() )
+        throw std::runtime_error( "ParticleBVH: too many particles" );
+
+    if ( count == 0 )
+        return;
+
+    std::vector<uint32_t> order( count );
+    for ( size_t i = 0; i < count; ++i )
+        order[i] = static_cast<uint32_t>( i );
+
+    m_nodes.reserve( 2 * ( count / BVH_LEAF_SIZE + 1 ) );
+    build( order, 0, count, positions );
+
+    m_positions.resize( count );
+    for ( size_t i = 0; i < count; ++i ) {
+        const float* p = positions + 4 * size_t( order[i] );
+        m_positions[i] = make_float4( p[0], p[1], p[2], p[3] * w_scale + w_offset );
+    }
+}
+
+
+void ParticleBVH::build( std::vector<uint32_t>& order, size_t begin, size_t end, const float* positions )
+{
+    const size_t node = m_nodes.size();
+    m_nodes.push_back( Node() );
+
+    float cmin[3] = {  1e16f,  1e16f,  1e16f };
+    float cmax[3] = { -1e16f, -1e16f, -1e16f };
+    for ( size_t i = begin; i < end; ++i ) {
+        const float* p = positions + 4 * size_t( order[i] );
+        for ( int k = 0; k < 3; ++k ) {
+            cmin[k] = std::min( cmin[k], p[k] );
+            cmax[k] = std::max( cmax[k], p[k] );
+        }
+    }
+
+    // the boxes of the spheres, as in particle_bounds of geometry.cu
+    for ( int k = 0; k < 3; ++k ) {
+        m_nodes[node].bounds_min[k] = cmin[k] - m_radius;
+        m_nodes[node].bounds_max[k] = cmax[k] + m_radius;
+    }
+
+    if ( end - begin <= BVH_LEAF_SIZE ) {
+        m_nodes[node].index = static_cast<uint32_t>( begin );
+        m_nodes[node].count = static_cast<uint16_t>( end - begin );
+        m_nodes[node].axis  = 0;
+        return;
+    }
+
+    int axis = 0;
+    for ( int k = 1; k < 3; ++k )
+        if ( cmax[k] - cmin[k] > cmax[axis] - cmin[axis] )
+            axis = k;
+
+    // ties broken by index, so that the tree does not depend on the library
+    const size_t mid = begin + ( end - begin ) / 2;
+    std::nth_element( order.begin() + begin, order.begin() + mid, order.begin() + end,
+                      [positions, axis]( uint32_t a, uint32_t b ) {
+                          const float pa = positions[4 * size_t( a ) + axis];
+                          const float pb = positions[4 * size_t( b ) + axis];
+                          return pa < pb || ( pa == pb && a < b );
+                      } );
+
+    m_nodes[node].count = 0;
+    m_nodes[node].axis  = static_cast<uint16_t>( axis );
+
+    build( order, begin, mid, positions );
+    m_nodes[node].index = static_cast<uint32_t>( m_nodes.size() );
+    build( order, mid, end, positions );
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Rendering
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// A sample in the hit buffer: depth along the ray and particle
+struct ParticleSample
+{
+    float       t;
+    uint32_t    index;
+};
+
+
+struct ParticleRay
+{
+    float3      origin;
+    float3      direction;
+    float       inv_direction[3];
+    bool        negative[3];
+};
+
+
+inline bool intersectNode( const ParticleBVH::Node& node, const ParticleRay& ray, float tmin, float tmax )
+{
+    const float o[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+    for ( int k = 0; k < 3; ++k ) {
+        const float t0 = ( node.bounds_min[k] - o[k] ) * ray.inv_direction[k];
+        const float t1 = ( node.bounds_max[k] - o[k] ) * ray.inv_direction[k];
+        tmin = fmaxf( tmin, fminf( t0, t1 ) );
+        tmax = fminf( tmax, fmaxf( t0, t1 ) );
+    }
+    return tmin <= tmax;
+}
+
+
+// Collects the particles hit in [tmin, tmax) into samples, in traversal order
+// and nearest child first.  Stops when the buffer is full: on the GPU the
+// any_hit program then accepts the intersection instead of ignoring it, which
+// can only shorten the ray, and the buffer does not change any more.
+int traceSlab( const ParticleBVH& bvh, const ParticleRay& ray, float tmin, float tmax,
+               ParticleSample samples[PARTICLE_BUFFER_SIZE], ParticleRenderStats& stats )
+{
+    const std::vector<ParticleBVH::Node>& nodes = bvh.nodes();
+    const std::vector<float4>& positions = bvh.positions();
+    const float radius = bvh.radius();
+
+    int tail = 0;
+    uint32_t stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+
+    while ( top > 0 ) {
+        const uint32_t n = stack[--top];
+        const ParticleBVH::Node& node = nodes[n];
+
+        ++stats.nodes_visited;
+        if ( !intersectNode( node, ray, tmin, tmax ) )
+            continue;
+
+        if ( node.count == 0 ) {
+            // push the far child first
+            const uint32_t first = n + 1;
+            const uint32_t second = node.index;
+            if ( ray.negative[node.axis] ) {
+                stack[top++] = first;
+                stack[top++] = second;
+            }
+            else {
+                stack[top++] = second;
+                stack[top++] = first;
+            }
+            continue;
+        }
+
+        stats.particles_tested += node.count;
+        for ( uint32_t i = node.index; i < node.index + node.count; ++i ) {
+
+            // particle_intersect of geometry.cu; a sample on the boundary of
+            // two slabs goes to the far one
+            const float4 pos = positions[i];
+            const float3 pos3 = make_float3( pos.x, pos.y, pos.z );
+            const float t = length( pos3 - ray.origin );
+            const float3 sample_pos = ray.origin + ray.direction * t;
+
+            if ( length( pos3 - sample_pos ) < radius && t >= tmin && t < tmax ) {
+                if ( tail == PARTICLE_BUFFER_SIZE ) {
+                    ++stats.full_buffers;
+                    return tail;
+                }
+                samples[tail].t = t;
+                samples[tail].index = i;
+                ++tail;
+            }
+        }
+    }
+
+    return tail;
+}
+
+
+// The slab loop of raygen_program for one pixel; returns the composited color
+float3 renderRay( const ParticleBVH& bvh, const ParticleRenderParams& params,
+                  unsigned int x, unsigned int y, unsigned int width, unsigned int height,
+                  ParticleRenderStats& stats )
+{
+    const float2 d = make_float2( float( x ) / float( width )  * 2.f - 1.f,
+                                  float( y ) / float( height ) * 2.f - 1.f );
+
+    ParticleRay ray;
+    ray.origin = params.eye;
+    ray.direction = normalize( d.x * params.U + d.y * params.V + params.W );
+    const float dir[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+    for ( int k = 0; k < 3; ++k ) {
+        ray.inv_direction[k] = 1.f / dir[k];
+        ray.negative[k] = dir[k] < 0.f;
+    }
+
+    const float redshiftScale = params.redshift / length( params.bbox_max - params.bbox_min );
+
+    //ray-AABB intersection to determine number of segments
+    const float3 t0 = ( params.bbox_max - ray.origin ) / ray.direction;
+    const float3 t1 = ( params.bbox_min - ray.origin ) / ray.direction;
+    const float3 tmax = fmaxf( t0, t1 );
+    const float3 tmin = fminf( t0, t1 );
+    const float tenter = fmaxf( 0.f, fmaxf( tmin.x, fmaxf( tmin.y, tmin.z ) ) );
+    const float texit = fminf( tmax.x, fminf( tmax.y, tmax.z ) );
+
+    const float slab_spacing = PARTICLE_BUFFER_SIZE * params.particles_per_slab * params.fixed_radius;
+
+    float3 result = make_float3( 0.f );
+    float result_alpha = 0.f;
+
+    ++stats.rays;
+    if ( !( tenter < texit ) )
+        return result;
+
+    const std::vector<float4>& positions = bvh.positions();
+    const float inv_fixed_radius_scale = 2.f / params.fixed_radius;
+
+    ParticleSample samples[PARTICLE_BUFFER_SIZE];
+    float tbuffer = 0.f;
+
+    while ( tbuffer < texit && result_alpha < 0.97f ) {
+        const float slab_min = fmaxf( tenter, tbuffer );
+        const float slab_max = fminf( texit, tbuffer + slab_spacing );
+
+        if ( slab_max > tenter ) {
+            ++stats.slabs;
+            const int tail = traceSlab( bvh, ray, slab_min, slab_max, samples, stats );
+
+            // insertion sort, equal depths stay in traversal order
+            for ( int i = 1; i < tail; ++i ) {
+                const ParticleSample s = samples[i];
+                int j = i;
+                for ( ; j > 0 && samples[j - 1].t > s.t; --j )
+                    samples[j] = samples[j - 1];
+                samples[j] = s;
+            }
+
+            //integrate depth-sorted list of particles
+            stats.particles_hit += tail;
+            for ( int i = 0; i < tail; ++i ) {
+                const float trbf = samples[i].t;
+                const float3 hit_sample = ray.origin + ray.direction * trbf;
+
+                const float4 pos = positions[samples[i].index];
+                const float3 hit_normal = make_float3( pos.x, pos.y, pos.z ) - hit_sample;
+                float drbf = length( hit_normal ) * inv_fixed_radius_scale;
+                drbf = fmaxf( 0.f, fminf( 1.f, params.w_scale * pos.w * expf( -drbf * drbf ) ) );
+                const float4 color_sample = tf( drbf, trbf * redshiftScale, params.tf_type );
+
+                // in double precision like the 1.0 literal on the GPU
+                const float alpha = color_sample.w * params.opacity;
+                const float alpha_1msa = float( alpha * ( 1.0 - result_alpha ) );
+                result += make_float3( color_sample.x, color_sample.y, color_sample.z ) * alpha_1msa;
+                result_alpha += alpha_1msa;
+            }
+        }
+
+        tbuffer += slab_spacing;
+    }
+
+    return result;
+}
+
+
+inline unsigned char colorByte( float c )
+{
+    return static_cast<unsigned char>( fminf( fmaxf( c, 0.f ), 1.f ) * 255.99f );
+}
+
+
+void addStats( ParticleRenderStats& sum, const ParticleRenderStats& stats )
+{
+    sum.rays             += stats.rays;
+    sum.slabs            += stats.slabs;
+    sum.nodes_visited    += stats.nodes_visited;
+    sum.particles_tested += stats.particles_tested;
+    sum.particles_hit    += stats.particles_hit;
+    sum.full_buffers     += stats.full_buffers;
+}
+
+} // namespace
+
+
+void renderParticlesCPU( const ParticleBVH& bvh,
+                         const ParticleRenderParams& params,
+                         unsigned int width,
+                         unsigned int height,
+                         std::vector<unsigned char>& pixels,
+                         ParticleRenderStats& stats,
+                         unsigned int num_threads )
+{
+    if ( params.fixed_radius != bvh.radius() )
+        throw std::runtime_error( "ParticleRenderCPU: fixed_radius differs from the radius of the BVH" );
+    if ( !( params.particles_per_slab * params.fixed_radius > 0.f ) )
+        throw std::runtime_error( "ParticleRenderCPU: the slab spacing has to be positive" );
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    stats = ParticleRenderStats();
+    pixels.assign( size_t( width ) * height * 4, 0 );
+
+    const unsigned int tiles_x = ( width  + TILE_SIZE - 1 ) / TILE_SIZE;
+    const unsigned int tiles_y = ( height + TILE_SIZE - 1 ) / TILE_SIZE;
+    const unsigned int num_tiles = tiles_x * tiles_y;
+
+    if ( num_threads == 0 )
+        num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+    num_threads = std::max( 1u, std::min( num_threads, num_tiles ) );
+
+    std::atomic<unsigned int> next_tile( 0 );
+    std::mutex stats_mutex;
+
+    const auto work = [&]() {
+        ParticleRenderStats local = ParticleRenderStats();
+
+        for ( unsigned int tile = next_tile++; tile < num_tiles; tile = next_tile++ ) {
+            const unsigned int x0 = ( tile % tiles_x ) * TILE_SIZE;
+            const unsigned int y0 = ( tile / tiles_x ) * TILE_SIZE;
+            const unsigned int x1 = std::min( x0 + TILE_SIZE, width );
+            const unsigned int y1 = std::min( y0 + TILE_SIZE, height );
+
+            for ( unsigned int y = y0; y < y1; ++y ) {
+                for ( unsigned int x = x0; x < x1; ++x ) {
+                    const float3 c = renderRay( bvh, params, x, y, width, height, local );
+
+                    // make_color of helpers.h
+                    unsigned char* pixel = &pixels[( size_t( y ) * width + x ) * 4];
+                    pixel[0] = colorByte( c.z );
+                    pixel[1] = colorByte( c.y );
+                    pixel[2] = colorByte( c.x );
+                    pixel[3] = 255;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock( stats_mutex );
+        addStats( stats, local );
+    };
+
+    if ( bvh.count() > 0 ) {
+        std::vector<std::thread> threads;
+        for ( unsigned int t = 1; t < num_threads; ++t )
+            threads.push_back( std::thread( work ) );
+        work();
+        for ( size_t t = 0; t < threads.size(); ++t )
+            threads[t].join();
+    }
+    else {
+        for ( size_t i = 3; i < pixels.size(); i += 4 )
+            pixels[i] = 255;
+        stats.rays = uint64_t( width ) * height;
+    }
+
+    stats.seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
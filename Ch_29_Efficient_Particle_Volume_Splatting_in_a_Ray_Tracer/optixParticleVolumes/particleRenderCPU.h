@@ -0,0 +1,117 @@
+//-----------------------------------------------------------------------------
+//
+// particleRenderCPU: CPU implementation of the slab-based particle volume
+// splatting of raygen.cu, for batch rendering without a GPU and as a
+// reference for regression images.
+//
+// Every ray walks the bounding box in slabs of PARTICLE_BUFFER_SIZE *
+// particlesPerSlab * fixed_radius.  For each slab it traverses a BVH over the
+// particles, collects up to PARTICLE_BUFFER_SIZE hits in a fixed-size buffer
+// (the any_hit program of material.cu), sorts them by depth and integrates
+// them front to back with tf(), until the ray leaves the box or its alpha
+// reaches 0.97.  The hit test is the one of particle_intersect in geometry.cu.
+// The image is split into tiles that the threads take in turn.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <optixu/optixu_vector_types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// The context variables raygen.cu reads, with the camera of the viewer
+//
+//------------------------------------------------------------------------------
+struct ParticleRenderParams
+{
+    optix::float3   eye;
+    optix::float3   U;                  // camera basis, as set by sutil::calculateCameraVariables
+    optix::float3   V;
+    optix::float3   W;
+    optix::float3   bbox_min;           // bounds of the particles, padded by fixed_radius
+    optix::float3   bbox_max;
+    float           fixed_radius;       // has to be the radius the BVH was built for
+    float           particles_per_slab;
+    float           w_scale;
+    float           opacity;
+    float           redshift;
+    int             tf_type;
+};
+
+
+struct ParticleRenderStats
+{
+    uint64_t    rays;
+    uint64_t    slabs;                  // slabs traced, summed over the rays
+    uint64_t    nodes_visited;          // BVH nodes whose box the ray segment was tested against
+    uint64_t    particles_tested;       // particles of the visited leaves
+    uint64_t    particles_hit;          // samples composited
+    uint64_t    full_buffers;           // slabs that had more hits than PARTICLE_BUFFER_SIZE
+    double      seconds;
+
+    double raysPerSecond() const            { return seconds > 0.0 ? double( rays ) / seconds : 0.0; }
+    double particlesTestedPerRay() const    { return rays ? double( particles_tested ) / double( rays ) : 0.0; }
+    double particlesHitPerRay() const       { return rays ? double( particles_hit ) / double( rays ) : 0.0; }
+    double slabsPerRay() const              { return rays ? double( slabs ) / double( rays ) : 0.0; }
+};
+
+
+//------------------------------------------------------------------------------
+//
+// Bounding volume hierarchy over spheres of one radius, split at the median of
+// the longest axis of the centers.  The nodes are stored depth first, so the
+// first child of an inner node follows it; the particles are copied in leaf
+// order.
+//
+//------------------------------------------------------------------------------
+class ParticleBVH
+{
+public:
+    struct Node
+    {
+        float       bounds_min[3];
+        uint32_t    index;          // first particle of a leaf, second child of an inner node
+        float       bounds_max[3];
+        uint16_t    count;          // particles of a leaf, 0 for an inner node
+        uint16_t    axis;           // split axis of an inner node
+    };
+
+    // Builds the hierarchy over count particles of 4 floats each (x, y, z,
+    // attribute), with the attribute mapped to attribute * w_scale + w_offset
+    // as in the upload to the GPU.
+    ParticleBVH( const float* positions, size_t count, float radius, float w_scale = 1.f, float w_offset = 0.f );
+
+    float                       radius() const      { return m_radius; }
+    size_t                      count() const       { return m_positions.size(); }
+    const std::vector<Node>&    nodes() const       { return m_nodes; }
+
+    // particles in leaf order
+    const std::vector<optix::float4>& positions() const { return m_positions; }
+
+private:
+    void build( std::vector<uint32_t>& order, size_t begin, size_t end, const float* positions );
+
+    float                       m_radius;
+    std::vector<Node>           m_nodes;
+    std::vector<optix::float4>  m_positions;
+};
+
+
+// Renders a width x height image of the particles of bvh into pixels, BGRA
+// bytes with the bottom row first, like the output buffer of raygen.cu.  Tiles
+// of the image are rendered by num_threads threads (0: one per hardware
+// thread); the image does not depend on the number of threads.  Throws
+// std::runtime_error if params.fixed_radius is not the radius of bvh.
+void renderParticlesCPU( const ParticleBVH& bvh,
+                         const ParticleRenderParams& params,
+                         unsigned int width,
+                         unsigned int height,
+                         std::vector<unsigned char>& pixels,
+                         ParticleRenderStats& stats,
+                         unsigned int num_threads = 0 );
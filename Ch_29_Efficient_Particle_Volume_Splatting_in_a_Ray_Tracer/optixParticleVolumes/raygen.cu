@@ -121,10 +121,10 @@ RT_PROGRAM void raygen_program()
         for(int i=0; i<N; i++)
           for(int j=0; j < N-i-1; j++)
           {
-            const float2 tmp = prd.particles[i];
-            if( tmp.x < prd.particles[j].x) {
-              prd.particles[i] = prd.particles[j];
-              prd.particles[j] = tmp;
+            const float2 tmp = prd.particles[j];
+            if( tmp.x > prd.particles[j+1].x) {
+              prd.particles[j] = prd.particles[j+1];
+              prd.particles[j+1] = tmp;
             }
           }
 #else
@@ -3,17 +3,17 @@
 
 #include <optixu/optixu_math_namespace.h>
 
-inline __device__ float4 lerp4f(float4 a, float4 b, float c)
+inline RT_HOSTDEVICE float4 lerp4f(float4 a, float4 b, float c)
 {
     return a * (1.f - c) + b * c;
 }
 
-inline __device__ float lerp1f(float a, float b, float c)
+inline RT_HOSTDEVICE float lerp1f(float a, float b, float c)
 {
     return a * (1.f - c) + b * c;
 }
 
-inline __device__ float4 tf(float v, float t, const int tf_type)
+inline RT_HOSTDEVICE float4 tf(float v, float t, const int tf_type)
 {
   float4 color;
 
@@ -0,0 +1,197 @@
+//------------------------------------------------------------------------------
+//
+// Bounds.h: componentwise min/max reduction over arrays of small float
+// records (vertex positions, particles with an attribute), vectorized with SSE
+// and split across threads for large arrays.  Min and max are exact, so the
+// result does not depend on the number of threads or on the vectorization.
+//
+// Header only, so that tools which do not link sutil can use it as well.
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <stddef.h>
+#include <thread>
+#include <vector>
+
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#  include <xmmintrin.h>
+#  define SUTIL_BOUNDS_SSE 1
+#endif
+
+
+namespace sutil
+{
+
+// Largest number of components per record
+static const size_t BOUNDS_MAX_COMPONENTS = 16;
+
+// Records per thread below which more threads do not pay off
+static const size_t BOUNDS_MIN_RECORDS_PER_THREAD = 1 << 16;
+
+
+namespace detail
+{
+
+// Extends bmin/bmax by count records; std::min/std::max skip NaN values when
+// the running bound comes first.
+inline void boundsScalar( const float* data, size_t count, size_t components, size_t stride,
+                          float* bmin, float* bmax )
+{
+  for( size_t i = 0; i < count; ++i, data += stride )
+  {
+    for( size_t k = 0; k < components; ++k )
+    {
+      bmin[k] = std::min( bmin[k], data[k] );
+      bmax[k] = std::max( bmax[k], data[k] );
+    }
+  }
+}
+
+
+#if SUTIL_BOUNDS_SSE
+// Largest stride the SSE path handles; a block of records is then at most 8
+// vectors long.
+static const size_t BOUNDS_MAX_SSE_STRIDE = 8;
+
+// Reduces blocks of a whole number of records that is also a whole number of
+// at least four vectors, lcm( stride, 4 ) floats doubled up to 16 or more,
+// keeping one min and one max vector per vector of the block.  The lanes are
+// folded into the components at the end.
+inline void boundsSSE( const float* data, size_t count, size_t components, size_t stride,
+                       float* bmin, float* bmax )
+{
+  size_t block = stride % 4 == 0 ? stride : ( stride % 2 == 0 ? stride * 2 : stride * 4 );
+  while( block < 16 )
+    block *= 2;
+  const size_t vectors = block / 4;
+  const size_t records = block / stride;
+  const size_t num_blocks = count / records;
+
+  float lanes_min[4 * BOUNDS_MAX_SSE_STRIDE];
+  float lanes_max[4 * BOUNDS_MAX_SSE_STRIDE];
+  for( size_t f = 0; f < block; ++f )
+  {
+    const size_t k = f % stride;
+    lanes_min[f] = k < components ? bmin[k] : 0.0f;
+    lanes_max[f] = k < components ? bmax[k] : 0.0f;
+  }
+
+  __m128 vmin[BOUNDS_MAX_SSE_STRIDE], vmax[BOUNDS_MAX_SSE_STRIDE];
+  for( size_t v = 0; v < vectors; ++v )
+  {
+    vmin[v] = _mm_loadu_ps( lanes_min + 4 * v );
+    vmax[v] = _mm_loadu_ps( lanes_max + 4 * v );
+  }
+
+  // _mm_min_ps/_mm_max_ps return the second operand if either is NaN
+  const float* p = data;
+  for( size_t b = 0; b < num_blocks; ++b, p += block )
+  {
+    for( size_t v = 0; v < vectors; ++v )
+    {
+      const __m128 x = _mm_loadu_ps( p + 4 * v );
+      vmin[v] = _mm_min_ps( x, vmin[v] );
+      vmax[v] = _mm_max_ps( x, vmax[v] );
+    }
+  }
+
+  for( size_t v = 0; v < vectors; ++v )
+  {
+    _mm_storeu_ps( lanes_min + 4 * v, vmin[v] );
+    _mm_storeu_ps( lanes_max + 4 * v, vmax[v] );
+  }
+  for( size_t f = 0; f < block; ++f )
+  {
+    const size_t k = f % stride;
+    if( k < components )
+    {
+      bmin[k] = std::min( bmin[k], lanes_min[f] );
+      bmax[k] = std::max( bmax[k], lanes_max[f] );
+    }
+  }
+
+  boundsScalar( p, count - num_blocks * records, components, stride, bmin, bmax );
+}
+#endif
+
+
+inline void boundsRange( const float* data, size_t count, size_t components, size_t stride,
+                         float* bmin, float* bmax )
+{
+#if SUTIL_BOUNDS_SSE
+  if( stride <= BOUNDS_MAX_SSE_STRIDE )
+  {
+    boundsSSE( data, count, components, stride, bmin, bmax );
+    return;
+  }
+#endif
+  boundsScalar( data, count, components, stride, bmin, bmax );
+}
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+//
+// Extends bmin[0..components) and bmax[0..components) by the first components
+// floats of count records that are stride floats apart; data must hold
+// count * stride floats.  Initialize the bounds to an empty box (e.g. 1e16f
+// and -1e16f) for the bounds of the records alone.  NaN values are ignored.
+// Large arrays are split across num_threads threads (0: one per hardware
+// thread).
+//
+//------------------------------------------------------------------------------
+inline void computeBounds( const float* data,
+                           size_t count,
+                           size_t components,
+                           size_t stride,
+                           float* bmin,
+                           float* bmax,
+                           unsigned int num_threads = 0 )
+{
+  if( count == 0 || components == 0 || components > BOUNDS_MAX_COMPONENTS || stride < components )
+    return;
+
+  if( num_threads == 0 )
+    num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+  num_threads = static_cast<unsigned int>(
+      std::min<size_t>( num_threads, std::max<size_t>( 1, count / BOUNDS_MIN_RECORDS_PER_THREAD ) ) );
+
+  if( num_threads == 1 )
+  {
+    detail::boundsRange( data, count, components, stride, bmin, bmax );
+    return;
+  }
+
+  // Every thread starts from the incoming bounds; merging them is idempotent.
+  std::vector<float> partial( 2 * BOUNDS_MAX_COMPONENTS * num_threads );
+  std::vector<std::thread> threads;
+  for( unsigned int t = 0; t < num_threads; ++t )
+  {
+    const size_t begin = count * t / num_threads;
+    const size_t end   = count * ( t + 1 ) / num_threads;
+    float* pmin = &partial[2 * BOUNDS_MAX_COMPONENTS * t];
+    float* pmax = pmin + BOUNDS_MAX_COMPONENTS;
+    std::copy( bmin, bmin + components, pmin );
+    std::copy( bmax, bmax + components, pmax );
+    threads.push_back( std::thread( detail::boundsRange, data + begin * stride, end - begin,
+                                    components, stride, pmin, pmax ) );
+  }
+
+  for( unsigned int t = 0; t < num_threads; ++t )
+  {
+    threads[t].join();
+    const float* pmin = &partial[2 * BOUNDS_MAX_COMPONENTS * t];
+    const float* pmax = pmin + BOUNDS_MAX_COMPONENTS;
+    for( size_t k = 0; k < components; ++k )
+    {
+      bmin[k] = std::min( bmin[k], pmin[k] );
+      bmax[k] = std::max( bmax[k], pmax[k] );
+    }
+  }
+}
+
+} // namespace sutil
@@ -31,6 +31,7 @@
 #include <optixu/optixu_math_stream_namespace.h>
 
 #include "Mesh.h" 
+#include "Bounds.h"
 #include "rply-1.01/rply.h"
 #include "tinyobjloader/tiny_obj_loader.h"
 #include <algorithm>
@@ -254,23 +255,15 @@ void applyLoadXForm( Mesh& mesh, const float* load_xform )
 
   if( have_matrix )
   {
-    mesh.bbox_min[0] = mesh.bbox_min[1] = mesh.bbox_min[2] =  1e16f;
-    mesh.bbox_max[0] = mesh.bbox_max[1] = mesh.bbox_max[2] = -1e16f;
-
     optix::Matrix4x4 mat( load_xform );
 
     float3* positions = reinterpret_cast<float3*>( mesh.positions );
     for( int32_t i = 0; i < mesh.num_vertices; ++i )
-    {
-      const float3 v = make_float3( mat*make_float4( positions[i], 1.0f ) );
-      positions[i] = v; 
-      mesh.bbox_min[0] = std::min<float>( mesh.bbox_min[0], v.x );
-      mesh.bbox_min[1] = std::min<float>( mesh.bbox_min[1], v.y );
-      mesh.bbox_min[2] = std::min<float>( mesh.bbox_min[2], v.z );
-      mesh.bbox_max[0] = std::max<float>( mesh.bbox_max[0], v.x );
-      mesh.bbox_max[1] = std::max<float>( mesh.bbox_max[1], v.y );
-      mesh.bbox_max[2] = std::max<float>( mesh.bbox_max[2], v.z );
-    }
+      positions[i] = make_float3( mat*make_float4( positions[i], 1.0f ) );
+
+    mesh.bbox_min[0] = mesh.bbox_min[1] = mesh.bbox_min[2] =  1e16f;
+    mesh.bbox_max[0] = mesh.bbox_max[1] = mesh.bbox_max[2] = -1e16f;
+    sutil::computeBounds( mesh.positions, mesh.num_vertices, 3, 3, mesh.bbox_min, mesh.bbox_max );
 
     if( mesh.has_normals )
     {
@@ -517,14 +510,6 @@ void MeshLoader::Impl::loadMeshOBJ( Mesh& mesh )
       const float y = shape.mesh.positions[i*3+1];
       const float z = shape.mesh.positions[i*3+2];
 
-      mesh.bbox_min[0] = std::min<float>( mesh.bbox_min[0], x );
-      mesh.bbox_min[1] = std::min<float>( mesh.bbox_min[1], y );
-      mesh.bbox_min[2] = std::min<float>( mesh.bbox_min[2], z );
-
-      mesh.bbox_max[0] = std::max<float>( mesh.bbox_max[0], x );
-      mesh.bbox_max[1] = std::max<float>( mesh.bbox_max[1], y );
-      mesh.bbox_max[2] = std::max<float>( mesh.bbox_max[2], z );
-
       mesh.positions[ vrt_offset*3 + i*3+0 ] = x; 
       mesh.positions[ vrt_offset*3 + i*3+1 ] = y; 
       mesh.positions[ vrt_offset*3 + i*3+2 ] = z; 
@@ -552,6 +537,8 @@ void MeshLoader::Impl::loadMeshOBJ( Mesh& mesh )
     tri_offset += static_cast<uint32_t>(shape.mesh.indices.size()) / 3;
   }
 
+  sutil::computeBounds( mesh.positions, vrt_offset, 3, 3, mesh.bbox_min, mesh.bbox_max );
+
   for( uint64_t i = 0; i < m_materials.size(); ++i )
   {
     MaterialParams mat_params;